@@ -0,0 +1,386 @@
+#include <assert.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "bench.h"
+#include "apix.h"
+#include "apix-posix.h"
+#include "srrp.h"
+
+/*
+ * Connection scale soak of one broker ctx, for each scale:
+ * - open conns idle unix clients, each syncs its nodeid and stays silent
+ * - record rss and allocations per conn once all are accepted
+ * - run a small active set of request/response pairs through the broker
+ *   for -t msec, recording the time of each apix_dispatch pass of the
+ *   broker and the round trip latency of the active set
+ * The broker uses the io_uring engine, select can't go past FD_SETSIZE.
+ */
+
+#define CONNS_ADDR "/tmp/apix-bench-conns"
+#define CONNS_SETTLE_MS 1000
+#define CONNS_FDS_SPARE 256
+#define ACTIVE_PAIRS 4
+
+static const int scales[] = { 1000, 10000, 50000 };
+
+struct samples {
+    u64 *buf;
+    u32 nr;
+    u32 cap;
+};
+
+static struct {
+    struct apix *ctx;
+    int uring;
+    int ready;
+    int exit;
+    int accepted;
+    int measure;
+    struct samples passes;
+} broker;
+
+static struct {
+    pthread_mutex_t lock;
+    int exit;
+    u64 msgs;
+    struct samples lats;
+} active;
+
+static u64 now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void samples_push(struct samples *s, u64 value)
+{
+    if (s->nr == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 4096;
+        s->buf = realloc(s->buf, s->cap * sizeof(*s->buf));
+        assert(s->buf);
+    }
+    s->buf[s->nr++] = value;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    u64 x = *(const u64 *)a, y = *(const u64 *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Sort s and return the value at permille. */
+static double samples_at(struct samples *s, u32 permille)
+{
+    if (s->nr == 0)
+        return 0;
+    qsort(s->buf, s->nr, sizeof(*s->buf), cmp_u64);
+    return s->buf[(u64)s->nr * permille / 1000];
+}
+
+static double samples_avg(struct samples *s)
+{
+    if (s->nr == 0)
+        return 0;
+    u64 sum = 0;
+    for (u32 i = 0; i < s->nr; i++)
+        sum += s->buf[i];
+    return (double)sum / s->nr;
+}
+
+static void samples_free(struct samples *s)
+{
+    free(s->buf);
+    memset(s, 0, sizeof(*s));
+}
+
+static long rss_bytes(void)
+{
+    long pages = 0, rss = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp == NULL)
+        return 0;
+    if (fscanf(fp, "%ld %ld", &pages, &rss) != 2)
+        rss = 0;
+    fclose(fp);
+    return rss * sysconf(_SC_PAGESIZE);
+}
+
+static int raise_nofile(rlim_t need)
+{
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0)
+        return -1;
+    if (rl.rlim_cur >= need)
+        return 0;
+
+    // the hard limit can only be raised by root
+    rl.rlim_cur = need;
+    if (rl.rlim_max < need)
+        rl.rlim_max = need;
+    return setrlimit(RLIMIT_NOFILE, &rl);
+}
+
+/*
+ * The broker polls by apix_get_poll_fd so each apix_dispatch is one pass
+ * over all streams without any idle wait inside.
+ */
+static void *broker_thread(void *arg)
+{
+    struct apix *ctx = apix_new();
+    broker.uring = apix_enable_posix_uring(ctx) == 0;
+    struct stream *server = apix_open_unix_server(ctx, CONNS_ADDR);
+    assert(server);
+    apix_upgrade_to_srrp(server, "1");
+    int fd = apix_get_poll_fd(ctx);
+    assert(fd != -1);
+    __atomic_store_n(&broker.ready, 1, __ATOMIC_RELEASE);
+
+    while (!__atomic_load_n(&broker.exit, __ATOMIC_ACQUIRE)) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        poll(&pfd, 1, 10);
+
+        for (;;) {
+            u64 start = now_ns();
+            struct stream *stream = apix_dispatch(ctx);
+            if (__atomic_load_n(&broker.measure, __ATOMIC_ACQUIRE))
+                samples_push(&broker.passes, now_ns() - start);
+            if (stream == NULL)
+                break;
+
+            switch (apix_wait_event(stream)) {
+            case AEC_ACCEPT:
+                if (apix_accept(stream))
+                    __atomic_add_fetch(&broker.accepted, 1, __ATOMIC_RELEASE);
+                break;
+            case AEC_SRRP_PACKET: {
+                struct srrp_packet *pac = apix_wait_srrp_packet(stream);
+                if (stream != server)
+                    apix_srrp_forward(stream, pac);
+                break;
+            }
+            default:
+                break;
+            }
+        }
+    }
+
+    apix_drop(ctx);
+    return NULL;
+}
+
+static int idle_open(int id)
+{
+    int fd = socket(PF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1)
+        return -1;
+
+    struct sockaddr_un sockaddr = {0};
+    sockaddr.sun_family = PF_UNIX;
+    snprintf(sockaddr.sun_path, sizeof(sockaddr.sun_path), "%s", CONNS_ADDR);
+    if (connect(fd, (struct sockaddr *)&sockaddr, sizeof(sockaddr)) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    char nodeid[32];
+    snprintf(nodeid, sizeof(nodeid), "idle-%d", id);
+    struct srrp_packet *sync = srrp_new_ctrl(nodeid, SRRP_CTRL_SYNC, "");
+    ssize_t nr = send(fd, srrp_get_raw(sync), srrp_get_packet_len(sync), 0);
+    srrp_free(sync);
+    if (nr <= 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void active_send(struct stream *stream, int id)
+{
+    char srcid[32], dstid[32], payload[32];
+    snprintf(srcid, sizeof(srcid), "active-req-%d", id);
+    snprintf(dstid, sizeof(dstid), "active-resp-%d", id);
+    snprintf(payload, sizeof(payload), "t:%llu", (unsigned long long)now_ns());
+    struct srrp_packet *pac = srrp_new_request(srcid, dstid, "/active", payload);
+    apix_srrp_send(stream, pac);
+    srrp_free(pac);
+}
+
+/*
+ * ACTIVE_PAIRS requesters & responders, each in its own ctx since one ctx
+ * can't hold two streams to the same broker, each requester keeps one
+ * request in flight to its responder
+ */
+static void *active_thread(void *arg)
+{
+    int idx = (int)(intptr_t)arg;
+    int requester = idx < ACTIVE_PAIRS;
+    int id = requester ? idx : idx - ACTIVE_PAIRS;
+    char nodeid[32];
+
+    struct apix *ctx = apix_new();
+    apix_enable_posix_uring(ctx);
+    apix_set_wait_timeout(ctx, 10 * 1000);
+    apix_set_busy_poll(ctx, 1);
+    struct stream *stream = apix_open_unix_client(ctx, CONNS_ADDR);
+    assert(stream);
+    snprintf(nodeid, sizeof(nodeid), requester ? "active-req-%d" : "active-resp-%d", id);
+    apix_upgrade_to_srrp(stream, nodeid);
+
+    // let the broker learn the nodeids before the first request
+    u64 start = now_ns();
+    while (now_ns() - start < CONNS_SETTLE_MS * 1000000ULL)
+        apix_wait_stream(ctx);
+    if (requester)
+        active_send(stream, id);
+
+    while (!__atomic_load_n(&active.exit, __ATOMIC_ACQUIRE)) {
+        struct stream *pos = apix_wait_stream(ctx);
+        if (pos == NULL) continue;
+        if (apix_wait_event(pos) != AEC_SRRP_PACKET)
+            continue;
+
+        struct srrp_packet *pac = apix_wait_srrp_packet(pos);
+        if (srrp_get_leader(pac) == SRRP_REQUEST_LEADER) {
+            struct srrp_packet *resp = srrp_new_response(
+                srrp_get_dstid(pac), srrp_get_srcid(pac),
+                srrp_get_anchor(pac), (const char *)srrp_get_payload(pac));
+            apix_srrp_send(pos, resp);
+            srrp_free(resp);
+        } else if (srrp_get_leader(pac) == SRRP_RESPONSE_LEADER) {
+            const char *payload = (const char *)srrp_get_payload(pac);
+            if (strncmp(payload, "t:", 2) == 0 &&
+                __atomic_load_n(&broker.measure, __ATOMIC_ACQUIRE)) {
+                u64 lat = now_ns() - strtoull(payload + 2, NULL, 10);
+                pthread_mutex_lock(&active.lock);
+                samples_push(&active.lats, lat);
+                active.msgs++;
+                pthread_mutex_unlock(&active.lock);
+            }
+            active_send(pos, id);
+        }
+    }
+
+    apix_drop(ctx);
+    return NULL;
+}
+
+static void run_scale(int conns)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "conns/%d", conns);
+    if (bench_skip(name))
+        return;
+
+    // both ends of every conn live in this process
+    if (raise_nofile(conns * 2 + CONNS_FDS_SPARE) != 0) {
+        fprintf(stderr, "%s: skipped, RLIMIT_NOFILE can't be raised to %d\n",
+                name, conns * 2 + CONNS_FDS_SPARE);
+        return;
+    }
+
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+    long rss_start = rss_bytes();
+    u64 allocs_start = bench_allocs();
+
+    memset(&broker, 0, sizeof(broker));
+    memset(&active, 0, sizeof(active));
+    pthread_mutex_init(&active.lock, NULL);
+    pthread_t broker_pid;
+    pthread_create(&broker_pid, NULL, broker_thread, NULL);
+    while (!__atomic_load_n(&broker.ready, __ATOMIC_ACQUIRE))
+        usleep(1000);
+
+    if (!broker.uring && conns * 2 + CONNS_FDS_SPARE > FD_SETSIZE) {
+        fprintf(stderr, "%s: skipped, no io_uring and select stops at %d fds\n",
+                name, FD_SETSIZE);
+        __atomic_store_n(&broker.exit, 1, __ATOMIC_RELEASE);
+        pthread_join(broker_pid, NULL);
+        return;
+    }
+
+    int *fds = malloc(conns * sizeof(*fds));
+    u64 setup_start = now_ns();
+    int opened = 0;
+    for (; opened < conns; opened++) {
+        fds[opened] = idle_open(opened);
+        if (fds[opened] == -1) {
+            fprintf(stderr, "%s: connect %d failed, %s\n", name, opened, strerror(errno));
+            break;
+        }
+    }
+    while (__atomic_load_n(&broker.accepted, __ATOMIC_ACQUIRE) < opened)
+        usleep(1000);
+    double setup_sec = (now_ns() - setup_start) / 1e9;
+
+    // syncs of the last conns are parsed after their accept
+    usleep(CONNS_SETTLE_MS * 1000);
+    double rss_per_conn = (double)(rss_bytes() - rss_start) / opened;
+    double allocs_per_conn = (double)(bench_allocs() - allocs_start) / opened;
+
+    pthread_t active_pids[ACTIVE_PAIRS * 2];
+    for (int i = 0; i < ACTIVE_PAIRS * 2; i++)
+        pthread_create(&active_pids[i], NULL, active_thread, (void *)(intptr_t)i);
+    usleep(CONNS_SETTLE_MS * 1000 * 3 / 2);
+
+    __atomic_store_n(&broker.measure, 1, __ATOMIC_RELEASE);
+    u64 measure_start = now_ns();
+    usleep(bench_min_ms() * 1000);
+    __atomic_store_n(&broker.measure, 0, __ATOMIC_RELEASE);
+    double measure_sec = (now_ns() - measure_start) / 1e9;
+
+    __atomic_store_n(&active.exit, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < ACTIVE_PAIRS * 2; i++)
+        pthread_join(active_pids[i], NULL);
+    __atomic_store_n(&broker.exit, 1, __ATOMIC_RELEASE);
+    pthread_join(broker_pid, NULL);
+
+    for (int i = 0; i < opened; i++)
+        close(fds[i]);
+    free(fds);
+
+    const char *keys[] = {
+        "conns", "setup_sec", "rss_per_conn", "allocs_per_conn",
+        "passes_per_sec", "pass_ns_avg", "pass_ns_p99",
+        "msgs_per_sec", "lat_ns_p50", "lat_ns_p99", "lat_ns_p999",
+    };
+    double values[] = {
+        opened, setup_sec, rss_per_conn, allocs_per_conn,
+        broker.passes.nr / measure_sec, samples_avg(&broker.passes),
+        samples_at(&broker.passes, 990),
+        active.msgs / measure_sec, samples_at(&active.lats, 500),
+        samples_at(&active.lats, 990), samples_at(&active.lats, 999),
+    };
+    bench_result(name, keys, values, sizeof(values) / sizeof(values[0]));
+
+    samples_free(&broker.passes);
+    samples_free(&active.lats);
+    pthread_mutex_destroy(&active.lock);
+}
+
+int main(int argc, char *argv[])
+{
+    if (bench_init("conns", argc, argv) != 0)
+        return -1;
+
+    for (u32 i = 0; i < sizeof(scales) / sizeof(scales[0]); i++)
+        run_scale(scales[i]);
+
+    return bench_fini();
+}
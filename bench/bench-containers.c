@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "vec.h"
+#include "ringbuf.h"
+#include "atbuf.h"
+
+/*
+ * vec, ringbuf and atbuf operations as used on the stream buffers.
+ */
+
+static const u32 sizes[] = { 16, 256, 1024, 8192 };
+
+struct container_arg {
+    u8 *data;
+    u8 *out;
+    u32 size;
+    vec_t *vec;
+    ringbuf_t *rb;
+    atbuf_t *ab;
+};
+
+static void bench_vpush_vpop(void *arg)
+{
+    struct container_arg *ca = arg;
+    u32 value = 0;
+    for (u32 i = 0; i < ca->size; i++)
+        vpush(ca->vec, &i);
+    for (u32 i = 0; i < ca->size; i++)
+        vpop(ca->vec, &value);
+    bench_keep(value);
+}
+
+static void bench_vpack_vdump(void *arg)
+{
+    struct container_arg *ca = arg;
+    vpack(ca->vec, ca->data, ca->size);
+    vdump(ca->vec, ca->out, ca->size);
+    bench_keep(ca->out[0]);
+}
+
+static void bench_vinsert_vremove(void *arg)
+{
+    struct container_arg *ca = arg;
+    // insert at the front of existing data as srrp does for packet_len
+    vinsert(ca->vec, 0, ca->data, 4);
+    vremove(ca->vec, 0, 4);
+    bench_keep(vraw(ca->vec));
+}
+
+static void bench_vec_new_free(void *arg)
+{
+    struct container_arg *ca = arg;
+    vec_t *vec = vec_new(1, ca->size);
+    vpack(vec, ca->data, ca->size);
+    bench_keep(vraw(vec));
+    vec_free(vec);
+}
+
+static void bench_ringbuf(void *arg)
+{
+    struct container_arg *ca = arg;
+    ringbuf_write(ca->rb, ca->data, ca->size);
+    size_t nr = ringbuf_read(ca->rb, ca->out, ca->size);
+    bench_keep(nr);
+}
+
+static void bench_atbuf(void *arg)
+{
+    struct container_arg *ca = arg;
+    atbuf_write(ca->ab, ca->data, ca->size);
+    size_t nr = atbuf_read(ca->ab, ca->out, ca->size);
+    atbuf_tidy(ca->ab);
+    bench_keep(nr);
+}
+
+static void run_containers(u32 size)
+{
+    struct container_arg ca = {0};
+    char name[64];
+
+    ca.size = size;
+    ca.data = malloc(size);
+    ca.out = malloc(size);
+    for (u32 i = 0; i < size; i++)
+        ca.data[i] = i;
+
+    ca.vec = vec_new(sizeof(u32), size);
+    snprintf(name, sizeof(name), "vpush_vpop/%u", size);
+    bench_run(name, size * sizeof(u32), bench_vpush_vpop, &ca);
+    vec_free(ca.vec);
+
+    ca.vec = vec_new(1, size);
+    snprintf(name, sizeof(name), "vpack_vdump/%u", size);
+    bench_run(name, size, bench_vpack_vdump, &ca);
+    vpack(ca.vec, ca.data, ca.size);
+    snprintf(name, sizeof(name), "vinsert_vremove/%u", size);
+    bench_run(name, size, bench_vinsert_vremove, &ca);
+    vec_free(ca.vec);
+
+    snprintf(name, sizeof(name), "vec_new_free/%u", size);
+    bench_run(name, size, bench_vec_new_free, &ca);
+
+    ca.rb = ringbuf_new(size * 2);
+    // keep the ring wrapping instead of always starting at 0
+    ringbuf_write(ca.rb, ca.data, size / 2 + 1);
+    snprintf(name, sizeof(name), "ringbuf_write_read/%u", size);
+    bench_run(name, size, bench_ringbuf, &ca);
+    ringbuf_delete(ca.rb);
+
+    ca.ab = atbuf_new(size * 2);
+    snprintf(name, sizeof(name), "atbuf_write_read/%u", size);
+    bench_run(name, size, bench_atbuf, &ca);
+    atbuf_delete(ca.ab);
+
+    free(ca.out);
+    free(ca.data);
+}
+
+int main(int argc, char *argv[])
+{
+    if (bench_init("containers", argc, argv) != 0)
+        return -1;
+
+    for (u32 i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+        run_containers(sizes[i]);
+
+    return bench_fini();
+}
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "srrp.h"
+#include "crc16.h"
+#include "crc32c.h"
+#include "json.h"
+
+/*
+ * srrp codec, checksums and json lookups across payload sizes.
+ */
+
+static const u32 sizes[] = { 16, 256, 1024, 8192 };
+
+struct codec_arg {
+    u8 *payload;
+    u32 payload_len;
+    struct srrp_packet *pac;
+    struct srrp_packet *fst;
+    struct srrp_packet *snd;
+    u8 *buf;
+    u32 buf_len;
+};
+
+static void bench_srrp_new(void *arg)
+{
+    struct codec_arg *ca = arg;
+    struct srrp_packet *pac = srrp_new(
+        SRRP_REQUEST_LEADER, SRRP_FIN_1, "3333", "8888",
+        "/bench/codec", ca->payload, ca->payload_len);
+    bench_keep(pac);
+    srrp_free(pac);
+}
+
+static void bench_srrp_parse(void *arg)
+{
+    struct codec_arg *ca = arg;
+    struct srrp_packet *pac = srrp_parse(
+        srrp_get_raw(ca->pac), srrp_get_packet_len(ca->pac));
+    bench_keep(pac);
+    srrp_free(pac);
+}
+
+static void bench_srrp_cat(void *arg)
+{
+    struct codec_arg *ca = arg;
+    struct srrp_packet *pac = srrp_cat(ca->fst, ca->snd);
+    bench_keep(pac);
+    srrp_free(pac);
+}
+
+static void bench_srrp_next_packet_offset(void *arg)
+{
+    struct codec_arg *ca = arg;
+    u32 offset = srrp_next_packet_offset(ca->buf, ca->buf_len);
+    bench_keep(offset);
+}
+
+static void bench_crc16(void *arg)
+{
+    struct codec_arg *ca = arg;
+    u16 crc = crc16(ca->payload, ca->payload_len);
+    bench_keep(crc);
+}
+
+static void bench_crc32c(void *arg)
+{
+    struct codec_arg *ca = arg;
+    u32 crc = crc32c(ca->payload, ca->payload_len);
+    bench_keep(crc);
+}
+
+static void run_codec(u32 size)
+{
+    struct codec_arg ca = {0};
+    char name[64];
+
+    ca.payload_len = size;
+    ca.payload = malloc(size + 1);
+    memcpy(ca.payload, "t:", 2);
+    for (u32 i = 2; i < size; i++)
+        ca.payload[i] = 'a' + i % 26;
+    ca.payload[size] = 0;
+
+    ca.pac = srrp_new(SRRP_REQUEST_LEADER, SRRP_FIN_1, "3333", "8888",
+                      "/bench/codec", ca.payload, size);
+    srrp_set_seqno(ca.pac, 1);
+    ca.fst = srrp_new_slice(ca.pac, SRRP_FIN_0, 0, size / 2, SRRP_INTEGRITY_CRC16);
+    ca.snd = srrp_new_slice(ca.pac, SRRP_FIN_1, size / 2, size - size / 2,
+                            SRRP_INTEGRITY_CRC16);
+
+    // noise of size bytes before a packet, as after a resync
+    ca.buf_len = size + srrp_get_packet_len(ca.pac);
+    ca.buf = malloc(ca.buf_len);
+    memset(ca.buf, '.', size);
+    memcpy(ca.buf + size, srrp_get_raw(ca.pac), srrp_get_packet_len(ca.pac));
+
+    snprintf(name, sizeof(name), "srrp_new/%u", size);
+    bench_run(name, size, bench_srrp_new, &ca);
+    snprintf(name, sizeof(name), "srrp_parse/%u", size);
+    bench_run(name, srrp_get_packet_len(ca.pac), bench_srrp_parse, &ca);
+    snprintf(name, sizeof(name), "srrp_cat/%u", size);
+    bench_run(name, size, bench_srrp_cat, &ca);
+    snprintf(name, sizeof(name), "srrp_next_packet_offset/%u", size);
+    bench_run(name, size, bench_srrp_next_packet_offset, &ca);
+    snprintf(name, sizeof(name), "crc16/%u", size);
+    bench_run(name, size, bench_crc16, &ca);
+    snprintf(name, sizeof(name), "crc32c/%u", size);
+    bench_run(name, size, bench_crc32c, &ca);
+
+    free(ca.buf);
+    srrp_free(ca.snd);
+    srrp_free(ca.fst);
+    srrp_free(ca.pac);
+    free(ca.payload);
+}
+
+struct json_arg {
+    const char *str;
+    struct json_object *jo;
+};
+
+static void bench_json_object_new(void *arg)
+{
+    struct json_arg *ja = arg;
+    struct json_object *jo = json_object_new(ja->str);
+    bench_keep(jo);
+    json_object_delete(jo);
+}
+
+static void bench_json_get_int(void *arg)
+{
+    struct json_arg *ja = arg;
+    int value = 0;
+    json_get_int(ja->jo, "/len", &value);
+    bench_keep(value);
+}
+
+static void bench_json_get_string(void *arg)
+{
+    struct json_arg *ja = arg;
+    char value[64];
+    json_get_string(ja->jo, "/name", value, sizeof(value));
+    bench_keep(value[0]);
+}
+
+static void bench_json_get_nested(void *arg)
+{
+    struct json_arg *ja = arg;
+    double value = 0;
+    json_get_double(ja->jo, "/equip/7/temp", &value);
+    bench_keep(value);
+}
+
+static void run_json(void)
+{
+    char str[2048];
+    int len = snprintf(str, sizeof(str),
+                       "{\"len\": 12, \"name\": \"yon\", \"online\": true, \"equip\": [");
+    for (int i = 0; i < 8; i++) {
+        len += snprintf(str + len, sizeof(str) - len,
+                        "%s{\"id\": %d, \"temp\": %d.5, \"tag\": \"sensor-%d\"}",
+                        i ? ", " : "", i, 20 + i, i);
+    }
+    snprintf(str + len, sizeof(str) - len, "]}");
+
+    struct json_arg ja = { .str = str, .jo = json_object_new(str) };
+    bench_run("json_object_new", strlen(str), bench_json_object_new, &ja);
+    bench_run("json_get_int", 0, bench_json_get_int, &ja);
+    bench_run("json_get_string", 0, bench_json_get_string, &ja);
+    bench_run("json_get_double/nested", 0, bench_json_get_nested, &ja);
+    json_object_delete(ja.jo);
+}
+
+int main(int argc, char *argv[])
+{
+    if (bench_init("srrp", argc, argv) != 0)
+        return -1;
+
+    for (u32 i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+        run_codec(sizes[i]);
+    run_json();
+
+    return bench_fini();
+}
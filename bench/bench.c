@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+#include "json.h"
+#include "opt.h"
+
+#define BENCH_OUTPUT_MAX (256 * 1024)
+
+static struct opt opttab[] = {
+    INIT_OPT_BOOL("-h", "help", false, "print this usage"),
+    INIT_OPT_STRING("-o:", "output", "", "write json results to file [defaut: stdout]"),
+    INIT_OPT_STRING("-f:", "filter", "", "only run cases whose name contains filter"),
+    INIT_OPT_INT("-t:", "min_time", 200, "min msec of the measured round [defaut: 200]"),
+    INIT_OPT_NONE(),
+};
+
+static struct {
+    const char *suite;
+    const char *output;
+    const char *filter;
+    u64 min_ns;
+    struct json_writer jw;
+    char *buf;
+} bench;
+
+/*
+ * malloc counters, linked with -Wl,--wrap=malloc,... so that every call
+ * from the bench and the static libapix, of any thread, goes through here
+ */
+
+static u64 nr_allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+char *__real_strdup(const char *s);
+
+void *__wrap_malloc(size_t size)
+{
+    __atomic_add_fetch(&nr_allocs, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    __atomic_add_fetch(&nr_allocs, 1, __ATOMIC_RELAXED);
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    __atomic_add_fetch(&nr_allocs, 1, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+char *__wrap_strdup(const char *s)
+{
+    __atomic_add_fetch(&nr_allocs, 1, __ATOMIC_RELAXED);
+    return __real_strdup(s);
+}
+
+static u64 now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int bench_init(const char *suite, int argc, char *argv[])
+{
+    opt_init_from_arg(opttab, argc, argv);
+    if (opt_bool(find_opt("help", opttab))) {
+        opt_usage(opttab);
+        exit(0);
+    }
+
+    bench.suite = suite;
+    bench.output = opt_string(find_opt("output", opttab));
+    bench.filter = opt_string(find_opt("filter", opttab));
+    bench.min_ns = opt_int(find_opt("min_time", opttab)) * 1000000ULL;
+    bench.buf = malloc(BENCH_OUTPUT_MAX);
+    if (bench.buf == NULL)
+        return -1;
+
+    json_writer_init(&bench.jw, bench.buf, BENCH_OUTPUT_MAX);
+    json_write_object_begin(&bench.jw);
+    json_write_key(&bench.jw, "suite");
+    json_write_string(&bench.jw, suite);
+    json_write_key(&bench.jw, "time");
+    json_write_int64(&bench.jw, time(NULL));
+    json_write_key(&bench.jw, "results");
+    json_write_array_begin(&bench.jw);
+
+    fprintf(stderr, "%-40s %12s %12s %12s %10s\n",
+            "name", "iters", "ns/op", "MB/s", "allocs/op");
+    return 0;
+}
+
+int bench_fini(void)
+{
+    int rc = 0;
+
+    json_write_array_end(&bench.jw);
+    json_write_object_end(&bench.jw);
+    if (bench.jw.err) {
+        fprintf(stderr, "%s: json output overflow\n", bench.suite);
+        rc = -1;
+        goto out;
+    }
+
+    FILE *fp = stdout;
+    if (bench.output[0]) {
+        fp = fopen(bench.output, "w");
+        if (fp == NULL) {
+            perror(bench.output);
+            rc = -1;
+            goto out;
+        }
+    }
+    fprintf(fp, "%s\n", json_writer_data(&bench.jw));
+    if (fp != stdout)
+        fclose(fp);
+
+out:
+    json_writer_fini(&bench.jw);
+    free(bench.buf);
+    opt_fini(opttab);
+    return rc;
+}
+
+int bench_skip(const char *name)
+{
+    return bench.filter[0] && strstr(name, bench.filter) == NULL;
+}
+
+u64 bench_min_ms(void)
+{
+    return bench.min_ns / 1000000;
+}
+
+u64 bench_allocs(void)
+{
+    return __atomic_load_n(&nr_allocs, __ATOMIC_RELAXED);
+}
+
+void bench_result(const char *name, const char *keys[], const double values[], int nr)
+{
+    fprintf(stderr, "%s\n", name);
+    json_write_object_begin(&bench.jw);
+    json_write_key(&bench.jw, "name");
+    json_write_string(&bench.jw, name);
+    for (int i = 0; i < nr; i++) {
+        fprintf(stderr, "    %-24s %16.1f\n", keys[i], values[i]);
+        json_write_key(&bench.jw, keys[i]);
+        json_write_double(&bench.jw, values[i]);
+    }
+    json_write_object_end(&bench.jw);
+}
+
+void bench_run(const char *name, size_t bytes, bench_fn_t fn, void *arg)
+{
+    if (bench_skip(name))
+        return;
+
+    // warm up caches and pools
+    fn(arg);
+
+    u64 iters = 1, ns = 0, allocs = 0;
+    for (;;) {
+        u64 allocs_start = nr_allocs;
+        u64 start = now_ns();
+        for (u64 i = 0; i < iters; i++)
+            fn(arg);
+        ns = now_ns() - start;
+        allocs = nr_allocs - allocs_start;
+        if (ns >= bench.min_ns || iters >= (1ULL << 40))
+            break;
+        iters *= 2;
+    }
+
+    double ns_op = (double)ns / iters;
+    double bytes_s = bytes ? bytes * 1e9 / ns_op : 0;
+    double allocs_op = (double)allocs / iters;
+
+    fprintf(stderr, "%-40s %12llu %12.1f %12.1f %10.2f\n", name,
+            (unsigned long long)iters, ns_op, bytes_s / 1e6, allocs_op);
+
+    json_write_object_begin(&bench.jw);
+    json_write_key(&bench.jw, "name");
+    json_write_string(&bench.jw, name);
+    json_write_key(&bench.jw, "bytes");
+    json_write_int64(&bench.jw, bytes);
+    json_write_key(&bench.jw, "iters");
+    json_write_int64(&bench.jw, iters);
+    json_write_key(&bench.jw, "ns_per_op");
+    json_write_double(&bench.jw, ns_op);
+    json_write_key(&bench.jw, "bytes_per_sec");
+    json_write_double(&bench.jw, bytes_s);
+    json_write_key(&bench.jw, "allocs_per_op");
+    json_write_double(&bench.jw, allocs_op);
+    json_write_object_end(&bench.jw);
+}
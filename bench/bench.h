@@ -0,0 +1,53 @@
+#ifndef __BENCH_H
+#define __BENCH_H
+
+#include <stddef.h>
+#include "types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * bench
+ * - each case runs fn in a loop, the loop count is doubled until one round
+ *   takes the min time, then the last round is reported
+ * - ns/op, bytes/s (when bytes is not zero) and malloc calls per op, the
+ *   allocation counters wrap malloc, calloc, realloc and strdup at link time
+ * - results are printed as a table on stderr and written as json to the
+ *   output file, so runs before and after a change can be diffed
+ */
+
+typedef void (*bench_fn_t)(void *arg);
+
+int bench_init(const char *suite, int argc, char *argv[]);
+int bench_fini(void);
+
+/*
+ * run fn unless name is filtered out by -f
+ * - bytes is the amount of data one call of fn walks through
+ */
+void bench_run(const char *name, size_t bytes, bench_fn_t fn, void *arg);
+
+/* Whether name is filtered out by -f. */
+int bench_skip(const char *name);
+
+/* Min msec of a measured round given by -t. */
+u64 bench_min_ms(void);
+
+/* Allocations counted since start. */
+u64 bench_allocs(void);
+
+/*
+ * report a case that doesn't fit bench_run, e.g. a soak, as nr pairs of
+ * keys and values
+ */
+void bench_result(const char *name, const char *keys[], const double values[], int nr);
+
+/* Keep the compiler from dropping the result of a benched call. */
+#define bench_keep(val) __asm__ volatile("" : : "g"(val) : "memory")
+
+#ifdef __cplusplus
+}
+#endif
+#endif
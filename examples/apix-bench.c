@@ -0,0 +1,432 @@
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <apix/apix.h>
+#include <apix/apix-posix.h>
+#include <apix/log.h>
+#include "opt.h"
+
+/*
+ * Load generator against a broker, either started in process or an
+ * apixsrv already running at the addr (-a). N requester and M responder
+ * nodes each poll their own ctx in a thread:
+ * - rr: every requester sends requests to one responder
+ * - pub: every requester publishes, every responder subscribes
+ * - bulk: rr with payloads large enough to be sliced
+ * Latency is taken from the send time carried in the payload, with -r the
+ * send time is the scheduled one so a stalled broker is not hidden.
+ */
+
+static struct opt opttab[] = {
+    INIT_OPT_BOOL("-h", "help", false, "print this usage"),
+    INIT_OPT_BOOL("-a", "attach", false, "use the broker running at addr [defaut: false]"),
+    INIT_OPT_BOOL("-T", "tcp_mode", false, "use tcp instead of unix socket [defaut: false]"),
+    INIT_OPT_STRING("-u:", "unix", "/tmp/apix-bench", "unix socket addr"),
+    INIT_OPT_STRING("-t:", "tcp", "127.0.0.1:3826", "tcp socket addr"),
+    INIT_OPT_STRING("-w:", "workload", "rr", "rr, pub or bulk [defaut: rr]"),
+    INIT_OPT_INT("-n:", "requesters", 4, "requester or publisher nodes [defaut: 4]"),
+    INIT_OPT_INT("-m:", "responders", 1, "responder or subscriber nodes [defaut: 1]"),
+    INIT_OPT_INT("-s:", "size", 64, "payload size, bulk takes at least 32768 [defaut: 64]"),
+    INIT_OPT_INT("-r:", "rate", 0, "msgs/s of each requester, 0 => closed loop, "
+                 "pub takes 1000 [defaut: 0]"),
+    INIT_OPT_INT("-d:", "duration", 5, "seconds measured [defaut: 5]"),
+    INIT_OPT_INT("-b:", "busy_poll", 1, "spin usec of apix_set_busy_poll, 0 => sleep when idle "
+                 "[defaut: 1]"),
+    INIT_OPT_BOOL("-c", "cut_through", false, "cut-through of the broker [defaut: false]"),
+    INIT_OPT_NONE(),
+};
+
+#define BENCH_ANCHOR "/bench"
+#define BENCH_WARMUP_MS 1000
+#define BULK_SIZE_MIN 32768
+
+enum workload {
+    WL_RR = 0,
+    WL_PUB,
+    WL_BULK,
+};
+
+enum phase {
+    PH_WARMUP = 0,
+    PH_RUN,
+    PH_DRAIN,
+    PH_EXIT,
+};
+
+enum role {
+    ROLE_REQUESTER = 0,
+    ROLE_RESPONDER,
+};
+
+struct node {
+    int id;
+    int role;
+    pthread_t pid;
+    u64 msgs;
+    u64 bytes;
+    u64 errors;
+    u64 *lats;
+    u32 nr_lats;
+    u32 cap_lats;
+};
+
+static int workload;
+static int size;
+static int rate;
+static int nr_responders;
+static int phase;
+static int broker_ready;
+
+static u64 now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int get_phase(void)
+{
+    return __atomic_load_n(&phase, __ATOMIC_ACQUIRE);
+}
+
+static const char *sink_addr(void)
+{
+    if (opt_bool(find_opt("tcp_mode", opttab)))
+        return opt_string(find_opt("tcp", opttab));
+    return opt_string(find_opt("unix", opttab));
+}
+
+static struct apix *new_ctx(u64 wait_usec)
+{
+    struct apix *ctx = apix_new();
+    apix_enable_posix(ctx);
+    apix_set_wait_timeout(ctx, wait_usec);
+    apix_set_busy_poll(ctx, opt_int(find_opt("busy_poll", opttab)));
+    return ctx;
+}
+
+static struct stream *open_client(struct apix *ctx)
+{
+    return opt_bool(find_opt("tcp_mode", opttab)) ?
+        apix_open_tcp_client(ctx, sink_addr()) :
+        apix_open_unix_client(ctx, sink_addr());
+}
+
+static void *broker_thread(void *arg)
+{
+    struct apix *ctx = new_ctx(10 * 1000);
+    apix_set_cut_through(ctx, opt_bool(find_opt("cut_through", opttab)));
+
+    struct stream *server = opt_bool(find_opt("tcp_mode", opttab)) ?
+        apix_open_tcp_server(ctx, sink_addr()) :
+        apix_open_unix_server(ctx, sink_addr());
+    if (server == NULL) {
+        LOG_ERROR("open server at %s failed!", sink_addr());
+        exit(-1);
+    }
+    apix_upgrade_to_srrp(server, "1");
+    __atomic_store_n(&broker_ready, 1, __ATOMIC_RELEASE);
+
+    while (get_phase() != PH_EXIT) {
+        struct stream *stream = apix_wait_stream(ctx);
+        if (stream == NULL) continue;
+
+        switch (apix_wait_event(stream)) {
+        case AEC_ACCEPT:
+            apix_accept(stream);
+            break;
+        case AEC_SRRP_PACKET: {
+            struct srrp_packet *pac = apix_wait_srrp_packet(stream);
+            if (stream != server)
+                apix_srrp_forward(stream, pac);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    apix_drop(ctx);
+    return NULL;
+}
+
+static void node_record(struct node *node, const struct srrp_packet *pac, u64 now)
+{
+    const char *payload = (const char *)srrp_get_payload(pac);
+    if (srrp_get_payload_len(pac) < 2 || strncmp(payload, "t:", 2) != 0) {
+        // error responses of the broker, a subscribe is confirmed by a publish
+        if (srrp_get_leader(pac) == SRRP_RESPONSE_LEADER)
+            node->errors++;
+        return;
+    }
+    if (get_phase() != PH_RUN)
+        return;
+
+    u64 ts = strtoull(payload + 2, NULL, 10);
+    if (node->nr_lats == node->cap_lats) {
+        node->cap_lats = node->cap_lats ? node->cap_lats * 2 : 4096;
+        node->lats = realloc(node->lats, node->cap_lats * sizeof(*node->lats));
+        assert(node->lats);
+    }
+    node->lats[node->nr_lats++] = now - ts;
+    node->msgs++;
+    node->bytes += size;
+}
+
+/*
+ * build "t:<ts> " padded to size, ts is written at the head so the
+ * payload is rebuilt in place for every message
+ */
+static void fill_payload(u8 *payload, u64 ts)
+{
+    int nr = snprintf((char *)payload, size + 1, "t:%llu ", (unsigned long long)ts);
+    if (nr < size)
+        payload[nr] = ' ';
+}
+
+static void node_send(struct stream *stream, struct node *node, u8 *payload, u64 ts)
+{
+    char srcid[32], dstid[32];
+    struct srrp_packet *pac;
+
+    fill_payload(payload, ts);
+    if (workload == WL_PUB) {
+        pac = srrp_new(SRRP_PUBLISH_LEADER, SRRP_FIN_1, "", "",
+                       BENCH_ANCHOR, payload, size);
+    } else {
+        snprintf(srcid, sizeof(srcid), "bench-req-%d", node->id);
+        snprintf(dstid, sizeof(dstid), "bench-resp-%d", node->id % nr_responders);
+        pac = srrp_new(SRRP_REQUEST_LEADER, SRRP_FIN_1, srcid, dstid,
+                       BENCH_ANCHOR, payload, size);
+    }
+    apix_srrp_send(stream, pac);
+    srrp_free(pac);
+}
+
+static void *requester_thread(void *arg)
+{
+    struct node *node = arg;
+    char nodeid[32];
+
+    u64 interval = rate ? 1000000000ULL / rate : 0;
+    struct apix *ctx = new_ctx(interval && interval < 1000000 ? interval / 1000 : 1000);
+    struct stream *stream = open_client(ctx);
+    if (stream == NULL) {
+        LOG_ERROR("open client to %s failed!", sink_addr());
+        exit(-1);
+    }
+    snprintf(nodeid, sizeof(nodeid), "bench-req-%d", node->id);
+    apix_upgrade_to_srrp(stream, nodeid);
+
+    u8 *payload = malloc(size + 1);
+    memset(payload, ' ', size);
+    payload[size] = 0;
+
+    u64 next = 0;
+    int outstanding = 0;
+    int ph;
+    while ((ph = get_phase()) != PH_EXIT) {
+        if (ph == PH_RUN) {
+            u64 now = now_ns();
+            if (interval) {
+                // open loop, catch up on every send that is due
+                if (next == 0)
+                    next = now;
+                for (; next <= now; next += interval)
+                    node_send(stream, node, payload, next);
+            } else if (!outstanding) {
+                node_send(stream, node, payload, now);
+                outstanding = 1;
+            }
+        }
+
+        struct stream *pos = apix_wait_stream(ctx);
+        if (pos == NULL) continue;
+        if (apix_wait_event(pos) == AEC_SRRP_PACKET) {
+            struct srrp_packet *pac = apix_wait_srrp_packet(pos);
+            if (srrp_get_leader(pac) == SRRP_RESPONSE_LEADER) {
+                node_record(node, pac, now_ns());
+                outstanding = 0;
+            }
+        }
+    }
+
+    free(payload);
+    apix_close(stream);
+    apix_drop(ctx);
+    return NULL;
+}
+
+static void *responder_thread(void *arg)
+{
+    struct node *node = arg;
+    char nodeid[32];
+
+    struct apix *ctx = new_ctx(10 * 1000);
+    struct stream *stream = open_client(ctx);
+    if (stream == NULL) {
+        LOG_ERROR("open client to %s failed!", sink_addr());
+        exit(-1);
+    }
+    snprintf(nodeid, sizeof(nodeid), "bench-resp-%d", node->id);
+    apix_upgrade_to_srrp(stream, nodeid);
+
+    if (workload == WL_PUB) {
+        struct srrp_packet *sub = srrp_new_subscribe(BENCH_ANCHOR, "{}");
+        apix_srrp_send(stream, sub);
+        srrp_free(sub);
+    }
+
+    while (get_phase() != PH_EXIT) {
+        struct stream *pos = apix_wait_stream(ctx);
+        if (pos == NULL) continue;
+        if (apix_wait_event(pos) != AEC_SRRP_PACKET)
+            continue;
+
+        struct srrp_packet *pac = apix_wait_srrp_packet(pos);
+        if (srrp_get_leader(pac) == SRRP_PUBLISH_LEADER) {
+            node_record(node, pac, now_ns());
+        } else if (srrp_get_leader(pac) == SRRP_REQUEST_LEADER) {
+            // answer with the send time only, the payload is not echoed
+            const char *payload = (const char *)srrp_get_payload(pac);
+            const char *end = memchr(payload, ' ', srrp_get_payload_len(pac));
+            u32 len = end ? end - payload : srrp_get_payload_len(pac);
+            struct srrp_packet *resp = srrp_new(
+                SRRP_RESPONSE_LEADER, SRRP_FIN_1, srrp_get_dstid(pac),
+                srrp_get_srcid(pac), srrp_get_anchor(pac), (const u8 *)payload, len);
+            apix_srrp_send(pos, resp);
+            srrp_free(resp);
+        }
+    }
+
+    apix_close(stream);
+    apix_drop(ctx);
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    u64 x = *(const u64 *)a, y = *(const u64 *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void report(struct node *nodes, int nr_nodes, int duration)
+{
+    u64 msgs = 0, bytes = 0, errors = 0;
+    u32 nr_lats = 0;
+    for (int i = 0; i < nr_nodes; i++) {
+        msgs += nodes[i].msgs;
+        bytes += nodes[i].bytes;
+        errors += nodes[i].errors;
+        nr_lats += nodes[i].nr_lats;
+    }
+
+    u64 *lats = malloc((nr_lats + 1) * sizeof(*lats));
+    u32 idx = 0;
+    for (int i = 0; i < nr_nodes; i++) {
+        memcpy(lats + idx, nodes[i].lats, nodes[i].nr_lats * sizeof(*lats));
+        idx += nodes[i].nr_lats;
+    }
+    qsort(lats, nr_lats, sizeof(*lats), cmp_u64);
+
+    printf("%s over %s, %d requesters, %d responders, %d bytes, %s\n",
+           opt_string(find_opt("workload", opttab)),
+           opt_bool(find_opt("tcp_mode", opttab)) ? "tcp" : "unix",
+           opt_int(find_opt("requesters", opttab)), nr_responders, size,
+           rate ? "open loop" : "closed loop");
+    if (rate)
+        printf("rate: %d msgs/s per requester\n", rate);
+    printf("msgs/s: %.1f, MB/s: %.2f, errors: %llu\n",
+           (double)msgs / duration, (double)bytes / duration / 1e6,
+           (unsigned long long)errors);
+    if (nr_lats) {
+        printf("latency usec: p50 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n",
+               lats[nr_lats / 2] / 1000.0, lats[(u64)nr_lats * 99 / 100] / 1000.0,
+               lats[(u64)nr_lats * 999 / 1000] / 1000.0, lats[nr_lats - 1] / 1000.0);
+    }
+    free(lats);
+}
+
+int main(int argc, char *argv[])
+{
+    opt_init_from_arg(opttab, argc, argv);
+    if (opt_bool(find_opt("help", opttab))) {
+        opt_usage(opttab);
+        return 0;
+    }
+
+    const char *wl = opt_string(find_opt("workload", opttab));
+    if (strcmp(wl, "rr") == 0) {
+        workload = WL_RR;
+    } else if (strcmp(wl, "pub") == 0) {
+        workload = WL_PUB;
+    } else if (strcmp(wl, "bulk") == 0) {
+        workload = WL_BULK;
+    } else {
+        opt_usage(opttab);
+        return -1;
+    }
+
+    int nr_requesters = opt_int(find_opt("requesters", opttab));
+    int duration = opt_int(find_opt("duration", opttab));
+    nr_responders = opt_int(find_opt("responders", opttab));
+    size = opt_int(find_opt("size", opttab));
+    rate = opt_int(find_opt("rate", opttab));
+    if (workload == WL_BULK && size < BULK_SIZE_MIN)
+        size = BULK_SIZE_MIN;
+    if (workload == WL_PUB && rate == 0)
+        rate = 1000;
+    if (nr_requesters <= 0 || nr_responders <= 0 || duration <= 0 ||
+        size < 32 || size > 1024 * 1024 || rate < 0 || rate > 1000000) {
+        opt_usage(opttab);
+        return -1;
+    }
+
+    pthread_t broker_pid;
+    if (!opt_bool(find_opt("attach", opttab))) {
+        pthread_create(&broker_pid, NULL, broker_thread, NULL);
+        while (!__atomic_load_n(&broker_ready, __ATOMIC_ACQUIRE))
+            usleep(1000);
+    }
+
+    int nr_nodes = nr_requesters + nr_responders;
+    struct node *nodes = calloc(nr_nodes, sizeof(*nodes));
+    for (int i = 0; i < nr_nodes; i++) {
+        struct node *node = &nodes[i];
+        if (i < nr_responders) {
+            node->id = i;
+            node->role = ROLE_RESPONDER;
+            pthread_create(&node->pid, NULL, responder_thread, node);
+        } else {
+            node->id = i - nr_responders;
+            node->role = ROLE_REQUESTER;
+            pthread_create(&node->pid, NULL, requester_thread, node);
+        }
+    }
+
+    // let every node finish its /sync before the clock starts
+    usleep(BENCH_WARMUP_MS * 1000);
+    __atomic_store_n(&phase, PH_RUN, __ATOMIC_RELEASE);
+    sleep(duration);
+    __atomic_store_n(&phase, PH_DRAIN, __ATOMIC_RELEASE);
+    usleep(100 * 1000);
+    __atomic_store_n(&phase, PH_EXIT, __ATOMIC_RELEASE);
+
+    for (int i = 0; i < nr_nodes; i++)
+        pthread_join(nodes[i].pid, NULL);
+    if (!opt_bool(find_opt("attach", opttab)))
+        pthread_join(broker_pid, NULL);
+
+    report(nodes, nr_nodes, duration);
+
+    for (int i = 0; i < nr_nodes; i++)
+        free(nodes[i].lats);
+    free(nodes);
+    opt_fini(opttab);
+    return 0;
+}
@@ -0,0 +1,180 @@
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <apix/apix.h>
+#include <apix/apix-posix.h>
+#include <apix/log.h>
+#include "opt.h"
+
+/*
+ * Round trip latency of one message at a time between two threads, each
+ * polling its own ctx, over the unix or tcp sink.
+ */
+
+static struct opt opttab[] = {
+    INIT_OPT_BOOL("-h", "help", false, "print this usage"),
+    INIT_OPT_BOOL("-T", "tcp_mode", false, "use tcp instead of unix socket [defaut: false]"),
+    INIT_OPT_STRING("-u:", "unix", "/tmp/apix-pingpong", "unix socket addr"),
+    INIT_OPT_STRING("-t:", "tcp", "127.0.0.1:3825", "tcp socket addr"),
+    INIT_OPT_INT("-n:", "count", 100000, "round trips [defaut: 100000]"),
+    INIT_OPT_INT("-s:", "size", 64, "message size [defaut: 64]"),
+    INIT_OPT_INT("-b:", "busy_poll", 0, "spin usec of apix_set_busy_poll, 0 => off [defaut: 0]"),
+    INIT_OPT_INT("-B:", "sock_busy_poll", 0, "SO_BUSY_POLL usec of tcp sockets [defaut: 0]"),
+    INIT_OPT_INT("-c:", "client_cpu", -1, "pin the client thread to cpu [defaut: -1]"),
+    INIT_OPT_INT("-C:", "server_cpu", -1, "pin the server thread to cpu [defaut: -1]"),
+    INIT_OPT_NONE(),
+};
+
+static int server_ready;
+static int server_exit;
+
+static struct apix *new_ctx(void)
+{
+    struct apix *ctx = apix_new();
+    apix_enable_posix(ctx);
+    apix_set_wait_timeout(ctx, 100 * 1000);
+    apix_set_busy_poll(ctx, opt_int(find_opt("busy_poll", opttab)));
+    apix_set_sock_busy_poll(ctx, opt_int(find_opt("sock_busy_poll", opttab)));
+    return ctx;
+}
+
+static const char *sink_addr(void)
+{
+    if (opt_bool(find_opt("tcp_mode", opttab)))
+        return opt_string(find_opt("tcp", opttab));
+    return opt_string(find_opt("unix", opttab));
+}
+
+static void *server_thread(void *arg)
+{
+    int cpu = opt_int(find_opt("server_cpu", opttab));
+    if (cpu >= 0)
+        apix_pin_thread(cpu);
+
+    struct apix *ctx = new_ctx();
+    struct stream *server = opt_bool(find_opt("tcp_mode", opttab)) ?
+        apix_open_tcp_server(ctx, sink_addr()) :
+        apix_open_unix_server(ctx, sink_addr());
+    if (server == NULL) {
+        LOG_ERROR("open server at %s failed!", sink_addr());
+        exit(-1);
+    }
+    __atomic_store_n(&server_ready, 1, __ATOMIC_RELEASE);
+
+    u8 buf[4096];
+    while (!__atomic_load_n(&server_exit, __ATOMIC_ACQUIRE)) {
+        struct stream *stream = apix_wait_stream(ctx);
+        if (stream == NULL) continue;
+
+        switch (apix_wait_event(stream)) {
+        case AEC_ACCEPT:
+            apix_accept(stream);
+            break;
+        case AEC_POLLIN: {
+            // pong
+            int nr;
+            while ((nr = apix_read_from_buffer(stream, buf, sizeof(buf))) > 0)
+                apix_send(stream, buf, nr);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    apix_close(server);
+    apix_drop(ctx);
+    return NULL;
+}
+
+static u64 now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    u64 x = *(const u64 *)a, y = *(const u64 *)b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char *argv[])
+{
+    opt_init_from_arg(opttab, argc, argv);
+    if (opt_bool(find_opt("help", opttab))) {
+        opt_usage(opttab);
+        return 0;
+    }
+
+    int count = opt_int(find_opt("count", opttab));
+    int size = opt_int(find_opt("size", opttab));
+    if (count <= 0 || size <= 0 || size > 4096) {
+        opt_usage(opttab);
+        return -1;
+    }
+
+    pthread_t server_pid;
+    pthread_create(&server_pid, NULL, server_thread, NULL);
+    while (!__atomic_load_n(&server_ready, __ATOMIC_ACQUIRE))
+        usleep(1000);
+
+    int cpu = opt_int(find_opt("client_cpu", opttab));
+    if (cpu >= 0)
+        apix_pin_thread(cpu);
+
+    struct apix *ctx = new_ctx();
+    struct stream *client = opt_bool(find_opt("tcp_mode", opttab)) ?
+        apix_open_tcp_client(ctx, sink_addr()) :
+        apix_open_unix_client(ctx, sink_addr());
+    if (client == NULL) {
+        LOG_ERROR("open client to %s failed!", sink_addr());
+        exit(-1);
+    }
+
+    u8 *msg = calloc(1, size);
+    u8 buf[4096];
+    u64 *rtts = calloc(count, sizeof(*rtts));
+    u64 start = now_ns();
+
+    for (int i = 0; i < count; i++) {
+        u64 ts = now_ns();
+        apix_send(client, msg, size);
+
+        int nr = 0;
+        while (nr < size) {
+            struct stream *stream = apix_wait_stream(ctx);
+            if (stream == NULL) continue;
+            if (apix_wait_event(stream) == AEC_POLLIN && stream == client) {
+                int rc = apix_read_from_buffer(client, buf, sizeof(buf));
+                if (rc > 0) nr += rc;
+            }
+        }
+        rtts[i] = now_ns() - ts;
+    }
+
+    u64 total = now_ns() - start;
+    qsort(rtts, count, sizeof(*rtts), cmp_u64);
+    printf("%s, %d round trips of %d bytes, busy_poll %dus\n",
+           opt_bool(find_opt("tcp_mode", opttab)) ? "tcp" : "unix", count, size,
+           opt_int(find_opt("busy_poll", opttab)));
+    printf("rtt usec: min %.1f, p50 %.1f, p99 %.1f, p99.9 %.1f, max %.1f, avg %.1f\n",
+           rtts[0] / 1000.0, rtts[count / 2] / 1000.0,
+           rtts[(u64)count * 99 / 100] / 1000.0, rtts[(u64)count * 999 / 1000] / 1000.0,
+           rtts[count - 1] / 1000.0, total / 1000.0 / count);
+
+    free(rtts);
+    free(msg);
+    apix_close(client);
+    apix_drop(ctx);
+
+    __atomic_store_n(&server_exit, 1, __ATOMIC_RELEASE);
+    pthread_join(server_pid, NULL);
+    return 0;
+}
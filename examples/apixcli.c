@@ -274,12 +274,46 @@ static void close_fd(int fd)
     }
 }
 
-static void *apix_thread(void *arg)
+/*
+ * Commands touching ctx run in apix_thread by apix_post, the cli thread
+ * waits for them, so fds & cur_fd are set before the next prompt.
+ */
+struct cli_post {
+    void (*func)(const char *cmd);
+    const char *cmd;
+    int done;
+};
+
+static pthread_mutex_t post_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t post_cond = PTHREAD_COND_INITIALIZER;
+
+static void run_cli_post(struct apix *ctx, void *arg)
 {
-    ctx = apix_new();
-    apix_enable_posix(ctx);
-    apix_set_wait_timeout(ctx, 100 * 1000);
+    struct cli_post *post = arg;
+    post->func(post->cmd);
 
+    pthread_mutex_lock(&post_lock);
+    post->done = 1;
+    pthread_cond_broadcast(&post_cond);
+    pthread_mutex_unlock(&post_lock);
+}
+
+static void run_in_apix(void (*func)(const char *cmd), const char *cmd)
+{
+    struct cli_post post = { func, cmd, 0 };
+    if (apix_post(ctx, run_cli_post, &post) != 0) {
+        printf("post error\n");
+        return;
+    }
+
+    pthread_mutex_lock(&post_lock);
+    while (!post.done)
+        pthread_cond_wait(&post_cond, &post_lock);
+    pthread_mutex_unlock(&post_lock);
+}
+
+static void *apix_thread(void *arg)
+{
     for (;;) {
         if (exit_flag == 1) break;
 
@@ -498,7 +532,7 @@ static void on_cmd_tcp_listen(const char *cmd)
     }
 }
 
-static void on_cmd_listen(const char *cmd)
+static void listen_in_apix(const char *cmd)
 {
     if (strcmp(cur_mode, "unix") == 0) {
         on_cmd_unix_listen(cmd);
@@ -507,6 +541,11 @@ static void on_cmd_listen(const char *cmd)
     }
 }
 
+static void on_cmd_listen(const char *cmd)
+{
+    run_in_apix(listen_in_apix, cmd);
+}
+
 static void on_cmd_unix_open(const char *cmd)
 {
     if (strcmp(cur_mode, "unix") != 0)
@@ -648,7 +687,7 @@ static void on_cmd_can_open(const char *cmd)
 
 #endif
 
-static void on_cmd_open(const char *cmd)
+static void open_in_apix(const char *cmd)
 {
     if (strcmp(cur_mode, "unix") == 0) {
         on_cmd_unix_open(cmd);
@@ -663,15 +702,20 @@ static void on_cmd_open(const char *cmd)
     }
 }
 
+static void on_cmd_open(const char *cmd)
+{
+    run_in_apix(open_in_apix, cmd);
+}
+
 static void on_cmd_close(const char *cmd)
 {
     int fd = 0;
     int nr = sscanf(cmd, "close %d", &fd);
     if (nr == 1) {
-        apix_close(fds[fd].stream);
+        apix_post_close(ctx, fds[fd].stream, NULL, NULL);
     } else if (strcmp(cmd, "close") == 0) {
         if (cur_fd != -1)
-            apix_close(fds[cur_fd].stream);
+            apix_post_close(ctx, fds[cur_fd].stream, NULL, NULL);
     }
 }
 
@@ -695,12 +739,13 @@ static void on_cmd_send(const char *cmd)
         memcpy(frame.data, msg, len);
         frame.can_dlc = strlen(msg);
         frame.can_id = fds[cur_fd].can_id | CAN_EFF_FLAG;
-        apix_send(fds[cur_fd].stream, (uint8_t *)&frame, sizeof(frame));
+        apix_post_send(ctx, fds[cur_fd].stream,
+                       (uint8_t *)&frame, sizeof(frame), NULL, NULL);
     } else {
-        apix_send(fds[cur_fd].stream, (uint8_t *)msg, len);
+        apix_post_send(ctx, fds[cur_fd].stream, (uint8_t *)msg, len, NULL, NULL);
     }
 #else
-    apix_send(fds[cur_fd].stream, (uint8_t *)msg, len);
+    apix_post_send(ctx, fds[cur_fd].stream, (uint8_t *)msg, len, NULL, NULL);
 #endif
 }
 
@@ -726,7 +771,7 @@ static void on_cmd_setid(const char *cmd)
     }
 }
 
-static void on_cmd_srrpmode(const char *cmd)
+static void srrpmode_in_apix(const char *cmd)
 {
     if (cur_fd == 0)
         return;
@@ -753,6 +798,11 @@ static void on_cmd_srrpmode(const char *cmd)
     }
 }
 
+static void on_cmd_srrpmode(const char *cmd)
+{
+    run_in_apix(srrpmode_in_apix, cmd);
+}
+
 static void on_cmd_srrpget(const char *cmd)
 {
     if (cur_fd == 0)
@@ -779,12 +829,15 @@ static void on_cmd_srrpget(const char *cmd)
         memcpy(frame.data, srrp_get_raw(pac), srrp_get_packet_len(pac));
         frame.can_dlc = strlen(msg);
         frame.can_id = fds[cur_fd].can_id | CAN_EFF_FLAG;
-        apix_send(fds[cur_fd].stream, (uint8_t *)&frame, sizeof(frame));
+        apix_post_send(ctx, fds[cur_fd].stream,
+                       (uint8_t *)&frame, sizeof(frame), NULL, NULL);
     } else {
-        apix_send(fds[cur_fd].stream, srrp_get_raw(pac), srrp_get_packet_len(pac));
+        apix_post_send(ctx, fds[cur_fd].stream,
+                       srrp_get_raw(pac), srrp_get_packet_len(pac), NULL, NULL);
     }
 #else
-    apix_send(fds[cur_fd].stream, srrp_get_raw(pac), srrp_get_packet_len(pac));
+    apix_post_send(ctx, fds[cur_fd].stream,
+                   srrp_get_raw(pac), srrp_get_packet_len(pac), NULL, NULL);
 #endif
     srrp_free(pac);
 }
@@ -811,7 +864,11 @@ static void on_cmd_srrpadd(const char *cmd)
     priv->fd = cur_fd;
     strcpy(priv->msg, msg);
     snprintf(msg, sizeof(msg), "%s:%s", fds[cur_fd].node_id, hdr);
-    svcx_add_service(svcx, msg, priv);
+    free(svcx_get_service_private_exact(svcx, msg));
+    if (svcx_add_service(svcx, msg, priv) != 0) {
+        printf("out of memory\n");
+        free(priv);
+    }
 }
 
 static void on_cmd_srrpdel(const char *cmd)
@@ -833,7 +890,7 @@ static void on_cmd_srrpdel(const char *cmd)
 
     char tmp[1024] = {0};
     snprintf(tmp, sizeof(tmp), "%s:%s", fds[cur_fd].node_id, hdr);
-    free(svcx_get_service_private(svcx, tmp));
+    free(svcx_get_service_private_exact(svcx, tmp));
     svcx_del_service(svcx, tmp);
 }
 
@@ -940,6 +997,11 @@ int main(int argc, char *argv[])
     svcx = svcx_new();
     on_cmd_env("");
 
+    // before the threads, the cli posts to ctx from the first command
+    ctx = apix_new();
+    apix_enable_posix(ctx);
+    apix_set_wait_timeout(ctx, 100 * 1000);
+
     pthread_t apix_pid;
     pthread_create(&apix_pid, NULL, apix_thread, NULL);
     pthread_t cli_pid;
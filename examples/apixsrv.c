@@ -25,6 +25,7 @@ static struct opt opttab[] = {
     INIT_OPT_BOOL("-r", "srrp_mode", true, "enable srrp mode [defaut: true]"),
     INIT_OPT_STRING("-u:", "unix", "/tmp/apix", "unix socket addr"),
     INIT_OPT_STRING("-t:", "tcp", "127.0.0.1:3824", "tcp socket addr"),
+    INIT_OPT_BOOL("-c", "cut_through", false, "forward sliced packets as they arrive [defaut: false]"),
     INIT_OPT_NONE(),
 };
 
@@ -32,6 +33,7 @@ static void *apix_thread(void *arg)
 {
     ctx = apix_new();
     apix_enable_posix(ctx);
+    apix_set_cut_through(ctx, opt_bool(find_opt("cut_through", opttab)));
 
     struct opt *opt;
 
@@ -8,6 +8,8 @@ package apix
 import "C"
 import "unsafe"
 import "errors"
+import "os"
+import "syscall"
 import "github.com/yonzkon/apix/ffi/go/srrp"
 
 const (
@@ -16,6 +18,7 @@ const (
     EventClose uint = 2
     EventAccept uint = 3
     EventPollin uint = 4
+    EventSrrpPacket uint = 5
 )
 
 type ApixStream struct {
@@ -72,21 +75,9 @@ func from_raw_packet_apix(pac *C.struct_srrp_packet) (srrp.SrrpPacket) {
         panic("raw point of srrp_packet is null")
     }
 
-    return srrp.SrrpPacket {
-        Leader: int8(C.srrp_get_leader(pac)),
-        PacketLen: uint16(C.srrp_get_packet_len(pac)),
-        Fin: uint8(C.srrp_get_fin(pac)),
-        Ver: uint16(C.srrp_get_ver(pac)),
-        PayloadLen: uint32(C.srrp_get_payload_len(pac)),
-        Srcid: C.GoString(C.srrp_get_srcid(pac)),
-        Dstid: C.GoString(C.srrp_get_dstid(pac)),
-        Anchor: C.GoString(C.srrp_get_anchor(pac)),
-        Payload: C.GoString((*C.char)(unsafe.Pointer(C.srrp_get_payload(pac)))),
-        Crc16: uint16(C.srrp_get_crc16(pac)),
-        Raw: C.GoBytes(unsafe.Pointer(C.srrp_get_raw(pac)),
-            (C.int)(C.srrp_get_packet_len(pac))),
-        Pac: unsafe.Pointer(pac),
-    }
+    var hdr C.struct_srrp_header
+    C.srrp_get_header(pac, &hdr)
+    return srrp.FromHeader(unsafe.Pointer(pac), unsafe.Pointer(&hdr))
 }
 
 func (self *ApixStream) WaitSrrpPacket() (srrp.SrrpPacket, error) {
@@ -114,13 +105,26 @@ func (self *ApixStream) SrrpSend(pac srrp.SrrpPacket) (int) {
 
 type Apix struct {
     ctx *C.struct_apix
+    evs []C.struct_apix_stream_event /* filled by apix_dispatch_events */
+    pollFile *os.File /* a dup of the poll fd, on the netpoller */
+    pollConn syscall.RawConn
+}
+
+// Event is one event of DispatchEvents, Packet is set for EventSrrpPacket.
+type Event struct {
+    Stream ApixStream
+    Code uint
+    Packet srrp.SrrpPacket
 }
 
-func New() (Apix) {
-    return Apix{ ctx: C.apix_new() }
+func New() (*Apix) {
+    return &Apix{ ctx: C.apix_new() }
 }
 
 func (self *Apix) Drop() {
+    if self.pollFile != nil {
+        self.pollFile.Close()
+    }
     C.apix_drop(self.ctx)
 }
 
@@ -128,6 +132,89 @@ func (self *Apix) SetWaitTimeout(usec uint64) () {
     C.apix_set_wait_timeout(self.ctx, C.ulong(usec))
 }
 
+func (self *Apix) GetPollFd() (int) {
+    return int(C.apix_get_poll_fd(self.ctx))
+}
+
+func (self *Apix) Dispatch() (ApixStream) {
+    stream := C.apix_dispatch(self.ctx)
+    if stream == nil {
+        return ApixStream{nil, -1}
+    } else {
+        return ApixStream{stream, int(C.apix_get_raw_fd(stream))}
+    }
+}
+
+// DispatchEvents takes the events of all streams into evs, up to its
+// length, by one cgo call, and returns how many. Each call polls the ctx, so
+// streams & packets are valid until the next dispatch or wait on the ctx.
+func (self *Apix) DispatchEvents(evs []Event) (int) {
+    if len(evs) == 0 {
+        return 0
+    }
+    if len(self.evs) < len(evs) {
+        self.evs = make([]C.struct_apix_stream_event, len(evs))
+    }
+
+    nr := int(C.apix_dispatch_events(self.ctx, &self.evs[0], C.uint(len(evs))))
+    for i := 0; i < nr; i++ {
+        cev := &self.evs[i]
+        ev := &evs[i]
+        ev.Stream = ApixStream{cev.stream, int(cev.fd)}
+        ev.Code = uint(cev.code)
+        if cev.pac != nil {
+            ev.Packet = srrp.FromHeader(
+                unsafe.Pointer(cev.pac), unsafe.Pointer(&cev.hdr))
+        } else {
+            ev.Packet = srrp.SrrpPacket{}
+        }
+    }
+    return nr
+}
+
+type pollFd struct {
+    fd int32
+    events int16
+    revents int16
+}
+
+func pollReadable(fd uintptr) (bool) {
+    pfd := pollFd{ fd: int32(fd), events: 0x1 /* POLLIN */ }
+    var ts syscall.Timespec
+    nr, _, errno := syscall.Syscall6(syscall.SYS_PPOLL,
+        uintptr(unsafe.Pointer(&pfd)), 1, uintptr(unsafe.Pointer(&ts)), 0, 0, 0)
+    return errno == 0 && nr == 1
+}
+
+// Wait parks the goroutine on the Go netpoller, not an OS thread in cgo,
+// until the poll fd of the ctx is readable, then DispatchEvents. The timer
+// of the ctx is behind the same fd, so calls time out on their own.
+func (self *Apix) Wait() (error) {
+    if self.pollConn == nil {
+        fd := int(C.apix_get_poll_fd(self.ctx))
+        if fd == -1 {
+            return errors.New("no poll fd")
+        }
+        // the dup shares O_NONBLOCK, which epoll_wait of apix ignores
+        dup, err := syscall.Dup(fd)
+        if err != nil {
+            return err
+        }
+        syscall.CloseOnExec(dup)
+        if err := syscall.SetNonblock(dup, true); err != nil {
+            syscall.Close(dup)
+            return err
+        }
+        self.pollFile = os.NewFile(uintptr(dup), "apix")
+        self.pollConn, err = self.pollFile.SyscallConn()
+        if err != nil {
+            return err
+        }
+    }
+
+    return self.pollConn.Read(pollReadable)
+}
+
 func (self *Apix) WaitStream() (ApixStream) {
     stream := C.apix_wait_stream(self.ctx)
     if stream == nil {
@@ -141,6 +228,10 @@ func (self *Apix) EnablePosix() {
     C.apix_enable_posix(self.ctx)
 }
 
+func (self *Apix) EnablePosixUring() int {
+    return int(C.apix_enable_posix_uring(self.ctx))
+}
+
 func (self *Apix) DisablePosix() {
     C.apix_disable_posix(self.ctx)
 }
@@ -58,3 +58,56 @@ func TestBase(T *testing.T) {
     stream.Close()
     ctx.Drop()
 }
+
+func TestDispatchEvents(T *testing.T) {
+    ctx := apix.New()
+    ctx.EnablePosix()
+    addr := "/tmp/apix_go_dispatch"
+    server := ctx.OpenUnixServer(addr)
+    server.UpgradeToSrrp("1")
+    // raw, 3333 is no nodeid of this ctx, so the peer takes its sync
+    client := ctx.OpenUnixClient(addr)
+
+    evs := make([]apix.Event, 16)
+    accepted, sent, got := false, false, 0
+    for i := 0; i < 1000 && got < 10; i++ {
+        if err := ctx.Wait(); err != nil {
+            T.Fatal(err)
+        }
+        nr := ctx.DispatchEvents(evs)
+        for _, ev := range evs[:nr] {
+            switch ev.Code {
+            case apix.EventAccept:
+                peer := ev.Stream.Accept()
+                if peer.IsNull() {
+                    T.Fatal("accept failed")
+                }
+                accepted = true
+            case apix.EventSrrpPacket:
+                if ev.Packet.Anchor == "/batch" {
+                    if ev.Packet.Payload != fmt.Sprintf("t:%d", got) {
+                        T.Fatal("wrong payload: " + ev.Packet.Payload)
+                    }
+                    got++
+                }
+            }
+        }
+        if !sent && accepted {
+            // requests of an unsynced peer get "nodeid not sync"
+            sync, _ := srrp.NewCtrl("3333", "/sync", "")
+            client.Send(sync.Raw)
+            for n := 0; n < 10; n++ {
+                pac, _ := srrp.NewRequest("3333", "1", "/batch", fmt.Sprintf("t:%d", n))
+                client.Send(pac.Raw)
+            }
+            sent = true
+        }
+    }
+    if got != 10 {
+        T.Fatalf("got %d packets", got)
+    }
+
+    client.Close()
+    server.Close()
+    ctx.Drop()
+}
@@ -14,6 +14,7 @@ type SrrpPacket struct {
     Srcid string
     Dstid string
     Anchor string
+    Seqno uint32
     Payload string
     Crc16 uint16
     Raw []byte
@@ -22,26 +23,42 @@ type SrrpPacket struct {
 
 type Srrp struct {}
 
+// FromHeader copies a packet out of its header taken by one
+// srrp_get_header, the strings & payload are copied without further cgo
+// calls.
+func FromHeader(pac unsafe.Pointer, hdr unsafe.Pointer) (SrrpPacket) {
+    h := (*C.struct_srrp_header)(hdr)
+    crc16 := uint16(0)
+    if h.integrity == C.SRRP_INTEGRITY_CRC16 {
+        crc16 = uint16(h.crc)
+    }
+
+    return SrrpPacket {
+        Leader: int8(h.leader),
+        PacketLen: uint16(h.packet_len),
+        Fin: uint8(h.fin),
+        Ver: uint16(h.ver),
+        PayloadLen: uint32(h.payload_len),
+        Srcid: C.GoString(h.srcid),
+        Dstid: C.GoString(h.dstid),
+        Anchor: C.GoString(h.anchor),
+        Seqno: uint32(h.seqno),
+        Payload: C.GoStringN((*C.char)(unsafe.Pointer(h.payload)),
+            C.int(h.payload_len)),
+        Crc16: crc16,
+        Raw: C.GoBytes(unsafe.Pointer(h.raw), C.int(h.packet_len)),
+        Pac: pac,
+    }
+}
+
 func from_raw_packet(pac *C.struct_srrp_packet) (SrrpPacket) {
     if pac == nil {
         panic("raw point of srrp_packet is null")
     }
 
-    return SrrpPacket {
-        Leader: int8(C.srrp_get_leader(pac)),
-        PacketLen: uint16(C.srrp_get_packet_len(pac)),
-        Fin: uint8(C.srrp_get_fin(pac)),
-        Ver: uint16(C.srrp_get_ver(pac)),
-        PayloadLen: uint32(C.srrp_get_payload_len(pac)),
-        Srcid: C.GoString(C.srrp_get_srcid(pac)),
-        Dstid: C.GoString(C.srrp_get_dstid(pac)),
-        Anchor: C.GoString(C.srrp_get_anchor(pac)),
-        Payload: C.GoString((*C.char)(unsafe.Pointer(C.srrp_get_payload(pac)))),
-        Crc16: uint16(C.srrp_get_crc16(pac)),
-        Raw: C.GoBytes(unsafe.Pointer(C.srrp_get_raw(pac)),
-            (C.int)(C.srrp_get_packet_len(pac))),
-        Pac: unsafe.Pointer(pac),
-    }
+    var hdr C.struct_srrp_header
+    C.srrp_get_header(pac, &hdr)
+    return FromHeader(unsafe.Pointer(pac), unsafe.Pointer(&hdr))
 }
 
 func NextPacketOffset(buf []byte) (uint) {
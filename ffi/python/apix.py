@@ -1,8 +1,8 @@
 import ctypes
-from ctypes.util import find_library
 import srrp
 
-lib = ctypes.CDLL(find_library("apix"))
+lib = srrp.lib
+_bind = srrp._bind
 
 LOG_LEVEL_TRACE = 1
 LOG_LEVEL_DEBUG = 2
@@ -12,21 +12,48 @@ LOG_LEVEL_WARN = 5
 LOG_LEVEL_ERROR = 6
 LOG_LEVEL_FATAL = 7
 
+RECV_SIZE = 1024
+WAIT_PACKETS_MAX = 64
+
+_vp = ctypes.c_void_p
+_log_set_level = _bind("log_set_level", None, ctypes.c_int32)
+_apix_get_raw_fd = _bind("apix_get_raw_fd", ctypes.c_int32, _vp)
+_apix_close = _bind("apix_close", ctypes.c_int32, _vp)
+_apix_accept = _bind("apix_accept", _vp, _vp)
+_apix_send = _bind("apix_send", ctypes.c_int32, _vp, _vp, ctypes.c_uint32)
+_apix_recv = _bind("apix_recv", ctypes.c_int32, _vp, _vp, ctypes.c_uint32)
+_apix_send_to_buffer = _bind("apix_send_to_buffer", ctypes.c_int32,
+                             _vp, _vp, ctypes.c_uint32)
+_apix_read_from_buffer = _bind("apix_read_from_buffer", ctypes.c_int32,
+                               _vp, _vp, ctypes.c_uint32)
+_apix_wait_event = _bind("apix_wait_event", ctypes.c_uint8, _vp)
+_apix_wait_srrp_packet = _bind("apix_wait_srrp_packet", _vp, _vp)
+_apix_wait_srrp_packets = _bind("apix_wait_srrp_packets", ctypes.c_int32,
+                                _vp, ctypes.POINTER(_vp),
+                                ctypes.POINTER(srrp.SrrpHeader), ctypes.c_uint32)
+_apix_upgrade_to_srrp = _bind("apix_upgrade_to_srrp", ctypes.c_int32,
+                              _vp, ctypes.c_char_p)
+_apix_srrp_forward = _bind("apix_srrp_forward", None, _vp, _vp)
+_apix_srrp_send = _bind("apix_srrp_send", ctypes.c_int32, _vp, _vp)
+_apix_new = _bind("apix_new", _vp)
+_apix_drop = _bind("apix_drop", None, _vp)
+_apix_set_wait_timeout = _bind("apix_set_wait_timeout", None, _vp, ctypes.c_uint64)
+_apix_get_poll_fd = _bind("apix_get_poll_fd", ctypes.c_int32, _vp)
+_apix_dispatch = _bind("apix_dispatch", _vp, _vp)
+_apix_wait_stream = _bind("apix_wait_stream", _vp, _vp)
+_apix_enable_posix = _bind("apix_enable_posix", ctypes.c_int32, _vp)
+_apix_enable_posix_uring = _bind("apix_enable_posix_uring", ctypes.c_int32, _vp)
+_apix_disable_posix = _bind("apix_disable_posix", None, _vp)
+_apix_open = _bind("apix_open", _vp, _vp, ctypes.c_char_p, ctypes.c_char_p)
+
 def log_set_level(level):
-    func = lib.log_set_level
-    func.argtypes = [ctypes.c_int32]
-    func(level)
+    _log_set_level(level)
 
 class ApixStream():
     def __init__(self, stream):
         self.stream = stream
-        self.fd = self.__raw_fd() if stream is not None else -1
-
-    def __raw_fd(self):
-        func = lib.apix_get_raw_fd
-        func.argtypes = [ctypes.c_void_p]
-        func.restype = ctypes.c_int32
-        return func(self.stream)
+        self.fd = _apix_get_raw_fd(stream) if stream is not None else -1
+        self.buf = None
 
     def is_null(self):
         if self.stream == None:
@@ -35,120 +62,96 @@ class ApixStream():
             return False
 
     def close(self):
-        func = lib.apix_close
-        func.argtypes = [ctypes.c_void_p]
-        func(self.stream)
+        _apix_close(self.stream)
 
     def accept(self):
-        func = lib.apix_accept
-        func.argtypes = [ctypes.c_void_p]
-        func.restype = ctypes.c_void_p
-        return ApixStream(func(self.stream))
+        return ApixStream(_apix_accept(self.stream))
 
     def send(self, buf):
-        func = lib.apix_send
-        func.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_uint32]
-        func.restype = ctypes.c_int32
         assert(type(buf) == bytes)
-        return func(self.stream, ctypes.cast(buf, ctypes.c_void_p), len(buf))
+        return _apix_send(self.stream, buf, len(buf))
 
     def send_str(self, s):
-        func = lib.apix_send
-        func.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_uint32]
-        func.restype = ctypes.c_int32
         assert(type(s) == str)
-        return func(self.stream, ctypes.c_char_p(s.encode('utf-8')), len(s))
+        buf = s.encode('utf-8')
+        return _apix_send(self.stream, buf, len(buf))
+
+    def __recv_buf(self):
+        if self.buf is None:
+            self.buf = ctypes.create_string_buffer(RECV_SIZE)
+        return self.buf
 
     def recv(self):
-        func = lib.apix_recv
-        func.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_uint32]
-        func.restype = ctypes.c_int32
-        buf = ctypes.create_string_buffer(1024)
-        nr = func(self.stream, ctypes.cast(buf, ctypes.c_void_p), len(buf))
-        return ctypes.cast(buf, ctypes.POINTER(ctypes.c_ubyte * nr)).contents
+        buf = self.__recv_buf()
+        nr = _apix_recv(self.stream, buf, RECV_SIZE)
+        return buf.raw[:nr] if nr > 0 else b""
 
     def send_to_buffer(self, buf):
-        func = lib.apix_send
-        func.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_uint32]
-        func.restype = ctypes.c_int32
         assert(type(buf) == bytes)
-        return func(self.stream, ctypes.cast(buf, ctypes.c_void_p), len(buf))
+        return _apix_send_to_buffer(self.stream, buf, len(buf))
 
     def read_from_buffer(self):
-        func = lib.apix_read_from_buffer
-        func.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_uint32]
-        func.restype = ctypes.c_int32
-        buf = ctypes.create_string_buffer(1024)
-        nr = func(self.stream, ctypes.cast(buf, ctypes.c_void_p), len(buf))
-        return ctypes.cast(buf, ctypes.POINTER(ctypes.c_ubyte * nr)).contents
+        buf = self.__recv_buf()
+        nr = _apix_read_from_buffer(self.stream, buf, RECV_SIZE)
+        return buf.raw[:nr] if nr > 0 else b""
 
     def wait_event(self):
-        func = lib.apix_wait_event
-        func.argtypes = [ctypes.c_void_p]
-        func.restype = ctypes.c_uint32
-        return func(self.stream)
+        return _apix_wait_event(self.stream)
 
+    # the packet is freed by the next poll of the apix, so are its views
     def wait_srrp_packet(self):
-        func = lib.apix_wait_srrp_packet
-        func.argtypes = [ctypes.c_void_p]
-        func.restype = ctypes.c_void_p
-        return srrp.Srrp(func(self.stream), False)
+        return srrp.Srrp(_apix_wait_srrp_packet(self.stream), False)
+
+    # up to max packets by one call, with their headers filled in by it,
+    # freed as wait_srrp_packet's
+    def wait_srrp_packets(self, max=WAIT_PACKETS_MAX):
+        pacs = (_vp * max)()
+        hdrs = (srrp.SrrpHeader * max)()
+        nr = _apix_wait_srrp_packets(self.stream, pacs, hdrs, max)
+        return [srrp.Srrp(pacs[i], False, hdrs[i]) for i in range(nr)]
 
     def upgrade_to_srrp(self, nodeid):
-        func = lib.apix_upgrade_to_srrp
-        func.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
-        func.restype = ctypes.c_int32
-        return func(self.stream, ctypes.cast(nodeid, ctypes.c_char_p))
+        if type(nodeid) == str:
+            nodeid = nodeid.encode('utf-8')
+        return _apix_upgrade_to_srrp(self.stream, nodeid)
 
     def srrp_forward(self, pac):
-        func = lib.apix_srrp_forward
-        func.argtypes = [ctypes.c_void_p, ctypes.c_void_p]
-        return func(self.stream, pac.pac)
+        return _apix_srrp_forward(self.stream, pac.pac)
 
     def srrp_send(self, pac):
-        func = lib.apix_srrp_send
-        func.argtypes = [ctypes.c_void_p, ctypes.c_void_p]
-        func.restype = ctypes.c_int32
-        return func(self.stream, pac.pac)
+        return _apix_srrp_send(self.stream, pac.pac)
 
 class Apix():
     def __init__(self):
-        func = lib.apix_new
-        func.restype = ctypes.c_void_p
-        self.ctx = func()
+        self.ctx = _apix_new()
 
     def __del__(self):
-        func = lib.apix_drop
-        func.argtypes = [ctypes.c_void_p]
-        func(self.ctx)
+        _apix_drop(self.ctx)
 
     def set_wait_timeout(self, usec):
-        func = lib.apix_set_wait_timeout
-        func.argtypes = [ctypes.c_void_p, ctypes.c_uint64]
-        func(self.ctx, usec)
+        _apix_set_wait_timeout(self.ctx, usec)
+
+    def get_poll_fd(self):
+        return _apix_get_poll_fd(self.ctx)
+
+    def dispatch(self):
+        return ApixStream(_apix_dispatch(self.ctx))
 
     def wait_stream(self):
-        func = lib.apix_wait_stream
-        func.argtypes = [ctypes.c_void_p]
-        func.restype = ctypes.c_void_p
-        return ApixStream(func(self.ctx))
+        return ApixStream(_apix_wait_stream(self.ctx))
 
     def enable_posix(self):
-        func = lib.apix_enable_posix
-        func.argtypes = [ctypes.c_void_p]
-        func(self.ctx)
+        _apix_enable_posix(self.ctx)
+
+    def enable_posix_uring(self):
+        return _apix_enable_posix_uring(self.ctx)
 
     def disable_posix(self):
-        func = lib.apix_disable_posix
-        func.argtypes = [ctypes.c_void_p]
-        func(self.ctx)
+        _apix_disable_posix(self.ctx)
 
     def open(self, sinkid, addr):
-        func = lib.apix_open
-        func.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_char_p]
-        func.restype = ctypes.c_void_p
-        return ApixStream(func(self.ctx, ctypes.c_char_p(sinkid.encode('utf-8')),
-             ctypes.c_char_p(addr.encode('utf-8'))))
+        return ApixStream(_apix_open(self.ctx, sinkid.encode('utf-8'),
+                                     addr.encode('utf-8')))
 
     def open_unix_server(self, addr):
         return self.open("sink_unix_s", addr)
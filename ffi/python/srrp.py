@@ -3,16 +3,69 @@ from ctypes.util import find_library
 
 lib = ctypes.CDLL(find_library("apix"))
 
+SRRP_INTEGRITY_NONE = 0
+SRRP_INTEGRITY_CRC16 = 1
+SRRP_INTEGRITY_CRC32C = 2
+
+# signatures are bound once here, not on each call
+def _bind(name, restype, *argtypes):
+    func = getattr(lib, name)
+    func.restype = restype
+    func.argtypes = list(argtypes)
+    return func
+
+class SrrpHeader(ctypes.Structure):
+    # struct srrp_header of srrp.h
+    _fields_ = [
+        ("srcid", ctypes.c_char_p),
+        ("dstid", ctypes.c_char_p),
+        ("anchor", ctypes.c_char_p),
+        ("payload", ctypes.c_void_p),
+        ("raw", ctypes.c_void_p),
+        ("payload_len", ctypes.c_uint32),
+        ("seqno", ctypes.c_uint32),
+        ("crc", ctypes.c_uint32),
+        ("ver", ctypes.c_uint16),
+        ("packet_len", ctypes.c_uint16),
+        ("leader", ctypes.c_char),
+        ("fin", ctypes.c_uint8),
+        ("payload_type", ctypes.c_uint8),
+        ("integrity", ctypes.c_uint8),
+    ]
+
+_srrp_free = _bind("srrp_free", None, ctypes.c_void_p)
+_srrp_get_header = _bind("srrp_get_header", None,
+                         ctypes.c_void_p, ctypes.POINTER(SrrpHeader))
+_srrp_next_packet_offset = _bind("srrp_next_packet_offset", ctypes.c_uint32,
+                                 ctypes.c_void_p, ctypes.c_uint32)
+_srrp_parse = _bind("srrp_parse", ctypes.c_void_p,
+                    ctypes.c_void_p, ctypes.c_uint32)
+_srrp_new = _bind("srrp_new", ctypes.c_void_p,
+                  ctypes.c_char, ctypes.c_uint8,
+                  ctypes.c_char_p, ctypes.c_char_p,
+                  ctypes.c_char_p, ctypes.c_char_p,
+                  ctypes.c_uint32)
+
+def _view(addr, size, owner):
+    if not addr or size == 0:
+        return memoryview(b"")
+    buf = (ctypes.c_ubyte * size).from_address(addr)
+    # keeps an owned packet alive as long as the view, packets of
+    # wait_srrp_packet(s) are not owned, apix frees them on its next poll
+    buf._owner = owner
+    return memoryview(buf).cast("B")
+
 class Srrp():
-    def __init__(self, pac, owned=False):
+    __slots__ = ("pac", "owned", "hdr", "__weakref__")
+
+    def __init__(self, pac, owned=False, hdr=None):
         self.pac = pac
         self.owned = owned
+        self.hdr = hdr
 
     def __del__(self):
-        if self.owned:
-            func = lib.srrp_free
-            func.argtypes = [ctypes.c_void_p]
-            func(self.pac)
+        if self.owned and self.pac:
+            _srrp_free(self.pac)
 
     def is_null(self):
         if self.pac is None:
@@ -20,98 +73,75 @@ class Srrp():
         else:
             return False
 
+    # all fields are fetched by one call on first use
+    def header(self):
+        if self.hdr is None:
+            self.hdr = SrrpHeader()
+            _srrp_get_header(self.pac, ctypes.byref(self.hdr))
+        return self.hdr
+
     def leader(self):
-        func = lib.srrp_get_leader
-        func.argtypes = [ctypes.c_void_p]
-        func.restype = ctypes.c_char
-        return func(self.pac)
+        return self.header().leader
 
     def fin(self):
-        func = lib.srrp_get_fin
-        func.argtypes = [ctypes.c_void_p]
-        func.restype = ctypes.c_uint8
-        return func(self.pac)
+        return self.header().fin
 
     def ver(self):
-        func = lib.srrp_get_ver
-        func.argtypes = [ctypes.c_void_p]
-        func.restype = ctypes.c_uint16
-        return func(self.pac)
+        return self.header().ver
 
     def packet_len(self):
-        func = lib.srrp_get_packet_len
-        func.argtypes = [ctypes.c_void_p]
-        func.restype = ctypes.c_uint16
-        return func(self.pac)
+        return self.header().packet_len
 
     def payload_len(self):
-        func = lib.srrp_get_payload_len
-        func.argtypes = [ctypes.c_void_p]
-        func.restype = ctypes.c_uint32
-        return func(self.pac)
+        return self.header().payload_len
 
     def srcid(self):
-        func = lib.srrp_get_srcid
-        func.argtypes = [ctypes.c_void_p]
-        func.restype = ctypes.c_char_p
-        return func(self.pac).decode("utf-8")
+        return self.header().srcid.decode("utf-8")
 
     def dstid(self):
-        func = lib.srrp_get_dstid
-        func.argtypes = [ctypes.c_void_p]
-        func.restype = ctypes.c_char_p
-        return func(self.pac).decode("utf-8")
+        return self.header().dstid.decode("utf-8")
 
     def anchor(self):
-        func = lib.srrp_get_anchor
-        func.argtypes = [ctypes.c_void_p]
-        func.restype = ctypes.c_char_p
-        return func(self.pac).decode("utf-8")
+        return self.header().anchor.decode("utf-8")
+
+    def seqno(self):
+        return self.header().seqno
 
     def payload(self):
-        func = lib.srrp_get_payload
-        func.argtypes = [ctypes.c_void_p]
-        func.restype = ctypes.c_char_p
-        return func(self.pac).decode("utf-8")
+        return bytes(self.payload_view()).decode("utf-8")
+
+    # no copy, valid as long as the packet: views of packets taken by
+    # wait_srrp_packet(s) must not be used past the next poll of their apix,
+    # any wait_* or dispatch, keep payload() or raw() copies instead
+    def payload_view(self):
+        hdr = self.header()
+        return _view(hdr.payload, hdr.payload_len, self)
 
     def crc16(self):
-        func = lib.srrp_get_crc16
-        func.argtypes = [ctypes.c_void_p]
-        func.restype = ctypes.c_uint16
-        return func(self.pac)
+        hdr = self.header()
+        return hdr.crc if hdr.integrity == SRRP_INTEGRITY_CRC16 else 0
 
     def raw(self):
-        func = lib.srrp_get_raw
-        func.argtypes = [ctypes.c_void_p]
-        func.restype = ctypes.POINTER(ctypes.c_ubyte * self.packet_len())
-        return bytes(func(self.pac).contents)
+        return bytes(self.raw_view())
+
+    # no copy, valid as payload_view
+    def raw_view(self):
+        hdr = self.header()
+        return _view(hdr.raw, hdr.packet_len, self)
 
 def srrp_next_packet_offset(buf):
-    func = lib.srrp_next_packet_offset
-    func.argtypes = [ctypes.c_void_p, ctypes.c_uint32]
-    func.restype = ctypes.c_uint32
-    return func(ctypes.cast(buf, ctypes.c_void_p), len(buf))
+    return _srrp_next_packet_offset(buf, len(buf))
 
 def srrp_parse(buf):
-    func = lib.srrp_parse
-    func.argtypes = [ctypes.c_void_p, ctypes.c_uint32]
-    func.restype = ctypes.c_void_p
-    pac = func(ctypes.cast(buf, ctypes.c_void_p), len(buf))
-    return Srrp(pac, True)
+    return Srrp(_srrp_parse(buf, len(buf)), True)
 
 def srrp_new(leader, fin, srcid, dstid, anchor, payload, payload_len):
-    func = lib.srrp_new
-    func.argtypes = [ctypes.c_char, ctypes.c_uint8,
-                     ctypes.c_char_p, ctypes.c_char_p,
-                     ctypes.c_char_p, ctypes.c_char_p,
-                     ctypes.c_uint32]
-    func.restype = ctypes.c_void_p
-    pac = func(leader, fin,
-               ctypes.c_char_p(srcid.encode('utf-8')),
-               ctypes.c_char_p(dstid.encode('utf-8')),
-               ctypes.c_char_p(anchor.encode('utf-8')),
-               ctypes.c_char_p(payload.encode('utf-8')),
-               payload_len)
+    pac = _srrp_new(leader, fin,
+                    srcid.encode('utf-8'),
+                    dstid.encode('utf-8'),
+                    anchor.encode('utf-8'),
+                    payload.encode('utf-8'),
+                    payload_len)
     assert(pac != 0)
     return Srrp(pac, True)
 
@@ -1,4 +1,5 @@
 #if defined __unix__ || defined __linux__ || defined __APPLE__
+#define _GNU_SOURCE /* recvmmsg, splice */
 
 #include <assert.h>
 #include <errno.h>
@@ -7,6 +8,9 @@
 #include <stdio.h>
 #include <strings.h>
 #include <time.h>
+#include <limits.h>
+#include <signal.h>
+#include <pthread.h>
 
 #include <unistd.h>
 #include <sys/select.h>
@@ -15,8 +19,15 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 #ifndef __APPLE__
 #include <termios.h>
+#include <linux/serial.h>
 #include <linux/can.h>
 #include <linux/can/raw.h>
 #endif
@@ -27,26 +38,397 @@
 #include "apix-posix.h"
 #include "unused.h"
 #include "log.h"
+#include "probe.h"
+#include "isotp.h"
+#include "vec.h"
 
 struct posix_sink {
     struct sink sink;
     // for select
     fd_set fds;
     int nfds;
+    int uring; /* streams are polled by io_uring, fds is unused */
 };
 
+/*
+ * select can't watch fds past FD_SETSIZE, refuse them instead of writing
+ * past fds, streams of an io_uring sink have no such limit
+ */
+static int posix_fds_set(struct sink *sink, int fd)
+{
+    struct posix_sink *ps = container_of(sink, struct posix_sink, sink);
+    if (ps->uring)
+        return 0;
+
+    if (fd >= FD_SETSIZE) {
+        LOG_ERROR("[%p:posix_fds_set] #%d over FD_SETSIZE", sink->ctx, fd);
+        return -1;
+    }
+
+    FD_SET(fd, &ps->fds);
+    if (ps->nfds < fd + 1)
+        ps->nfds = fd + 1;
+    return 0;
+}
+
+static void posix_fds_clr(struct sink *sink, int fd)
+{
+    struct posix_sink *ps = container_of(sink, struct posix_sink, sink);
+    if (!ps->uring && fd < FD_SETSIZE)
+        FD_CLR(fd, &ps->fds);
+}
+
+/* Return a new stream of fd, or NULL with fd closed if out of streams. */
+static struct stream *posix_stream_new(struct sink *sink, int fd)
+{
+    struct stream *stream = stream_new(sink);
+    if (stream == NULL) {
+        posix_fds_clr(sink, fd);
+        close(fd);
+        return NULL;
+    }
+    stream->fd = fd;
+    return stream;
+}
+
 static int __fd_close(struct stream *stream)
 {
     close(stream->fd);
-
-    struct posix_sink *unix_c_sink =
-        container_of(stream->sink, struct posix_sink, sink);
-    FD_CLR(stream->fd, &unix_c_sink->fds);
+    posix_fds_clr(stream->sink, stream->fd);
 
     stream_free(stream);
     return 0;
 }
 
+/*
+ * relay
+ * - see apix_relay, bytes received on src are moved to dst by splice when
+ *   the sink polls src readable, they never reach rxbuf
+ */
+
+#define RELAY_CHUNK (64 * 1024)
+
+#ifdef __linux__
+
+/*
+ * write, splice & sendfile to a pipe raise SIGPIPE once its reader is gone,
+ * block it around the call and take the pending one, as MSG_NOSIGNAL does
+ * for send
+ */
+static void sigpipe_block(sigset_t *old, int *pending)
+{
+    sigset_t set, cur;
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &set, old);
+    sigpending(&cur);
+    *pending = sigismember(&cur, SIGPIPE);
+}
+
+static void sigpipe_unblock(const sigset_t *old, int pending, int epipe)
+{
+    if (epipe && !pending) {
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGPIPE);
+        struct timespec ts = { 0, 0 };
+        sigtimedwait(&set, NULL, &ts);
+    }
+    pthread_sigmask(SIG_SETMASK, old, NULL);
+}
+
+static int is_fifo(int fd)
+{
+    struct stat st;
+    return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+static ssize_t relay_splice(int in, int out, size_t len)
+{
+    sigset_t old;
+    int pending;
+    sigpipe_block(&old, &pending);
+    ssize_t nr = splice(in, NULL, out, NULL, len,
+                        SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    sigpipe_unblock(&old, pending, nr == -1 && errno == EPIPE);
+    return nr;
+}
+
+/*
+ * Move the bytes left in relay_pipe on to dst, as far as dst takes them.
+ * - return -1 if dst failed and was closed
+ */
+static int relay_drain(struct stream *src, struct stream *dst)
+{
+    while (src->relay_left) {
+        ssize_t nr = relay_splice(src->relay_pipe[0], stream_tx_fd(dst),
+                                  src->relay_left);
+        if (nr == -1 && (errno == EAGAIN || errno == EINTR))
+            return 0;
+        if (nr <= 0) {
+            LOG_DEBUG("[%p:splice] #%d %s(%d)",
+                      dst->ctx, stream_tx_fd(dst), strerror(errno), errno);
+            dst->sink->ops.close(dst);
+            return -1;
+        }
+        src->relay_left -= nr;
+    }
+    return 0;
+}
+
+/*
+ * Take the bytes left in relay_pipe back into rxbuf of src, once there is
+ * no dst for them any more.
+ */
+static void relay_unpark(struct stream *src)
+{
+    u8 buf[4096];
+    while (src->relay_left) {
+        ssize_t nr = read(src->relay_pipe[0], buf,
+                          src->relay_left < sizeof(buf) ? src->relay_left : sizeof(buf));
+        if (nr <= 0) {
+            if (nr == -1 && errno == EINTR)
+                continue;
+            break;
+        }
+        stream_rx_append(src, buf, nr);
+        src->relay_left -= nr;
+    }
+    src->relay_left = 0;
+    if (stream_rx_size(src)) {
+        stream_mark_rx(src);
+        src->ev.bits.pollin = 1;
+    }
+}
+
+static void posix_relay(struct stream *src)
+{
+    struct stream *dst = src->relay_dst;
+    if (dst->ev.bits.close || dst->state == STREAM_ST_FINISHED) {
+        src->relay_dst = NULL;
+        dst->relay_src = NULL;
+        relay_unpark(src);
+        return;
+    }
+
+    // what dst had queued goes first, the bytes wait in the kernel meanwhile
+    if (stream_tx_size(dst) || !fd_writable(stream_tx_fd(dst)))
+        return;
+
+    ssize_t nr;
+    if (src->relay_pipe[0] == -1) {
+        nr = relay_splice(src->fd, stream_tx_fd(dst), RELAY_CHUNK);
+    } else {
+        // src is read no further until dst took what relay_pipe holds
+        if (relay_drain(src, dst) != 0 || src->relay_left)
+            return;
+        nr = relay_splice(src->fd, src->relay_pipe[1], RELAY_CHUNK);
+        if (nr > 0) {
+            src->relay_left = nr;
+            if (relay_drain(src, dst) != 0)
+                return;
+        }
+    }
+    PROBE2(apix, sink_read, src->fd, (int)nr);
+
+    if (nr == -1 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (nr <= 0) {
+        LOG_DEBUG("[%p:splice] #%d %s", src->ctx, src->fd,
+                  nr == 0 ? "finished" : strerror(errno));
+        src->sink->ops.close(src);
+    }
+}
+
+/*
+ * Drain relay_pipe once dst took its queue, src may not turn readable again
+ * to push the bytes left there on.
+ */
+static int relay_flush(struct sink *sink)
+{
+    struct stream *pos;
+    list_for_each_entry(pos, &sink->streams, ln_sink) {
+        struct stream *dst = pos->relay_dst;
+        if (dst && pos->relay_left && !stream_tx_size(dst) &&
+            !dst->ev.bits.close && dst->state != STREAM_ST_FINISHED)
+            relay_drain(pos, dst);
+    }
+    return 0;
+}
+
+#else
+
+static void posix_relay(struct stream *src)
+{
+    UNUSED(src);
+}
+
+static int relay_flush(struct sink *sink)
+{
+    UNUSED(sink);
+    return 0;
+}
+
+#endif
+
+/*
+ * send file
+ * - see apix_srrp_send_file, the file of a stream is fed by the flush of
+ *   its sink, inside apix_poll
+ */
+
+#ifdef APIX_STATIC_ALLOC
+#define FILE_SLICE_LIMIT PAYLOAD_LIMIT /* the peer parses it in one frame */
+#else
+#define FILE_SLICE_LIMIT (60 * 1024) /* leaves room for the head under 64K */
+#endif
+
+/*
+ * One slice is framed at a time, once tx of the stream drained. Plain socket
+ * & pipe streams get the head & tail of it through txbuf and the payload by
+ * sendfile in between, others get it all queued to txbuf.
+ */
+struct file_tx {
+    int fd; /* dup of the file */
+    u8 *map; /* from the page holding offset, NULL => len 0 */
+    size_t map_len;
+    u32 delta; /* of offset in map */
+    off_t offset;
+    size_t len;
+    size_t idx; /* of the payload framed so far */
+    int direct;
+    int fin; /* the last slice is framed */
+    struct srrp_packet *hdr;
+    vec_t *head;
+    vec_t *tail; /* of the framed slice, empty once queued */
+    off_t pos; /* direct: next byte of the framed slice for sendfile */
+    off_t end;
+};
+
+void file_tx_free(struct file_tx *tx)
+{
+    if (tx->map)
+        munmap(tx->map, tx->map_len);
+    if (tx->fd != -1)
+        close(tx->fd);
+    if (tx->hdr)
+        srrp_free(tx->hdr);
+    if (tx->head)
+        vec_free(tx->head);
+    if (tx->tail)
+        vec_free(tx->tail);
+    mem_free(tx);
+}
+
+static void file_tx_end(struct stream *stream)
+{
+    file_tx_free(stream->tx_file);
+    stream->tx_file = NULL;
+    stream_tx_unhold(stream);
+}
+
+#ifdef __linux__
+static ssize_t file_sendfile(struct stream *stream, struct file_tx *tx)
+{
+    sigset_t old;
+    int pending;
+    sigpipe_block(&old, &pending);
+    ssize_t nr = sendfile(stream_tx_fd(stream), tx->fd, &tx->pos, tx->end - tx->pos);
+    sigpipe_unblock(&old, pending, nr == -1 && errno == EPIPE);
+    if (nr == 0)
+        errno = EIO; /* the file shrank under us */
+    return nr;
+}
+#endif
+
+/*
+ * Frame the next slice and queue what goes through txbuf, return -1 if
+ * there is no room for it now, the slice is framed again on the next try.
+ */
+static int file_frame(struct stream *stream, struct file_tx *tx)
+{
+    u32 cnt = tx->len - tx->idx > FILE_SLICE_LIMIT ?
+        FILE_SLICE_LIMIT : tx->len - tx->idx;
+    u8 fin = tx->idx + cnt == tx->len ? SRRP_FIN_1 : SRRP_FIN_0;
+    const u8 *payload = tx->map ? tx->map + tx->delta + tx->idx : NULL;
+    if (srrp_frame_slice(tx->hdr, fin, payload, cnt, stream->tx_integrity,
+                         tx->head, tx->tail) != 0)
+        return -1;
+
+    if (tx->direct) {
+        if (stream_tx_append(stream, vraw(tx->head), vsize(tx->head)) != 0)
+            return -1;
+        tx->pos = tx->offset + tx->idx;
+        tx->end = tx->pos + cnt;
+    } else {
+        if (stream_tx_append(stream, vraw(tx->head), vsize(tx->head)) != 0 ||
+            (cnt && stream_tx_append(stream, payload, cnt) != 0) ||
+            stream_tx_append(stream, vraw(tx->tail), vsize(tx->tail)) != 0) {
+            if (stream->txbuf) /* it was empty */
+                vdrop(stream->txbuf, vsize(stream->txbuf));
+            return -1;
+        }
+        vdrop(tx->tail, vsize(tx->tail));
+    }
+    tx->idx += cnt;
+    tx->fin = fin == SRRP_FIN_1;
+    return 0;
+}
+
+/* Feed the stream what it takes of its file, without blocking. */
+static void file_pump(struct stream *stream)
+{
+    struct file_tx *tx = stream->tx_file;
+    if (stream->ev.bits.close || stream->state == STREAM_ST_FINISHED)
+        return;
+
+    for (;;) {
+#ifdef __linux__
+        if (tx->pos != tx->end) {
+            if (stream_tx_size(stream))
+                return;
+            ssize_t nr = file_sendfile(stream, tx);
+            if (nr == -1 && (errno == EAGAIN || errno == EINTR))
+                return;
+            if (nr <= 0) {
+                LOG_DEBUG("[%p:sendfile] #%d %s(%d)",
+                          stream->ctx, stream_tx_fd(stream), strerror(errno), errno);
+                stream->sink->ops.close(stream);
+                return;
+            }
+            continue;
+        }
+#endif
+        if (vsize(tx->tail)) {
+            if (stream_tx_append(stream, vraw(tx->tail), vsize(tx->tail)) != 0)
+                return;
+            vdrop(tx->tail, vsize(tx->tail));
+        }
+        if (tx->fin) {
+            file_tx_end(stream);
+            return;
+        }
+        if (stream_tx_size(stream) || file_frame(stream, tx) != 0)
+            return;
+    }
+}
+
+static int file_flush(struct sink *sink)
+{
+    struct stream *pos;
+    list_for_each_entry(pos, &sink->streams, ln_sink) {
+        if (pos->tx_file)
+            file_pump(pos);
+    }
+    return 0;
+}
+
+static int posix_flush(struct sink *sink)
+{
+    relay_flush(sink);
+    return file_flush(sink);
+}
+
 /**
  * unix domain socket server
  */
@@ -75,14 +457,17 @@ static struct stream *unix_s_open(struct sink *sink, const char *addr)
         return NULL;
     }
 
-    struct stream *stream = stream_new(sink);
-    stream->fd = fd;
-    stream->type = STREAM_T_LISTEN;
-    snprintf(stream->addr, sizeof(stream->addr), "%s", addr);
+    if (posix_fds_set(sink, fd) != 0) {
+        close(fd);
+        return NULL;
+    }
 
-    struct posix_sink *ps = container_of(sink, struct posix_sink, sink);
-    FD_SET(fd, &ps->fds);
-    ps->nfds = fd + 1;
+    struct stream *stream = posix_stream_new(sink, fd);
+    if (stream == NULL)
+        return NULL;
+    stream->type = STREAM_T_LISTEN;
+    stream->integrity = SRRP_INTEGRITY_NONE; /* kept intact by the kernel */
+    stream_set_addr(stream, addr);
 
     return stream;
 }
@@ -90,37 +475,61 @@ static struct stream *unix_s_open(struct sink *sink, const char *addr)
 static int unix_s_close(struct stream *stream)
 {
     if (strcmp(stream->sink->id, SINK_UNIX_S) == 0)
-        unlink(stream->addr);
+        unlink(stream_addr(stream));
 
     __fd_close(stream);
     return 0;
 }
 
-static struct stream *unix_s_accept(struct stream *stream)
+static void set_sock_busy_poll(struct stream *stream)
 {
-    struct posix_sink *ps = container_of(stream->sink, struct posix_sink, sink);
-
-    int newfd = accept(stream->fd, NULL, NULL);
-    if (newfd == -1) {
-        LOG_ERROR("[%p:accept] #%d %s(%d)",
+#ifdef SO_BUSY_POLL
+    int usec = stream->ctx->sock_busy_poll_usec;
+    if (usec && setsockopt(stream->fd, SOL_SOCKET, SO_BUSY_POLL,
+                           &usec, sizeof(usec)) != 0) {
+        LOG_DEBUG("[%p:setsockopt] #%d SO_BUSY_POLL %s(%d)",
                   stream->ctx, stream->fd, strerror(errno), errno);
-        return NULL;
     }
+#else
+    UNUSED(stream);
+#endif
+}
+
+static struct stream *__accept_stream(struct stream *stream, int newfd)
+{
     LOG_DEBUG("[%p:accept] #%d accept #%d", stream->ctx, stream->fd, newfd);
 
-    struct stream *new_stream = stream_new(stream->sink);
-    new_stream->fd = newfd;
+    if (posix_fds_set(stream->sink, newfd) != 0) {
+        close(newfd);
+        return NULL;
+    }
+
+    struct stream *new_stream = posix_stream_new(stream->sink, newfd);
+    if (new_stream == NULL)
+        return NULL;
     new_stream->father = stream;
     new_stream->type = STREAM_T_ACCEPT;
     new_stream->srrp_mode = stream->srrp_mode;
+    new_stream->integrity = stream->integrity;
 
-    if (ps->nfds < newfd + 1)
-        ps->nfds = newfd + 1;
-    FD_SET(newfd, &ps->fds);
+    if (strcmp(stream->sink->id, SINK_TCP_S) == 0)
+        set_sock_busy_poll(new_stream);
 
     return new_stream;
 }
 
+static struct stream *unix_s_accept(struct stream *stream)
+{
+    int newfd = accept(stream->fd, NULL, NULL);
+    if (newfd == -1) {
+        LOG_ERROR("[%p:accept] #%d %s(%d)",
+                  stream->ctx, stream->fd, strerror(errno), errno);
+        return NULL;
+    }
+
+    return __accept_stream(stream, newfd);
+}
+
 static int unix_s_send(struct stream *stream, const u8 *buf, u32 len)
 {
     return send(stream->fd, buf, len, MSG_NOSIGNAL);
@@ -159,9 +568,12 @@ static int unix_s_poll(struct sink *sink)
         // accept
         if (pos->type == STREAM_T_LISTEN) {
             pos->ev.bits.accept = 1;
+        } else if (pos->relay_dst) {
+            posix_relay(pos);
         } else /* recv */ {
             char buf[1024] = {0};
             int nread = recv(pos->fd, buf, sizeof(buf), 0);
+            PROBE2(apix, sink_read, pos->fd, nread);
             if (nread == -1) {
                 LOG_DEBUG("[%p:recv] #%d %s(%d)", sink->ctx, pos->fd, strerror(errno), errno);
                 sink->ops.close(pos);
@@ -170,8 +582,8 @@ static int unix_s_poll(struct sink *sink)
                 sink->ops.close(pos);
             } else {
                 LOG_TRACE("[%p:recv] #%d packet in", sink->ctx, pos->fd);
-                vpack(pos->rxbuf, buf, nread);
-                gettimeofday(&pos->ts_poll_recv, NULL);
+                stream_rx_append(pos, buf, nread);
+                stream_mark_rx(pos);
                 pos->ev.bits.pollin = 1;
             }
         }
@@ -188,6 +600,7 @@ static struct sink_operations unix_s_ops = {
     .send = unix_s_send,
     .recv = unix_s_recv,
     .poll = unix_s_poll,
+    .flush = posix_flush,
 };
 
 /**
@@ -211,13 +624,16 @@ static struct stream *unix_c_open(struct sink *sink, const char *addr)
         return NULL;
     }
 
-    struct stream *stream = stream_new(sink);
-    stream->fd = fd;
-    snprintf(stream->addr, sizeof(stream->addr), "%s", addr);
+    if (posix_fds_set(sink, fd) != 0) {
+        close(fd);
+        return NULL;
+    }
 
-    struct posix_sink *ps = container_of(sink, struct posix_sink, sink);
-    FD_SET(fd, &ps->fds);
-    ps->nfds = fd + 1;
+    struct stream *stream = posix_stream_new(sink, fd);
+    if (stream == NULL)
+        return NULL;
+    stream->integrity = SRRP_INTEGRITY_NONE; /* kept intact by the kernel */
+    stream_set_addr(stream, addr);
 
     return stream;
 }
@@ -257,8 +673,14 @@ static int unix_c_poll(struct sink *sink)
 
         nr_recv_fds--;
 
+        if (pos->relay_dst) {
+            posix_relay(pos);
+            continue;
+        }
+
         char buf[1024] = {0};
         int nread = recv(pos->fd, buf, sizeof(buf), 0);
+        PROBE2(apix, sink_read, pos->fd, nread);
         if (nread == -1) {
             LOG_DEBUG("[%p:recv] #%d %s(%d)", sink->ctx, pos->fd, strerror(errno), errno);
             sink->ops.close(pos);
@@ -267,8 +689,8 @@ static int unix_c_poll(struct sink *sink)
             sink->ops.close(pos);
         } else {
             LOG_TRACE("[%p:recv] #%d packet in", sink->ctx, pos->fd);
-            vpack(pos->rxbuf, buf, nread);
-            gettimeofday(&pos->ts_poll_recv, NULL);
+            stream_rx_append(pos, buf, nread);
+            stream_mark_rx(pos);
             pos->ev.bits.pollin = 1;
         }
     }
@@ -284,6 +706,7 @@ static struct sink_operations unix_c_ops = {
     .send = unix_c_send,
     .recv = unix_c_recv,
     .poll = unix_c_poll,
+    .flush = posix_flush,
 };
 
 /**
@@ -298,12 +721,12 @@ static struct stream *tcp_s_open(struct sink *sink, const char *addr)
 
     u32 host;
     u16 port;
-    char *tmp = strdup(addr);
+    char tmp[64];
+    snprintf(tmp, sizeof(tmp), "%s", addr);
     char *colon = strchr(tmp, ':');
     *colon = 0;
     host = inet_addr(tmp);
     port = htons(atoi(colon + 1));
-    free(tmp);
 
     int rc = 0;
     struct sockaddr_in sockaddr = {0};
@@ -323,14 +746,16 @@ static struct stream *tcp_s_open(struct sink *sink, const char *addr)
         return NULL;
     }
 
-    struct stream *stream = stream_new(sink);
-    stream->fd = fd;
-    stream->type = STREAM_T_LISTEN;
-    snprintf(stream->addr, sizeof(stream->addr), "%s", addr);
+    if (posix_fds_set(sink, fd) != 0) {
+        close(fd);
+        return NULL;
+    }
 
-    struct posix_sink *tcp_s_sink = container_of(sink, struct posix_sink, sink);
-    FD_SET(fd, &tcp_s_sink->fds);
-    tcp_s_sink->nfds = fd + 1;
+    struct stream *stream = posix_stream_new(sink, fd);
+    if (stream == NULL)
+        return NULL;
+    stream->type = STREAM_T_LISTEN;
+    stream_set_addr(stream, addr);
 
     return stream;
 }
@@ -343,6 +768,7 @@ static struct sink_operations tcp_s_ops = {
     .send = unix_s_send,
     .recv = unix_s_recv,
     .poll = unix_s_poll,
+    .flush = posix_flush,
 };
 
 /**
@@ -357,12 +783,12 @@ static struct stream *tcp_c_open(struct sink *sink, const char *addr)
 
     u32 host;
     u16 port;
-    char *tmp = strdup(addr);
+    char tmp[64];
+    snprintf(tmp, sizeof(tmp), "%s", addr);
     char *colon = strchr(tmp, ':');
     *colon = 0;
     host = inet_addr(tmp);
     port = htons(atoi(colon + 1));
-    free(tmp);
 
     int rc = 0;
     struct sockaddr_in sockaddr = {0};
@@ -376,15 +802,18 @@ static struct stream *tcp_c_open(struct sink *sink, const char *addr)
         return NULL;
     }
 
-    struct stream *stream = stream_new(sink);
-    stream->fd = fd;
-    stream->type = STREAM_T_CONNECT;
-    snprintf(stream->addr, sizeof(stream->addr), "%s", addr);
+    if (posix_fds_set(sink, fd) != 0) {
+        close(fd);
+        return NULL;
+    }
 
-    struct posix_sink *tcp_c_sink = container_of(sink, struct posix_sink, sink);
-    FD_SET(fd, &tcp_c_sink->fds);
-    tcp_c_sink->nfds = fd + 1;
+    struct stream *stream = posix_stream_new(sink, fd);
+    if (stream == NULL)
+        return NULL;
+    stream->type = STREAM_T_CONNECT;
+    stream_set_addr(stream, addr);
 
+    set_sock_busy_poll(stream);
     return stream;
 }
 
@@ -396,67 +825,309 @@ static struct sink_operations tcp_c_ops = {
     .send = unix_c_send,
     .recv = unix_c_recv,
     .poll = unix_c_poll,
+    .flush = posix_flush,
 };
 
-#ifndef __APPLE__
-
 /**
- * com
+ * pipe
+ * - addr is "rx:tx", each end an inherited fd number or the path of a fifo,
+ *   made if missing, e.g. "0:1" for the stdin & stdout of a child
+ * - fifos are opened O_RDWR, so opening never waits for the other side
  */
 
-static struct stream *com_open(struct sink *sink, const char *addr)
+static int pipe_open_end(const char *end, size_t len)
 {
-    int fd = open(addr, O_RDWR | O_NOCTTY | O_NDELAY);
+    char path[PATH_MAX];
+    if (len == 0 || len >= sizeof(path))
+        return -1;
+    memcpy(path, end, len);
+    path[len] = 0;
+
+    if (strspn(path, "0123456789") == len)
+        return atoi(path);
+
+    if (mkfifo(path, 0600) == -1 && errno != EEXIST)
+        return -1;
+    return open(path, O_RDWR | O_CLOEXEC);
+}
+
+static struct stream *pipe_open(struct sink *sink, const char *addr)
+{
+    const char *sep = strchr(addr, ':');
+    if (sep == NULL)
+        return NULL;
+
+    int fd = pipe_open_end(addr, sep - addr);
     if (fd == -1)
         return NULL;
+    int tx_fd = pipe_open_end(sep + 1, strlen(sep + 1));
+    if (tx_fd == -1) {
+        close(fd);
+        return NULL;
+    }
 
-    struct stream *stream = stream_new(sink);
-    stream->fd = fd;
-    snprintf(stream->addr, sizeof(stream->addr), "%s", addr);
+    if (posix_fds_set(sink, fd) != 0) {
+        close(fd);
+        if (tx_fd != fd)
+            close(tx_fd);
+        return NULL;
+    }
+
+#ifdef F_SETNOSIGPIPE
+    fcntl(tx_fd, F_SETNOSIGPIPE, 1);
+#endif
 
-    struct posix_sink *com_sink = container_of(sink, struct posix_sink, sink);
-    FD_SET(fd, &com_sink->fds);
-    com_sink->nfds = fd + 1;
+    struct stream *stream = posix_stream_new(sink, fd);
+    if (stream == NULL) {
+        if (tx_fd != fd)
+            close(tx_fd);
+        return NULL;
+    }
+    stream->tx_fd = tx_fd == fd ? -1 : tx_fd;
+    stream->type = STREAM_T_CONNECT;
+    stream->integrity = SRRP_INTEGRITY_NONE; /* kept intact by the kernel */
+    stream_set_addr(stream, addr);
 
     return stream;
 }
 
-static int
-com_ioctl(struct stream *stream, unsigned int cmd, unsigned long arg)
+static int pipe_close(struct stream *stream)
 {
-    UNUSED(cmd);
-    struct ioctl_com_param *sp = (struct ioctl_com_param *)arg;
-    struct termios newtio, oldtio;
+    if (stream->tx_fd != -1) {
+        close(stream->tx_fd);
+        stream->tx_fd = -1;
+    }
+    return __fd_close(stream);
+}
 
-    if (tcgetattr(stream->fd, &oldtio) != 0)
-        return -1;
+static int pipe_send(struct stream *stream, const u8 *buf, u32 len)
+{
+#ifdef __linux__
+    sigset_t old;
+    int pending;
+    sigpipe_block(&old, &pending);
+    int nr = write(stream_tx_fd(stream), buf, len);
+    sigpipe_unblock(&old, pending, nr == -1 && errno == EPIPE);
+    return nr;
+#else
+    return write(stream_tx_fd(stream), buf, len); /* F_SETNOSIGPIPE */
+#endif
+}
 
-    bzero(&newtio, sizeof(newtio));
-    newtio.c_cflag |= (CLOCAL | CREAD);
-    newtio.c_cflag &= ~CSIZE;
+static int pipe_recv(struct stream *stream, u8 *buf, u32 len)
+{
+    return read(stream->fd, buf, len);
+}
 
-    if (sp->baud == COM_ARG_BAUD_9600) {
-        cfsetispeed(&newtio, B9600);
-    } else if (sp->baud == COM_ARG_BAUD_115200) {
-        cfsetispeed(&newtio, B115200);
-    } else {
+static int pipe_poll(struct sink *sink)
+{
+    struct posix_sink *ps = container_of(sink, struct posix_sink, sink);
+
+    struct timeval tv = { 0, 0 };
+    fd_set recvfds;
+    memcpy(&recvfds, &ps->fds, sizeof(recvfds));
+
+    int nr_recv_fds = select(ps->nfds, &recvfds, NULL, NULL, &tv);
+    if (nr_recv_fds == -1) {
+        if (errno == EINTR)
+            return 0;
+        LOG_ERROR("[%p:select] %s(%d)", sink->ctx, strerror(errno), errno);
         return -1;
     }
-    if (sp->bits == COM_ARG_BITS_7) {
-        newtio.c_cflag |= CS7;
-    } else if (sp->bits == COM_ARG_BITS_8) {
-        newtio.c_cflag |= CS8;
-    } else {
+
+    struct stream *pos, *n;
+    list_for_each_entry_safe(pos, n, &sink->streams, ln_sink) {
+        if (nr_recv_fds == 0) break;
+
+        if (!FD_ISSET(pos->fd, &recvfds))
+            continue;
+
+        nr_recv_fds--;
+
+        if (pos->relay_dst) {
+            posix_relay(pos);
+            continue;
+        }
+
+        char buf[4096];
+        int nread = read(pos->fd, buf, sizeof(buf));
+        PROBE2(apix, sink_read, pos->fd, nread);
+        if (nread == -1 && (errno == EAGAIN || errno == EINTR)) {
+            continue;
+        } else if (nread == -1) {
+            LOG_DEBUG("[%p:read] #%d %s(%d)", sink->ctx, pos->fd, strerror(errno), errno);
+            sink->ops.close(pos);
+        } else if (nread == 0) {
+            LOG_DEBUG("[%p:read] #%d finished", sink->ctx, pos->fd);
+            sink->ops.close(pos);
+        } else {
+            LOG_TRACE("[%p:read] #%d packet in", sink->ctx, pos->fd);
+            stream_rx_append(pos, buf, nread);
+            stream_mark_rx(pos);
+            pos->ev.bits.pollin = 1;
+        }
+    }
+
+    return 0;
+}
+
+static struct sink_operations pipe_ops = {
+    .open = pipe_open,
+    .close = pipe_close,
+    .accept = NULL,
+    .ioctl = NULL,
+    .send = pipe_send,
+    .recv = pipe_recv,
+    .poll = pipe_poll,
+    .flush = posix_flush,
+};
+
+#ifndef __APPLE__
+
+/**
+ * com
+ */
+
+static struct stream *com_open(struct sink *sink, const char *addr)
+{
+    int fd = open(addr, O_RDWR | O_NOCTTY | O_NDELAY);
+    if (fd == -1)
+        return NULL;
+
+    if (posix_fds_set(sink, fd) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    struct stream *stream = posix_stream_new(sink, fd);
+    if (stream == NULL)
+        return NULL;
+    stream_set_addr(stream, addr);
+
+    return stream;
+}
+
+/*
+ * termios2 of the asm-generic layout, glibc's termios.h clashes with
+ * asm/termbits.h which has the real one
+ */
+#if defined __linux__ && defined TCGETS2 && \
+    (defined __x86_64__ || defined __i386__ || defined __arm__ || \
+     defined __aarch64__ || defined __riscv)
+#define COM_TERMIOS2
+struct termios2 {
+    tcflag_t c_iflag;
+    tcflag_t c_oflag;
+    tcflag_t c_cflag;
+    tcflag_t c_lflag;
+    cc_t c_line;
+    cc_t c_cc[19];
+    speed_t c_ispeed;
+    speed_t c_ospeed;
+};
+#ifndef BOTHER
+#define BOTHER 0010000
+#endif
+#ifndef IBSHIFT
+#define IBSHIFT 16
+#endif
+#endif
+
+#define COM_READ_SIZE 4096
+#define COM_READ_MAX (64 * 1024) /* per stream & poll pass */
+
+static const struct {
+    u32 baud;
+    speed_t speed;
+} com_speeds[] = {
+    { 1200, B1200 }, { 2400, B2400 }, { 4800, B4800 }, { 9600, B9600 },
+    { 19200, B19200 }, { 38400, B38400 }, { 57600, B57600 },
+    { 115200, B115200 }, { 230400, B230400 },
+#ifdef B460800
+    { 460800, B460800 }, { 921600, B921600 }, { 1000000, B1000000 },
+    { 1500000, B1500000 }, { 2000000, B2000000 }, { 3000000, B3000000 },
+    { 4000000, B4000000 },
+#endif
+};
+
+static speed_t com_speed(u32 baud)
+{
+    for (u32 i = 0; i < sizeof(com_speeds) / sizeof(com_speeds[0]); i++) {
+        if (com_speeds[i].baud == baud)
+            return com_speeds[i].speed;
+    }
+    return B0;
+}
+
+static int com_set_baud_other(int fd, u32 baud)
+{
+#ifdef COM_TERMIOS2
+    struct termios2 tio;
+    if (ioctl(fd, TCGETS2, &tio) != 0)
+        return -1;
+    tio.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+    tio.c_cflag |= BOTHER | (BOTHER << IBSHIFT);
+    tio.c_ispeed = baud;
+    tio.c_ospeed = baud;
+    return ioctl(fd, TCSETS2, &tio);
+#else
+    UNUSED(fd);
+    UNUSED(baud);
+    return -1;
+#endif
+}
+
+static void com_set_low_latency(struct stream *stream)
+{
+#ifdef ASYNC_LOW_LATENCY
+    struct serial_struct ss;
+    if (ioctl(stream->fd, TIOCGSERIAL, &ss) == 0) {
+        ss.flags |= ASYNC_LOW_LATENCY;
+        if (ioctl(stream->fd, TIOCSSERIAL, &ss) == 0)
+            return;
+    }
+    LOG_DEBUG("[%p:com_ioctl] #%d ASYNC_LOW_LATENCY %s(%d)",
+              stream->ctx, stream->fd, strerror(errno), errno);
+#else
+    UNUSED(stream);
+#endif
+}
+
+static int
+com_ioctl(struct stream *stream, unsigned int cmd, unsigned long arg)
+{
+    UNUSED(cmd);
+    struct ioctl_com_param *sp = (struct ioctl_com_param *)arg;
+    struct termios newtio, oldtio;
+
+    if (tcgetattr(stream->fd, &oldtio) != 0)
+        return -1;
+
+    bzero(&newtio, sizeof(newtio));
+    newtio.c_cflag |= (CLOCAL | CREAD);
+    newtio.c_cflag &= ~CSIZE;
+
+    if (sp->baud == 0)
+        return -1;
+    // B38400 holds the place of a rate without constant until termios2
+    speed_t speed = com_speed(sp->baud);
+    cfsetispeed(&newtio, speed == B0 ? B38400 : speed);
+    cfsetospeed(&newtio, speed == B0 ? B38400 : speed);
+    if (sp->bits == COM_ARG_BITS_7) {
+        newtio.c_cflag |= CS7;
+    } else if (sp->bits == COM_ARG_BITS_8) {
+        newtio.c_cflag |= CS8;
+    } else {
         return -1;
     }
     if (sp->parity == COM_ARG_PARITY_O) {
         newtio.c_cflag |= PARENB;
         newtio.c_cflag |= PARODD;
-        newtio.c_cflag |= (INPCK | ISTRIP);
+        newtio.c_iflag |= (INPCK | ISTRIP);
     } else if (sp->parity == COM_ARG_PARITY_E) {
         newtio.c_cflag |= PARENB;
         newtio.c_cflag &= ~PARODD;
-        newtio.c_cflag |= (INPCK | ISTRIP);
+        newtio.c_iflag |= (INPCK | ISTRIP);
     } else if (sp->parity == COM_ARG_PARITY_N) {
         newtio.c_cflag &= ~PARENB;
     } else {
@@ -469,6 +1140,11 @@ com_ioctl(struct stream *stream, unsigned int cmd, unsigned long arg)
     } else {
         return -1;
     }
+    if (sp->flow == COM_ARG_FLOW_RTSCTS) {
+        newtio.c_cflag |= CRTSCTS;
+    } else if (sp->flow != COM_ARG_FLOW_NONE) {
+        return -1;
+    }
 
     newtio.c_cc[VTIME] = 0;
     newtio.c_cc[VMIN] = 0;
@@ -476,6 +1152,15 @@ com_ioctl(struct stream *stream, unsigned int cmd, unsigned long arg)
 
     if (tcsetattr(stream->fd, TCSANOW, &newtio) != 0)
         return -1;
+    if (speed == B0 && com_set_baud_other(stream->fd, sp->baud) != 0) {
+        LOG_ERROR("[%p:com_ioctl] #%d baud %u %s(%d)", stream->ctx,
+                  stream->fd, sp->baud, strerror(errno), errno);
+        return -1;
+    }
+
+    if (sp->low_latency)
+        com_set_low_latency(stream);
+    stream->rx_gap_usec = sp->gap_usec;
 
     return 0;
 }
@@ -490,6 +1175,48 @@ static int com_recv(struct stream *stream, u8 *buf, u32 len)
     return read(stream->fd, buf, len);
 }
 
+/*
+ * Read into rxbuf until the fd is drained, so a burst arrives in one pass
+ * instead of a few bytes per syscall.
+ */
+static int com_read(struct stream *stream)
+{
+    u8 buf[COM_READ_SIZE];
+    int total = 0;
+
+    while (total < COM_READ_MAX) {
+        int nread = read(stream->fd, buf, sizeof(buf));
+        PROBE2(apix, sink_read, stream->fd, nread);
+        if (nread <= 0) {
+            if (total == 0)
+                return nread;
+            break;
+        }
+        stream_rx_append(stream, buf, nread);
+        total += nread;
+    }
+
+    return total;
+}
+
+/*
+ * With rx_gap_usec, a frame is held in rxbuf until the line stayed idle that
+ * long, apix_idle wakes up in time for it, see clamp_to_deadlines in apix.c.
+ */
+static void com_rx_gap(struct stream *stream)
+{
+    struct timeval now, elapsed;
+    gettimeofday(&now, NULL);
+    timersub(&now, &stream->rx_gap_ts, &elapsed);
+    if ((u64)elapsed.tv_sec * 1000000 + elapsed.tv_usec < stream->rx_gap_usec &&
+        stream_rx_size(stream) < COM_READ_MAX)
+        return;
+
+    timerclear(&stream->rx_gap_ts);
+    stream_mark_rx(stream);
+    stream->ev.bits.pollin = 1;
+}
+
 static int com_poll(struct sink *sink)
 {
     struct posix_sink *ps = container_of(sink, struct posix_sink, sink);
@@ -508,25 +1235,29 @@ static int com_poll(struct sink *sink)
 
     struct stream *pos, *n;
     list_for_each_entry_safe(pos, n, &sink->streams, ln_sink) {
-        if (nr_recv_fds == 0) break;
-
-        if (!FD_ISSET(pos->fd, &recvfds))
+        if (nr_recv_fds == 0 || !FD_ISSET(pos->fd, &recvfds)) {
+            if (timerisset(&pos->rx_gap_ts))
+                com_rx_gap(pos);
             continue;
+        }
 
         nr_recv_fds--;
 
-        char buf[1024] = {0};
-        int nread = read(pos->fd, buf, sizeof(buf));
-        if (nread == -1) {
+        int nread = com_read(pos);
+        if (nread == -1 && errno == EAGAIN) {
+            continue;
+        } else if (nread == -1) {
             LOG_DEBUG("[%p:read] #%d %s(%d)", sink->ctx, pos->fd, strerror(errno), errno);
             sink->ops.close(pos);
         } else if (nread == 0) {
             LOG_DEBUG("[%p:read] #%d finished", sink->ctx, pos->fd);
             sink->ops.close(pos);
+        } else if (pos->rx_gap_usec) {
+            gettimeofday(&pos->rx_gap_ts, NULL);
+            com_rx_gap(pos);
         } else {
             LOG_TRACE("[%p:read] #%d packet in", sink->ctx, pos->fd);
-            vpack(pos->rxbuf, buf, nread);
-            gettimeofday(&pos->ts_poll_recv, NULL);
+            stream_mark_rx(pos);
             pos->ev.bits.pollin = 1;
         }
     }
@@ -542,6 +1273,7 @@ static struct sink_operations com_ops = {
     .send = com_send,
     .recv = com_recv,
     .poll = com_poll,
+    .flush = file_flush,
 };
 
 /**
@@ -568,21 +1300,162 @@ static struct stream *can_open(struct sink *sink, const char *addr)
         return NULL;
     }
 
-    struct stream *stream = stream_new(sink);
-    stream->fd = fd;
-    stream->type = STREAM_T_CONNECT;
-    snprintf(stream->addr, sizeof(stream->addr), "%s", addr);
+    if (posix_fds_set(sink, fd) != 0) {
+        close(fd);
+        return NULL;
+    }
 
-    struct posix_sink *tcp_c_sink = container_of(sink, struct posix_sink, sink);
-    FD_SET(fd, &tcp_c_sink->fds);
-    tcp_c_sink->nfds = fd + 1;
+    struct stream *stream = posix_stream_new(sink, fd);
+    if (stream == NULL)
+        return NULL;
+    stream->type = STREAM_T_CONNECT;
+    stream_set_addr(stream, addr);
 
     return stream;
 }
 
+/*
+ * isotp of a can stream, set by apix_ioctl(CAN_ARG_ISOTP), streams without
+ * it carry raw struct can_frame as before
+ */
+struct can_link {
+    struct isotp *tp;
+    canid_t tx_id;
+    u8 fd; /* CAN FD frames */
+};
+
+#define CAN_READ_BATCH 32 /* frames per recvmmsg */
+#define CAN_TX_RETRY (1000) /* usec, a full can tx queue doesn't signal room */
+
+static u64 can_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static int can_close(struct stream *stream)
+{
+    if (stream->can) {
+        isotp_free(stream->can->tp);
+        mem_free(stream->can);
+        stream->can = NULL;
+        timerclear(&stream->due_ts);
+    }
+    return __fd_close(stream);
+}
+
+static int
+can_ioctl(struct stream *stream, unsigned int cmd, unsigned long arg)
+{
+    struct ioctl_can_isotp_param *ip = (struct ioctl_can_isotp_param *)arg;
+    if (cmd != CAN_ARG_ISOTP)
+        return -1;
+
+    struct can_filter filter = { .can_id = ip->rx_id };
+    filter.can_mask = (ip->rx_id & CAN_EFF_FLAG) ?
+        (CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_EFF_MASK) :
+        (CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_SFF_MASK);
+    if (setsockopt(stream->fd, SOL_CAN_RAW, CAN_RAW_FILTER,
+                   &filter, sizeof(filter)) != 0)
+        return -1;
+
+    int enable = ip->fd ? 1 : 0;
+    if (setsockopt(stream->fd, SOL_CAN_RAW, CAN_RAW_FD_FRAMES,
+                   &enable, sizeof(enable)) != 0) {
+        LOG_ERROR("[%p:can_ioctl] #%d CAN_RAW_FD_FRAMES %s(%d)",
+                  stream->ctx, stream->fd, strerror(errno), errno);
+        return -1;
+    }
+
+    struct can_link *can = mem_calloc(1, sizeof(*can));
+    if (can == NULL)
+        return -1;
+    can->tp = isotp_new(ip->fd ? ISOTP_FRAME_CANFD : ISOTP_FRAME_CAN);
+    if (can->tp == NULL) {
+        mem_free(can);
+        return -1;
+    }
+    isotp_set_flow(can->tp, ip->block_size, ip->st_min);
+    can->tx_id = ip->tx_id;
+    can->fd = ip->fd ? 1 : 0;
+
+    if (stream->can) {
+        isotp_free(stream->can->tp);
+        mem_free(stream->can);
+    }
+    stream->can = can;
+    return 0;
+}
+
+/* Set due_ts to the monotonic usec next, so apix_idle wakes up for it. */
+static void can_set_due(struct stream *stream, u64 now, u64 next)
+{
+    if (next == ISOTP_NEVER) {
+        timerclear(&stream->due_ts);
+        return;
+    }
+
+    u64 left = next > now ? next - now : 0;
+    struct timeval tv = { left / 1000000, left % 1000000 };
+    gettimeofday(&stream->due_ts, NULL);
+    timeradd(&stream->due_ts, &tv, &stream->due_ts);
+}
+
+/*
+ * Put the frames isotp has due on the bus, flow control of the receiving
+ * side first, consecutive frames as STmin of the peer allows. A frame the
+ * socket has no room for, ENOBUFS or EAGAIN, is put back and retried after
+ * CAN_TX_RETRY.
+ * - due_ts is left at the time isotp has work next
+ */
+static void can_pump(struct stream *stream)
+{
+    struct can_link *can = stream->can;
+    struct canfd_frame frame;
+    u64 next = ISOTP_NEVER;
+    int len;
+
+    while ((len = isotp_poll_frame(can->tp, can_now(), frame.data)) != 0) {
+        if (len == -1) {
+            LOG_DEBUG("[%p:can_pump] #%d isotp message dropped by peer",
+                      stream->ctx, stream->fd);
+            continue;
+        }
+        frame.can_id = can->tx_id;
+        frame.len = len;
+        frame.flags = 0;
+        ssize_t nr = write(stream->fd, &frame, can->fd ? CANFD_MTU : CAN_MTU);
+        PROBE3(apix, sink_write, stream->fd, len, nr);
+        if (nr == -1) {
+            LOG_DEBUG("[%p:write] #%d %s(%d)",
+                      stream->ctx, stream->fd, strerror(errno), errno);
+            isotp_unpoll_frame(can->tp);
+            next = can_now() + CAN_TX_RETRY;
+            break;
+        }
+    }
+
+    u64 now = can_now();
+    if (next == ISOTP_NEVER)
+        next = isotp_next_deadline(can->tp);
+    can_set_due(stream, now, next);
+}
+
 static int can_send(struct stream *stream, const u8 *buf, u32 len)
 {
-    return write(stream->fd, buf, len);
+    if (stream->can == NULL)
+        return write(stream->fd, buf, len);
+
+    // one isotp message at a time, the rest stays in txbuf
+    if (isotp_tx_busy(stream->can->tp))
+        return 0;
+    if (len > ISOTP_MSG_MAX)
+        len = ISOTP_MSG_MAX;
+    if (isotp_send(stream->can->tp, buf, len) != 0)
+        return -1;
+    can_pump(stream);
+    return len;
 }
 
 static int can_recv(struct stream *stream, u8 *buf, u32 len)
@@ -590,6 +1463,28 @@ static int can_recv(struct stream *stream, u8 *buf, u32 len)
     return read(stream->fd, buf, len);
 }
 
+static void can_frame_in(struct stream *stream, struct canfd_frame *frame, int size)
+{
+    if (stream->can == NULL) {
+        stream_rx_append(stream, frame, sizeof(struct can_frame));
+        stream->ev.bits.pollin = 1;
+        return;
+    }
+
+    u32 len = 0;
+    u8 max = size == CANFD_MTU ? CANFD_MAX_DLEN : CAN_MAX_DLEN;
+    int rc = isotp_recv_frame(stream->can->tp, can_now(), frame->data,
+                              frame->len < max ? frame->len : max);
+    if (rc == 1) {
+        const u8 *msg = isotp_rx_msg(stream->can->tp, &len);
+        stream_rx_append(stream, msg, len);
+        stream->ev.bits.pollin = 1;
+    } else if (rc == -1) {
+        LOG_DEBUG("[%p:can_frame_in] #%d isotp frame %02x dropped",
+                  stream->ctx, stream->fd, frame->data[0]);
+    }
+}
+
 static int can_poll(struct sink *sink)
 {
     struct posix_sink *ps = container_of(sink, struct posix_sink, sink);
@@ -606,6 +1501,10 @@ static int can_poll(struct sink *sink)
         return -1;
     }
 
+    struct canfd_frame frames[CAN_READ_BATCH];
+    struct iovec iovs[CAN_READ_BATCH];
+    struct mmsghdr msgs[CAN_READ_BATCH];
+
     struct stream *pos, *n;
     list_for_each_entry_safe(pos, n, &sink->streams, ln_sink) {
         if (nr_recv_fds == 0) break;
@@ -615,79 +1514,357 @@ static int can_poll(struct sink *sink)
 
         nr_recv_fds--;
 
-        struct can_frame frame = {0};
-        int nread = read(pos->fd, &frame, sizeof(struct can_frame));
-        if (nread == -1) {
-            LOG_DEBUG("[%p:read] #%d %s(%d)", sink->ctx, pos->fd, strerror(errno), errno);
+        for (int i = 0; i < CAN_READ_BATCH; i++) {
+            iovs[i] = (struct iovec){ &frames[i], sizeof(frames[i]) };
+            msgs[i] = (struct mmsghdr){ .msg_hdr = { .msg_iov = &iovs[i], .msg_iovlen = 1 } };
+        }
+        int nr = recvmmsg(pos->fd, msgs, CAN_READ_BATCH, MSG_DONTWAIT, NULL);
+        PROBE2(apix, sink_read, pos->fd, nr);
+        if (nr == -1 && (errno == EAGAIN || errno == EINTR)) {
+            continue;
+        } else if (nr == -1) {
+            LOG_DEBUG("[%p:recvmmsg] #%d %s(%d)", sink->ctx, pos->fd, strerror(errno), errno);
             sink->ops.close(pos);
-        } else if (nread == 0) {
-            LOG_DEBUG("[%p:read] #%d finished", sink->ctx, pos->fd);
+        } else if (nr == 0) {
+            LOG_DEBUG("[%p:recvmmsg] #%d finished", sink->ctx, pos->fd);
             sink->ops.close(pos);
         } else {
-            LOG_TRACE("[%p:read] #%d packet in", sink->ctx, pos->fd);
-            vpack(pos->rxbuf, &frame, sizeof(struct can_frame));
-            gettimeofday(&pos->ts_poll_recv, NULL);
-            pos->ev.bits.pollin = 1;
+            LOG_TRACE("[%p:recvmmsg] #%d %d frames in", sink->ctx, pos->fd, nr);
+            for (int i = 0; i < nr; i++)
+                can_frame_in(pos, &frames[i], msgs[i].msg_len);
+            if (pos->ev.bits.pollin)
+                stream_mark_rx(pos);
+            // flow control answers go out in the same pass
+            if (pos->can)
+                can_pump(pos);
         }
     }
 
     return 0;
 }
 
+static int can_flush(struct sink *sink)
+{
+    file_flush(sink);
+
+    struct stream *pos;
+    list_for_each_entry(pos, &sink->streams, ln_sink) {
+        if (pos->can)
+            can_pump(pos);
+    }
+    return 0;
+}
+
 static struct sink_operations can_ops = {
     .open = can_open,
-    .close = __fd_close,
+    .close = can_close,
     .accept = NULL,
-    .ioctl = NULL,
+    .ioctl = can_ioctl,
     .send = can_send,
     .recv = can_recv,
     .poll = can_poll,
+    .flush = can_flush,
 };
 
 #endif
 
+/**
+ * io_uring sinks
+ * - unix & tcp sockets opened as above, but received, accepted and sent
+ *   through the ring of apix-uring.c
+ */
+
+static struct stream *__uring_open(struct stream *stream)
+{
+    if (stream && uring_attach(stream) != 0) {
+        __fd_close(stream);
+        return NULL;
+    }
+    return stream;
+}
+
+static struct stream *uring_unix_s_open(struct sink *sink, const char *addr)
+{
+    return __uring_open(unix_s_open(sink, addr));
+}
+
+static struct stream *uring_unix_c_open(struct sink *sink, const char *addr)
+{
+    return __uring_open(unix_c_open(sink, addr));
+}
+
+static struct stream *uring_tcp_s_open(struct sink *sink, const char *addr)
+{
+    return __uring_open(tcp_s_open(sink, addr));
+}
+
+static struct stream *uring_tcp_c_open(struct sink *sink, const char *addr)
+{
+    return __uring_open(tcp_c_open(sink, addr));
+}
+
+static int uring_close(struct stream *stream)
+{
+    uring_detach(stream);
+    return unix_s_close(stream);
+}
+
+static struct stream *uring_s_accept(struct stream *stream)
+{
+    int newfd = uring_accept(stream);
+    if (newfd == -1)
+        return NULL;
+    return __uring_open(__accept_stream(stream, newfd));
+}
+
+static int __uring_flush(struct sink *sink)
+{
+    file_flush(sink);
+    return uring_flush(sink);
+}
+
+static struct sink_operations uring_unix_s_ops = {
+    .open = uring_unix_s_open,
+    .close = uring_close,
+    .accept = uring_s_accept,
+    .ioctl = NULL,
+    .send = uring_send,
+    .recv = unix_s_recv,
+    .poll = uring_poll,
+    .flush = __uring_flush,
+};
+
+static struct sink_operations uring_unix_c_ops = {
+    .open = uring_unix_c_open,
+    .close = uring_close,
+    .accept = NULL,
+    .ioctl = NULL,
+    .send = uring_send,
+    .recv = unix_c_recv,
+    .poll = uring_poll,
+    .flush = __uring_flush,
+};
+
+static struct sink_operations uring_tcp_s_ops = {
+    .open = uring_tcp_s_open,
+    .close = uring_close,
+    .accept = uring_s_accept,
+    .ioctl = NULL,
+    .send = uring_send,
+    .recv = unix_s_recv,
+    .poll = uring_poll,
+    .flush = __uring_flush,
+};
+
+static struct sink_operations uring_tcp_c_ops = {
+    .open = uring_tcp_c_open,
+    .close = uring_close,
+    .accept = NULL,
+    .ioctl = NULL,
+    .send = uring_send,
+    .recv = unix_c_recv,
+    .poll = uring_poll,
+    .flush = __uring_flush,
+};
+
+/**
+ * apix_relay
+ */
+
+static int relay_capable(struct stream *stream)
+{
+    struct posix_sink *ps = container_of(stream->sink, struct posix_sink, sink);
+    const char *id = stream->sink->id;
+    return !ps->uring && stream->type != STREAM_T_LISTEN &&
+        (strcmp(id, SINK_UNIX_S) == 0 || strcmp(id, SINK_UNIX_C) == 0 ||
+         strcmp(id, SINK_TCP_S) == 0 || strcmp(id, SINK_TCP_C) == 0 ||
+         strcmp(id, SINK_PIPE) == 0);
+}
+
+int apix_relay(struct stream *src, struct stream *dst)
+{
+#ifdef __linux__
+    if (dst && (dst == src || dst->relay_src ||
+                !relay_capable(src) || !relay_capable(dst)))
+        return -1;
+
+    if (src->relay_dst) {
+        src->relay_dst->relay_src = NULL;
+        src->relay_dst = NULL;
+        relay_unpark(src);
+    }
+    if (dst == NULL)
+        return 0;
+
+    // splice needs a pipe on one side, else bytes go through our own
+    if (!is_fifo(src->fd) && !is_fifo(stream_tx_fd(dst)) &&
+        src->relay_pipe[0] == -1 && pipe2(src->relay_pipe, O_CLOEXEC) != 0) {
+        src->relay_pipe[0] = src->relay_pipe[1] = -1;
+        return -1;
+    }
+
+    // bytes already read keep their order in front of the spliced ones
+    if (stream_rx_size(src)) {
+        if (stream_tx_append(dst, vraw(src->rxbuf), vsize(src->rxbuf)) != 0)
+            return -1;
+        vdrop(src->rxbuf, vsize(src->rxbuf));
+    }
+
+    src->relay_dst = dst;
+    dst->relay_src = src;
+    return 0;
+#else
+    UNUSED(src);
+    UNUSED(dst);
+    return -1;
+#endif
+}
+
+/**
+ * apix_srrp_send_file
+ */
+
+static int __send_file(struct stream *stream, struct srrp_packet *hdr,
+                       int fd, off_t offset, size_t len)
+{
+    if (stream->tx_file || stream->cut_src)
+        return -1;
+
+    struct file_tx *tx = mem_calloc(1, sizeof(*tx));
+    if (tx == NULL)
+        return -1;
+    tx->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    tx->offset = offset;
+    tx->len = len;
+#ifdef __linux__
+    tx->direct = relay_capable(stream) && !stream->relay_src;
+#endif
+    tx->hdr = srrp_new_slice(hdr, SRRP_FIN_0, 0, 0, SRRP_INTEGRITY_NONE);
+    tx->head = vec_new(1, 256);
+    tx->tail = vec_new(1, 16);
+    if (tx->fd == -1 || tx->hdr == NULL || tx->head == NULL || tx->tail == NULL)
+        goto err;
+
+    // map from the page holding offset, the crcs are taken over the pages
+    if (len) {
+        tx->delta = offset % sysconf(_SC_PAGESIZE);
+        tx->map_len = len + tx->delta;
+        tx->map = mmap(NULL, tx->map_len, PROT_READ, MAP_SHARED,
+                       fd, offset - tx->delta);
+        if (tx->map == MAP_FAILED) {
+            LOG_ERROR("[%p:apix_srrp_send_file] mmap: %s",
+                      stream->ctx, strerror(errno));
+            tx->map = NULL;
+            goto err;
+        }
+    }
+
+    // the first slice fails here, the rest are alike
+    if (srrp_frame_slice(tx->hdr, len > FILE_SLICE_LIMIT ? SRRP_FIN_0 : SRRP_FIN_1,
+                         tx->map ? tx->map + tx->delta : NULL,
+                         len > FILE_SLICE_LIMIT ? FILE_SLICE_LIMIT : len,
+                         stream->tx_integrity, tx->head, tx->tail) != 0)
+        goto err;
+    vdrop(tx->tail, vsize(tx->tail));
+
+    stream->tx_file = tx;
+    file_pump(stream);
+    return 0;
+
+err:
+    file_tx_free(tx);
+    return -1;
+}
+
+int apix_srrp_send_file(struct stream *stream, struct srrp_packet *hdr,
+                        int fd, off_t offset, size_t len)
+{
+    if (offset < 0)
+        return -1;
+
+    int retval = -1;
+
+    // send to src stream
+    if (stream->type != STREAM_T_LISTEN &&
+        __send_file(stream, hdr, fd, offset, len) == 0)
+        retval = 0;
+
+    // send to nodeid
+    if (srrp_get_dstid(hdr) != 0) {
+        struct stream *nd_stream =
+            find_stream_by_r_nodeid(stream->ctx, srrp_get_dstid_atom(hdr));
+        if (nd_stream && nd_stream != stream &&
+            __send_file(nd_stream, hdr, fd, offset, len) == 0)
+            retval = 0;
+    }
+
+    return retval;
+}
+
+int apix_srrp_recv_file(struct stream *stream, const char *anchor, int fd)
+{
+    if (stream->type == STREAM_T_LISTEN || stream->rx_file_head)
+        return -1;
+
+    atom_put(stream->rx_file_anchor);
+    stream->rx_file_anchor = NULL;
+    stream->rx_file_fd = -1;
+    stream->rx_file_errno = 0;
+    if (fd == -1)
+        return 0;
+
+    if (anchor == NULL)
+        return -1;
+    stream->rx_file_anchor = atom_new(anchor);
+    stream->rx_file_fd = fd;
+    return 0;
+}
+
 /**
  * posix_sink
  */
 
+static void posix_sink_register(
+    struct apix *ctx, const char *id, const struct sink_operations *ops, int uring)
+{
+    struct posix_sink *ps = mem_calloc(1, sizeof(struct posix_sink));
+    FD_ZERO(&ps->fds);
+    ps->uring = uring;
+    sink_init(&ps->sink, id, ops);
+    apix_sink_register(ctx, &ps->sink);
+}
+
 int apix_enable_posix(struct apix *ctx)
 {
-    // unix_s
-    struct posix_sink *unix_s_sink = calloc(1, sizeof(struct posix_sink));
-    FD_ZERO(&unix_s_sink->fds);
-    sink_init(&unix_s_sink->sink, SINK_UNIX_S, &unix_s_ops);
-    apix_sink_register(ctx, &unix_s_sink->sink);
-
-    // unix_c
-    struct posix_sink *unix_c_sink = calloc(1, sizeof(struct posix_sink));
-    FD_ZERO(&unix_c_sink->fds);
-    sink_init(&unix_c_sink->sink, SINK_UNIX_C, &unix_c_ops);
-    apix_sink_register(ctx, &unix_c_sink->sink);
-
-    // tcp_s
-    struct posix_sink *tcp_s_sink = calloc(1, sizeof(struct posix_sink));
-    FD_ZERO(&tcp_s_sink->fds);
-    sink_init(&tcp_s_sink->sink, SINK_TCP_S, &tcp_s_ops);
-    apix_sink_register(ctx, &tcp_s_sink->sink);
-
-    // tcp_c
-    struct posix_sink *tcp_c_sink = calloc(1, sizeof(struct posix_sink));
-    FD_ZERO(&tcp_c_sink->fds);
-    sink_init(&tcp_c_sink->sink, SINK_TCP_C, &tcp_c_ops);
-    apix_sink_register(ctx, &tcp_c_sink->sink);
+    posix_sink_register(ctx, SINK_UNIX_S, &unix_s_ops, 0);
+    posix_sink_register(ctx, SINK_UNIX_C, &unix_c_ops, 0);
+    posix_sink_register(ctx, SINK_TCP_S, &tcp_s_ops, 0);
+    posix_sink_register(ctx, SINK_TCP_C, &tcp_c_ops, 0);
+    posix_sink_register(ctx, SINK_PIPE, &pipe_ops, 0);
+#ifndef __APPLE__
+    posix_sink_register(ctx, SINK_COM, &com_ops, 0);
+    posix_sink_register(ctx, SINK_CAN, &can_ops, 0);
+#endif
 
+    return 0;
+}
+
+int apix_enable_posix_uring(struct apix *ctx)
+{
+    if (uring_new(ctx) != 0) {
+        LOG_INFO("[%p:apix_enable_posix_uring] fall back to select", ctx);
+        apix_enable_posix(ctx);
+        return 1;
+    }
+
+    posix_sink_register(ctx, SINK_UNIX_S, &uring_unix_s_ops, 1);
+    posix_sink_register(ctx, SINK_UNIX_C, &uring_unix_c_ops, 1);
+    posix_sink_register(ctx, SINK_TCP_S, &uring_tcp_s_ops, 1);
+    posix_sink_register(ctx, SINK_TCP_C, &uring_tcp_c_ops, 1);
+    posix_sink_register(ctx, SINK_PIPE, &pipe_ops, 0);
 #ifndef __APPLE__
-    // com
-    struct posix_sink *com_sink = calloc(1, sizeof(struct posix_sink));
-    FD_ZERO(&com_sink->fds);
-    sink_init(&com_sink->sink, SINK_COM, &com_ops);
-    apix_sink_register(ctx, &com_sink->sink);
-
-    // can
-    struct posix_sink *can_sink = calloc(1, sizeof(struct posix_sink));
-    FD_ZERO(&can_sink->fds);
-    sink_init(&can_sink->sink, SINK_CAN, &can_ops);
-    apix_sink_register(ctx, &can_sink->sink);
+    posix_sink_register(ctx, SINK_COM, &com_ops, 0);
+    posix_sink_register(ctx, SINK_CAN, &can_ops, 0);
 #endif
 
     return 0;
@@ -703,7 +1880,7 @@ void apix_disable_posix(struct apix *ctx)
                 container_of(pos, struct posix_sink, sink);
             apix_sink_unregister(ctx, &unix_s_sink->sink);
             sink_fini(&unix_s_sink->sink);
-            free(unix_s_sink);
+            mem_free(unix_s_sink);
         }
 
         // unix_c
@@ -712,7 +1889,7 @@ void apix_disable_posix(struct apix *ctx)
                 container_of(pos, struct posix_sink, sink);
             apix_sink_unregister(ctx, &unix_c_sink->sink);
             sink_fini(&unix_c_sink->sink);
-            free(unix_c_sink);
+            mem_free(unix_c_sink);
         }
 
         // tcp_s
@@ -721,7 +1898,7 @@ void apix_disable_posix(struct apix *ctx)
                 container_of(pos, struct posix_sink, sink);
             apix_sink_unregister(ctx, &tcp_s_sink->sink);
             sink_fini(&tcp_s_sink->sink);
-            free(tcp_s_sink);
+            mem_free(tcp_s_sink);
         }
 
         // tcp_c
@@ -730,7 +1907,16 @@ void apix_disable_posix(struct apix *ctx)
                 container_of(pos, struct posix_sink, sink);
             apix_sink_unregister(ctx, &tcp_c_sink->sink);
             sink_fini(&tcp_c_sink->sink);
-            free(tcp_c_sink);
+            mem_free(tcp_c_sink);
+        }
+
+        // pipe
+        if (strcmp(pos->id, SINK_PIPE) == 0) {
+            struct posix_sink *pipe_sink =
+                container_of(pos, struct posix_sink, sink);
+            apix_sink_unregister(ctx, &pipe_sink->sink);
+            sink_fini(&pipe_sink->sink);
+            mem_free(pipe_sink);
         }
 
 #ifndef __APPLE__
@@ -740,7 +1926,7 @@ void apix_disable_posix(struct apix *ctx)
                 container_of(pos, struct posix_sink, sink);
             apix_sink_unregister(ctx, &com_sink->sink);
             sink_fini(&com_sink->sink);
-            free(com_sink);
+            mem_free(com_sink);
         }
 
         // can
@@ -749,7 +1935,7 @@ void apix_disable_posix(struct apix *ctx)
                 container_of(pos, struct posix_sink, sink);
             apix_sink_unregister(ctx, &can_sink->sink);
             sink_fini(&can_sink->sink);
-            free(can_sink);
+            mem_free(can_sink);
         }
 #endif
     }
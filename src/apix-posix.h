@@ -3,6 +3,7 @@
 
 #if defined __unix__ || __APPLE__
 
+#include <sys/types.h>
 #include "types.h"
 
 #ifdef __cplusplus
@@ -33,14 +34,48 @@ extern "C" {
 #define COM_ARG_PARITY_N 'N'
 #define COM_ARG_STOP_1 1
 #define COM_ARG_STOP_2 2
+#define COM_ARG_FLOW_NONE 0
+#define COM_ARG_FLOW_RTSCTS 1
+#define CAN_ARG_ISOTP 1 /* cmd of apix_ioctl on a can stream */
 
 struct apix;
+struct stream;
+struct srrp_packet;
 
+/**
+ * ioctl_com_param
+ * - baud is any rate the uart takes, e.g. 3000000, rates without a Bxxx
+ *   constant are set by termios2 & BOTHER on linux
+ * - gap_usec, a read keeps collecting bytes until the line is idle this long,
+ *   so a frame reaches the parser in one piece, 0 => take what is there
+ * - low_latency asks the driver for ASYNC_LOW_LATENCY, ignored if it can't
+ */
 struct ioctl_com_param {
     u32 baud;
     char bits;
     char parity;
     char stop;
+    char flow; /* COM_ARG_FLOW_* */
+    u32 gap_usec;
+    char low_latency;
+};
+
+/**
+ * ioctl_can_isotp_param
+ * - run the can stream over ISO 15765-2, so srrp mode works on it: the
+ *   stream is segmented into isotp messages sent as tx_id, frames of rx_id
+ *   are reassembled, all other ids are filtered out
+ * - ids with CAN_EFF_FLAG are 29 bit
+ * - fd => 64 byte CAN FD frames, the interface must have CAN FD enabled
+ * - block_size & st_min are asked of the peer in flow control, st_min is
+ *   honoured at the granularity of apix_poll passes
+ */
+struct ioctl_can_isotp_param {
+    u32 tx_id;
+    u32 rx_id;
+    u8 fd;
+    u8 block_size;
+    u8 st_min;
 };
 
 #define apix_open_unix_server(ctx, addr) apix_open(ctx, SINK_UNIX_S, addr)
@@ -49,10 +84,60 @@ struct ioctl_com_param {
 #define apix_open_tcp_client(ctx, addr) apix_open(ctx, SINK_TCP_C, addr)
 #define apix_open_com(ctx, addr) apix_open(ctx, SINK_COM, addr)
 #define apix_open_can(ctx, addr) apix_open(ctx, SINK_CAN, addr)
+#define apix_open_pipe(ctx, addr) apix_open(ctx, SINK_PIPE, addr)
 
 int apix_enable_posix(struct apix *ctx);
+
+/**
+ * apix_enable_posix_uring
+ * - same sinks as apix_enable_posix, but unix & tcp sockets are driven by one
+ *   io_uring: multishot accept & recv into a provided buffer ring, and all
+ *   sends of a poll pass submitted by a single io_uring_enter
+ * - apix_send never blocks on these sockets, data is queued until sent
+ * - fall back to apix_enable_posix and return 1 if the kernel lacks support
+ */
+int apix_enable_posix_uring(struct apix *ctx);
 void apix_disable_posix(struct apix *ctx);
 
+/**
+ * apix_relay
+ * - move every byte received on src to dst inside the kernel by splice, so
+ *   they never pass rxbuf & txbuf, src raises no AEC_POLLIN while relaying
+ * - src & dst are unix, tcp or pipe streams of apix_enable_posix, it's one
+ *   way, relay dst to src as well for both
+ * - dst NULL stops the relay, so does closing either end
+ */
+int apix_relay(struct stream *src, struct stream *dst);
+
+/**
+ * apix_srrp_send_file
+ * - send len bytes of fd from offset as the payload of hdr, in slices of up
+ *   to 60K, each framed & checked over the mmap'd pages of fd, so the file
+ *   is never read into a packet and may be over SRRP_PACKET_MAX
+ * - never blocks: a slice is framed each time tx of the stream drained,
+ *   inside apix_poll, sends made meanwhile are held until the last slice
+ * - on unix, tcp & pipe streams of apix_enable_posix, the payload goes out
+ *   by sendfile from the page cache, on others the slices are queued to
+ *   txbuf as apix_srrp_send does
+ * - fd must be mmap-able, a regular file, it may be closed after the call
+ * - return -1 if a file is being sent, or a cut through passes, on stream
+ * - peers need apix_srrp_recv_file, or cut through on a broker, to take
+ *   messages over SRRP_PACKET_MAX
+ */
+int apix_srrp_send_file(struct stream *stream, struct srrp_packet *hdr,
+                        int fd, off_t offset, size_t len);
+
+/**
+ * apix_srrp_recv_file
+ * - write the payload of the next message to anchor received on stream to
+ *   fd slice by slice, instead of reassembling it in memory
+ * - once its last slice is written, the message is raised as usual with the
+ *   header only, its payload empty, or the error text of a failed write
+ * - one message a call, fd -1 disarms, fd is left open
+ * - return -1 if a message is being written
+ */
+int apix_srrp_recv_file(struct stream *stream, const char *anchor, int fd);
+
 #ifdef __cplusplus
 }
 #endif
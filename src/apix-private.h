@@ -9,17 +9,29 @@
 #include "types.h"
 #include "list.h"
 #include "vec.h"
-#include "str.h"
+#include "atom.h"
+#include "mem.h"
 #include "srrp.h"
 
 #define SINK_ID_SIZE 64
-#define STREAM_ADDR_SIZE 64
+#ifdef APIX_STATIC_ALLOC
+#define STREAM_BUF_SIZE APIX_MAX_FRAME
+#define STREAM_BUF_MAX (2 * APIX_MAX_FRAME) /* a frame & the start of the next */
+#define STREAM_BUF_POOL_MAX 0 /* drained buffers go back to the byte pools */
+#else
+#define STREAM_BUF_SIZE 2048
+#define STREAM_BUF_POOL_MAX 64 /* per ctx */
+#endif
 
 #define STREAM_SYNC_TIMEOUT (1000 * 5) /*ms*/
 #define PARSE_PACKET_TIMEOUT 1000 /*ms*/
 #define APIX_IDLE_MAX (1 * 1000 * 1000) /*us*/
 
+#if defined APIX_STATIC_ALLOC && APIX_MAX_FRAME < 1400 + 512
+#define PAYLOAD_LIMIT (APIX_MAX_FRAME - 512) /* room for the head */
+#else
 #define PAYLOAD_LIMIT 1400
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -28,6 +40,42 @@ extern "C" {
 struct apix;
 struct sink;
 struct stream;
+struct message;
+struct work;
+struct workers;
+struct uring;
+struct can_link;
+
+/**
+ * post
+ * - request queued by apix_post_* from any thread, run in apix_poll
+ */
+
+enum post_type {
+    POST_T_SEND = 0,
+    POST_T_SRRP_SEND,
+    POST_T_CLOSE,
+    POST_T_RUN, /* run is called with arg */
+    POST_T_WORK, /* arg is a work done by workers */
+};
+
+struct post {
+    struct post *next;
+    int type; /* post_type */
+    struct stream *stream;
+    struct srrp_packet *pac;
+    const u8 *buf;
+    u32 len;
+    apix_post_func_t func;
+    apix_post_run_t run;
+    void *arg;
+};
+
+/*
+ * Queue the done work for workers_finish, called from worker threads.
+ * - return -1 if out of posts, the work is left to the caller to retry
+ */
+int post_work(struct apix *ctx, struct work *work);
 
 /**
  * apix
@@ -36,10 +84,31 @@ struct stream;
 struct apix {
     struct list_head streams;
     struct list_head sinks;
+    struct list_head calls;
+    u32 seqno;
+    struct post *post_head; /* producers push here */
+    struct post *post_tail; /* the polling thread pops here */
+    struct post post_stub;
+    struct workers *workers; /* NULL => handle requests inline */
+    struct uring *uring; /* io_uring of apix_enable_posix_uring */
+    int event_fd; /* wakeup of apix_idle & poll_fd, -1 => not supported */
+    int poll_fd; /* epoll of apix_get_poll_fd, -1 => not used */
+    int timer_fd;
     struct timeval poll_ts;
+    u64 poll_seq; /* of the apix_poll in progress */
     u8 poll_cnt;
     u64 idle_usec;
     u64 idle_usec_max;
+    u32 busy_poll_usec; /* 0 => sleep in apix_idle */
+    u32 sock_busy_poll_usec; /* SO_BUSY_POLL of tcp streams */
+    struct timeval busy_ts; /* start of the spin window */
+    struct pollfd *idle_pfds; /* of wait_ctx: event_fd, then rx, tx & relay dst by stream */
+    u32 nr_idle_pfds;
+    u32 idle_pfds_gen; /* streams_gen idle_pfds was built for */
+    u32 streams_gen; /* bumped when a stream is added or removed */
+    u32 stream_ids; /* last id given by stream_new */
+    vec_p_t *buf_pool; /* drained stream buffers */
+    int cut_through; /* forward slices as they arrive, see apix_set_cut_through */
 };
 
 /**
@@ -55,6 +124,8 @@ struct sink_operations {
     int (*send)(struct stream *stream, const u8 *buf, u32 len);
     int (*recv)(struct stream *stream, u8 *buf, u32 size);
     int (*poll)(struct sink *sink);
+    /* optional, called at the end of each apix_poll pass */
+    int (*flush)(struct sink *sink);
 };
 
 struct sink {
@@ -93,18 +164,13 @@ enum stream_state {
 };
 
 struct stream {
+    /* hot, touched by every apix_poll pass */
     int fd;
-    struct stream *father;
-    char addr[STREAM_ADDR_SIZE];
+    int tx_fd; /* pipe: the write end, -1 => fd, see stream_tx_fd */
     char type; /* stream_type */
-    int state; /* stream_state */
-    time_t ts_sync_in;
-    time_t ts_sync_out;
-    struct timeval ts_poll_recv;
-
-    vec_8_t *txbuf;
-    vec_8_t *rxbuf;
-
+    u8 srrp_mode;
+    u8 integrity; /* SRRP_INTEGRITY_*, asked of the peer in /sync */
+    u8 tx_integrity; /* asked by the peer, crc16 until its /sync */
     union {
         u8 byte;
         struct {
@@ -115,29 +181,156 @@ struct stream {
             u8 srrp_packet_in:1;
         } bits;
     } ev;
-
-    // only for srrp
-    int srrp_mode;
-    str_t *l_nodeid; /* local nodeid */
-    str_t *r_nodeid; /* remote nodeid */
-    vec_p_t *sub_topics;
-    struct srrp_packet *rxpac_unfin;
+    int state; /* stream_state */
+    u32 poll_events; /* registered in ctx->poll_fd, 0 => not */
+    vec_8_t *txbuf; /* NULL => empty, see stream_tx_append */
+    vec_8_t *rxbuf; /* NULL => empty, see stream_rx_append */
+    struct timeval ts_poll_recv;
+    u64 rx_poll_seq; /* poll_seq of the last receive */
+    time_t ts_sync_out;
     struct list_head msgs;
 
     struct apix *ctx;
     struct sink *sink;
+    u32 id; /* unique in ctx, unlike the address reused by the next stream */
     struct list_head ln_ctx;
     struct list_head ln_sink;
+
+    /*
+     * cold, srrp control & setup and the features below, inline but past the
+     * hot part, so a poll pass over idle streams doesn't load them
+     */
+    struct stream *father;
+    time_t ts_sync_in;
+    atom_t *l_nodeid; /* local nodeid, NULL => "" */
+    atom_t *r_nodeid; /* remote nodeid, NULL => "" */
+    vec_p_t *sub_topics; /* atoms, NULL => none */
+    struct srrp_packet *rxpac_unfin;
+    char *addr; /* NULL => none */
+    u32 rx_gap_usec; /* com: line idle time ending a frame, 0 => none */
+    struct timeval rx_gap_ts; /* com: last rx of a frame in the gap, 0 => none */
+    struct can_link *can; /* can: isotp of the stream, NULL => raw frames */
+    struct timeval due_ts; /* can: next isotp frame or timeout, 0 => none */
+
+    // cut through, see apix_set_cut_through
+    struct srrp_packet *cut_head; /* first slice of the message passing through */
+    struct stream *cut_dst; /* NULL => dst gone, drop the rest */
+    struct stream *cut_src; /* stream cutting through to us */
+    vec_8_t *cut_held; /* sends held back until cut_src or tx_file finishes */
+
+    // relay, see apix_relay
+    struct stream *relay_dst; /* bytes received are spliced to it */
+    struct stream *relay_src;
+    int relay_pipe[2]; /* splice needs a pipe end between two sockets */
+    u32 relay_left; /* bytes in relay_pipe dst didn't take yet */
+
+    // recv file, see apix_srrp_recv_file
+    int rx_file_fd; /* payloads are written to it, -1 => none */
+    atom_t *rx_file_anchor;
+    struct srrp_packet *rx_file_head; /* first slice of the message written */
+    int rx_file_errno; /* of the first failed write, 0 => none */
+
+    // send file, see apix_srrp_send_file
+    struct file_tx *tx_file; /* NULL => none */
 };
 
 struct stream *stream_new(struct sink *sink);
 void stream_free(struct stream *stream);
 
+/*
+ * Append to the rx or tx buffer, taken from the pool of ctx if the stream
+ * has none, idle streams hold no buffer at all.
+ * - return -1 and take nothing if the buffer can't grow: out of memory, or
+ *   over STREAM_BUF_MAX with APIX_STATIC_ALLOC
+ */
+int stream_rx_append(struct stream *stream, const void *buf, u32 len);
+int stream_tx_append(struct stream *stream, const void *buf, u32 len);
+
+/* Give drained buffers back to the pool, grown ones are freed. */
+void stream_release_bufs(struct stream *stream);
+
+/* Queue the sends held in cut_held, the stream is free for other messages. */
+void stream_tx_unhold(struct stream *stream);
+
+/* Mark bytes received, apix_poll parses the streams marked in its pass. */
+static inline void stream_mark_rx(struct stream *stream)
+{
+    gettimeofday(&stream->ts_poll_recv, NULL);
+    stream->rx_poll_seq = stream->ctx->poll_seq;
+}
+
+static inline u32 stream_rx_size(struct stream *stream)
+{
+    return stream->rxbuf ? vsize(stream->rxbuf) : 0;
+}
+
+static inline u32 stream_tx_size(struct stream *stream)
+{
+    return stream->txbuf ? vsize(stream->txbuf) : 0;
+}
+
+static inline int stream_tx_fd(struct stream *stream)
+{
+    return stream->tx_fd == -1 ? stream->fd : stream->tx_fd;
+}
+
+void stream_set_addr(struct stream *stream, const char *addr);
+
+static inline const char *stream_addr(struct stream *stream)
+{
+    return stream->addr ? stream->addr : "";
+}
+
+static inline const char *stream_l_nodeid(struct stream *stream)
+{
+    return atom_str(stream->l_nodeid);
+}
+
+static inline const char *stream_r_nodeid(struct stream *stream)
+{
+    return atom_str(stream->r_nodeid);
+}
+
+/**
+ * uring
+ * - io_uring engine for socket sinks, see apix-uring.c
+ * - poll & flush serve as sink_operations, the rest wrap the posix ones
+ */
+
+/* Create ctx->uring, return -1 if the kernel lacks support. */
+int uring_new(struct apix *ctx);
+void uring_drop(struct apix *ctx);
+
+/* Start receiving or accepting on the opened stream. */
+int uring_attach(struct stream *stream);
+/* Cancel requests of the stream, call it before closing fd. */
+void uring_detach(struct stream *stream);
+/* Return the next fd taken by multishot accept, or -1. */
+int uring_accept(struct stream *stream);
+/* Queue buf to be sent by the next flush, never block. */
+int uring_send(struct stream *stream, const u8 *buf, u32 len);
+int uring_poll(struct sink *sink);
+int uring_flush(struct sink *sink);
+
+/**
+ * file_tx
+ * - the file apix_srrp_send_file sends on a stream, fed slice by slice by the
+ *   sink flush as tx of the stream drains, see apix-posix.c
+ */
+
+struct file_tx;
+void file_tx_free(struct file_tx *tx);
+
 struct stream *find_stream_in_apix(struct apix *ctx, int fd);
 struct stream *find_stream_in_sink(struct sink *sink, int fd);
-struct stream *find_stream_by_l_nodeid(struct apix *ctx, const char *nodeid);
-struct stream *find_stream_by_r_nodeid(struct apix *ctx, const char *nodeid);
-struct stream *find_stream_by_nodeid(struct apix *ctx, const char *nodeid);
+struct stream *find_stream_by_l_nodeid(struct apix *ctx, atom_t *nodeid);
+struct stream *find_stream_by_r_nodeid(struct apix *ctx, atom_t *nodeid);
+struct stream *find_stream_by_nodeid(struct apix *ctx, atom_t *nodeid);
+/* The stream of id if it is still open, NULL once it is closed or freed. */
+struct stream *find_stream_by_id(struct apix *ctx, u32 id);
+
+/* 1 if fd takes a write right now without blocking */
+int fd_writable(int fd);
 
 /**
  * message
@@ -167,12 +360,47 @@ static inline void message_finish(struct message *msg)
     msg->state = MESSAGE_ST_FINISHED;
 }
 
-static inline void message_free(struct message *msg)
-{
-    list_del(&msg->ln);
-    srrp_free(msg->pac);
-    free(msg);
-}
+/**
+ * workers
+ * - thread pool of apix_enable_workers, see apix-worker.c
+ */
+
+/*
+ * Hand the WAITING request over to the handler registered for it, then msg
+ * is finished and its pac moved away.
+ * - return 0 on success, -1 if no handler matches, 1 if the handler is at its
+ *   concurrency limit, every queue is full or out of works, msg is left to
+ *   retry then
+ */
+int workers_submit(struct apix *ctx, struct message *msg);
+
+/*
+ * Send the response of the work if its stream is still open and free it, run
+ * in apix_poll.
+ */
+void workers_finish(struct apix *ctx, struct work *work);
+
+/* Join all worker threads and drop works never started. */
+void workers_stop(struct apix *ctx);
+void workers_free(struct apix *ctx);
+
+/**
+ * srrp_call
+ * - pending request of apix_srrp_call, kept in sending order
+ */
+
+struct srrp_call {
+    u32 seqno;
+    struct stream *stream; /* send to */
+    atom_t *srcid;
+    atom_t *dstid;
+    atom_t *anchor;
+    u32 timeout_ms; /* 0 => never */
+    struct timeval deadline;
+    apix_srrp_call_func_t func;
+    void *arg;
+    struct list_head ln;
+};
 
 #ifdef __cplusplus
 }
@@ -38,12 +38,16 @@ static int tcp_s_open(struct sink *sink, const char *addr)
 
     u32 host;
     u16 port;
-    char *tmp = strdup(addr);
+    char *tmp = mem_strdup(addr);
+    if (tmp == NULL) {
+        close(fd);
+        return -1;
+    }
     char *colon = strchr(tmp, ':');
     *colon = 0;
     host = inet_addr(tmp);
     port = htons(atoi(colon + 1));
-    free(tmp);
+    mem_free(tmp);
 
     int rc = 0;
     struct sockaddr_in sockaddr = {0};
@@ -66,7 +70,7 @@ static int tcp_s_open(struct sink *sink, const char *addr)
     struct stream *stream = stream_new(sink);
     stream->fd = fd;
     stream->type = STREAM_T_LISTEN;
-    snprintf(stream->addr, sizeof(stream->addr), "%s", addr);
+    stream_set_addr(stream, addr);
 
     struct posix_sink *tcp_s_sink = container_of(sink, struct posix_sink, sink);
     FD_SET(fd, &tcp_s_sink->fds);
@@ -82,7 +86,7 @@ static int tcp_s_close(struct sink *sink, int fd)
         return -1;
     close(stream->fd);
     if (strcmp(sink->id, SINK_STM32_TCP_S) == 0)
-        unlink(stream->addr);
+        unlink(stream_addr(stream));
     stream_free(stream);
     return 0;
 }
@@ -155,8 +159,8 @@ static int tcp_s_poll(struct sink *sink)
                 FD_CLR(pos->fd, &tcp_s_sink->fds);
                 sink->ops.close(sink, pos->fd);
             } else {
-                vpack(pos->rxbuf, buf, nread);
-                gettimeofday(&pos->ts_poll_recv, NULL);
+                stream_rx_append(pos, buf, nread);
+                stream_mark_rx(pos);
             }
         //}
     }
@@ -185,12 +189,16 @@ static int tcp_c_open(struct sink *sink, const char *addr)
 
     u32 host;
     u16 port;
-    char *tmp = strdup(addr);
+    char *tmp = mem_strdup(addr);
+    if (tmp == NULL) {
+        close(fd);
+        return -1;
+    }
     char *colon = strchr(tmp, ':');
     *colon = 0;
     host = inet_addr(tmp);
     port = htons(atoi(colon + 1));
-    free(tmp);
+    mem_free(tmp);
 
     int rc = 0;
     struct sockaddr_in sockaddr = {0};
@@ -207,7 +215,7 @@ static int tcp_c_open(struct sink *sink, const char *addr)
     struct stream *stream = stream_new(sink);
     stream->fd = fd;
     stream->type = STREAM_T_LISTEN;
-    snprintf(stream->addr, sizeof(stream->addr), "%s", addr);
+    stream_set_addr(stream, addr);
 
     struct posix_sink *tcp_c_sink = container_of(sink, struct posix_sink, sink);
     FD_SET(fd, &tcp_c_sink->fds);
@@ -280,8 +288,8 @@ static int tcp_c_poll(struct sink *sink)
             FD_CLR(pos->fd, &tcp_c_sink->fds);
             sink->ops.close(sink, pos->fd);
         } else {
-            vpack(pos->rxbuf, buf, nread);
-            gettimeofday(&pos->ts_poll_recv, NULL);
+            stream_rx_append(pos, buf, nread);
+            stream_mark_rx(pos);
         }
     }
 
@@ -308,7 +316,7 @@ static int com_open(struct sink *sink, const char *addr)
 
     struct stream *stream = stream_new(sink);
     stream->fd = fd;
-    snprintf(stream->addr, sizeof(stream->addr), "%s", addr);
+    stream_set_addr(stream, addr);
 
     return fd;
 }
@@ -354,7 +362,8 @@ static int com_poll(struct sink *sink)
             LOG_ERROR("poll failed!");
             continue;
         }
-        vpack(pos->rxbuf, buf, nread);
+        stream_rx_append(pos, buf, nread);
+        stream_mark_rx(pos);
     }
     return 0;
 }
@@ -371,17 +380,17 @@ static const struct sink_operations com_ops = {
 int apix_enable_stm32(struct apix *ctx)
 {
     // tcp_s
-    struct posix_sink *tcp_s_sink = calloc(1, sizeof(struct posix_sink));
+    struct posix_sink *tcp_s_sink = mem_calloc(1, sizeof(struct posix_sink));
     sink_init(&tcp_s_sink->sink, SINK_STM32_TCP_S, &tcp_s_ops);
     apix_sink_register(ctx, &tcp_s_sink->sink);
 
     // tcp_c
-    struct posix_sink *tcp_c_sink = calloc(1, sizeof(struct posix_sink));
+    struct posix_sink *tcp_c_sink = mem_calloc(1, sizeof(struct posix_sink));
     sink_init(&tcp_c_sink->sink, SINK_STM32_TCP_C, &tcp_c_ops);
     apix_sink_register(ctx, &tcp_c_sink->sink);
 
     // com
-    struct posix_sink *com_sink = calloc(1, sizeof(struct posix_sink));
+    struct posix_sink *com_sink = mem_calloc(1, sizeof(struct posix_sink));
     sink_init(&com_sink->sink, SINK_STM32_COM, &com_ops);
     apix_sink_register(ctx, &com_sink->sink);
 
@@ -398,7 +407,7 @@ void apix_disable_stm32(struct apix *ctx)
                 container_of(pos, struct posix_sink, sink);
             apix_sink_unregister(ctx, &tcp_s_sink->sink);
             sink_fini(&tcp_s_sink->sink);
-            free(tcp_s_sink);
+            mem_free(tcp_s_sink);
         }
 
         // tcp_c
@@ -407,7 +416,7 @@ void apix_disable_stm32(struct apix *ctx)
                 container_of(pos, struct posix_sink, sink);
             apix_sink_unregister(ctx, &tcp_c_sink->sink);
             sink_fini(&tcp_c_sink->sink);
-            free(tcp_c_sink);
+            mem_free(tcp_c_sink);
         }
 
         // com
@@ -416,7 +425,7 @@ void apix_disable_stm32(struct apix *ctx)
                 container_of(pos, struct posix_sink, sink);
             apix_sink_unregister(ctx, &com_sink->sink);
             sink_fini(&com_sink->sink);
-            free(com_sink);
+            mem_free(com_sink);
         }
     }
 }
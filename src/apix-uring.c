@@ -0,0 +1,723 @@
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "apix-private.h"
+#include "unused.h"
+#include "log.h"
+#include "probe.h"
+
+#if defined __linux__ && defined __has_include
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#if defined __linux__ && defined IORING_RECV_MULTISHOT
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#define URING_ENTRIES 256
+#define URING_BUF_NR 256 /* power of 2 */
+#define URING_BUF_SIZE 2048
+#define URING_BGID 0
+
+/**
+ * uring
+ * - one io_uring per ctx shared by the sinks built on it, raw syscalls only
+ * - completions are reaped from the mapped cq in sink poll without any
+ *   syscall, everything queued in the pass is submitted by one
+ *   io_uring_enter in sink flush
+ * - each socket keeps one multishot recv, or multishot accept, in flight,
+ *   receiving into a provided buffer ring, and at most one send
+ * - user_data is the uring_conn with the op in its low bits
+ */
+
+enum uring_op {
+    URING_OP_RECV = 1,
+    URING_OP_SEND,
+    URING_OP_ACCEPT,
+};
+
+#define URING_OP_MASK 7ULL
+
+struct uring_conn {
+    struct stream *stream; /* NULL => detached, freed after its last cqe */
+    int fd;
+    int listen;
+    int multishot; /* 0 => kernel lacks it, rearm after each cqe */
+    int armed; /* recv or accept in flight */
+    int sending; /* send in flight */
+    vec_8_t *tx; /* in flight */
+    vec_8_t *txq; /* queued behind tx */
+    vec_32_t *accepted; /* fds from multishot accept */
+    int completing; /* kept alive while its cqe is handled */
+    struct list_head ln; /* in uring->pending, or cancels once detached */
+    struct list_head ln_all;
+};
+
+struct uring {
+    int fd;
+
+    u32 *sq_head;
+    u32 *sq_tail;
+    u32 *sq_mask;
+    u32 *sq_flags;
+    u32 sq_entries;
+    u32 to_submit;
+    struct io_uring_sqe *sqes;
+
+    u32 *cq_head;
+    u32 *cq_tail;
+    u32 *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ptr;
+    void *cq_ptr;
+    size_t sq_len;
+    size_t cq_len;
+    size_t sqes_len;
+
+    struct io_uring_buf_ring *br;
+    size_t br_len;
+    u16 br_tail;
+    u8 *bufs;
+
+    struct uring_conn **conns; /* by fd */
+    int nr_conns;
+    struct list_head pending; /* conns to arm or to send */
+    struct list_head cancels; /* detached conns whose cancel found no sqe */
+    struct list_head conns_all; /* detached ones included */
+};
+
+static int sys_uring_setup(u32 entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_uring_enter(int fd, u32 to_submit, u32 min_complete, u32 flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_uring_register(int fd, u32 opcode, void *arg, u32 nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static int uring_submit(struct uring *ur, u32 flags)
+{
+    int rc = sys_uring_enter(ur->fd, ur->to_submit, 0, flags);
+    if (rc == -1) {
+        // left in the sq, retried by the next flush
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+            return 0;
+        LOG_ERROR("[%p:uring_submit] %s(%d)", ur, strerror(errno), errno);
+        return -1;
+    }
+    ur->to_submit -= rc;
+    return 0;
+}
+
+static struct io_uring_sqe *uring_get_sqe(struct uring *ur)
+{
+    u32 tail = *ur->sq_tail;
+    if (tail - __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE) == ur->sq_entries) {
+        uring_submit(ur, 0);
+        if (tail - __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE) == ur->sq_entries)
+            return NULL;
+    }
+
+    struct io_uring_sqe *sqe = &ur->sqes[tail & *ur->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+static void uring_commit_sqe(struct uring *ur)
+{
+    __atomic_store_n(ur->sq_tail, *ur->sq_tail + 1, __ATOMIC_RELEASE);
+    ur->to_submit++;
+}
+
+static void uring_recycle_buf(struct uring *ur, u16 bid)
+{
+    struct io_uring_buf *buf = &ur->br->bufs[ur->br_tail & (URING_BUF_NR - 1)];
+    buf->addr = (u64)(uintptr_t)(ur->bufs + bid * URING_BUF_SIZE);
+    buf->len = URING_BUF_SIZE;
+    buf->bid = bid;
+    ur->br_tail++;
+    __atomic_store_n(&ur->br->tail, ur->br_tail, __ATOMIC_RELEASE);
+}
+
+static struct uring_conn *uring_find_conn(struct uring *ur, struct stream *stream)
+{
+    if (stream->fd < 0 || stream->fd >= ur->nr_conns)
+        return NULL;
+    struct uring_conn *conn = ur->conns[stream->fd];
+    return conn && conn->stream == stream ? conn : NULL;
+}
+
+static void uring_put_conn(struct uring_conn *conn)
+{
+    if (conn->stream || conn->armed || conn->sending || conn->completing)
+        return;
+    list_del(&conn->ln);
+    list_del(&conn->ln_all);
+    vec_free(conn->tx);
+    vec_free(conn->txq);
+    if (conn->accepted)
+        vec_free(conn->accepted);
+    free(conn);
+}
+
+/* Cancel the request of conn & op, -1 if the sq stays full. */
+static int uring_cancel(struct uring *ur, struct uring_conn *conn, u64 op)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ur);
+    if (sqe == NULL)
+        return -1;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = (u64)(uintptr_t)conn | op;
+    sqe->user_data = 0;
+    uring_commit_sqe(ur);
+    return 0;
+}
+
+static u64 uring_armed_op(struct uring_conn *conn)
+{
+    return conn->listen ? URING_OP_ACCEPT : URING_OP_RECV;
+}
+
+static void uring_pend_conn(struct uring *ur, struct uring_conn *conn)
+{
+    if (list_empty(&conn->ln))
+        list_add_tail(&conn->ln, &ur->pending);
+}
+
+static void uring_start_send(struct uring *ur, struct uring_conn *conn)
+{
+    if (conn->sending)
+        return;
+
+    if (vsize(conn->tx) == 0) {
+        if (vsize(conn->txq) == 0)
+            return;
+        vec_8_t *tmp = conn->tx;
+        conn->tx = conn->txq;
+        conn->txq = tmp;
+    }
+
+    struct io_uring_sqe *sqe = uring_get_sqe(ur);
+    if (sqe == NULL) {
+        uring_pend_conn(ur, conn);
+        return;
+    }
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = conn->fd;
+    sqe->addr = (u64)(uintptr_t)vraw(conn->tx);
+    sqe->len = vsize(conn->tx);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (u64)(uintptr_t)conn | URING_OP_SEND;
+    uring_commit_sqe(ur);
+    conn->sending = 1;
+}
+
+static void uring_arm_conn(struct uring *ur, struct uring_conn *conn)
+{
+    if (!conn->armed) {
+        struct io_uring_sqe *sqe = uring_get_sqe(ur);
+        if (sqe == NULL) {
+            uring_pend_conn(ur, conn);
+            return;
+        }
+        sqe->fd = conn->fd;
+        if (conn->listen) {
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->ioprio = conn->multishot ? IORING_ACCEPT_MULTISHOT : 0;
+            sqe->user_data = (u64)(uintptr_t)conn | URING_OP_ACCEPT;
+        } else {
+            sqe->opcode = IORING_OP_RECV;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = URING_BGID;
+            sqe->ioprio = conn->multishot ? IORING_RECV_MULTISHOT : 0;
+            sqe->user_data = (u64)(uintptr_t)conn | URING_OP_RECV;
+        }
+        uring_commit_sqe(ur);
+        conn->armed = 1;
+    }
+
+    uring_start_send(ur, conn);
+}
+
+static void uring_complete_recv(struct uring *ur, struct uring_conn *conn,
+                                int res, u32 flags)
+{
+    struct stream *stream = conn->stream;
+
+    if (!(flags & IORING_CQE_F_MORE))
+        conn->armed = 0;
+
+    if (flags & IORING_CQE_F_BUFFER) {
+        u16 bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        if (stream && res > 0) {
+            PROBE2(apix, sink_read, conn->fd, res);
+            LOG_TRACE("[%p:recv] #%d packet in", stream->ctx, conn->fd);
+            stream_rx_append(stream, ur->bufs + bid * URING_BUF_SIZE, res);
+            stream_mark_rx(stream);
+            stream->ev.bits.pollin = 1;
+        }
+        uring_recycle_buf(ur, bid);
+    }
+
+    if (stream == NULL)
+        return;
+
+    if (res == 0) {
+        LOG_DEBUG("[%p:recv] #%d finished", stream->ctx, conn->fd);
+        stream->sink->ops.close(stream);
+        return;
+    } else if (res == -EINVAL && conn->multishot) {
+        LOG_INFO("[%p:recv] #%d multishot recv unsupported", stream->ctx, conn->fd);
+        conn->multishot = 0;
+    } else if (res < 0 && res != -ENOBUFS) {
+        LOG_DEBUG("[%p:recv] #%d %s(%d)", stream->ctx, conn->fd, strerror(-res), -res);
+        stream->sink->ops.close(stream);
+        return;
+    }
+
+    if (!conn->armed)
+        uring_pend_conn(ur, conn);
+}
+
+static void uring_complete_send(struct uring *ur, struct uring_conn *conn, int res)
+{
+    conn->sending = 0;
+    if (conn->stream == NULL)
+        return;
+
+    if (res < 0) {
+        // the recv side sees the error too and closes the stream
+        LOG_DEBUG("[%p:send] #%d %s(%d)", conn->stream->ctx, conn->fd, strerror(-res), -res);
+        res = vsize(conn->tx);
+    }
+    if (res > 0)
+        vdrop(conn->tx, res);
+
+    uring_start_send(ur, conn);
+}
+
+static void uring_complete_accept(struct uring *ur, struct uring_conn *conn,
+                                  int res, u32 flags)
+{
+    if (!(flags & IORING_CQE_F_MORE))
+        conn->armed = 0;
+
+    if (res >= 0) {
+        if (conn->stream) {
+            vpush(conn->accepted, &res);
+            conn->stream->ev.bits.accept = 1;
+        } else {
+            close(res);
+        }
+    } else if (res == -EINVAL && conn->multishot) {
+        LOG_INFO("[%p:accept] #%d multishot accept unsupported", ur, conn->fd);
+        conn->multishot = 0;
+    } else if (res != -ECANCELED) {
+        LOG_ERROR("[%p:accept] #%d %s(%d)", ur, conn->fd, strerror(-res), -res);
+    }
+
+    if (conn->stream && !conn->armed)
+        uring_pend_conn(ur, conn);
+}
+
+static void uring_reap(struct uring *ur)
+{
+    u32 head = *ur->cq_head;
+
+    while (head != __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe = &ur->cqes[head & *ur->cq_mask];
+        u64 user_data = cqe->user_data;
+        int res = cqe->res;
+        u32 flags = cqe->flags;
+        __atomic_store_n(ur->cq_head, ++head, __ATOMIC_RELEASE);
+
+        // cancel
+        if (user_data == 0)
+            continue;
+
+        struct uring_conn *conn = (void *)(uintptr_t)(user_data & ~URING_OP_MASK);
+        conn->completing = 1;
+        switch (user_data & URING_OP_MASK) {
+        case URING_OP_RECV:
+            uring_complete_recv(ur, conn, res, flags);
+            break;
+        case URING_OP_SEND:
+            uring_complete_send(ur, conn, res);
+            break;
+        case URING_OP_ACCEPT:
+            uring_complete_accept(ur, conn, res, flags);
+            break;
+        }
+        conn->completing = 0;
+        uring_put_conn(conn);
+    }
+}
+
+int uring_poll(struct sink *sink)
+{
+    uring_reap(sink->ctx->uring);
+    return 0;
+}
+
+int uring_flush(struct sink *sink)
+{
+    struct uring *ur = sink->ctx->uring;
+
+    // cancels of detached conns first, their files stay open until then
+    struct uring_conn *pos, *n;
+    list_for_each_entry_safe(pos, n, &ur->cancels, ln) {
+        if (uring_cancel(ur, pos, uring_armed_op(pos)) != 0)
+            break;
+        list_del_init(&pos->ln);
+    }
+
+    list_for_each_entry_safe(pos, n, &ur->pending, ln) {
+        list_del_init(&pos->ln);
+        uring_arm_conn(ur, pos);
+    }
+
+    // move completions overflowed from a full cq back into it
+    u32 flags = 0;
+    if (__atomic_load_n(ur->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW)
+        flags |= IORING_ENTER_GETEVENTS;
+
+    if (ur->to_submit == 0 && flags == 0)
+        return 0;
+    return uring_submit(ur, flags);
+}
+
+int uring_attach(struct stream *stream)
+{
+    struct uring *ur = stream->ctx->uring;
+
+    if (stream->fd >= ur->nr_conns) {
+        int nr = ur->nr_conns ? ur->nr_conns : 64;
+        while (nr <= stream->fd)
+            nr *= 2;
+        struct uring_conn **conns = realloc(ur->conns, nr * sizeof(*conns));
+        if (conns == NULL)
+            return -1;
+        memset(conns + ur->nr_conns, 0, (nr - ur->nr_conns) * sizeof(*conns));
+        ur->conns = conns;
+        ur->nr_conns = nr;
+    }
+
+    struct uring_conn *conn = calloc(1, sizeof(*conn));
+    if (conn == NULL)
+        return -1;
+    conn->stream = stream;
+    conn->fd = stream->fd;
+    conn->listen = stream->type == STREAM_T_LISTEN;
+    conn->multishot = 1;
+    conn->tx = vec_new(1, 2048);
+    conn->txq = vec_new(1, 2048);
+    if (conn->listen)
+        conn->accepted = vec_new(sizeof(int), 8);
+    INIT_LIST_HEAD(&conn->ln);
+    list_add(&conn->ln_all, &ur->conns_all);
+
+    ur->conns[stream->fd] = conn;
+    uring_arm_conn(ur, conn);
+    return 0;
+}
+
+void uring_detach(struct stream *stream)
+{
+    struct uring *ur = stream->ctx->uring;
+    struct uring_conn *conn = uring_find_conn(ur, stream);
+    if (conn == NULL)
+        return;
+
+    ur->conns[conn->fd] = NULL;
+    conn->stream = NULL;
+    list_del_init(&conn->ln);
+
+    while (conn->accepted && vsize(conn->accepted)) {
+        int fd;
+        vpop(conn->accepted, &fd);
+        close(fd);
+    }
+
+    // the multishot request holds the file, the peer sees no close until
+    // it is cancelled, retried by flush if the sq is full
+    if (conn->armed) {
+        if (uring_cancel(ur, conn, uring_armed_op(conn)) == 0)
+            uring_submit(ur, 0);
+        else
+            list_add_tail(&conn->ln, &ur->cancels);
+    }
+
+    uring_put_conn(conn);
+}
+
+int uring_accept(struct stream *stream)
+{
+    struct uring_conn *conn = uring_find_conn(stream->ctx->uring, stream);
+    if (conn == NULL || conn->accepted == NULL || vsize(conn->accepted) == 0)
+        return -1;
+
+    int fd;
+    vpop_front(conn->accepted, &fd);
+    if (vsize(conn->accepted))
+        stream->ev.bits.accept = 1;
+    return fd;
+}
+
+int uring_send(struct stream *stream, const u8 *buf, u32 len)
+{
+    struct uring *ur = stream->ctx->uring;
+    struct uring_conn *conn = uring_find_conn(ur, stream);
+    if (conn == NULL)
+        return -1;
+
+    if (vreserve(conn->txq, len) != 0)
+        return -1;
+    vpack(conn->txq, buf, len);
+    uring_start_send(ur, conn);
+    return len;
+}
+
+/*
+ * Cancel every request in flight & reap them, the kernel writes into the
+ * provided buffers & reads the tx vecs until their cqe is posted.
+ * - return -1 if some are left
+ */
+static int uring_cancel_all(struct uring *ur)
+{
+    struct uring_conn *pos, *n;
+    list_for_each_entry_safe(pos, n, &ur->conns_all, ln_all) {
+        pos->stream = NULL;
+        list_del_init(&pos->ln);
+        if (pos->armed && uring_cancel(ur, pos, uring_armed_op(pos)) != 0)
+            return -1;
+        if (pos->sending && uring_cancel(ur, pos, URING_OP_SEND) != 0)
+            return -1;
+        uring_put_conn(pos);
+    }
+
+    while (!list_empty(&ur->conns_all)) {
+        int rc = sys_uring_enter(ur->fd, ur->to_submit, 1, IORING_ENTER_GETEVENTS);
+        if (rc == -1 && errno != EINTR && errno != EBUSY)
+            return -1;
+        if (rc > 0)
+            ur->to_submit -= rc;
+        uring_reap(ur);
+    }
+    return 0;
+}
+
+static void uring_free(struct uring *ur)
+{
+    if (ur->cq_head && uring_cancel_all(ur) != 0) {
+        // leaked rather than freed under the kernel
+        LOG_ERROR("[%p:uring_free] requests left in flight: %s(%d)",
+                  ur, strerror(errno), errno);
+        close(ur->fd);
+        return;
+    }
+
+    if (ur->fd != -1)
+        close(ur->fd);
+    if (ur->sqes && ur->sqes != MAP_FAILED)
+        munmap(ur->sqes, ur->sqes_len);
+    if (ur->cq_ptr && ur->cq_ptr != MAP_FAILED && ur->cq_ptr != ur->sq_ptr)
+        munmap(ur->cq_ptr, ur->cq_len);
+    if (ur->sq_ptr && ur->sq_ptr != MAP_FAILED)
+        munmap(ur->sq_ptr, ur->sq_len);
+    if (ur->br && ur->br != MAP_FAILED)
+        munmap(ur->br, ur->br_len);
+    free(ur->bufs);
+    free(ur->conns);
+    free(ur);
+}
+
+static int uring_probe(struct uring *ur)
+{
+    static const u8 ops[] = {
+        IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_ASYNC_CANCEL,
+    };
+
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, len);
+    if (probe == NULL)
+        return -1;
+
+    int rc = sys_uring_register(ur->fd, IORING_REGISTER_PROBE, probe, 256);
+    for (size_t i = 0; rc == 0 && i < sizeof(ops); i++) {
+        if (ops[i] > probe->last_op || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED))
+            rc = -1;
+    }
+
+    free(probe);
+    return rc;
+}
+
+static int uring_map(struct uring *ur, struct io_uring_params *p)
+{
+    ur->sq_len = p->sq_off.array + p->sq_entries * sizeof(u32);
+    ur->cq_len = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        if (ur->cq_len > ur->sq_len)
+            ur->sq_len = ur->cq_len;
+        ur->cq_len = ur->sq_len;
+    }
+
+    ur->sq_ptr = mmap(NULL, ur->sq_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQ_RING);
+    if (ur->sq_ptr == MAP_FAILED)
+        return -1;
+
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        ur->cq_ptr = ur->sq_ptr;
+    } else {
+        ur->cq_ptr = mmap(NULL, ur->cq_len, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_CQ_RING);
+        if (ur->cq_ptr == MAP_FAILED)
+            return -1;
+    }
+
+    ur->sqes_len = p->sq_entries * sizeof(struct io_uring_sqe);
+    ur->sqes = mmap(NULL, ur->sqes_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQES);
+    if (ur->sqes == MAP_FAILED)
+        return -1;
+
+    u8 *sq = ur->sq_ptr;
+    ur->sq_head = (u32 *)(sq + p->sq_off.head);
+    ur->sq_tail = (u32 *)(sq + p->sq_off.tail);
+    ur->sq_mask = (u32 *)(sq + p->sq_off.ring_mask);
+    ur->sq_flags = (u32 *)(sq + p->sq_off.flags);
+    ur->sq_entries = p->sq_entries;
+
+    // sqes are used in ring order, so the index array is fixed
+    u32 *array = (u32 *)(sq + p->sq_off.array);
+    for (u32 i = 0; i < p->sq_entries; i++)
+        array[i] = i;
+
+    u8 *cq = ur->cq_ptr;
+    ur->cq_head = (u32 *)(cq + p->cq_off.head);
+    ur->cq_tail = (u32 *)(cq + p->cq_off.tail);
+    ur->cq_mask = (u32 *)(cq + p->cq_off.ring_mask);
+    ur->cqes = (struct io_uring_cqe *)(cq + p->cq_off.cqes);
+    return 0;
+}
+
+static int uring_setup_bufs(struct uring *ur)
+{
+    ur->br_len = URING_BUF_NR * sizeof(struct io_uring_buf);
+    ur->br = mmap(NULL, ur->br_len, PROT_READ | PROT_WRITE,
+                  MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (ur->br == MAP_FAILED)
+        return -1;
+
+    ur->bufs = malloc(URING_BUF_NR * URING_BUF_SIZE);
+    if (ur->bufs == NULL)
+        return -1;
+
+    struct io_uring_buf_reg reg = {
+        .ring_addr = (u64)(uintptr_t)ur->br,
+        .ring_entries = URING_BUF_NR,
+        .bgid = URING_BGID,
+    };
+    if (sys_uring_register(ur->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+        return -1;
+
+    for (u16 i = 0; i < URING_BUF_NR; i++)
+        uring_recycle_buf(ur, i);
+    return 0;
+}
+
+int uring_new(struct apix *ctx)
+{
+    assert(ctx->uring == NULL);
+
+    struct uring *ur = calloc(1, sizeof(*ur));
+    if (ur == NULL)
+        return -1;
+    INIT_LIST_HEAD(&ur->pending);
+    INIT_LIST_HEAD(&ur->cancels);
+    INIT_LIST_HEAD(&ur->conns_all);
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ur->fd = sys_uring_setup(URING_ENTRIES, &p);
+    if (ur->fd == -1) {
+        LOG_INFO("[%p:uring_new] io_uring_setup: %s(%d)", ctx, strerror(errno), errno);
+        goto err;
+    }
+
+    if (uring_probe(ur) != 0) {
+        LOG_INFO("[%p:uring_new] io_uring lacks accept, recv or send", ctx);
+        goto err;
+    }
+
+    if (uring_map(ur, &p) != 0) {
+        LOG_ERROR("[%p:uring_new] mmap: %s(%d)", ctx, strerror(errno), errno);
+        goto err;
+    }
+
+    if (uring_setup_bufs(ur) != 0) {
+        LOG_INFO("[%p:uring_new] provided buffer ring: %s(%d)", ctx, strerror(errno), errno);
+        goto err;
+    }
+
+    // completions wake up apix_idle & apix_get_poll_fd
+    if (ctx->event_fd != -1)
+        sys_uring_register(ur->fd, IORING_REGISTER_EVENTFD, &ctx->event_fd, 1);
+
+    ctx->uring = ur;
+    return 0;
+
+err:
+    uring_free(ur);
+    return -1;
+}
+
+void uring_drop(struct apix *ctx)
+{
+    if (ctx->uring == NULL)
+        return;
+    uring_free(ctx->uring);
+    ctx->uring = NULL;
+}
+
+#else
+
+int uring_new(struct apix *ctx)
+{
+    UNUSED(ctx);
+    return -1;
+}
+
+void uring_drop(struct apix *ctx) { UNUSED(ctx); }
+int uring_attach(struct stream *stream) { UNUSED(stream); return -1; }
+void uring_detach(struct stream *stream) { UNUSED(stream); }
+int uring_accept(struct stream *stream) { UNUSED(stream); return -1; }
+
+int uring_send(struct stream *stream, const u8 *buf, u32 len)
+{
+    UNUSED(stream);
+    UNUSED(buf);
+    UNUSED(len);
+    return -1;
+}
+
+int uring_poll(struct sink *sink) { UNUSED(sink); return -1; }
+int uring_flush(struct sink *sink) { UNUSED(sink); return -1; }
+
+#endif
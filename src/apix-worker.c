@@ -0,0 +1,386 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apix-private.h"
+#include "svcx.h"
+#include "unused.h"
+#include "log.h"
+
+#if defined __unix__ || defined __linux__ || defined __APPLE__
+
+#include <pthread.h>
+#include <unistd.h>
+
+#define POST_RETRY_USEC 1000
+
+/**
+ * workers
+ * - each worker owns a bounded deque, the polling thread puts requests onto
+ *   them round robin, a worker pops its own deque from the front and steals
+ *   from the back of the others when it runs dry
+ * - handlers and their running counts are only touched by the polling thread,
+ *   a work carries func & arg of its handler as they were at submit
+ * - a work names its stream by id, the stream may be gone and its address
+ *   taken by another one when the work is done
+ */
+
+struct srrp_handler {
+    apix_srrp_handler_t func;
+    void *arg;
+    u32 max_concurrency; /* 0 => unlimited */
+    u32 running;
+};
+
+struct work {
+    u32 stream_id; /* receive from */
+    struct srrp_packet *req;
+    struct srrp_packet *resp;
+    struct srrp_handler *handler; /* for running, polling thread only */
+    apix_srrp_handler_t func;
+    void *arg;
+};
+
+struct worker {
+    pthread_t tid;
+    pthread_mutex_t lock;
+    struct work **works; /* ring of queue_size */
+    u32 head;
+    u32 cnt;
+    struct workers *pool;
+};
+
+struct workers {
+    struct apix *ctx;
+    struct worker *workers;
+    u32 nr_workers;
+    u32 queue_size;
+    u32 next; /* round robin of submit */
+    pthread_mutex_t lock; /* for pending & stop */
+    pthread_cond_t cond;
+    int pending; /* works queued but not taken */
+    int stop;
+    struct svcx *handlers;
+};
+
+static int worker_push(struct worker *worker, struct work *work)
+{
+    int rc = -1;
+    pthread_mutex_lock(&worker->lock);
+    if (worker->cnt < worker->pool->queue_size) {
+        u32 idx = (worker->head + worker->cnt) % worker->pool->queue_size;
+        worker->works[idx] = work;
+        worker->cnt++;
+        rc = 0;
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return rc;
+}
+
+static struct work *worker_pop(struct worker *worker, int steal)
+{
+    struct work *work = NULL;
+    pthread_mutex_lock(&worker->lock);
+    if (worker->cnt) {
+        if (steal) {
+            u32 idx = (worker->head + worker->cnt - 1) % worker->pool->queue_size;
+            work = worker->works[idx];
+        } else {
+            work = worker->works[worker->head];
+            worker->head = (worker->head + 1) % worker->pool->queue_size;
+        }
+        worker->cnt--;
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return work;
+}
+
+static struct work *worker_take(struct worker *worker)
+{
+    struct workers *pool = worker->pool;
+    struct work *work = worker_pop(worker, 0);
+    if (work)
+        return work;
+
+    u32 self = worker - pool->workers;
+    for (u32 i = 1; i < pool->nr_workers; i++) {
+        work = worker_pop(&pool->workers[(self + i) % pool->nr_workers], 1);
+        if (work)
+            return work;
+    }
+    return NULL;
+}
+
+static void work_free(struct work *work)
+{
+    srrp_free(work->req);
+    if (work->resp)
+        srrp_free(work->resp);
+    mem_free(work);
+}
+
+static void *worker_thread(void *arg)
+{
+    struct worker *worker = arg;
+    struct workers *pool = worker->pool;
+
+    for (;;) {
+        struct work *work = worker_take(worker);
+        if (work) {
+            pthread_mutex_lock(&pool->lock);
+            pool->pending--;
+            pthread_mutex_unlock(&pool->lock);
+
+            work->resp = work->func(work->req, work->arg);
+            while (post_work(pool->ctx, work) != 0) {
+                // out of posts, the polling thread frees them as it runs them
+                pthread_mutex_lock(&pool->lock);
+                int stop = pool->stop;
+                pthread_mutex_unlock(&pool->lock);
+                if (stop) {
+                    work_free(work);
+                    break;
+                }
+                usleep(POST_RETRY_USEC);
+            }
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        while (pool->pending <= 0 && !pool->stop)
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        int stop = pool->stop;
+        pthread_mutex_unlock(&pool->lock);
+        if (stop)
+            break;
+    }
+
+    return NULL;
+}
+
+int apix_enable_workers(struct apix *ctx, u32 nr_threads, u32 queue_size)
+{
+    if (ctx->workers || nr_threads == 0 || queue_size == 0)
+        return -1;
+
+    struct workers *pool = mem_calloc(1, sizeof(*pool));
+    if (pool == NULL)
+        return -1;
+    pool->ctx = ctx;
+    pool->queue_size = queue_size;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+    ctx->workers = pool;
+
+    // nr_workers counts the workers set up, so workers_free unwinds them
+    pool->handlers = svcx_new();
+    pool->workers = mem_calloc(nr_threads, sizeof(*pool->workers));
+    if (pool->handlers == NULL || pool->workers == NULL) {
+        LOG_ERROR("[%p:apix_enable_workers] out of memory", ctx);
+        workers_free(ctx);
+        return -1;
+    }
+    for (; pool->nr_workers < nr_threads; pool->nr_workers++) {
+        struct worker *worker = &pool->workers[pool->nr_workers];
+        worker->pool = pool;
+        worker->works = mem_calloc(queue_size, sizeof(*worker->works));
+        if (worker->works == NULL) {
+            LOG_ERROR("[%p:apix_enable_workers] out of memory", ctx);
+            workers_free(ctx);
+            return -1;
+        }
+        pthread_mutex_init(&worker->lock, NULL);
+    }
+
+    pool->nr_workers = 0;
+    for (u32 i = 0; i < nr_threads; i++) {
+        if (pthread_create(&pool->workers[i].tid, NULL,
+                           worker_thread, &pool->workers[i]) != 0) {
+            LOG_ERROR("[%p:apix_enable_workers] pthread_create failed", ctx);
+            break;
+        }
+        pool->nr_workers++;
+    }
+
+    if (pool->nr_workers != nr_threads) {
+        workers_stop(ctx);
+        pool->nr_workers = nr_threads;
+        workers_free(ctx);
+        return -1;
+    }
+    return 0;
+}
+
+int apix_srrp_handle(struct apix *ctx, const char *header,
+                     apix_srrp_handler_t func, void *arg, u32 max_concurrency)
+{
+    struct workers *pool = ctx->workers;
+    if (pool == NULL || func == NULL)
+        return -1;
+
+    struct srrp_handler *handler =
+        svcx_get_service_private_exact(pool->handlers, header);
+    if (handler == NULL) {
+        handler = mem_calloc(1, sizeof(*handler));
+        if (handler == NULL)
+            return -1;
+        if (svcx_add_service(pool->handlers, header, handler) != 0) {
+            mem_free(handler);
+            return -1;
+        }
+    }
+
+    // running works keep the handler for their count, func & arg are copied
+    handler->func = func;
+    handler->arg = arg;
+    handler->max_concurrency = max_concurrency;
+    return 0;
+}
+
+int workers_submit(struct apix *ctx, struct message *msg)
+{
+    struct workers *pool = ctx->workers;
+    char header[SRRP_ID_MAX + SRRP_ANCHOR_MAX + 2];
+    snprintf(header, sizeof(header), "%s:%s",
+             srrp_get_dstid(msg->pac), srrp_get_anchor(msg->pac));
+
+    struct srrp_handler *handler = svcx_get_service_private(pool->handlers, header);
+    if (handler == NULL)
+        return -1;
+
+    if (handler->max_concurrency && handler->running >= handler->max_concurrency)
+        return 1;
+
+    struct work *work = mem_alloc(sizeof(*work));
+    if (work == NULL)
+        return 1;
+    work->stream_id = msg->stream->id;
+    work->req = msg->pac;
+    work->resp = NULL;
+    work->handler = handler;
+    work->func = handler->func;
+    work->arg = handler->arg;
+
+    for (u32 i = 0; i < pool->nr_workers; i++) {
+        struct worker *worker = &pool->workers[pool->next];
+        pool->next = (pool->next + 1) % pool->nr_workers;
+        if (worker_push(worker, work) == 0) {
+            handler->running++;
+            msg->pac = NULL;
+            message_finish(msg);
+
+            pthread_mutex_lock(&pool->lock);
+            pool->pending++;
+            pthread_cond_signal(&pool->cond);
+            pthread_mutex_unlock(&pool->lock);
+            return 0;
+        }
+    }
+
+    // every queue is full
+    mem_free(work);
+    return 1;
+}
+
+void workers_finish(struct apix *ctx, struct work *work)
+{
+    work->handler->running--;
+
+    struct stream *stream = find_stream_by_id(ctx, work->stream_id);
+    if (stream && work->resp) {
+        if (srrp_get_seqno(work->resp) == 0)
+            srrp_set_seqno(work->resp, srrp_get_seqno(work->req));
+        apix_srrp_send(stream, work->resp);
+    }
+
+    work_free(work);
+}
+
+void workers_stop(struct apix *ctx)
+{
+    struct workers *pool = ctx->workers;
+    if (pool == NULL)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (u32 i = 0; i < pool->nr_workers; i++)
+        pthread_join(pool->workers[i].tid, NULL);
+
+    // drop works never started
+    for (u32 i = 0; i < pool->nr_workers; i++) {
+        struct work *work;
+        while ((work = worker_pop(&pool->workers[i], 0)) != NULL)
+            work_free(work);
+    }
+}
+
+static void free_handler(const char *header, void *private_data)
+{
+    UNUSED(header);
+    mem_free(private_data);
+}
+
+void workers_free(struct apix *ctx)
+{
+    struct workers *pool = ctx->workers;
+    if (pool == NULL)
+        return;
+
+    for (u32 i = 0; i < pool->nr_workers; i++) {
+        pthread_mutex_destroy(&pool->workers[i].lock);
+        mem_free(pool->workers[i].works);
+    }
+    mem_free(pool->workers);
+
+    if (pool->handlers) {
+        svcx_foreach(pool->handlers, free_handler);
+        svcx_drop(pool->handlers);
+    }
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->lock);
+    mem_free(pool);
+    ctx->workers = NULL;
+}
+
+#else
+
+int apix_enable_workers(struct apix *ctx, u32 nr_threads, u32 queue_size)
+{
+    UNUSED(ctx);
+    UNUSED(nr_threads);
+    UNUSED(queue_size);
+    return -1;
+}
+
+int apix_srrp_handle(struct apix *ctx, const char *header,
+                     apix_srrp_handler_t func, void *arg, u32 max_concurrency)
+{
+    UNUSED(ctx);
+    UNUSED(header);
+    UNUSED(func);
+    UNUSED(arg);
+    UNUSED(max_concurrency);
+    return -1;
+}
+
+int workers_submit(struct apix *ctx, struct message *msg)
+{
+    UNUSED(ctx);
+    UNUSED(msg);
+    return -1;
+}
+
+void workers_finish(struct apix *ctx, struct work *work)
+{
+    UNUSED(ctx);
+    UNUSED(work);
+}
+
+void workers_stop(struct apix *ctx) { UNUSED(ctx); }
+void workers_free(struct apix *ctx) { UNUSED(ctx); }
+
+#endif
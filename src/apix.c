@@ -1,3 +1,7 @@
+#ifdef __linux__
+#define _GNU_SOURCE /* sched_setaffinity */
+#endif
+
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
@@ -9,9 +13,20 @@
 #include <sys/time.h>
 #include <sys/select.h>
 #include <regex.h>
+#if defined __unix__ || defined __APPLE__
+#include <poll.h>
+#endif
+#ifdef __linux__
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#endif
 
 #include "apix-private.h"
+#include "json.h"
 #include "list.h"
+#include "probe.h"
 #include "srrp.h"
 #include "unused.h"
 #include "log.h"
@@ -22,26 +37,243 @@
  * apix
  */
 
-static void log_hex_string(const char *buf, u32 len)
+static void log_broken_packet(struct apix *ctx, const char *buf, u32 len)
 {
-    printf("len: %d, data: ", (int)len);
-    for (int i = 0; i < (int)len; i++) {
-        if (isprint(buf[i]))
-            printf("%c", buf[i]);
+    static struct log_ratelimit rl;
+    char hex[LOG_RECORD_MSG_MAX / 2];
+    u32 idx = 0;
+
+    if (!LOG_LEVEL_ON(LOG_LV_WARN) || !log_ratelimit(&rl))
+        return;
+
+    for (u32 i = 0; i < len && idx + 6 < sizeof(hex); i++) {
+        if (isprint((u8)buf[i]))
+            hex[idx++] = buf[i];
         else
-            printf("_0x%.2x", buf[i]);
+            idx += snprintf(hex + idx, sizeof(hex) - idx, "_0x%.2x", (u8)buf[i]);
+    }
+    hex[idx] = 0;
+
+    LOG_WARN("[%p:parse_packet] broken packet: len: %d, data: %s",
+             ctx, (int)len, hex);
+}
+
+static int same_message(const struct srrp_packet *fst, const struct srrp_packet *snd)
+{
+    return srrp_get_leader(fst) == srrp_get_leader(snd) &&
+        srrp_get_ver(fst) == srrp_get_ver(snd) &&
+        srrp_get_srcid_atom(fst) == srrp_get_srcid_atom(snd) &&
+        srrp_get_dstid_atom(fst) == srrp_get_dstid_atom(snd) &&
+        srrp_get_seqno(fst) == srrp_get_seqno(snd) &&
+        srrp_get_anchor_atom(fst) == srrp_get_anchor_atom(snd);
+}
+
+/**
+ * cut through
+ * - the first slice of a request or response routed to a remote nodeid
+ *   picks the dst stream, it and the following slices of the same message
+ *   are put onto dst->txbuf as soon as they are parsed
+ * - other sends to dst are held in cut_held meanwhile, so slices of
+ *   different messages never interleave on dst
+ * - a cut given up before its FIN_1 slice, on a slice of another message,
+ *   on timeout or on close of the source, is closed at dst by an empty
+ *   FIN_1 slice, so dst never waits on a partial that won't go on
+ */
+
+/* Let the sends held at dst go out, dst is free for other messages. */
+static void cut_release(struct stream *stream)
+{
+    struct stream *dst = stream->cut_dst;
+    if (dst == NULL)
+        return;
+
+    dst->cut_src = NULL;
+    stream_tx_unhold(dst);
+    stream->cut_dst = NULL;
+}
+
+static void cut_end(struct stream *stream)
+{
+    cut_release(stream);
+    srrp_free(stream->cut_head);
+    stream->cut_head = NULL;
+}
+
+/* Close the partial message at dst, the rest of it is dropped. */
+static void cut_detach(struct stream *stream)
+{
+    struct stream *dst = stream->cut_dst;
+    if (dst == NULL)
+        return;
+
+    struct srrp_packet *fin = srrp_new_slice(
+        stream->cut_head, SRRP_FIN_1, 0, 0, dst->tx_integrity);
+    if (fin) {
+        stream_tx_append(dst, srrp_get_raw(fin), srrp_get_packet_len(fin));
+        srrp_free(fin);
+    }
+    cut_release(stream);
+}
+
+static void cut_abort(struct stream *stream)
+{
+    cut_detach(stream);
+    cut_end(stream);
+}
+
+/*
+ * Return 1 if pac is cut through and taken, else 0.
+ * - only for synced sources, the others are left to handle_message which
+ *   answers "nodeid not sync"
+ * - a slice dst has no room for cuts the message short at dst, the rest of
+ *   it is taken & dropped
+ */
+static int cut_through(struct stream *stream, struct srrp_packet *pac)
+{
+    if (stream->cut_head) {
+        if (same_message(stream->cut_head, pac)) {
+            if (stream->cut_dst) {
+                srrp_set_integrity(pac, stream->cut_dst->tx_integrity);
+                if (stream_tx_append(stream->cut_dst, srrp_get_raw(pac),
+                                     srrp_get_packet_len(pac)) != 0) {
+                    LOG_RATELIMITED(LOG_LV_WARN, "[%p:cut_through] #%d dst #%d "
+                                    "full, cut short:%s", stream->ctx, stream->fd,
+                                    stream->cut_dst->fd, srrp_get_anchor(pac));
+                    cut_detach(stream);
+                }
+            }
+            if (srrp_get_fin(pac) == SRRP_FIN_1)
+                cut_end(stream);
+            srrp_free(pac);
+            return 1;
+        }
+        // the rest of the previous message is lost, as in reassembly
+        cut_abort(stream);
+    }
+
+    if (stream->r_nodeid == NULL)
+        return 0;
+
+    if ((srrp_get_leader(pac) != SRRP_REQUEST_LEADER &&
+         srrp_get_leader(pac) != SRRP_RESPONSE_LEADER) ||
+        srrp_get_fin(pac) != SRRP_FIN_0 || stream->rxpac_unfin)
+        return 0;
+
+    struct apix *ctx = stream->ctx;
+    if (find_stream_by_l_nodeid(ctx, srrp_get_dstid_atom(pac)))
+        return 0;
+    struct stream *dst = find_stream_by_r_nodeid(ctx, srrp_get_dstid_atom(pac));
+    if (dst == NULL || dst == stream || dst->cut_src || dst->tx_file)
+        return 0;
+
+    PROBE5(apix, route, stream->fd, srrp_get_srcid(pac),
+           srrp_get_dstid(pac), srrp_get_anchor(pac), dst->fd);
+    srrp_set_integrity(pac, dst->tx_integrity);
+    if (stream_tx_append(dst, srrp_get_raw(pac), srrp_get_packet_len(pac)) != 0)
+        return 0;
+    stream->cut_head = pac;
+    stream->cut_dst = dst;
+    dst->cut_src = stream;
+    return 1;
+}
+
+MEM_POOL(message_pool, struct message, APIX_MAX_MESSAGES);
+
+static void message_free(struct message *msg)
+{
+    list_del(&msg->ln);
+    if (msg->pac) /* NULL => moved to workers */
+        srrp_free(msg->pac);
+    mem_pool_free(&message_pool, msg);
+}
+
+static void queue_message(struct stream *stream, struct srrp_packet *pac)
+{
+    struct message *msg = mem_pool_alloc(&message_pool);
+    if (msg == NULL) {
+        LOG_RATELIMITED(LOG_LV_ERROR, "[%p:queue_message] #%d out of messages, "
+                        "dropped:%s", stream->ctx, stream->fd, srrp_get_raw(pac));
+        srrp_free(pac);
+        return;
+    }
+    msg->state = MESSAGE_ST_NONE;
+    msg->stream = stream;
+    msg->pac = pac;
+    INIT_LIST_HEAD(&msg->ln);
+    list_add_tail(&msg->ln, &stream->msgs);
+}
+
+/*
+ * Return 1 if pac is a slice of the message armed by apix_srrp_recv_file,
+ * its payload written to rx_file_fd and pac taken, else 0.
+ */
+static int recv_file(struct stream *stream, struct srrp_packet *pac)
+{
+    if (stream->rx_file_head) {
+        if (!same_message(stream->rx_file_head, pac))
+            return 0;
+    } else if (srrp_get_leader(pac) == SRRP_CTRL_LEADER ||
+               srrp_get_anchor_atom(pac) != stream->rx_file_anchor) {
+        return 0;
+    }
+
+    // after a failed write the rest is only taken to the last slice
+    const u8 *buf = srrp_get_payload(pac);
+    u32 len = srrp_get_payload_len(pac);
+    while (len && stream->rx_file_errno == 0) {
+        ssize_t nr = write(stream->rx_file_fd, buf, len);
+        if (nr < 0) {
+            if (errno == EINTR)
+                continue;
+            stream->rx_file_errno = errno;
+            LOG_ERROR("[%p:recv_file] #%d write: %s",
+                      stream->ctx, stream->fd, strerror(errno));
+            break;
+        }
+        buf += nr;
+        len -= nr;
     }
-    printf("\n");
+
+    struct srrp_packet *head = stream->rx_file_head ? stream->rx_file_head : pac;
+    if (srrp_get_fin(pac) == SRRP_FIN_1) {
+        const char *err = stream->rx_file_errno ?
+            strerror(stream->rx_file_errno) : "";
+        struct srrp_packet *done = srrp_new(
+            srrp_get_leader(head), SRRP_FIN_1, srrp_get_srcid(head),
+            srrp_get_dstid(head), srrp_get_anchor(head),
+            (const u8 *)err, strlen(err));
+        if (done) {
+            srrp_set_seqno(done, srrp_get_seqno(head));
+            queue_message(stream, done);
+        }
+
+        srrp_free(head);
+        if (head != pac)
+            srrp_free(pac);
+        stream->rx_file_head = NULL;
+        stream->rx_file_fd = -1;
+        stream->rx_file_errno = 0;
+        atom_put(stream->rx_file_anchor);
+        stream->rx_file_anchor = NULL;
+    } else if (head != pac) {
+        srrp_free(pac);
+    } else {
+        stream->rx_file_head = pac;
+    }
+    return 1;
 }
 
 static void parse_packet(struct stream *stream)
 {
+    if (stream->rxbuf == NULL)
+        return;
+
     while (vsize(stream->rxbuf)) {
         u32 offset = srrp_next_packet_offset(
             vraw(stream->rxbuf), vsize(stream->rxbuf));
         if (offset != 0) {
-            LOG_WARN("[%p:parse_packet] broken packet:", stream->ctx);
-            log_hex_string(vraw(stream->rxbuf), offset);
+            PROBE2(apix, parse_drop, stream->fd, offset);
+            log_broken_packet(stream->ctx, vraw(stream->rxbuf), offset);
             vdrop(stream->rxbuf, offset);
         }
         if (vsize(stream->rxbuf) == 0)
@@ -53,25 +285,41 @@ static void parse_packet(struct stream *stream)
             if (time(0) < stream->ts_poll_recv.tv_sec + PARSE_PACKET_TIMEOUT / 1000)
                 break;
 
-            LOG_ERROR("[%p:parse_packet] wrong packet:%s",
-                      stream->ctx, vraw(stream->rxbuf));
+            LOG_RATELIMITED(LOG_LV_ERROR, "[%p:parse_packet] wrong packet:%.*s",
+                            stream->ctx, (int)vsize(stream->rxbuf),
+                            (char *)vraw(stream->rxbuf));
             u32 offset = srrp_next_packet_offset(
                 vraw(stream->rxbuf) + 1,
                 vsize(stream->rxbuf) - 1) + 1;
+            PROBE2(apix, parse_drop, stream->fd, offset);
             vdrop(stream->rxbuf, offset);
             break;
         }
         vdrop(stream->rxbuf, srrp_get_packet_len(pac));
         assert(srrp_get_ver(pac) == SRRP_VERSION);
 
+        // unchecked packets are only trusted where we asked for none
+        if (srrp_get_integrity(pac) == SRRP_INTEGRITY_NONE &&
+            stream->integrity != SRRP_INTEGRITY_NONE) {
+            PROBE2(apix, parse_drop, stream->fd, srrp_get_packet_len(pac));
+            LOG_RATELIMITED(LOG_LV_ERROR, "[%p:parse_packet] unchecked packet:%s",
+                            stream->ctx, srrp_get_raw(pac));
+            srrp_free(pac);
+            continue;
+        }
+        PROBE4(apix, parse_accept, stream->fd, srrp_get_leader(pac),
+               srrp_get_fin(pac), srrp_get_packet_len(pac));
+
+        if (stream->rx_file_fd != -1 && recv_file(stream, pac))
+            continue;
+
+        if (stream->ctx->cut_through && cut_through(stream, pac))
+            continue;
+
         // concatenate srrp packet
         if (stream->rxpac_unfin) {
             assert(srrp_get_fin(stream->rxpac_unfin) == SRRP_FIN_0);
-            if (srrp_get_leader(pac) != srrp_get_leader(stream->rxpac_unfin) ||
-                srrp_get_ver(pac) != srrp_get_ver(stream->rxpac_unfin) ||
-                strcmp(srrp_get_srcid(pac), srrp_get_srcid(stream->rxpac_unfin)) != 0 ||
-                strcmp(srrp_get_dstid(pac), srrp_get_dstid(stream->rxpac_unfin)) != 0 ||
-                strcmp(srrp_get_anchor(pac), srrp_get_anchor(stream->rxpac_unfin)) != 0) {
+            if (!same_message(stream->rxpac_unfin, pac)) {
                 // drop pre pac
                 srrp_free(stream->rxpac_unfin);
                 // set to rxpac_unfin
@@ -79,10 +327,14 @@ static void parse_packet(struct stream *stream)
             } else {
                 struct srrp_packet *tsp = stream->rxpac_unfin;
                 stream->rxpac_unfin = srrp_cat(tsp, pac);
-                assert(stream->rxpac_unfin != NULL);
                 srrp_free(tsp);
                 srrp_free(pac);
                 pac = NULL;
+                if (stream->rxpac_unfin == NULL) {
+                    LOG_RATELIMITED(LOG_LV_ERROR, "[%p:parse_packet] #%d message "
+                                    "too large, dropped", stream->ctx, stream->fd);
+                    continue;
+                }
             }
         } else {
             stream->rxpac_unfin = pac;
@@ -94,14 +346,7 @@ static void parse_packet(struct stream *stream)
 
         // construct message if receviced fin srrp packet
         if (srrp_get_fin(stream->rxpac_unfin) == SRRP_FIN_1) {
-            struct message *msg = malloc(sizeof(*msg));
-            memset(msg, 0, sizeof(*msg));
-            msg->state = MESSAGE_ST_NONE;
-            msg->stream = stream;
-            msg->pac = stream->rxpac_unfin;
-            INIT_LIST_HEAD(&msg->ln);
-            list_add_tail(&msg->ln, &stream->msgs);
-
+            queue_message(stream, stream->rxpac_unfin);
             stream->rxpac_unfin = NULL;
         }
     }
@@ -115,36 +360,78 @@ static int apix_response(
         srrp_get_srcid(req),
         srrp_get_anchor(req),
         data);
+    if (resp == NULL)
+        return -1;
+    srrp_set_seqno(resp, srrp_get_seqno(req));
     int rc = apix_srrp_send(stream, resp);
     srrp_free(resp);
     return rc;
 }
 
+/**
+ * integrity
+ * - each side asks in the payload of /sync for the check it wants to
+ *   receive, {"integrity":"crc32c"}, peers asking nothing get crc16
+ * - parse accepts any check, so the switch needs no round trip
+ */
+
+static const char *integrity_names[] = {
+    [SRRP_INTEGRITY_NONE] = "none",
+    [SRRP_INTEGRITY_CRC16] = "crc16",
+    [SRRP_INTEGRITY_CRC32C] = "crc32c",
+};
+
+static u8 parse_sync_integrity(const struct srrp_packet *pac)
+{
+    const char *payload = (const char *)srrp_get_payload(pac);
+    u8 integrity = SRRP_INTEGRITY_CRC16;
+
+    if (srrp_get_payload_len(pac) <= 2 || strncmp(payload, "j:", 2) != 0)
+        return integrity;
+
+    struct json_object *jo = json_object_new(payload + 2);
+    if (jo == NULL)
+        return integrity;
+
+    char name[16] = {0};
+    if (json_get_string(jo, "/integrity", name, sizeof(name)) == 0) {
+        for (u32 i = 0; i < sizeof(integrity_names) / sizeof(integrity_names[0]); i++) {
+            if (strcmp(name, integrity_names[i]) == 0)
+                integrity = i;
+        }
+    }
+    json_object_delete(jo);
+    return integrity;
+}
+
 static void handle_ctrl(struct message *am)
 {
     assert(am->stream->type != STREAM_T_LISTEN);
 
-    str_t *nodeid = NULL;
+    const char *nodeid = NULL;
     if (am->stream->type == STREAM_T_ACCEPT) {
         assert(am->stream->father);
-        nodeid = am->stream->father->l_nodeid;
+        nodeid = stream_l_nodeid(am->stream->father);
     } else {
-        nodeid = am->stream->l_nodeid;
+        nodeid = stream_l_nodeid(am->stream);
     }
 
     struct stream *tmp = find_stream_by_nodeid(
-        am->stream->ctx, srrp_get_srcid(am->pac));
+        am->stream->ctx, srrp_get_srcid_atom(am->pac));
     if (tmp != NULL && tmp != am->stream) {
-        struct srrp_packet *pac = srrp_new_ctrl(sget(nodeid), SRRP_CTRL_NODEID_DUP, "");
-        apix_srrp_send(am->stream, pac);
-        srrp_free(pac);
+        struct srrp_packet *pac = srrp_new_ctrl(nodeid, SRRP_CTRL_NODEID_DUP, "");
+        if (pac) {
+            apix_srrp_send(am->stream, pac);
+            srrp_free(pac);
+        }
         am->stream->state = STREAM_ST_NODEID_DUP;
         goto out;
     }
 
     if (strcmp(srrp_get_anchor(am->pac), SRRP_CTRL_SYNC) == 0) {
-        str_free(am->stream->r_nodeid);
-        am->stream->r_nodeid = str_new(srrp_get_srcid(am->pac));
+        atom_put(am->stream->r_nodeid);
+        am->stream->r_nodeid = atom_get(srrp_get_srcid_atom(am->pac));
+        am->stream->tx_integrity = parse_sync_integrity(am->pac);
         am->stream->state = STREAM_ST_NODEID_NORMAL;
         am->stream->ts_sync_in = time(0);
         goto out;
@@ -164,21 +451,26 @@ static void handle_subscribe(struct message *am)
 {
     assert(am->stream->type != STREAM_T_LISTEN);
 
+    if (am->stream->sub_topics == NULL)
+        am->stream->sub_topics = vec_new(sizeof(void *), 1);
+
     for (u32 i = 0; i < vsize(am->stream->sub_topics); i++) {
-        if (strcmp(sget(vat(am->stream->sub_topics, i)), srrp_get_anchor(am->pac)) == 0) {
+        if (*(atom_t **)vat(am->stream->sub_topics, i) == srrp_get_anchor_atom(am->pac)) {
             apix_response(am->stream, am->pac, "j:{\"err\":0}");
             message_finish(am);
             return;
         }
     }
 
-    str_t *topic = str_new(srrp_get_anchor(am->pac));
+    atom_t *topic = atom_get(srrp_get_anchor_atom(am->pac));
     vpush(am->stream->sub_topics, &topic);
 
     struct srrp_packet *pub = srrp_new_publish(
         srrp_get_anchor(am->pac), "j:{\"state\":\"sub\"}");
-    apix_srrp_send(am->stream, pub);
-    srrp_free(pub);
+    if (pub) {
+        apix_srrp_send(am->stream, pub);
+        srrp_free(pub);
+    }
 
     message_finish(am);
 }
@@ -187,10 +479,9 @@ static void handle_unsubscribe(struct message *am)
 {
     assert(am->stream->type != STREAM_T_LISTEN);
 
-    for (u32 i = 0; i < vsize(am->stream->sub_topics); i++) {
-        if (strcmp(sget(*(str_t **)vat(am->stream->sub_topics, i)),
-                   srrp_get_anchor(am->pac)) == 0) {
-            str_free(*(str_t **)vat(am->stream->sub_topics, i));
+    for (u32 i = 0; am->stream->sub_topics && i < vsize(am->stream->sub_topics); i++) {
+        if (*(atom_t **)vat(am->stream->sub_topics, i) == srrp_get_anchor_atom(am->pac)) {
+            atom_put(*(atom_t **)vat(am->stream->sub_topics, i));
             vremove(am->stream->sub_topics, i, 1);
             break;
         }
@@ -198,8 +489,10 @@ static void handle_unsubscribe(struct message *am)
 
     struct srrp_packet *pub = srrp_new_publish(
         srrp_get_anchor(am->pac), "j:{\"state\":\"unsub\"}");
-    apix_srrp_send(am->stream, pub);
-    srrp_free(pub);
+    if (pub) {
+        apix_srrp_send(am->stream, pub);
+        srrp_free(pub);
+    }
 
     message_finish(am);
 }
@@ -208,25 +501,31 @@ static void forward_request_or_response(struct message *am)
 {
     struct stream *dst = NULL;
 
-    dst = find_stream_by_l_nodeid(am->stream->ctx, srrp_get_dstid(am->pac));
+    dst = find_stream_by_l_nodeid(am->stream->ctx, srrp_get_dstid_atom(am->pac));
     LOG_TRACE("[%p:forward_rr_l] dstid:%x, dst:%p",
               am->stream->ctx, srrp_get_dstid(am->pac), dst);
     if (dst) {
+        PROBE5(apix, route, am->stream->fd, srrp_get_srcid(am->pac),
+               srrp_get_dstid(am->pac), srrp_get_anchor(am->pac), dst->fd);
         list_del(&am->ln);
         list_add_tail(&am->ln, &dst->msgs);
         dst->ev.bits.srrp_packet_in = 1;
         return;
     }
 
-    dst = find_stream_by_r_nodeid(am->stream->ctx, srrp_get_dstid(am->pac));
+    dst = find_stream_by_r_nodeid(am->stream->ctx, srrp_get_dstid_atom(am->pac));
     LOG_TRACE("[%p:forward_rr_r] dstid:%x, dst:%p",
               am->stream->ctx, srrp_get_dstid(am->pac), dst);
     if (dst) {
+        PROBE5(apix, route, am->stream->fd, srrp_get_srcid(am->pac),
+               srrp_get_dstid(am->pac), srrp_get_anchor(am->pac), dst->fd);
         apix_srrp_send(dst, am->pac);
         message_finish(am);
         return;
     }
 
+    PROBE5(apix, route, am->stream->fd, srrp_get_srcid(am->pac),
+           srrp_get_dstid(am->pac), srrp_get_anchor(am->pac), -1);
     apix_response(am->stream, am->pac,
                   "j:{\"err\":404,\"msg\":\"Destination not found\"}");
     message_finish(am);
@@ -240,13 +539,17 @@ static void forward_publish(struct message *am)
 
     struct stream *pos;
     list_for_each_entry(pos, &am->stream->ctx->streams, ln_ctx) {
+        if (pos->sub_topics == NULL)
+            continue;
         for (u32 i = 0; i < vsize(pos->sub_topics); i++) {
             //LOG_TRACE("[%p:forward_publish] topic:%s, sub:%s",
-            //          ctx, srrp_get_anchor(am->pac), sget(*(str_t **)vat(pos->sub_topics, i)));
-            rc = regcomp(&regex, sget(*(str_t **)vat(pos->sub_topics, i)), 0);
+            //          ctx, srrp_get_anchor(am->pac), atom_str(*(atom_t **)vat(pos->sub_topics, i)));
+            rc = regcomp(&regex, atom_str(*(atom_t **)vat(pos->sub_topics, i)), 0);
             if (rc != 0) continue;
             rc = regexec(&regex, srrp_get_anchor(am->pac), 0, NULL, 0);
             if (rc == 0) {
+                PROBE4(apix, publish, am->stream->fd, pos->fd,
+                       srrp_get_anchor(am->pac), srrp_get_payload_len(am->pac));
                 apix_srrp_send(pos, am->pac);
             }
             regfree(&regex);
@@ -271,6 +574,59 @@ static void handle_forward(struct message *am)
     }
 }
 
+static void srrp_call_free(struct srrp_call *call)
+{
+    list_del(&call->ln);
+    atom_put(call->srcid);
+    atom_put(call->dstid);
+    atom_put(call->anchor);
+    mem_free(call);
+}
+
+static void srrp_call_finish(struct srrp_call *call, struct srrp_packet *resp)
+{
+    list_del_init(&call->ln);
+    call->func(call->stream, resp, call->arg);
+    srrp_call_free(call);
+}
+
+static struct srrp_call *find_srrp_call(struct apix *ctx, struct srrp_packet *resp)
+{
+    u32 seqno = srrp_get_seqno(resp);
+
+    struct srrp_call *pos;
+    list_for_each_entry(pos, &ctx->calls, ln) {
+        if (pos->srcid != srrp_get_dstid_atom(resp))
+            continue;
+        if (seqno) {
+            if (pos->seqno == seqno)
+                return pos;
+        } else if (pos->dstid == srrp_get_srcid_atom(resp) &&
+                   pos->anchor == srrp_get_anchor_atom(resp)) {
+            return pos;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * func may close streams, which finishes their calls & may free any entry
+ * of ctx->calls, so the scan restarts after each finished call.
+ */
+static void timeout_srrp_calls(struct apix *ctx)
+{
+    struct srrp_call *pos;
+again:
+    list_for_each_entry(pos, &ctx->calls, ln) {
+        if (pos->timeout_ms && !timercmp(&ctx->poll_ts, &pos->deadline, <)) {
+            LOG_DEBUG("[%p:timeout_srrp_calls] #%d seqno:%x, anchor:%s",
+                      ctx, pos->stream->fd, pos->seqno, atom_str(pos->anchor));
+            srrp_call_finish(pos, NULL);
+            goto again;
+        }
+    }
+}
+
 static void handle_message(struct stream *stream)
 {
     struct message *pos;
@@ -289,10 +645,11 @@ static void handle_message(struct stream *stream)
             continue;
         }
 
-        if (stream->r_nodeid == 0) {
+        if (stream->r_nodeid == NULL) {
             LOG_DEBUG("[%p:handle_message] #%d nodeid zero: "
-                      "l_nodeid:%d, r_nodeid:%d, state:%d, raw:%s",
-                      stream->ctx, pos->stream->fd, stream->l_nodeid, stream->r_nodeid,
+                      "l_nodeid:%s, r_nodeid:%s, state:%d, raw:%s",
+                      stream->ctx, pos->stream->fd,
+                      stream_l_nodeid(stream), stream_r_nodeid(stream),
                       pos->state, srrp_get_raw(pos->pac));
             if (srrp_get_leader(pos->pac) == SRRP_REQUEST_LEADER)
                 apix_response(stream, pos->pac,
@@ -316,6 +673,28 @@ static void handle_message(struct stream *stream)
             continue;
         }
 
+        if (srrp_get_leader(pos->pac) == SRRP_RESPONSE_LEADER &&
+            !list_empty(&stream->ctx->calls)) {
+            struct srrp_call *call = find_srrp_call(stream->ctx, pos->pac);
+            if (call) {
+                message_finish(pos);
+                srrp_call_finish(call, pos->pac);
+                continue;
+            }
+        }
+
+        if (stream->ctx->workers &&
+            srrp_get_leader(pos->pac) == SRRP_REQUEST_LEADER) {
+            int rc = workers_submit(stream->ctx, pos);
+            if (rc == 0)
+                continue;
+            if (rc == 1) {
+                LOG_TRACE("[%p:handle_message] #%d workers busy, anchor:%s",
+                          stream->ctx, stream->fd, srrp_get_anchor(pos->pac));
+                continue;
+            }
+        }
+
         stream->ev.bits.srrp_packet_in = 1;
         pos->state = MESSAGE_ST_WAITING;
         //LOG_TRACE("[%p:handle_message] set srrp_packet_in", stream->ctx);
@@ -337,30 +716,255 @@ static void sync_nodeid(struct stream *stream)
 
     LOG_TRACE("[%p:sync_nodeid] #%d sync", stream->ctx, stream->fd);
 
-    str_t *nodeid = NULL;
+    const char *nodeid = NULL;
     if (stream->type == STREAM_T_ACCEPT) {
         assert(stream->father);
-        nodeid = stream->father->l_nodeid;
+        nodeid = stream_l_nodeid(stream->father);
     } else {
-        nodeid = stream->l_nodeid;
+        nodeid = stream_l_nodeid(stream);
     }
-    struct srrp_packet *pac = srrp_new_ctrl(sget(nodeid), SRRP_CTRL_SYNC, "");
+    char payload[64];
+    snprintf(payload, sizeof(payload), "j:{\"integrity\":\"%s\"}",
+             integrity_names[stream->integrity]);
+    struct srrp_packet *pac = srrp_new_ctrl(nodeid, SRRP_CTRL_SYNC, payload);
+    if (pac == NULL)
+        return;
     apix_send(stream, srrp_get_raw(pac), srrp_get_packet_len(pac));
     srrp_free(pac);
     stream->ts_sync_out = time(0);
 }
 
+/*
+ * wakeup
+ * - the eventfd is written to end apix_idle and make poll_fd readable
+ */
+
+static void wakeup_ctx(struct apix *ctx)
+{
+#ifdef __linux__
+    if (ctx->event_fd != -1) {
+        u64 one = 1;
+        ssize_t nr = write(ctx->event_fd, &one, sizeof(one));
+        UNUSED(nr);
+    }
+#else
+    UNUSED(ctx);
+#endif
+}
+
+static void sleep_ctx(struct apix *ctx, u64 usec)
+{
+#ifdef __linux__
+    if (ctx->event_fd != -1) {
+        struct pollfd pfd = { .fd = ctx->event_fd, .events = POLLIN };
+        if (poll(&pfd, 1, (usec + 999) / 1000) == 1) {
+            u64 cnt;
+            ssize_t nr = read(ctx->event_fd, &cnt, sizeof(cnt));
+            UNUSED(nr);
+        }
+        return;
+    }
+#endif
+    usleep(usec);
+}
+
+/*
+ * post queue
+ * - intrusive MPSC queue by Dmitry Vyukov, producers only swap post_head,
+ *   the polling thread owns post_tail
+ * - post_stub keeps the queue non-empty, so head & tail are never NULL
+ */
+
+static void push_post(struct apix *ctx, struct post *post)
+{
+    __atomic_store_n(&post->next, NULL, __ATOMIC_RELAXED);
+    struct post *prev = __atomic_exchange_n(&ctx->post_head, post, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, post, __ATOMIC_RELEASE);
+}
+
+static struct post *pop_post(struct apix *ctx)
+{
+    struct post *tail = ctx->post_tail;
+    struct post *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+    if (tail == &ctx->post_stub) {
+        if (next == NULL)
+            return NULL;
+        ctx->post_tail = next;
+        tail = next;
+        next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+    }
+
+    if (next) {
+        ctx->post_tail = next;
+        return tail;
+    }
+
+    // a producer is between swapping head and linking prev, retry next poll
+    if (tail != __atomic_load_n(&ctx->post_head, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    push_post(ctx, &ctx->post_stub);
+
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next) {
+        ctx->post_tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+static void finish_post(struct post *post, int rc)
+{
+    if (post->func)
+        post->func(post->stream, rc, post->arg);
+    if (post->pac)
+        srrp_free(post->pac);
+    mem_free(post);
+}
+
+static int is_stream_alive(struct apix *ctx, struct stream *stream)
+{
+    struct stream *pos;
+    list_for_each_entry(pos, &ctx->streams, ln_ctx) {
+        if (pos == stream)
+            return pos->state != STREAM_ST_FINISHED && !pos->ev.bits.close;
+    }
+    return 0;
+}
+
+static void run_posts(struct apix *ctx)
+{
+    struct post *post;
+    while ((post = pop_post(ctx)) != NULL) {
+        if (post->type == POST_T_WORK) {
+            workers_finish(ctx, post->arg);
+            mem_free(post);
+            continue;
+        }
+
+        if (post->type == POST_T_RUN) {
+            post->run(ctx, post->arg);
+            mem_free(post);
+            continue;
+        }
+
+        int rc = -1;
+        if (is_stream_alive(ctx, post->stream)) {
+            switch (post->type) {
+            case POST_T_SEND:
+                rc = apix_send_to_buffer(post->stream, post->buf, post->len);
+                break;
+            case POST_T_SRRP_SEND:
+                rc = apix_srrp_send(post->stream, post->pac);
+                break;
+            case POST_T_CLOSE:
+                rc = apix_close(post->stream);
+                break;
+            }
+        }
+        finish_post(post, rc);
+    }
+}
+
+static struct post *new_post(struct stream *stream, int type, u32 len,
+                             apix_post_func_t func, void *arg)
+{
+    struct post *post = mem_alloc(sizeof(*post) + len);
+    if (post == NULL)
+        return NULL;
+    memset(post, 0, sizeof(*post));
+    post->type = type;
+    post->stream = stream;
+    post->buf = (u8 *)(post + 1);
+    post->len = len;
+    post->func = func;
+    post->arg = arg;
+    return post;
+}
+
+int apix_post_send(struct apix *ctx, struct stream *stream, const u8 *buf, u32 len,
+                   apix_post_func_t func, void *arg)
+{
+    struct post *post = new_post(stream, POST_T_SEND, len, func, arg);
+    if (post == NULL)
+        return -1;
+    memcpy(post + 1, buf, len);
+    push_post(ctx, post);
+    wakeup_ctx(ctx);
+    return 0;
+}
+
+int apix_post_srrp_send(struct apix *ctx, struct stream *stream, struct srrp_packet *pac,
+                        apix_post_func_t func, void *arg)
+{
+    struct post *post = new_post(stream, POST_T_SRRP_SEND, 0, func, arg);
+    if (post == NULL)
+        return -1;
+    post->pac = pac;
+    push_post(ctx, post);
+    wakeup_ctx(ctx);
+    return 0;
+}
+
+int post_work(struct apix *ctx, struct work *work)
+{
+    struct post *post = new_post(NULL, POST_T_WORK, 0, NULL, work);
+    if (post == NULL)
+        return -1;
+    push_post(ctx, post);
+    wakeup_ctx(ctx);
+    return 0;
+}
+
+int apix_post_close(struct apix *ctx, struct stream *stream,
+                    apix_post_func_t func, void *arg)
+{
+    struct post *post = new_post(stream, POST_T_CLOSE, 0, func, arg);
+    if (post == NULL)
+        return -1;
+    push_post(ctx, post);
+    wakeup_ctx(ctx);
+    return 0;
+}
+
+int apix_post(struct apix *ctx, apix_post_run_t func, void *arg)
+{
+    struct post *post = new_post(NULL, POST_T_RUN, 0, NULL, arg);
+    if (post == NULL)
+        return -1;
+    post->run = func;
+    push_post(ctx, post);
+    wakeup_ctx(ctx);
+    return 0;
+}
+
+MEM_POOL(ctx_pool, struct apix, APIX_MAX_CTX);
+
 struct apix *apix_new()
 {
-    struct apix *ctx = malloc(sizeof(*ctx));
-    bzero(ctx, sizeof(*ctx));
+    struct apix *ctx = mem_pool_alloc(&ctx_pool);
+    if (ctx == NULL)
+        return NULL;
     INIT_LIST_HEAD(&ctx->streams);
     INIT_LIST_HEAD(&ctx->sinks);
+    INIT_LIST_HEAD(&ctx->calls);
+    ctx->post_head = &ctx->post_stub;
+    ctx->post_tail = &ctx->post_stub;
+#ifdef __linux__
+    ctx->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#else
+    ctx->event_fd = -1;
+#endif
+    ctx->poll_fd = -1;
+    ctx->timer_fd = -1;
     return ctx;
 }
 
 void apix_drop(struct apix *ctx)
 {
+    workers_stop(ctx);
+
     struct stream *stream_pos, *stream_n;
     list_for_each_entry_safe(stream_pos, stream_n, &ctx->streams, ln_ctx) {
         stream_pos->state = STREAM_ST_FINISHED;
@@ -371,10 +975,40 @@ void apix_drop(struct apix *ctx)
     list_for_each_entry_safe(sink_pos, sink_n, &ctx->sinks, ln) {
         apix_sink_unregister(sink_pos->ctx, sink_pos);
         sink_fini(sink_pos);
-        free(sink_pos);
+        mem_free(sink_pos);
     }
+    uring_drop(ctx);
+
+    // fail posts left behind
+    struct post *post;
+    while ((post = pop_post(ctx)) != NULL) {
+        if (post->type == POST_T_WORK) {
+            workers_finish(ctx, post->arg);
+            mem_free(post);
+        } else {
+            finish_post(post, -1);
+        }
+    }
+    workers_free(ctx);
+
+    if (ctx->buf_pool) {
+        while (vsize(ctx->buf_pool)) {
+            vec_8_t *buf = NULL;
+            vpop(ctx->buf_pool, &buf);
+            vec_free(buf);
+        }
+        vec_free(ctx->buf_pool);
+    }
+
+    mem_free(ctx->idle_pfds);
+    if (ctx->poll_fd != -1) {
+        close(ctx->poll_fd);
+        close(ctx->timer_fd);
+    }
+    if (ctx->event_fd != -1)
+        close(ctx->event_fd);
 
-    free(ctx);
+    mem_pool_free(&ctx_pool, ctx);
 }
 
 struct stream *apix_open(struct apix *ctx, const char *sinkid, const char *addr)
@@ -414,7 +1048,9 @@ int apix_send(struct stream *stream, const u8 *buf, u32 len)
 {
     if (stream->type == STREAM_T_LISTEN || stream->sink->ops.send == NULL)
         return -1;
-    return stream->sink->ops.send(stream, buf, len);
+    int nr = stream->sink->ops.send(stream, buf, len);
+    PROBE3(apix, sink_write, stream->fd, len, nr);
+    return nr;
 }
 
 int apix_recv(struct stream *stream, u8 *buf, u32 len)
@@ -428,14 +1064,23 @@ int apix_send_to_buffer(struct stream *stream, const u8 *buf, u32 len)
 {
     if (stream->type == STREAM_T_LISTEN || stream->sink->ops.send == NULL)
         return -1;
-    vpack(stream->txbuf, buf, len);
-    return 0;
+    if (stream->cut_src || stream->tx_file) {
+        if (stream->cut_held == NULL)
+            stream->cut_held = vec_new(1, len);
+        if (stream->cut_held == NULL || vreserve(stream->cut_held, len) != 0)
+            return -1;
+        vpack(stream->cut_held, buf, len);
+        return 0;
+    }
+    return stream_tx_append(stream, buf, len);
 }
 
 int apix_read_from_buffer(struct stream *stream, u8 *buf, u32 len)
 {
-    u32 less = len < vsize(stream->rxbuf) ? len : vsize(stream->rxbuf);
+    u32 size = stream_rx_size(stream);
+    u32 less = len < size ? len : size;
     if (less) vdump(stream->rxbuf, buf, less);
+    if (less == size) stream_release_bufs(stream);
     return less;
 }
 
@@ -450,11 +1095,228 @@ void apix_set_wait_timeout(struct apix *ctx, u64 usec)
     ctx->idle_usec_max = usec;
 }
 
+int apix_set_busy_poll(struct apix *ctx, u32 spin_usec)
+{
+    ctx->busy_poll_usec = spin_usec;
+    gettimeofday(&ctx->busy_ts, NULL);
+    return 0;
+}
+
+int apix_set_sock_busy_poll(struct apix *ctx, u32 usec)
+{
+    ctx->sock_busy_poll_usec = usec;
+    return 0;
+}
+
+int apix_set_cut_through(struct apix *ctx, int enable)
+{
+    ctx->cut_through = enable;
+    return 0;
+}
+
+int apix_set_integrity(struct stream *stream, u8 integrity)
+{
+    if (integrity > SRRP_INTEGRITY_CRC32C)
+        return -1;
+    stream->integrity = integrity;
+    stream->ts_sync_out = 0; /* tell the peer on the next poll */
+    return 0;
+}
+
+int apix_pin_thread(int cpu)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        LOG_ERROR("[apix_pin_thread] cpu %d: %s(%d)", cpu, strerror(errno), errno);
+        return -1;
+    }
+    return 0;
+#else
+    UNUSED(cpu);
+    return -1;
+#endif
+}
+
+/*
+ * poll fd
+ * - streams are added to the epoll lazily after each poll, EPOLLOUT is only
+ *   asked for while txbuf is not empty
+ * - the eventfd is signalled while events are left to dispatch
+ * - the timerfd fires at the earliest call deadline, at most after
+ *   APIX_IDLE_MAX, to drive sync & timeouts
+ */
+
+#ifdef __linux__
+
+static void sync_poll_fd(struct apix *ctx)
+{
+    struct stream *pos;
+    list_for_each_entry(pos, &ctx->streams, ln_ctx) {
+        if (pos->fd == -1 || pos->state == STREAM_ST_FINISHED)
+            continue;
+
+        // the write end of a pipe is a second fd, armed while txbuf waits
+        if (pos->tx_fd != -1 && stream_tx_size(pos)) {
+            struct epoll_event ev = {
+                .events = EPOLLOUT | EPOLLONESHOT, .data.fd = pos->tx_fd };
+            if (epoll_ctl(ctx->poll_fd, EPOLL_CTL_MOD, pos->tx_fd, &ev) == -1 &&
+                errno == ENOENT)
+                epoll_ctl(ctx->poll_fd, EPOLL_CTL_ADD, pos->tx_fd, &ev);
+        }
+
+        u32 events = EPOLLIN;
+        if (stream_tx_size(pos) && pos->tx_fd == -1)
+            events |= EPOLLOUT;
+        if (events == pos->poll_events)
+            continue;
+
+        struct epoll_event ev = { .events = events, .data.fd = pos->fd };
+        int op = pos->poll_events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        int rc = epoll_ctl(ctx->poll_fd, op, pos->fd, &ev);
+        if (rc == -1 && errno == EEXIST)
+            rc = epoll_ctl(ctx->poll_fd, EPOLL_CTL_MOD, pos->fd, &ev);
+        else if (rc == -1 && errno == ENOENT)
+            rc = epoll_ctl(ctx->poll_fd, EPOLL_CTL_ADD, pos->fd, &ev);
+        if (rc == -1) {
+            LOG_DEBUG("[%p:sync_poll_fd] #%d %s(%d)",
+                      ctx, pos->fd, strerror(errno), errno);
+        }
+        pos->poll_events = events;
+    }
+}
+
+static void unsync_poll_fd(struct stream *stream)
+{
+    struct apix *ctx = stream->ctx;
+
+    if (ctx->poll_fd == -1 || stream->poll_events == 0)
+        return;
+    stream->poll_events = 0;
+
+    // the fd may be closed & reused by another stream already
+    struct stream *pos;
+    list_for_each_entry(pos, &ctx->streams, ln_ctx) {
+        if (pos != stream && pos->fd == stream->fd)
+            return;
+    }
+    epoll_ctl(ctx->poll_fd, EPOLL_CTL_DEL, stream->fd, NULL);
+}
+
+static void arm_poll_timer(struct apix *ctx)
+{
+    struct timeval tv = { APIX_IDLE_MAX / 1000000, APIX_IDLE_MAX % 1000000 };
+
+    struct srrp_call *pos;
+    list_for_each_entry(pos, &ctx->calls, ln) {
+        if (pos->timeout_ms == 0)
+            continue;
+        struct timeval left = { 0, 0 };
+        if (timercmp(&pos->deadline, &ctx->poll_ts, >))
+            timersub(&pos->deadline, &ctx->poll_ts, &left);
+        if (timercmp(&left, &tv, <))
+            tv = left;
+    }
+
+    // zero disarms the timer
+    struct itimerspec its = {
+        .it_value = { tv.tv_sec, tv.tv_usec * 1000 },
+    };
+    if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+        its.it_value.tv_nsec = 1;
+    timerfd_settime(ctx->timer_fd, 0, &its, NULL);
+}
+
+static void drain_poll_fd(struct apix *ctx)
+{
+    u64 cnt;
+    ssize_t nr = read(ctx->event_fd, &cnt, sizeof(cnt));
+    nr = read(ctx->timer_fd, &cnt, sizeof(cnt));
+    UNUSED(nr);
+}
+
+int apix_get_poll_fd(struct apix *ctx)
+{
+    if (ctx->poll_fd != -1)
+        return ctx->poll_fd;
+
+    if (ctx->event_fd == -1)
+        return -1;
+
+    int event_fd = ctx->event_fd;
+    int poll_fd = epoll_create1(EPOLL_CLOEXEC);
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (poll_fd == -1 || timer_fd == -1)
+        goto err;
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = event_fd };
+    if (epoll_ctl(poll_fd, EPOLL_CTL_ADD, event_fd, &ev) == -1)
+        goto err;
+    ev.data.fd = timer_fd;
+    if (epoll_ctl(poll_fd, EPOLL_CTL_ADD, timer_fd, &ev) == -1)
+        goto err;
+
+    ctx->poll_fd = poll_fd;
+    ctx->timer_fd = timer_fd;
+    sync_poll_fd(ctx);
+    arm_poll_timer(ctx);
+    // let the host dispatch what is pending already
+    wakeup_ctx(ctx);
+    return poll_fd;
+
+err:
+    LOG_ERROR("[%p:apix_get_poll_fd] %s(%d)", ctx, strerror(errno), errno);
+    if (poll_fd != -1) close(poll_fd);
+    if (timer_fd != -1) close(timer_fd);
+    return -1;
+}
+
+#else
+
+static void sync_poll_fd(struct apix *ctx) { UNUSED(ctx); }
+static void unsync_poll_fd(struct stream *stream) { UNUSED(stream); }
+static void arm_poll_timer(struct apix *ctx) { UNUSED(ctx); }
+static void drain_poll_fd(struct apix *ctx) { UNUSED(ctx); }
+
+int apix_get_poll_fd(struct apix *ctx)
+{
+    UNUSED(ctx);
+    return -1;
+}
+
+#endif
+
+/*
+ * poll instead of select where possible, fds past FD_SETSIZE are common on
+ * a broker with many streams
+ */
+int fd_writable(int fd)
+{
+#if defined __unix__ || defined __APPLE__
+    struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+    return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLOUT);
+#else
+    struct timeval tv = { 0, 0 };
+    fd_set sendfds;
+    FD_ZERO(&sendfds);
+    FD_SET(fd, &sendfds);
+    return select(fd + 1, NULL, &sendfds, NULL, &tv) == 1;
+#endif
+}
+
 static int apix_poll(struct apix *ctx)
 {
     ctx->poll_cnt = 0;
+    ctx->poll_seq++;
     gettimeofday(&ctx->poll_ts, NULL);
 
+    // run requests posted by other threads
+    if (ctx->post_tail != &ctx->post_stub ||
+        __atomic_load_n(&ctx->post_stub.next, __ATOMIC_ACQUIRE))
+        run_posts(ctx);
+
     // poll each sink
     struct sink *pos_sink;
     list_for_each_entry(pos_sink, &ctx->sinks, ln) {
@@ -463,6 +1325,9 @@ static int apix_poll(struct apix *ctx)
         }
     }
 
+    if (!list_empty(&ctx->calls))
+        timeout_srrp_calls(ctx);
+
     // clean & sync & send & parse each streams
     struct stream *pos_fd, *n;
     list_for_each_entry_safe(pos_fd, n, &ctx->streams, ln_ctx) {
@@ -478,28 +1343,26 @@ static int apix_poll(struct apix *ctx)
             sync_nodeid(pos_fd);
         }
 
+        // give up a cut through stalled in the middle
+        if (pos_fd->cut_head &&
+            pos_fd->ts_poll_recv.tv_sec + PARSE_PACKET_TIMEOUT / 1000 < time(0)) {
+            LOG_DEBUG("[%p:apix_poll] #%d cut through timeout", ctx, pos_fd->fd);
+            cut_abort(pos_fd);
+        }
+
         // send txbuf to system buffer
-        struct timeval tv = { 0, 0 };
-        fd_set sendfds;
-        FD_ZERO(&sendfds);
-        FD_SET(pos_fd->fd, &sendfds);
-        int rc = select(pos_fd->fd + 1, NULL, &sendfds, NULL, &tv);
-        FD_CLR(pos_fd->fd, &sendfds);
-        if (rc == 1) {
-            if (vsize(pos_fd->txbuf)) {
-                int nr = apix_send(
-                    pos_fd, vraw(pos_fd->txbuf), vsize(pos_fd->txbuf));
-                if (nr > 0) assert((u32)nr <= vsize(pos_fd->txbuf));
+        if (stream_tx_size(pos_fd) && fd_writable(stream_tx_fd(pos_fd))) {
+            int nr = apix_send(
+                pos_fd, vraw(pos_fd->txbuf), vsize(pos_fd->txbuf));
+            if (nr > 0) {
+                assert((u32)nr <= vsize(pos_fd->txbuf));
                 vdrop(pos_fd->txbuf, nr);
             }
         }
 
-        // parse rxbuf to srrp_packet
-        // FIXME: timercmp will fail when ntpdate just time in large diff sec
-        //if (timercmp(&ctx->poll_ts, &pos_fd->ts_poll_recv, <) &&
-        //    vsize(pos_fd->rxbuf) && pos_fd->ev.bits.pollin) {
-        if (timercmp(&ctx->poll_ts, &pos_fd->ts_poll_recv, <)) {
-            assert(vsize(pos_fd->rxbuf));
+        // parse rxbuf to srrp_packet, if received in this pass
+        if (pos_fd->rx_poll_seq == ctx->poll_seq) {
+            assert(stream_rx_size(pos_fd));
             assert(pos_fd->ev.bits.pollin);
             ctx->poll_cnt++;
 
@@ -510,19 +1373,161 @@ static int apix_poll(struct apix *ctx)
 
         handle_message(pos_fd);
         clear_finished_message(pos_fd);
+        stream_release_bufs(pos_fd);
     }
 
+    // submit what streams queued in this pass, e.g. io_uring sends
+    list_for_each_entry(pos_sink, &ctx->sinks, ln) {
+        if (pos_sink->ops.flush)
+            pos_sink->ops.flush(pos_sink);
+    }
+
+    if (ctx->poll_fd != -1)
+        sync_poll_fd(ctx);
+
     //LOG_TRACE("[%p:apix_poll] poll_cnt:%d", ctx, ctx->poll_cnt);
     return 0;
 }
 
+/*
+ * Block until a stream is readable, or writable with tx or a file pending, a
+ * post is queued or usec passed. A relay src backed up on its dst waits on
+ * the dst. The pollfds are kept on ctx & only rebuilt when streams change.
+ */
+static void wait_ctx(struct apix *ctx, u64 usec)
+{
+#if defined __unix__ || defined __APPLE__
+    if (ctx->idle_pfds == NULL || ctx->idle_pfds_gen != ctx->streams_gen) {
+        u32 nfds = 1;
+        struct stream *pos;
+        list_for_each_entry(pos, &ctx->streams, ln_ctx)
+            nfds += 3;
+
+        struct pollfd *pfds = mem_realloc(ctx->idle_pfds, nfds * sizeof(*pfds));
+        if (pfds == NULL) {
+            sleep_ctx(ctx, usec);
+            return;
+        }
+        ctx->idle_pfds = pfds;
+        ctx->nr_idle_pfds = nfds;
+        ctx->idle_pfds_gen = ctx->streams_gen;
+    }
+
+    // negative fds are ignored by poll
+    struct pollfd *pfds = ctx->idle_pfds;
+    pfds[0] = (struct pollfd){ .fd = ctx->event_fd, .events = POLLIN };
+    u32 i = 1;
+    struct stream *pos;
+    list_for_each_entry(pos, &ctx->streams, ln_ctx) {
+        int alive = pos->fd >= 0 && !pos->ev.bits.close;
+        // a relay src is not read while dst is backed up, wait on dst instead
+        struct stream *dst = pos->relay_dst;
+        int backed_up = alive && dst &&
+            (pos->relay_left || stream_tx_size(dst) ||
+             !fd_writable(stream_tx_fd(dst)));
+        pfds[i++] = (struct pollfd){
+            .fd = alive && !backed_up ? pos->fd : -1, .events = POLLIN };
+        pfds[i++] = (struct pollfd){
+            .fd = alive && (stream_tx_size(pos) || pos->tx_file) ?
+                stream_tx_fd(pos) : -1,
+            .events = POLLOUT };
+        pfds[i++] = (struct pollfd){
+            .fd = backed_up ? stream_tx_fd(dst) : -1, .events = POLLOUT };
+    }
+
+    if (poll(pfds, ctx->nr_idle_pfds, (usec + 999) / 1000) > 0 &&
+        ctx->event_fd != -1 && (pfds[0].revents & POLLIN)) {
+        u64 cnt;
+        ssize_t nr = read(ctx->event_fd, &cnt, sizeof(cnt));
+        UNUSED(nr);
+    }
+#else
+    sleep_ctx(ctx, usec);
+#endif
+}
+
+/*
+ * Shorten usec to the nearest deadline of apix_srrp_call, com rx gap or the
+ * due_ts of a stream.
+ */
+static u64 clamp_to_deadlines(struct apix *ctx, u64 usec)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    struct srrp_call *pos;
+    list_for_each_entry(pos, &ctx->calls, ln) {
+        if (pos->timeout_ms == 0)
+            continue;
+        if (!timercmp(&now, &pos->deadline, <))
+            return 0;
+        struct timeval left;
+        timersub(&pos->deadline, &now, &left);
+        u64 left_usec = (u64)left.tv_sec * 1000000 + left.tv_usec;
+        if (left_usec < usec)
+            usec = left_usec;
+    }
+
+    struct stream *stream;
+    list_for_each_entry(stream, &ctx->streams, ln_ctx) {
+        if (!timerisset(&stream->rx_gap_ts))
+            continue;
+        struct timeval elapsed;
+        timersub(&now, &stream->rx_gap_ts, &elapsed);
+        u64 elapsed_usec = (u64)elapsed.tv_sec * 1000000 + elapsed.tv_usec;
+        if (elapsed_usec >= stream->rx_gap_usec)
+            return 0;
+        if (stream->rx_gap_usec - elapsed_usec < usec)
+            usec = stream->rx_gap_usec - elapsed_usec;
+    }
+
+    list_for_each_entry(stream, &ctx->streams, ln_ctx) {
+        if (!timerisset(&stream->due_ts))
+            continue;
+        if (!timercmp(&now, &stream->due_ts, <))
+            return 0;
+        struct timeval left;
+        timersub(&stream->due_ts, &now, &left);
+        u64 left_usec = (u64)left.tv_sec * 1000000 + left.tv_usec;
+        if (left_usec < usec)
+            usec = left_usec;
+    }
+
+    return usec;
+}
+
+/*
+ * Spin until busy_poll_usec passed without data, then block on readiness.
+ */
+static void busy_idle(struct apix *ctx)
+{
+    if (ctx->poll_cnt) {
+        ctx->busy_ts = ctx->poll_ts;
+        return;
+    }
+
+    struct timeval now, elapsed;
+    gettimeofday(&now, NULL);
+    timersub(&now, &ctx->busy_ts, &elapsed);
+    if ((u64)elapsed.tv_sec * 1000000 + elapsed.tv_usec < ctx->busy_poll_usec)
+        return;
+
+    wait_ctx(ctx, clamp_to_deadlines(ctx, ctx->idle_usec_max));
+    gettimeofday(&ctx->busy_ts, NULL);
+}
+
 static void apix_idle(struct apix *ctx)
 {
-    if (ctx->idle_usec_max == 0)
+    if (ctx->idle_usec_max == 0 || ctx->poll_fd != -1)
         return;
 
+    if (ctx->busy_poll_usec) {
+        busy_idle(ctx);
+        return;
+    }
+
     if (ctx->poll_cnt == 0) {
-        usleep(ctx->idle_usec);
+        sleep_ctx(ctx, clamp_to_deadlines(ctx, ctx->idle_usec));
         if (ctx->idle_usec != ctx->idle_usec_max) {
             ctx->idle_usec += ctx->idle_usec_max / 10;
             if (ctx->idle_usec > ctx->idle_usec_max)
@@ -533,27 +1538,12 @@ static void apix_idle(struct apix *ctx)
     }
 }
 
-struct stream *apix_wait_stream(struct apix *ctx)
-{
-    apix_poll(ctx);
-
-    struct stream *pos;
-    list_for_each_entry(pos, &ctx->streams, ln_ctx) {
-        if (pos->ev.byte != 0) {
-            return pos;
-        }
-    }
-
-    apix_idle(ctx);
-    return NULL;
-}
-
-u8 apix_wait_event(struct stream *stream)
+/*
+ * Take the next event of stream raised by the last poll, AEC_SRRP_PACKET
+ * stays until all waiting packets are taken.
+ */
+static u8 take_event(struct stream *stream)
 {
-    apix_poll(stream->ctx);
-
-    //LOG_TRACE("[%p:apix_wait_event] #%d event %d", ctx, stream->fd, stream->ev.byte);
-
     if (stream->ev.bits.open) {
         stream->ev.bits.open = 0;
         return AEC_OPEN;
@@ -588,10 +1578,111 @@ u8 apix_wait_event(struct stream *stream)
         }
     }
 
-    apix_idle(stream->ctx);
     return AEC_NONE;
 }
 
+struct stream *apix_dispatch(struct apix *ctx)
+{
+    if (ctx->poll_fd != -1)
+        drain_poll_fd(ctx);
+
+    apix_poll(ctx);
+
+    struct stream *pos;
+    list_for_each_entry(pos, &ctx->streams, ln_ctx) {
+        if (pos->ev.byte != 0) {
+            // stay readable until all events are dispatched
+            if (ctx->poll_fd != -1)
+                wakeup_ctx(ctx);
+            break;
+        }
+    }
+
+    if (ctx->poll_fd != -1)
+        arm_poll_timer(ctx);
+
+    return &pos->ln_ctx == &ctx->streams ? NULL : pos;
+}
+
+int apix_dispatch_events(struct apix *ctx, struct apix_stream_event *evs, u32 max)
+{
+    if (ctx->poll_fd != -1)
+        drain_poll_fd(ctx);
+
+    apix_poll(ctx);
+
+    u32 nr = 0;
+    struct stream *pos;
+    list_for_each_entry(pos, &ctx->streams, ln_ctx) {
+        while (nr != max && pos->ev.byte != 0) {
+            u8 code = take_event(pos);
+            if (code == AEC_NONE)
+                break;
+
+            if (code != AEC_SRRP_PACKET) {
+                evs[nr].stream = pos;
+                evs[nr].fd = pos->fd;
+                evs[nr].code = code;
+                evs[nr].pac = NULL;
+                nr++;
+                continue;
+            }
+
+            struct message *msg;
+            list_for_each_entry(msg, &pos->msgs, ln) {
+                if (nr == max)
+                    break;
+                if (msg->state != MESSAGE_ST_WAITING)
+                    continue;
+                message_finish(msg);
+                evs[nr].stream = pos;
+                evs[nr].fd = pos->fd;
+                evs[nr].code = AEC_SRRP_PACKET;
+                evs[nr].pac = msg->pac;
+                srrp_get_header(msg->pac, &evs[nr].hdr);
+                nr++;
+            }
+        }
+        if (nr == max)
+            break;
+    }
+
+    if (ctx->poll_fd != -1) {
+        // stay readable until all events are dispatched
+        if (nr == max)
+            wakeup_ctx(ctx);
+        arm_poll_timer(ctx);
+    }
+    return nr;
+}
+
+struct stream *apix_wait_stream(struct apix *ctx)
+{
+    apix_poll(ctx);
+
+    struct stream *pos;
+    list_for_each_entry(pos, &ctx->streams, ln_ctx) {
+        if (pos->ev.byte != 0) {
+            return pos;
+        }
+    }
+
+    apix_idle(ctx);
+    return NULL;
+}
+
+u8 apix_wait_event(struct stream *stream)
+{
+    apix_poll(stream->ctx);
+
+    //LOG_TRACE("[%p:apix_wait_event] #%d event %d", ctx, stream->fd, stream->ev.byte);
+
+    u8 code = take_event(stream);
+    if (code == AEC_NONE)
+        apix_idle(stream->ctx);
+    return code;
+}
+
 struct srrp_packet *apix_wait_srrp_packet(struct stream *stream)
 {
     apix_poll(stream->ctx);
@@ -608,11 +1699,36 @@ struct srrp_packet *apix_wait_srrp_packet(struct stream *stream)
     return NULL;
 }
 
+int apix_wait_srrp_packets(struct stream *stream, struct srrp_packet **pacs,
+                           struct srrp_header *hdrs, u32 max)
+{
+    apix_poll(stream->ctx);
+
+    u32 nr = 0;
+    struct message *pos;
+    list_for_each_entry(pos, &stream->msgs, ln) {
+        if (nr == max)
+            break;
+        if (pos->state == MESSAGE_ST_WAITING) {
+            message_finish(pos);
+            pacs[nr] = pos->pac;
+            if (hdrs)
+                srrp_get_header(pos->pac, &hdrs[nr]);
+            nr++;
+        }
+    }
+
+    if (nr == 0)
+        apix_idle(stream->ctx);
+    return nr;
+}
+
 int apix_upgrade_to_srrp(struct stream *stream, const char *nodeid)
 {
     stream->srrp_mode = 1;
     assert(nodeid != NULL);
-    stream->l_nodeid = str_new(nodeid);
+    atom_put(stream->l_nodeid);
+    stream->l_nodeid = atom_new(nodeid);
     return 0;
 }
 
@@ -628,21 +1744,26 @@ void apix_srrp_forward(struct stream *stream, struct srrp_packet *pac)
     assert(false);
 }
 
-static void __apix_srrp_send(
-    struct stream *stream, const struct srrp_packet *pac)
+static int __apix_srrp_send(struct stream *stream, struct srrp_packet *pac)
 {
     u32 idx = 0;
     struct srrp_packet *tmp_pac = NULL;
 
     LOG_TRACE("[%p:__apix_srrp_send] send:%s", stream->ctx, srrp_get_raw(pac));
+    PROBE4(apix, srrp_send, stream->fd, srrp_get_anchor(pac),
+           srrp_get_payload_len(pac), srrp_get_packet_len(pac));
 
     // payload_len < cnt, maybe zero, should not remove this code
     if (srrp_get_payload_len(pac) < PAYLOAD_LIMIT) {
-        apix_send_to_buffer(stream, srrp_get_raw(pac), srrp_get_packet_len(pac));
-        return;
+        srrp_set_integrity(pac, stream->tx_integrity);
+        return apix_send_to_buffer(stream, srrp_get_raw(pac), srrp_get_packet_len(pac));
     }
 
-    // payload_len > cnt, can't be zero
+    // payload_len > cnt, can't be zero, a slice failing takes the ones queued
+    // before it back, so no message goes out cut short
+    vec_t *queue = stream->cut_src || stream->tx_file ?
+        stream->cut_held : stream->txbuf;
+    u32 queued = queue ? vsize(queue) : 0;
     while (idx != srrp_get_payload_len(pac)) {
         u32 tmp_cnt = srrp_get_payload_len(pac) - idx;
         u8 fin = 0;
@@ -652,19 +1773,26 @@ static void __apix_srrp_send(
         } else {
             fin = SRRP_FIN_1;
         };
-        tmp_pac = srrp_new(srrp_get_leader(pac),
-                       fin,
-                       srrp_get_srcid(pac),
-                       srrp_get_dstid(pac),
-                       srrp_get_anchor(pac),
-                       srrp_get_payload(pac) + idx,
-                       tmp_cnt);
+        tmp_pac = srrp_new_slice(pac, fin, idx, tmp_cnt, stream->tx_integrity);
+        if (tmp_pac == NULL)
+            goto rollback;
         LOG_TRACE("[%p:__apix_srrp_send] split:%s", stream->ctx, srrp_get_raw(tmp_pac));
-        apix_send_to_buffer(stream, srrp_get_raw(tmp_pac),
-                            srrp_get_packet_len(tmp_pac));
+        PROBE4(apix, srrp_slice, stream->fd, idx, tmp_cnt, fin);
+        int rc = apix_send_to_buffer(stream, srrp_get_raw(tmp_pac),
+                                     srrp_get_packet_len(tmp_pac));
         idx += tmp_cnt;
         srrp_free(tmp_pac);
+        if (rc != 0)
+            goto rollback;
     }
+    return 0;
+
+rollback:
+    queue = stream->cut_src || stream->tx_file ?
+        stream->cut_held : stream->txbuf;
+    if (queue && vsize(queue) > queued)
+        vremove(queue, queued, vsize(queue) - queued);
+    return -1;
 }
 
 int apix_srrp_send(struct stream *stream, struct srrp_packet *pac)
@@ -672,24 +1800,59 @@ int apix_srrp_send(struct stream *stream, struct srrp_packet *pac)
     int retval = -1;
 
     // send to src stream
-    if (stream->type != STREAM_T_LISTEN) {
-        __apix_srrp_send(stream, pac);
+    if (stream->type != STREAM_T_LISTEN && __apix_srrp_send(stream, pac) == 0)
         retval = 0;
-    }
 
     // send to nodeid
     if (srrp_get_dstid(pac) != 0) {
         struct stream *nd_stream =
-            find_stream_by_r_nodeid(stream->ctx, srrp_get_dstid(pac));
-        if (nd_stream && nd_stream != stream) {
-            __apix_srrp_send(nd_stream, pac);
+            find_stream_by_r_nodeid(stream->ctx, srrp_get_dstid_atom(pac));
+        if (nd_stream && nd_stream != stream && __apix_srrp_send(nd_stream, pac) == 0)
             retval = 0;
-        }
     }
 
     return retval;
 }
 
+int apix_srrp_call(struct stream *stream, struct srrp_packet *pac,
+                   apix_srrp_call_func_t func, void *arg, u32 timeout_ms)
+{
+    assert(func);
+
+    if (srrp_get_leader(pac) != SRRP_REQUEST_LEADER)
+        return -1;
+
+    struct apix *ctx = stream->ctx;
+    if (++ctx->seqno == 0)
+        ctx->seqno = 1;
+    srrp_set_seqno(pac, ctx->seqno);
+
+    struct srrp_call *call = mem_calloc(1, sizeof(*call));
+    if (call == NULL)
+        return -1;
+    if (apix_srrp_send(stream, pac) != 0) {
+        mem_free(call);
+        return -1;
+    }
+    call->seqno = ctx->seqno;
+    call->stream = stream;
+    call->srcid = atom_get(srrp_get_srcid_atom(pac));
+    call->dstid = atom_get(srrp_get_dstid_atom(pac));
+    call->anchor = atom_get(srrp_get_anchor_atom(pac));
+    call->timeout_ms = timeout_ms;
+    if (timeout_ms) {
+        struct timeval now, tv = {
+            timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+        gettimeofday(&now, NULL);
+        timeradd(&now, &tv, &call->deadline);
+    }
+    call->func = func;
+    call->arg = arg;
+    INIT_LIST_HEAD(&call->ln);
+    list_add_tail(&call->ln, &ctx->calls);
+    return 0;
+}
+
 /**
  * sink
  */
@@ -736,36 +1899,141 @@ void apix_sink_unregister(struct apix *ctx, struct sink *sink)
     sink->ctx = NULL;
 }
 
+/**
+ * stream buffers
+ * - a stream holds rx and tx buffers only while data is in flight, idle
+ *   streams cost nothing but the struct itself
+ * - drained buffers go back to the per ctx pool, buffers grown beyond
+ *   STREAM_BUF_SIZE by a burst are freed instead of being kept around
+ */
+
+static vec_8_t *buf_get(struct apix *ctx)
+{
+    vec_8_t *buf = NULL;
+    if (ctx->buf_pool && vsize(ctx->buf_pool))
+        vpop(ctx->buf_pool, &buf);
+    else
+        buf = vec_new(1, STREAM_BUF_SIZE);
+    return buf;
+}
+
+static void buf_put(struct apix *ctx, vec_8_t *buf)
+{
+    assert(vsize(buf) == 0);
+    if (vcap(buf) > STREAM_BUF_SIZE || STREAM_BUF_POOL_MAX == 0) {
+        vec_free(buf);
+        return;
+    }
+
+    if (ctx->buf_pool == NULL)
+        ctx->buf_pool = vec_new(sizeof(void *), STREAM_BUF_POOL_MAX);
+    if (vsize(ctx->buf_pool) >= STREAM_BUF_POOL_MAX) {
+        vec_free(buf);
+        return;
+    }
+    vpush(ctx->buf_pool, &buf);
+}
+
+static int buf_append(struct apix *ctx, vec_8_t **buf, const void *data, u32 len)
+{
+    if (*buf == NULL && (*buf = buf_get(ctx)) == NULL)
+        return -1;
+#ifdef STREAM_BUF_MAX
+    if (vsize(*buf) + len > STREAM_BUF_MAX)
+        return -1;
+#endif
+    if (vreserve(*buf, len) != 0)
+        return -1;
+    vpack(*buf, data, len);
+    return 0;
+}
+
+int stream_rx_append(struct stream *stream, const void *buf, u32 len)
+{
+    if (buf_append(stream->ctx, &stream->rxbuf, buf, len) != 0) {
+        LOG_RATELIMITED(LOG_LV_ERROR, "[%p:stream_rx_append] #%d rxbuf full, "
+                        "%u bytes dropped", stream->ctx, stream->fd, len);
+        return -1;
+    }
+    return 0;
+}
+
+int stream_tx_append(struct stream *stream, const void *buf, u32 len)
+{
+    return buf_append(stream->ctx, &stream->txbuf, buf, len);
+}
+
+void stream_release_bufs(struct stream *stream)
+{
+    if (stream->rxbuf && vsize(stream->rxbuf) == 0) {
+        buf_put(stream->ctx, stream->rxbuf);
+        stream->rxbuf = NULL;
+    }
+    if (stream->txbuf && vsize(stream->txbuf) == 0) {
+        buf_put(stream->ctx, stream->txbuf);
+        stream->txbuf = NULL;
+    }
+}
+
+void stream_tx_unhold(struct stream *stream)
+{
+    if (stream->cut_held) {
+        stream_tx_append(stream, vraw(stream->cut_held), vsize(stream->cut_held));
+        vec_free(stream->cut_held);
+        stream->cut_held = NULL;
+    }
+}
+
+void stream_set_addr(struct stream *stream, const char *addr)
+{
+    mem_free(stream->addr);
+    stream->addr = mem_strdup(addr);
+}
+
+MEM_POOL(stream_pool, struct stream, APIX_MAX_STREAMS);
+
 struct stream *stream_new(struct sink *sink)
 {
-    struct stream *stream = malloc(sizeof(struct stream));
-    memset(stream, 0, sizeof(*stream));
+    struct stream *stream = mem_pool_alloc(&stream_pool);
+    if (stream == NULL) {
+        LOG_ERROR("[%p:stream_new] out of streams", sink->ctx);
+        return NULL;
+    }
 
     stream->fd = -1;
+    stream->tx_fd = -1;
+    stream->relay_pipe[0] = -1;
+    stream->relay_pipe[1] = -1;
+    stream->rx_file_fd = -1;
     stream->father = NULL;
     stream->type = 0;
     stream->state = STREAM_ST_NONE;
     stream->ts_sync_in = 0;
     stream->ts_sync_out = 0;
 
-    stream->txbuf = vec_new(1, 2048);
-    stream->rxbuf = vec_new(1, 2048);
+    stream->txbuf = NULL;
+    stream->rxbuf = NULL;
 
     stream->ev.byte = 0;
     stream->ev.bits.open = 1;
 
     stream->srrp_mode = 0;
-    stream->l_nodeid = str_new("");
-    stream->r_nodeid = str_new("");
-    stream->sub_topics = vec_new(sizeof(void *), 3);
+    stream->integrity = SRRP_INTEGRITY_CRC16;
+    stream->tx_integrity = SRRP_INTEGRITY_CRC16;
+    stream->l_nodeid = NULL;
+    stream->r_nodeid = NULL;
+    stream->sub_topics = NULL;
     stream->rxpac_unfin = NULL;
+    stream->addr = NULL;
     INIT_LIST_HEAD(&stream->msgs);
 
     stream->ctx = sink->ctx;
     stream->sink = sink;
+    stream->id = ++sink->ctx->stream_ids;
     INIT_LIST_HEAD(&stream->ln_ctx);
     INIT_LIST_HEAD(&stream->ln_sink);
     list_add(&stream->ln_ctx, &sink->ctx->streams);
+    sink->ctx->streams_gen++;
     list_add(&stream->ln_sink, &sink->streams);
 
     return stream;
@@ -780,28 +2048,72 @@ void stream_free(struct stream *stream)
 
     assert(stream->state == STREAM_ST_FINISHED);
 
-    vec_free(stream->txbuf);
-    vec_free(stream->rxbuf);
+    unsync_poll_fd(stream);
+
+    if (stream->txbuf)
+        vec_free(stream->txbuf);
+    if (stream->rxbuf)
+        vec_free(stream->rxbuf);
 
-    str_free(stream->l_nodeid);
-    str_free(stream->r_nodeid);
+    atom_put(stream->l_nodeid);
+    atom_put(stream->r_nodeid);
 
-    while (vsize(stream->sub_topics)) {
-        str_t *tmp = 0;
-        vpop(stream->sub_topics, &tmp);
-        str_free(tmp);
+    if (stream->sub_topics) {
+        while (vsize(stream->sub_topics)) {
+            atom_t *tmp = NULL;
+            vpop(stream->sub_topics, &tmp);
+            atom_put(tmp);
+        }
+        vec_free(stream->sub_topics);
+    }
+    mem_free(stream->addr);
+
+    if (stream->cut_head)
+        cut_abort(stream);
+    if (stream->cut_src)
+        stream->cut_src->cut_dst = NULL;
+    if (stream->cut_held)
+        vec_free(stream->cut_held);
+
+    if (stream->relay_dst)
+        stream->relay_dst->relay_src = NULL;
+    if (stream->relay_src)
+        stream->relay_src->relay_dst = NULL;
+    if (stream->relay_pipe[0] != -1) {
+        close(stream->relay_pipe[0]);
+        close(stream->relay_pipe[1]);
     }
-    vec_free(stream->sub_topics);
+
+    atom_put(stream->rx_file_anchor);
+    if (stream->rx_file_head)
+        srrp_free(stream->rx_file_head);
+#if defined __unix__ || defined __APPLE__
+    if (stream->tx_file)
+        file_tx_free(stream->tx_file);
+#endif
 
     struct message *pos, *n;
     list_for_each_entry_safe(pos, n, &stream->msgs, ln)
         message_free(pos);
 
+    // detached first, func may close other streams & finish their calls
+    LIST_HEAD(calls);
+    struct srrp_call *call, *call_n;
+    list_for_each_entry_safe(call, call_n, &stream->ctx->calls, ln) {
+        if (call->stream == stream)
+            list_move_tail(&call->ln, &calls);
+    }
+    while (!list_empty(&calls)) {
+        call = list_first_entry(&calls, struct srrp_call, ln);
+        srrp_call_finish(call, NULL);
+    }
+
+    stream->ctx->streams_gen++;
     stream->ctx = NULL;
     stream->sink = NULL;
     list_del_init(&stream->ln_sink);
     list_del_init(&stream->ln_ctx);
-    free(stream);
+    mem_pool_free(&stream_pool, stream);
 }
 
 struct stream *find_stream_in_apix(struct apix *ctx, int fd)
@@ -824,35 +2136,45 @@ struct stream *find_stream_in_sink(struct sink *sink, int fd)
     return NULL;
 }
 
-struct stream *find_stream_by_l_nodeid(struct apix *ctx, const char *nodeid)
+struct stream *find_stream_by_l_nodeid(struct apix *ctx, atom_t *nodeid)
 {
     if (nodeid == NULL) return NULL;
     struct stream *pos, *n;
     list_for_each_entry_safe(pos, n, &ctx->streams, ln_ctx) {
-        if (strcmp(sget(pos->l_nodeid), nodeid) == 0)
+        if (pos->l_nodeid == nodeid)
             return pos;
     }
     return NULL;
 }
 
-struct stream *find_stream_by_r_nodeid(struct apix *ctx, const char *nodeid)
+struct stream *find_stream_by_r_nodeid(struct apix *ctx, atom_t *nodeid)
 {
     if (nodeid == 0) return NULL;
     struct stream *pos, *n;
     list_for_each_entry_safe(pos, n, &ctx->streams, ln_ctx) {
-        if (strcmp(sget(pos->r_nodeid), nodeid) == 0)
+        if (pos->r_nodeid == nodeid)
             return pos;
     }
     return NULL;
 }
 
-struct stream *find_stream_by_nodeid(struct apix *ctx, const char *nodeid)
+struct stream *find_stream_by_id(struct apix *ctx, u32 id)
+{
+    struct stream *pos;
+    list_for_each_entry(pos, &ctx->streams, ln_ctx) {
+        if (pos->id == id)
+            return pos->state != STREAM_ST_FINISHED && !pos->ev.bits.close
+                ? pos : NULL;
+    }
+    return NULL;
+}
+
+struct stream *find_stream_by_nodeid(struct apix *ctx, atom_t *nodeid)
 {
     if (nodeid == 0) return NULL;
     struct stream *pos, *n;
     list_for_each_entry_safe(pos, n, &ctx->streams, ln_ctx) {
-        if (strcmp(sget(pos->l_nodeid), nodeid) == 0 ||
-            strcmp(sget(pos->r_nodeid), nodeid) == 0)
+        if (pos->l_nodeid == nodeid || pos->r_nodeid == nodeid)
             return pos;
     }
     return NULL;
@@ -30,6 +30,7 @@ enum apix_event {
 
 /**
  * apix_new
+ * - NULL if out of memory, with APIX_STATIC_ALLOC past APIX_MAX_CTX
  */
 struct apix *apix_new();
 
@@ -103,6 +104,85 @@ int apix_get_raw_fd(struct stream *stream);
  */
 void apix_set_wait_timeout(struct apix *ctx, u64 usec);
 
+/**
+ * apix_set_busy_poll
+ * - spin_usec: 0 => off, else apix_wait_* never sleep for spin_usec after
+ *   data was last received, then block until a stream is readable or a post
+ *   arrives, instead of sleeping in steps up to the wait timeout
+ */
+int apix_set_busy_poll(struct apix *ctx, u32 spin_usec);
+
+/**
+ * apix_set_sock_busy_poll
+ * - set SO_BUSY_POLL to usec on tcp streams opened or accepted afterwards,
+ *   raising it over net.core.busy_read needs CAP_NET_ADMIN
+ */
+int apix_set_sock_busy_poll(struct apix *ctx, u32 usec);
+
+/**
+ * apix_set_cut_through
+ * - enable: 0 => off, else a sliced request or response routed to a remote
+ *   nodeid is forwarded slice by slice as it arrives instead of being
+ *   reassembled, such messages never show up in apix_wait_srrp_packet
+ * - a message cut off in the middle, by a slice of another message from
+ *   the same source, by a second of silence or by close of the source, is
+ *   ended at dst with an empty FIN_1 slice, so dst gets it truncated
+ */
+int apix_set_cut_through(struct apix *ctx, int enable);
+
+/**
+ * apix_set_integrity
+ * - integrity: SRRP_INTEGRITY_*, the check the peer is asked to put on the
+ *   packets it sends, packets without a check are dropped unless none
+ * - unix streams default to none, others to crc16, streams accepted by a
+ *   listening stream take its mode
+ */
+int apix_set_integrity(struct stream *stream, u8 integrity);
+
+/**
+ * apix_pin_thread
+ * - pin the calling thread, e.g. the one polling ctx, to cpu
+ * - linux only, return -1 on other platforms
+ */
+int apix_pin_thread(int cpu);
+
+/**
+ * apix_get_poll_fd
+ * - return a fd which is readable whenever the ctx has work to do, so a host
+ *   event loop can wait on it and call apix_dispatch instead of apix_wait_*
+ * - apix_wait_* never idle once it is used, block on the fd instead
+ * - linux only, return -1 on other platforms or on failure
+ */
+int apix_get_poll_fd(struct apix *ctx);
+
+/**
+ * apix_dispatch
+ * - a nonblocking apix_wait_stream, call it until it returns NULL
+ */
+struct stream *apix_dispatch(struct apix *ctx);
+
+/**
+ * apix_stream_event
+ * - an event of apix_dispatch_events
+ * - pac & hdr: the packet of AEC_SRRP_PACKET & its header, else NULL
+ */
+struct apix_stream_event {
+    struct stream *stream;
+    int fd;
+    u8 code; /* AEC_* */
+    struct srrp_packet *pac;
+    struct srrp_header hdr;
+};
+
+/**
+ * apix_dispatch_events
+ * - apix_dispatch, apix_wait_event & apix_wait_srrp_packet of every stream
+ *   in one call: poll once, then take up to max events in stream order,
+ *   AEC_SRRP_PACKET once per waiting packet, return how many
+ * - streams & packets stay valid until the next poll of the ctx
+ */
+int apix_dispatch_events(struct apix *ctx, struct apix_stream_event *evs, u32 max);
+
 /**
  * apix_wait_stream
  */
@@ -118,6 +198,17 @@ u8 apix_wait_event(struct stream *stream);
  */
 struct srrp_packet *apix_wait_srrp_packet(struct stream *stream);
 
+/**
+ * apix_wait_srrp_packets
+ * - take up to max packets waiting on stream after one poll, return how
+ *   many, each is what apix_wait_srrp_packet would return in turn
+ * - hdrs: NULL, or max headers filled in as by srrp_get_header
+ * - packets are freed by the next poll of the ctx, as with
+ *   apix_wait_srrp_packet
+ */
+int apix_wait_srrp_packets(struct stream *stream, struct srrp_packet **pacs,
+                           struct srrp_header *hdrs, u32 max);
+
 /**
  * apix_upgrade_to_srrp
  * - enable srrp mode
@@ -136,6 +227,92 @@ void apix_srrp_forward(struct stream *stream, struct srrp_packet *pac);
  */
 int apix_srrp_send(struct stream *stream, struct srrp_packet *pac);
 
+typedef void (*apix_srrp_call_func_t)(
+    struct stream *stream, struct srrp_packet *resp, void *arg);
+
+/**
+ * apix_srrp_call
+ * - send the request with a new seqno set into pac, and call func once with
+ *   the response, or with resp NULL after timeout_ms or when stream closed
+ * - timeout_ms: 0 => wait forever
+ * - responses are matched by seqno, or by srcid, dstid & anchor in sending
+ *   order if the responder does not echo the seqno
+ * - func is called in apix_wait_*, resp is freed after func returns
+ */
+int apix_srrp_call(struct stream *stream, struct srrp_packet *pac,
+                   apix_srrp_call_func_t func, void *arg, u32 timeout_ms);
+
+typedef void (*apix_post_func_t)(struct stream *stream, int rc, void *arg);
+
+/**
+ * apix_post_send
+ * - apix_post_* are lock-free and the only apix calls which may be made from
+ *   threads other than the one polling ctx
+ * - buf is copied and queued by apix_send_to_buffer in the polling thread,
+ *   which wakes up from apix_idle or apix_get_poll_fd at once
+ * - func may be NULL, it is called in the polling thread with the result,
+ *   or with -1 if the stream is closed before, stream is only for telling
+ *   apart and must not be dereferenced then
+ */
+int apix_post_send(struct apix *ctx, struct stream *stream, const u8 *buf, u32 len,
+                   apix_post_func_t func, void *arg);
+
+/**
+ * apix_post_srrp_send
+ * - same as apix_post_send but run apix_srrp_send, pac is owned by apix and
+ *   freed after sent
+ */
+int apix_post_srrp_send(struct apix *ctx, struct stream *stream, struct srrp_packet *pac,
+                        apix_post_func_t func, void *arg);
+
+/**
+ * apix_post_close
+ * - same as apix_post_send but run apix_close
+ */
+int apix_post_close(struct apix *ctx, struct stream *stream,
+                    apix_post_func_t func, void *arg);
+
+typedef void (*apix_post_run_t)(struct apix *ctx, void *arg);
+
+/**
+ * apix_post
+ * - same as apix_post_send but run func in the polling thread, for any
+ *   other apix call on behalf of another thread, e.g. apix_open, apix_ioctl
+ *   or apix_upgrade_to_srrp
+ */
+int apix_post(struct apix *ctx, apix_post_run_t func, void *arg);
+
+/**
+ * apix_srrp_handler_t
+ * - run in a worker thread, req is only valid during the call
+ * - return the response, or NULL for none, it is sent back to the requester
+ *   by the polling thread with the seqno of req if not set, then freed
+ * - must not call apix functions other than apix_post_*
+ */
+typedef struct srrp_packet *(*apix_srrp_handler_t)(
+    const struct srrp_packet *req, void *arg);
+
+/**
+ * apix_enable_workers
+ * - start nr_threads workers, each with a queue of queue_size requests, for
+ *   the handlers registered by apix_srrp_handle
+ * - workers are stopped by apix_drop
+ * - return -1 if enabled already or out of memory, nothing is left started
+ */
+int apix_enable_workers(struct apix *ctx, u32 nr_threads, u32 queue_size);
+
+/**
+ * apix_srrp_handle
+ * - handle requests whose "dstid:anchor" has the longest prefix header in
+ *   workers instead of returning them by apix_wait_srrp_packet
+ * - max_concurrency: 0 => unlimited, else requests over it or over full
+ *   queues are kept pending in the stream until a worker is free
+ * - register again to replace func, arg & max_concurrency
+ * - return -1 without workers or out of memory
+ */
+int apix_srrp_handle(struct apix *ctx, const char *header,
+                     apix_srrp_handler_t func, void *arg, u32 max_concurrency);
+
 #ifdef __cplusplus
 }
 #endif
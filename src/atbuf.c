@@ -1,4 +1,5 @@
 #include "atbuf.h"
+#include "mem.h"
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
@@ -15,12 +16,12 @@ atbuf_t *atbuf_new(size_t size)
     if (size == 0)
         size = ATBUF_DEFAULT_SIZE;
 
-    atbuf_t *self = (atbuf_t*)calloc(sizeof(atbuf_t), 1);
+    atbuf_t *self = (atbuf_t*)mem_calloc(sizeof(atbuf_t), 1);
     if (!self) return NULL;
 
-    self->rawbuf = (char*)calloc(size, 1);
+    self->rawbuf = (char*)mem_calloc(size, 1);
     if (!self->rawbuf) {
-        free(self);
+        mem_free(self);
         return NULL;
     }
 
@@ -34,14 +35,14 @@ atbuf_t *atbuf_new(size_t size)
 void atbuf_delete(atbuf_t *self)
 {
     if (self) {
-        free(self->rawbuf);
-        free(self);
+        mem_free(self->rawbuf);
+        mem_free(self);
     }
 }
 
 int atbuf_realloc(atbuf_t *self, size_t len)
 {
-    void *newbuf = realloc(self->rawbuf, len);
+    void *newbuf = mem_realloc(self->rawbuf, len);
     if (newbuf) {
         self->rawbuf = newbuf;
         self->size = len;
@@ -0,0 +1,182 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "atom.h"
+#include "mem.h"
+#include "unused.h"
+
+#ifdef APIX_STATIC_ALLOC
+// the table never grows, unused atoms give their blocks back early
+#define ATOM_BUCKETS_MIN 64
+#define ATOM_KEEP_MIN 64
+#else
+#define ATOM_BUCKETS_MIN 256
+#define ATOM_KEEP_MIN 4096 /* atoms kept before dropping unused ones */
+#endif
+
+struct atom {
+    struct atom *next;
+    uint32_t hash;
+    int ref;
+    size_t len;
+    char s[];
+};
+
+static struct {
+    char lock;
+    struct atom **buckets;
+    size_t nr_buckets;
+    size_t nr_atoms;
+    size_t keep; /* purge unused atoms when nr_atoms reaches it */
+} table;
+
+static void table_lock(void)
+{
+    while (__atomic_test_and_set(&table.lock, __ATOMIC_ACQUIRE))
+        ;
+}
+
+static void table_unlock(void)
+{
+    __atomic_clear(&table.lock, __ATOMIC_RELEASE);
+}
+
+static uint32_t atom_hash(const char *buf, size_t len)
+{
+    // fnv-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)buf[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void table_resize(size_t nr_buckets)
+{
+    struct atom **buckets = mem_calloc(nr_buckets, sizeof(*buckets));
+    assert(buckets);
+
+    for (size_t i = 0; i < table.nr_buckets; i++) {
+        struct atom *pos = table.buckets[i];
+        while (pos) {
+            struct atom *next = pos->next;
+            size_t idx = pos->hash & (nr_buckets - 1);
+            pos->next = buckets[idx];
+            buckets[idx] = pos;
+            pos = next;
+        }
+    }
+
+    mem_free(table.buckets);
+    table.buckets = buckets;
+    table.nr_buckets = nr_buckets;
+}
+
+static void table_purge(void)
+{
+    for (size_t i = 0; i < table.nr_buckets; i++) {
+        struct atom **pos = &table.buckets[i];
+        while (*pos) {
+            struct atom *atom = *pos;
+            if (__atomic_load_n(&atom->ref, __ATOMIC_ACQUIRE) == 0) {
+                *pos = atom->next;
+                mem_free(atom);
+                table.nr_atoms--;
+            } else {
+                pos = &atom->next;
+            }
+        }
+    }
+
+    table.keep = table.nr_atoms * 2;
+    if (table.keep < ATOM_KEEP_MIN)
+        table.keep = ATOM_KEEP_MIN;
+}
+
+atom_t *atom_new(const char *s)
+{
+    return atom_new_len(s, strlen(s));
+}
+
+atom_t *atom_new_len(const void *buf, size_t len)
+{
+    if (len == 0)
+        return NULL;
+
+    uint32_t hash = atom_hash(buf, len);
+
+    table_lock();
+
+    if (table.buckets) {
+        struct atom *pos = table.buckets[hash & (table.nr_buckets - 1)];
+        for (; pos; pos = pos->next) {
+            if (pos->hash == hash && pos->len == len && memcmp(pos->s, buf, len) == 0) {
+                __atomic_add_fetch(&pos->ref, 1, __ATOMIC_RELAXED);
+                table_unlock();
+                return pos;
+            }
+        }
+    } else {
+        table_resize(ATOM_BUCKETS_MIN);
+        table.keep = ATOM_KEEP_MIN;
+    }
+
+    if (table.nr_atoms >= table.keep)
+        table_purge();
+#ifndef APIX_STATIC_ALLOC
+    if (table.nr_atoms >= table.nr_buckets)
+        table_resize(table.nr_buckets * 2);
+#endif
+
+    struct atom *atom = mem_alloc(sizeof(*atom) + len + 1);
+    if (atom == NULL) {
+        // out of blocks, drop the unused atoms and try once more
+        table_purge();
+        atom = mem_alloc(sizeof(*atom) + len + 1);
+        if (atom == NULL) {
+            table_unlock();
+            return NULL;
+        }
+    }
+    atom->hash = hash;
+    atom->ref = 1;
+    atom->len = len;
+    memcpy(atom->s, buf, len);
+    atom->s[len] = 0;
+
+    size_t idx = hash & (table.nr_buckets - 1);
+    atom->next = table.buckets[idx];
+    table.buckets[idx] = atom;
+    table.nr_atoms++;
+
+    table_unlock();
+    return atom;
+}
+
+atom_t *atom_get(atom_t *self)
+{
+    if (self)
+        __atomic_add_fetch(&self->ref, 1, __ATOMIC_RELAXED);
+    return self;
+}
+
+void atom_put(atom_t *self)
+{
+    if (self) {
+        int ref = __atomic_sub_fetch(&self->ref, 1, __ATOMIC_RELEASE);
+        assert(ref >= 0);
+        UNUSED(ref);
+    }
+}
+
+const char *atom_str(atom_t *self)
+{
+    return self ? self->s : "";
+}
+
+size_t atom_len(atom_t *self)
+{
+    return self ? self->len : 0;
+}
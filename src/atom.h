@@ -0,0 +1,36 @@
+#ifndef __ATOM_H
+#define __ATOM_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * atom
+ * - interned, refcounted string shared by every holder of the same content,
+ *   so two atoms are equal only if they are the same pointer
+ * - the empty string is the NULL atom, atom_new returns NULL as well when
+ *   it is out of memory
+ * - thread safe, atoms dropped to zero refs stay in the table for reuse
+ *   until the table grows too large
+ */
+
+typedef struct atom atom_t;
+
+atom_t *atom_new(const char *s);
+atom_t *atom_new_len(const void *buf, size_t len);
+
+/* Take another ref of self. */
+atom_t *atom_get(atom_t *self);
+void atom_put(atom_t *self);
+
+const char *atom_str(atom_t *self);
+size_t atom_len(atom_t *self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef _CRC_CRC32C_H
+#define _CRC_CRC32C_H
+
+#include "types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus  */
+
+u32 crc32c(const u8 *buf, int len);
+u32 crc32c_crc(u32 crc, const u8 *buf, int len);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus  */
+#endif
@@ -0,0 +1,408 @@
+#include <stdlib.h>
+#include <string.h>
+#include "isotp.h"
+#include "mem.h"
+
+#define PCI_SF 0x00
+#define PCI_FF 0x10
+#define PCI_CF 0x20
+#define PCI_FC 0x30
+
+#define FC_CTS 0
+#define FC_WAIT 1
+#define FC_OVFLW 2
+
+enum isotp_tx_state {
+    TX_IDLE = 0,
+    TX_FIRST, /* single or first frame not out yet */
+    TX_WAIT_FC,
+    TX_CF,
+};
+
+struct isotp {
+    u8 frame_size;
+
+    // sending side
+    int tx_state; /* isotp_tx_state */
+    u8 *tx_buf;
+    u32 tx_len;
+    u32 tx_off;
+    u8 tx_sn;
+    u8 tx_bs; /* asked by the peer, 0 => no limit */
+    u8 tx_bs_left;
+    u32 tx_st_min; /* usec between consecutive frames, asked by the peer */
+    u64 tx_next; /* earliest time of the next consecutive frame */
+    u64 tx_deadline; /* of the flow control we wait for */
+
+    // receiving side
+    u8 *rx_buf;
+    u32 rx_cap;
+    u32 rx_len; /* 0 => idle */
+    u32 rx_off;
+    u8 rx_sn;
+    u8 rx_bs_left;
+    u64 rx_deadline; /* of the next consecutive frame */
+    u8 bs; /* asked of the peer */
+    u8 st_min;
+    int fc_pending; /* FC_*, -1 => none */
+    u32 msg_len; /* completed message in rx_buf */
+
+    // state before the last isotp_poll_frame, see isotp_unpoll_frame
+    struct {
+        int tx_state;
+        u32 tx_off;
+        u8 tx_sn;
+        u8 tx_bs_left;
+        u64 tx_next;
+        u64 tx_deadline;
+        int fc_pending;
+    } polled;
+};
+
+struct isotp *isotp_new(u8 frame_size)
+{
+    if (frame_size != ISOTP_FRAME_CAN && frame_size != ISOTP_FRAME_CANFD)
+        return NULL;
+
+    struct isotp *tp = mem_calloc(1, sizeof(*tp));
+    if (tp == NULL)
+        return NULL;
+    tp->frame_size = frame_size;
+    tp->fc_pending = -1;
+    return tp;
+}
+
+void isotp_free(struct isotp *tp)
+{
+    mem_free(tp->tx_buf);
+    mem_free(tp->rx_buf);
+    mem_free(tp);
+}
+
+void isotp_set_flow(struct isotp *tp, u8 block_size, u8 st_min)
+{
+    tp->bs = block_size;
+    tp->st_min = st_min;
+}
+
+static u32 st_min_usec(u8 st_min)
+{
+    if (st_min <= 0x7f)
+        return st_min * 1000;
+    if (st_min >= 0xf1 && st_min <= 0xf9)
+        return (st_min - 0xf0) * 100;
+    return 0x7f * 1000; /* reserved, take the longest */
+}
+
+/* Pad to 8, or to the next CAN FD dlc. */
+static u8 frame_pad(u8 *frame, u8 len)
+{
+    static const u8 dlcs[] = { 8, 12, 16, 20, 24, 32, 48, 64 };
+    u8 padded = 64;
+    for (u32 i = 0; i < sizeof(dlcs); i++) {
+        if (len <= dlcs[i]) {
+            padded = dlcs[i];
+            break;
+        }
+    }
+    memset(frame + len, ISOTP_PAD, padded - len);
+    return padded;
+}
+
+/*
+ * sending side
+ */
+
+int isotp_send(struct isotp *tp, const u8 *buf, u32 len)
+{
+    if (tp->tx_state != TX_IDLE || len == 0 || len > ISOTP_MSG_MAX)
+        return -1;
+
+    u8 *tx_buf = mem_realloc(tp->tx_buf, len);
+    if (tx_buf == NULL)
+        return -1;
+    memcpy(tx_buf, buf, len);
+    tp->tx_buf = tx_buf;
+    tp->tx_len = len;
+    tp->tx_off = 0;
+    tp->tx_state = TX_FIRST;
+    return 0;
+}
+
+int isotp_tx_busy(struct isotp *tp)
+{
+    return tp->tx_state != TX_IDLE;
+}
+
+static int poll_first(struct isotp *tp, u64 now, u8 *frame)
+{
+    u32 len = tp->tx_len;
+
+    // single frame, the classic form if it fits, else the CAN FD escape
+    if (len <= 7) {
+        frame[0] = PCI_SF | len;
+        memcpy(frame + 1, tp->tx_buf, len);
+        tp->tx_state = TX_IDLE;
+        return frame_pad(frame, 1 + len);
+    }
+    if (len <= (u32)tp->frame_size - 2 && tp->frame_size > ISOTP_FRAME_CAN) {
+        frame[0] = PCI_SF;
+        frame[1] = len;
+        memcpy(frame + 2, tp->tx_buf, len);
+        tp->tx_state = TX_IDLE;
+        return frame_pad(frame, 2 + len);
+    }
+
+    u32 hdr;
+    if (len <= 0xfff) {
+        frame[0] = PCI_FF | (len >> 8);
+        frame[1] = len & 0xff;
+        hdr = 2;
+    } else {
+        frame[0] = PCI_FF;
+        frame[1] = 0;
+        frame[2] = len >> 24;
+        frame[3] = len >> 16;
+        frame[4] = len >> 8;
+        frame[5] = len;
+        hdr = 6;
+    }
+    u32 nr = tp->frame_size - hdr;
+    memcpy(frame + hdr, tp->tx_buf, nr);
+    tp->tx_off = nr;
+    tp->tx_sn = 1;
+    tp->tx_state = TX_WAIT_FC;
+    tp->tx_deadline = now + ISOTP_TIMEOUT;
+    return tp->frame_size;
+}
+
+static int poll_consecutive(struct isotp *tp, u64 now, u8 *frame)
+{
+    if (now < tp->tx_next)
+        return 0;
+
+    u32 nr = tp->tx_len - tp->tx_off;
+    if (nr > (u32)tp->frame_size - 1)
+        nr = tp->frame_size - 1;
+    frame[0] = PCI_CF | tp->tx_sn;
+    memcpy(frame + 1, tp->tx_buf + tp->tx_off, nr);
+    tp->tx_off += nr;
+    tp->tx_sn = (tp->tx_sn + 1) & 0x0f;
+    tp->tx_next = now + tp->tx_st_min;
+
+    if (tp->tx_off == tp->tx_len) {
+        tp->tx_state = TX_IDLE;
+    } else if (tp->tx_bs && --tp->tx_bs_left == 0) {
+        tp->tx_state = TX_WAIT_FC;
+        tp->tx_deadline = now + ISOTP_TIMEOUT;
+    }
+    return frame_pad(frame, 1 + nr);
+}
+
+int isotp_poll_frame(struct isotp *tp, u64 now, u8 *frame)
+{
+    tp->polled.tx_state = tp->tx_state;
+    tp->polled.tx_off = tp->tx_off;
+    tp->polled.tx_sn = tp->tx_sn;
+    tp->polled.tx_bs_left = tp->tx_bs_left;
+    tp->polled.tx_next = tp->tx_next;
+    tp->polled.tx_deadline = tp->tx_deadline;
+    tp->polled.fc_pending = tp->fc_pending;
+
+    if (tp->fc_pending != -1) {
+        frame[0] = PCI_FC | tp->fc_pending;
+        frame[1] = tp->bs;
+        frame[2] = tp->st_min;
+        tp->fc_pending = -1;
+        return frame_pad(frame, 3);
+    }
+
+    if (tp->rx_len && now > tp->rx_deadline)
+        tp->rx_len = 0;
+
+    switch (tp->tx_state) {
+    case TX_FIRST:
+        return poll_first(tp, now, frame);
+    case TX_WAIT_FC:
+        if (now > tp->tx_deadline) {
+            tp->tx_state = TX_IDLE;
+            return -1;
+        }
+        return 0;
+    case TX_CF:
+        return poll_consecutive(tp, now, frame);
+    default:
+        return 0;
+    }
+}
+
+void isotp_unpoll_frame(struct isotp *tp)
+{
+    tp->tx_state = tp->polled.tx_state;
+    tp->tx_off = tp->polled.tx_off;
+    tp->tx_sn = tp->polled.tx_sn;
+    tp->tx_bs_left = tp->polled.tx_bs_left;
+    tp->tx_next = tp->polled.tx_next;
+    tp->tx_deadline = tp->polled.tx_deadline;
+    tp->fc_pending = tp->polled.fc_pending;
+}
+
+u64 isotp_next_deadline(struct isotp *tp)
+{
+    if (tp->fc_pending != -1 || tp->tx_state == TX_FIRST)
+        return 0;
+
+    // timeouts are taken once now is past them
+    u64 next = ISOTP_NEVER;
+    if (tp->rx_len)
+        next = tp->rx_deadline + 1;
+    if (tp->tx_state == TX_WAIT_FC && tp->tx_deadline + 1 < next)
+        next = tp->tx_deadline + 1;
+    if (tp->tx_state == TX_CF && tp->tx_next < next)
+        next = tp->tx_next;
+    return next;
+}
+
+static int recv_flow_control(struct isotp *tp, u64 now, const u8 *frame, u8 len)
+{
+    if (tp->tx_state != TX_WAIT_FC || len < 3)
+        return 0;
+
+    switch (frame[0] & 0x0f) {
+    case FC_CTS:
+        tp->tx_bs = frame[1];
+        tp->tx_bs_left = frame[1];
+        tp->tx_st_min = st_min_usec(frame[2]);
+        tp->tx_next = now;
+        tp->tx_state = TX_CF;
+        return 0;
+    case FC_WAIT:
+        tp->tx_deadline = now + ISOTP_TIMEOUT;
+        return 0;
+    default:
+        // overflow or invalid, isotp_poll_frame reports the drop
+        tp->tx_deadline = 0;
+        return 0;
+    }
+}
+
+/*
+ * receiving side
+ */
+
+static int rx_reserve(struct isotp *tp, u32 len)
+{
+    if (tp->rx_cap >= len)
+        return 0;
+    u8 *rx_buf = mem_realloc(tp->rx_buf, len);
+    if (rx_buf == NULL)
+        return -1;
+    tp->rx_buf = rx_buf;
+    tp->rx_cap = len;
+    return 0;
+}
+
+static int recv_single(struct isotp *tp, const u8 *frame, u8 len)
+{
+    u32 msg_len = frame[0] & 0x0f;
+    u32 hdr = 1;
+    if (msg_len == 0 && len > ISOTP_FRAME_CAN) {
+        msg_len = frame[1];
+        hdr = 2;
+    }
+    if (msg_len == 0 || hdr + msg_len > len || rx_reserve(tp, msg_len) != 0)
+        return -1;
+
+    memcpy(tp->rx_buf, frame + hdr, msg_len);
+    tp->msg_len = msg_len;
+    return 1;
+}
+
+static int recv_first(struct isotp *tp, u64 now, const u8 *frame, u8 len)
+{
+    if (len < ISOTP_FRAME_CAN)
+        return -1;
+
+    u32 msg_len = ((frame[0] & 0x0f) << 8) | frame[1];
+    u32 hdr = 2;
+    if (msg_len == 0) {
+        msg_len = ((u32)frame[2] << 24) | ((u32)frame[3] << 16) |
+            ((u32)frame[4] << 8) | frame[5];
+        hdr = 6;
+    }
+    if (msg_len <= (u32)len - hdr)
+        return -1;
+
+    if (msg_len > ISOTP_MSG_MAX || rx_reserve(tp, msg_len) != 0) {
+        tp->fc_pending = FC_OVFLW;
+        return -1;
+    }
+
+    memcpy(tp->rx_buf, frame + hdr, len - hdr);
+    tp->rx_len = msg_len;
+    tp->rx_off = len - hdr;
+    tp->rx_sn = 1;
+    tp->rx_bs_left = tp->bs;
+    tp->rx_deadline = now + ISOTP_TIMEOUT;
+    tp->msg_len = 0;
+    tp->fc_pending = FC_CTS;
+    return 0;
+}
+
+static int recv_consecutive(struct isotp *tp, u64 now, const u8 *frame, u8 len)
+{
+    if (tp->rx_len == 0)
+        return 0; /* not ours, or after a timeout */
+
+    if ((frame[0] & 0x0f) != tp->rx_sn) {
+        tp->rx_len = 0;
+        return -1;
+    }
+
+    u32 nr = tp->rx_len - tp->rx_off;
+    if (nr > (u32)len - 1)
+        nr = len - 1;
+    memcpy(tp->rx_buf + tp->rx_off, frame + 1, nr);
+    tp->rx_off += nr;
+    tp->rx_sn = (tp->rx_sn + 1) & 0x0f;
+    tp->rx_deadline = now + ISOTP_TIMEOUT;
+
+    if (tp->rx_off == tp->rx_len) {
+        tp->msg_len = tp->rx_len;
+        tp->rx_len = 0;
+        return 1;
+    }
+    if (tp->bs && --tp->rx_bs_left == 0) {
+        tp->rx_bs_left = tp->bs;
+        tp->fc_pending = FC_CTS;
+    }
+    return 0;
+}
+
+int isotp_recv_frame(struct isotp *tp, u64 now, const u8 *frame, u8 len)
+{
+    if (len == 0)
+        return -1;
+
+    switch (frame[0] & 0xf0) {
+    case PCI_SF:
+        // a new message aborts the one being reassembled
+        tp->rx_len = 0;
+        return recv_single(tp, frame, len);
+    case PCI_FF:
+        tp->rx_len = 0;
+        return recv_first(tp, now, frame, len);
+    case PCI_CF:
+        return recv_consecutive(tp, now, frame, len);
+    case PCI_FC:
+        return recv_flow_control(tp, now, frame, len);
+    default:
+        return -1;
+    }
+}
+
+const u8 *isotp_rx_msg(struct isotp *tp, u32 *len)
+{
+    *len = tp->msg_len;
+    return tp->rx_buf;
+}
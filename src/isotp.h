@@ -0,0 +1,84 @@
+#ifndef __ISOTP_H
+#define __ISOTP_H
+
+#include "types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * isotp
+ * - ISO 15765-2 transport of one can id pair, normal addressing: messages
+ *   are segmented into single, first & consecutive frames, and reassembled
+ *   with flow control (block size & STmin) on the other end
+ * - frame_size is ISOTP_FRAME_CAN, or ISOTP_FRAME_CANFD for 64 byte CAN FD
+ *   frames, frames are padded with ISOTP_PAD to a valid dlc
+ * - no io & no clock of its own, the caller feeds received frames, pulls
+ *   frames to put on the bus and passes the time in usec
+ */
+
+#define ISOTP_FRAME_CAN 8
+#define ISOTP_FRAME_CANFD 64
+#ifdef APIX_STATIC_ALLOC
+#include "mem.h"
+#define ISOTP_MSG_MAX APIX_MAX_FRAME /* carries one srrp packet */
+#else
+#define ISOTP_MSG_MAX (64 * 1024) /* first frames over 4095 use the escape */
+#endif
+#define ISOTP_PAD 0xcc
+#define ISOTP_TIMEOUT (1000 * 1000) /* N_Bs & N_Cr, usec */
+
+struct isotp;
+
+struct isotp *isotp_new(u8 frame_size);
+void isotp_free(struct isotp *tp);
+
+/* Block size & STmin asked of the peer in our flow control, 0 => none. */
+void isotp_set_flow(struct isotp *tp, u8 block_size, u8 st_min);
+
+/*
+ * Queue buf as one message, taken out by isotp_poll_frame.
+ * - return -1 if the last message is still going out or len is invalid
+ */
+int isotp_send(struct isotp *tp, const u8 *buf, u32 len);
+int isotp_tx_busy(struct isotp *tp);
+
+/*
+ * Take the next frame due at now into frame, which holds frame_size bytes.
+ * - flow control of the receiving side first, then the message queued by
+ *   isotp_send, consecutive frames wait for the STmin of the peer
+ * - return the frame length, 0 if nothing is due, -1 if the queued message
+ *   was dropped: flow control timed out or the peer overflowed
+ */
+int isotp_poll_frame(struct isotp *tp, u64 now, u8 *frame);
+
+/*
+ * Put back the frame taken by the last isotp_poll_frame, e.g. the bus had no
+ * room for it, so the next isotp_poll_frame takes the same frame again.
+ * - only valid right after isotp_poll_frame returned a frame
+ */
+void isotp_unpoll_frame(struct isotp *tp);
+
+/*
+ * Time isotp_poll_frame has work next: a frame due, or a timeout to take.
+ * - return 0 if it is due at once, ISOTP_NEVER if nothing is pending
+ */
+#define ISOTP_NEVER ((u64)-1)
+u64 isotp_next_deadline(struct isotp *tp);
+
+/*
+ * Feed a frame received at now.
+ * - return 1 if it completed a message, see isotp_rx_msg, 0 if more frames
+ *   are needed, -1 if the frame broke the message being reassembled
+ * - flow control frames for our sending side are taken here as well
+ */
+int isotp_recv_frame(struct isotp *tp, u64 now, const u8 *frame, u8 len);
+
+/* The message completed by the last isotp_recv_frame. */
+const u8 *isotp_rx_msg(struct isotp *tp, u32 *len);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -1,218 +1,888 @@
 #include "json.h"
+#include "mem.h"
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define JSON_TOKENS_MIN 16
+
+enum json_token_type {
+    JSON_T_NONE = 0,
+    JSON_T_OBJECT,
+    JSON_T_ARRAY,
+    JSON_T_STRING,
+    JSON_T_PRIMITIVE,
+};
+
+/**
+ * json_token
+ * - tokens are stored in document order, children follow their container
+ * - start/end is the text span, the quotes of strings are excluded
+ * - size is the number of keys of an object or elements of an array
+ * - next is the index of the first token after the subtree, so siblings
+ *   are visited without descending into them
+ */
+struct json_token {
+    int type;
+    uint32_t start;
+    uint32_t end;
+    uint32_t size;
+    uint32_t next;
+};
 
 struct json_object {
-    int errno;
+    int err;
     char *raw;
-    const char *walk_idx;
+    size_t len;
+    struct json_token *tokens;
+    uint32_t nr_tokens;
+    uint32_t cap_tokens;
 };
 
+/**
+ * tokenizer
+ */
+
+// return the position of the first quote or backslash at or after idx
+static size_t json_scan_string(const char *str, size_t idx, size_t len, char quote)
+{
+#ifdef __SSE2__
+    const __m128i q = _mm_set1_epi8(quote);
+    const __m128i bs = _mm_set1_epi8('\\');
+    while (idx + 16 <= len) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(str + idx));
+        int mask = _mm_movemask_epi8(_mm_or_si128(
+            _mm_cmpeq_epi8(chunk, q), _mm_cmpeq_epi8(chunk, bs)));
+        if (mask)
+            return idx + __builtin_ctz(mask);
+        idx += 16;
+    }
+#endif
+    for (; idx < len; idx++) {
+        if (str[idx] == quote || str[idx] == '\\')
+            return idx;
+    }
+    return len;
+}
+
+static int json_is_delimiter(char c)
+{
+    return c == ',' || c == ':' || c == '}' || c == ']' || isspace((uint8_t)c);
+}
+
+#ifdef __SSE2__
+// bit i of the mask is set if byte i of chunk is isspace()
+static int json_space_mask(__m128i chunk)
+{
+    // '\t' .. '\r' are 9 .. 13, a byte is in the range if c - 9 <= 4 unsigned
+    __m128i off = _mm_sub_epi8(chunk, _mm_set1_epi8(9));
+    __m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(off, _mm_set1_epi8(4)), off);
+    return _mm_movemask_epi8(_mm_or_si128(
+        ctl, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(' '))));
+}
+#endif
+
+// return the position of the first non-space at or after idx
+static size_t json_skip_space(const char *str, size_t idx, size_t len)
+{
+#ifdef __SSE2__
+    while (idx + 16 <= len) {
+        int mask = json_space_mask(_mm_loadu_si128((const __m128i *)(str + idx)));
+        if (mask != 0xffff)
+            return idx + __builtin_ctz(~mask);
+        idx += 16;
+    }
+#endif
+    while (idx < len && isspace((uint8_t)str[idx]))
+        idx++;
+    return idx;
+}
+
+// return the position of the first delimiter at or after idx
+static size_t json_scan_primitive(const char *str, size_t idx, size_t len)
+{
+#ifdef __SSE2__
+    while (idx + 16 <= len) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(str + idx));
+        __m128i delim = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(',')),
+                         _mm_cmpeq_epi8(chunk, _mm_set1_epi8(':'))),
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('}')),
+                         _mm_cmpeq_epi8(chunk, _mm_set1_epi8(']'))));
+        int mask = _mm_movemask_epi8(delim) | json_space_mask(chunk);
+        if (mask)
+            return idx + __builtin_ctz(mask);
+        idx += 16;
+    }
+#endif
+    while (idx < len && !json_is_delimiter(str[idx]))
+        idx++;
+    return idx;
+}
+
+static struct json_token *
+json_token_new(struct json_object *jo, int type, uint32_t start)
+{
+    if (jo->nr_tokens == jo->cap_tokens) {
+        uint32_t cap = jo->cap_tokens << 1;
+        struct json_token *tokens = mem_realloc(jo->tokens, cap * sizeof(*tokens));
+        if (tokens == NULL)
+            return NULL;
+        jo->tokens = tokens;
+        jo->cap_tokens = cap;
+    }
+
+    struct json_token *tok = &jo->tokens[jo->nr_tokens];
+    tok->type = type;
+    tok->start = start;
+    tok->end = start;
+    tok->size = 0;
+    tok->next = ++jo->nr_tokens;
+    return tok;
+}
+
+static int json_tokenize(struct json_object *jo)
+{
+    const char *str = jo->raw;
+    uint32_t stack[JSON_DEPTH_MAX];
+    int depth = 0;
+    int expect_key = 0;
+
+    for (size_t i = 0; (i = json_skip_space(str, i, jo->len)) < jo->len; i++) {
+        char c = str[i];
+
+        if (c == ':') {
+            if (depth == 0 || jo->tokens[stack[depth - 1]].type != JSON_T_OBJECT)
+                return JSON_ERR_SYNTAX;
+            expect_key = 0;
+            continue;
+        }
+
+        if (c == ',') {
+            if (depth == 0)
+                return JSON_ERR_SYNTAX;
+            expect_key = jo->tokens[stack[depth - 1]].type == JSON_T_OBJECT;
+            continue;
+        }
+
+        if (c == '}' || c == ']') {
+            if (depth == 0)
+                return JSON_ERR_BRACE;
+            struct json_token *tok = &jo->tokens[stack[--depth]];
+            if (tok->type != (c == '}' ? JSON_T_OBJECT : JSON_T_ARRAY))
+                return JSON_ERR_BRACE;
+            if (tok->type == JSON_T_OBJECT) {
+                // direct children were counted, keys and values
+                if (tok->size % 2 != 0)
+                    return JSON_ERR_SYNTAX;
+                tok->size /= 2;
+            }
+            tok->end = i + 1;
+            tok->next = jo->nr_tokens;
+            expect_key = 0;
+            continue;
+        }
+
+        // a new value or key begins
+        if (depth == 0 && jo->nr_tokens != 0)
+            return JSON_ERR_SYNTAX;
+        if (depth != 0)
+            jo->tokens[stack[depth - 1]].size++;
+
+        struct json_token *tok = NULL;
+
+        if (c == '{' || c == '[') {
+            if (expect_key)
+                return JSON_ERR_SYNTAX;
+            if (depth == JSON_DEPTH_MAX)
+                return JSON_ERR_BRACE;
+            tok = json_token_new(jo, c == '{' ? JSON_T_OBJECT : JSON_T_ARRAY, i);
+            if (tok == NULL)
+                return JSON_ERR_SYNTAX;
+            stack[depth++] = tok - jo->tokens;
+            expect_key = c == '{';
+        } else if (c == '"' || c == '\'') {
+            size_t j = i + 1;
+            for (;;) {
+                j = json_scan_string(str, j, jo->len, c);
+                if (j >= jo->len)
+                    return JSON_ERR_BRACE;
+                if (str[j] != '\\')
+                    break;
+                j += 2;
+            }
+            tok = json_token_new(jo, JSON_T_STRING, i + 1);
+            if (tok == NULL)
+                return JSON_ERR_SYNTAX;
+            tok->end = j;
+            i = j;
+        } else {
+            size_t j = json_scan_primitive(str, i + 1, jo->len);
+            tok = json_token_new(jo, JSON_T_PRIMITIVE, i);
+            if (tok == NULL)
+                return JSON_ERR_SYNTAX;
+            tok->end = j;
+            i = j - 1;
+        }
+    }
+
+    if (depth != 0)
+        return JSON_ERR_BRACE;
+    if (jo->nr_tokens == 0)
+        return JSON_ERR_SYNTAX;
+    return JSON_ERR_OK;
+}
+
 struct json_object *json_object_new(const char *str)
 {
-    struct json_object *jo = malloc(sizeof(*jo));
-    memset(jo, 0, sizeof(*jo));
-    jo->raw = strdup(str);
-    jo->walk_idx = jo->raw;
+    struct json_object *jo = mem_calloc(1, sizeof(*jo));
+    if (jo == NULL)
+        return NULL;
+    jo->raw = mem_strdup(str);
+    jo->len = strlen(str);
+
+    jo->cap_tokens = jo->len / 8 + JSON_TOKENS_MIN;
+    jo->tokens = mem_alloc(jo->cap_tokens * sizeof(*jo->tokens));
+    if (jo->raw == NULL || jo->tokens == NULL) {
+        json_object_delete(jo);
+        return NULL;
+    }
+
+    jo->err = json_tokenize(jo);
+    if (jo->err != JSON_ERR_OK)
+        jo->nr_tokens = 0;
     return jo;
 }
 
 void json_object_delete(struct json_object *jo)
 {
     assert(jo);
-    free(jo->raw);
-    free(jo);
+    mem_free(jo->tokens);
+    mem_free(jo->raw);
+    mem_free(jo);
 }
 
-static int json_walk(struct json_object *jo, const char *str, const char *path)
+/**
+ * lookup
+ */
+
+static struct json_token *json_lookup(struct json_object *jo, const char *path)
 {
-    assert(path[0] == '/');
-    assert(path[1] != 0);
+    if (jo->nr_tokens == 0)
+        return NULL;
 
-    char *path_next = strchr(path + 1, '/');
+    uint32_t cur = 0;
+    const char *seg = path;
 
-    // recursive fininshed
-    if (path_next == NULL) {
-        const char *key = path + 1;
-        int brace_cnt = 0;
+    while (*seg == '/') {
+        seg++;
+        const char *seg_end = strchr(seg, '/');
+        size_t seg_len = seg_end ? (size_t)(seg_end - seg) : strlen(seg);
+        if (seg_len == 0)
+            continue;
 
-        for (size_t i = 0; i < strlen(str); i++) {
-                if (str[i] == '{') {
-                    brace_cnt++;
-                    continue;
-                }
-                if (str[i] == '}') {
-                    brace_cnt--;
-                    continue;
-                }
-                if (brace_cnt == 1) {
-                    if (key[0] == str[i] &&
-                        memcmp(key, str + i, strlen(key)) == 0) {
-                        jo->walk_idx = str + i + strlen(key);
-                        return 0;
-                    }
-                }
-        }
-        jo->errno = JSON_ERR_KEY;
-        return -1;
-    } else {
-        char *key = malloc(path_next - path);
-        memset(key, 0, path_next - path);
-        memcpy(key, path + 1, path_next - path - 1);
-        int find_key = 0;
-        int brace_cnt = 0;
-
-        for (size_t i = 0; i < strlen(str); i++) {
-            if (find_key == 0) {
-                if (str[i] == '{') {
-                    brace_cnt++;
-                    continue;
-                }
-                if (str[i] == '}') {
-                    brace_cnt--;
-                    continue;
-                }
-                if (brace_cnt == 1) {
-                    if (key[0] == str[i] &&
-                        memcmp(key, str + i, strlen(key)) == 0) {
-                        find_key = 1;
-                        i += strlen(key) - 1;
-                        continue;
-                    }
+        struct json_token *tok = &jo->tokens[cur];
+
+        if (tok->type == JSON_T_OBJECT) {
+            uint32_t i = cur + 1;
+            for (;;) {
+                if (i >= tok->next) {
+                    jo->err = JSON_ERR_KEY;
+                    return NULL;
                 }
-            } else {
-                if (str[i] == ' ' || str[i] == ':')
-                    continue;
-                if (str[i] != '{') {
-                    jo->errno = JSON_ERR_TYPE;
-                    free(key);
-                    return -1;
+                struct json_token *key = &jo->tokens[i];
+                if (key->end - key->start == seg_len &&
+                    memcmp(jo->raw + key->start, seg, seg_len) == 0)
+                    break;
+                i = jo->tokens[i + 1].next;
+            }
+            cur = i + 1;
+        } else if (tok->type == JSON_T_ARRAY) {
+            uint32_t idx = 0;
+            for (size_t k = 0; k < seg_len; k++) {
+                uint32_t digit = seg[k] - '0';
+                if (!isdigit((uint8_t)seg[k]) ||
+                    idx > (UINT32_MAX - digit) / 10) {
+                    jo->err = JSON_ERR_KEY;
+                    return NULL;
                 }
-                free(key);
-                return json_walk(jo, str + i, path_next);
+                idx = idx * 10 + digit;
+            }
+            if (idx >= tok->size) {
+                jo->err = JSON_ERR_KEY;
+                return NULL;
             }
+            uint32_t i = cur + 1;
+            while (idx--)
+                i = jo->tokens[i].next;
+            cur = i;
+        } else {
+            jo->err = JSON_ERR_TYPE;
+            return NULL;
         }
 
-        free(key);
-        jo->errno = JSON_ERR_KEY;
+        seg += seg_len;
+    }
+
+    if (*seg != 0) {
+        jo->err = JSON_ERR_KEY;
+        return NULL;
+    }
+    return &jo->tokens[cur];
+}
+
+static enum json_type json_token_type(struct json_object *jo, struct json_token *tok)
+{
+    switch (tok->type) {
+    case JSON_T_OBJECT:
+        return JSON_TYPE_OBJECT;
+    case JSON_T_ARRAY:
+        return JSON_TYPE_ARRAY;
+    case JSON_T_STRING:
+        return JSON_TYPE_STRING;
+    case JSON_T_PRIMITIVE: {
+        const char *str = jo->raw + tok->start;
+        size_t len = tok->end - tok->start;
+        if (len == 4 && memcmp(str, "true", 4) == 0)
+            return JSON_TYPE_BOOL;
+        if (len == 5 && memcmp(str, "false", 5) == 0)
+            return JSON_TYPE_BOOL;
+        if (len == 4 && memcmp(str, "null", 4) == 0)
+            return JSON_TYPE_NULL;
+        if (isdigit((uint8_t)str[0]) || str[0] == '-' || str[0] == '+' || str[0] == '.')
+            return JSON_TYPE_NUMBER;
+        // unquoted word
+        return JSON_TYPE_STRING;
+    }
+    default:
+        return JSON_TYPE_NONE;
+    }
+}
+
+enum json_type json_get_type(struct json_object *jo, const char *path)
+{
+    struct json_token *tok = json_lookup(jo, path);
+    if (tok == NULL)
+        return JSON_TYPE_NONE;
+    return json_token_type(jo, tok);
+}
+
+static size_t json_utf8_encode(uint32_t cp, char *out)
+{
+    if (cp < 0x80) {
+        out[0] = cp;
+        return 1;
+    } else if (cp < 0x800) {
+        out[0] = 0xc0 | (cp >> 6);
+        out[1] = 0x80 | (cp & 0x3f);
+        return 2;
+    } else if (cp < 0x10000) {
+        out[0] = 0xe0 | (cp >> 12);
+        out[1] = 0x80 | ((cp >> 6) & 0x3f);
+        out[2] = 0x80 | (cp & 0x3f);
+        return 3;
+    } else {
+        out[0] = 0xf0 | (cp >> 18);
+        out[1] = 0x80 | ((cp >> 12) & 0x3f);
+        out[2] = 0x80 | ((cp >> 6) & 0x3f);
+        out[3] = 0x80 | (cp & 0x3f);
+        return 4;
+    }
+}
+
+static int json_hex4(const char *str, size_t len, uint32_t *value)
+{
+    if (len < 4)
         return -1;
+    *value = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = str[i];
+        if (!isxdigit((uint8_t)c))
+            return -1;
+        *value = (*value << 4) |
+            (isdigit((uint8_t)c) ? c - '0' : (tolower((uint8_t)c) - 'a' + 10));
     }
+    return 0;
 }
 
-static int __json_get_string(struct json_object *jo, char *value, size_t size)
+int json_get_string(struct json_object *jo, const char *path, char *value, size_t size)
 {
-    assert(value != NULL);
-    const char *str = jo->raw;
+    assert(value != NULL && size != 0);
 
-    for (size_t i = jo->walk_idx - jo->raw; i < strlen(jo->raw); i++) {
-        if (str[i] == ' ' || str[i] == ':')
+    struct json_token *tok = json_lookup(jo, path);
+    if (tok == NULL)
+        return -1;
+    if (json_token_type(jo, tok) != JSON_TYPE_STRING) {
+        jo->err = JSON_ERR_TYPE;
+        return -1;
+    }
+
+    const char *str = jo->raw + tok->start;
+    size_t len = tok->end - tok->start;
+    size_t idx = 0;
+
+    for (size_t i = 0; i < len && idx + 1 < size; i++) {
+        if (str[i] != '\\') {
+            value[idx++] = str[i];
             continue;
-        if (!isprint((uint8_t)str[i])) {
-            jo->errno = JSON_ERR_TYPE;
-            return -1;
         }
-        char *value_end = NULL;
-        size_t j = i;
-        for (; j < strlen(str); j++) {
-            if (value_end == NULL
-                && isprint((uint8_t)str[j])
-                && str[j] != ' '
-                && str[j] != ','
-                && str[j] != '}')
-                continue;
-            if (str[j] == ' ') {
-                if (value_end == NULL)
-                    value_end = (char *)(str + j);
-                continue;
-            }
-            if (str[j] == ',' || str[j] == '}') {
-                if (value_end == NULL)
-                    value_end = (char *)(str + j);
-                break;
-            } else {
-                jo->errno = JSON_ERR_TYPE;
+
+        if (++i == len)
+            break;
+        char tmp[4];
+        size_t n = 1;
+        switch (str[i]) {
+        case 'b': tmp[0] = '\b'; break;
+        case 'f': tmp[0] = '\f'; break;
+        case 'n': tmp[0] = '\n'; break;
+        case 'r': tmp[0] = '\r'; break;
+        case 't': tmp[0] = '\t'; break;
+        case 'u': {
+            uint32_t cp, lo;
+            if (json_hex4(str + i + 1, len - i - 1, &cp) != 0) {
+                jo->err = JSON_ERR_SYNTAX;
                 return -1;
             }
+            i += 4;
+            if (cp >= 0xd800 && cp < 0xdc00 && i + 6 < len &&
+                str[i + 1] == '\\' && str[i + 2] == 'u' &&
+                json_hex4(str + i + 3, len - i - 3, &lo) == 0 &&
+                lo >= 0xdc00 && lo < 0xe000) {
+                cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+                i += 6;
+            }
+            n = json_utf8_encode(cp, tmp);
+            break;
         }
-        if (j == strlen(str)) {
-            jo->errno = JSON_ERR_BRACE;
-            return -1;
-        }
-        assert(value_end != NULL);
-        if ((str[i] != '\'' && str[i] != '"') || str[i] != *(value_end-1)) {
-            jo->errno = JSON_ERR_TYPE;
-            return -1;
+        default: tmp[0] = str[i]; break;
         }
-        size_t cpy_cnt = value_end - str - i - 2;
-        if (cpy_cnt > size - 1) cpy_cnt = size - 1;
-        memcpy(value, str + i + 1, cpy_cnt);
-        value[cpy_cnt] = 0;
-        return 0;
+        if (idx + n >= size)
+            break;
+        memcpy(value + idx, tmp, n);
+        idx += n;
     }
 
-    jo->errno = JSON_ERR_TYPE;
-    return -1;
+    value[idx] = 0;
+    return 0;
 }
 
-int json_get_string(struct json_object *jo, const char *path, char *value, size_t size)
+int json_get_int64(struct json_object *jo, const char *path, int64_t *value)
 {
-    int rc = json_walk(jo, jo->raw, path);
-    if (rc != 0) return rc;
-    return __json_get_string(jo, value, size);
+    assert(value != NULL);
+
+    struct json_token *tok = json_lookup(jo, path);
+    if (tok == NULL)
+        return -1;
+    if (json_token_type(jo, tok) != JSON_TYPE_NUMBER) {
+        jo->err = JSON_ERR_TYPE;
+        return -1;
+    }
+
+    char *end = NULL;
+    errno = 0;
+    long long tmp = strtoll(jo->raw + tok->start, &end, 10);
+    if (end != jo->raw + tok->end) {
+        jo->err = JSON_ERR_TYPE;
+        return -1;
+    }
+    if (errno == ERANGE) {
+        jo->err = JSON_ERR_RANGE;
+        return -1;
+    }
+
+    *value = tmp;
+    return 0;
 }
 
-static int __json_get_int(struct json_object *jo, int *value)
+int json_get_int(struct json_object *jo, const char *path, int *value)
 {
     assert(value != NULL);
-    const char *str = jo->raw;
 
-    for (size_t i = jo->walk_idx - jo->raw; i < strlen(jo->raw); i++) {
-        if (str[i] == ' ' || str[i] == ':')
-            continue;
-        if (!isdigit((uint8_t)str[i])) {
-            jo->errno = JSON_ERR_TYPE;
-            return -1;
-        }
-        char *value_end = NULL;
-        size_t j = i;
-        for (; j < strlen(str); j++) {
-            if (value_end == NULL && isdigit((uint8_t)str[j]))
-                continue;
-            if (str[j] == ' ') {
-                if (value_end == NULL)
-                    value_end = (char *)(str + j);
-                continue;
-            }
-            if (str[j] == ',' || str[j] == '}') {
-                if (value_end == NULL)
-                    value_end = (char *)(str + j);
-                break;
-            } else {
-                jo->errno = JSON_ERR_TYPE;
+    int64_t tmp;
+    if (json_get_int64(jo, path, &tmp) != 0)
+        return -1;
+    if (tmp < INT_MIN || tmp > INT_MAX) {
+        jo->err = JSON_ERR_RANGE;
+        return -1;
+    }
+
+    *value = tmp;
+    return 0;
+}
+
+int json_get_double(struct json_object *jo, const char *path, double *value)
+{
+    assert(value != NULL);
+
+    struct json_token *tok = json_lookup(jo, path);
+    if (tok == NULL)
+        return -1;
+    if (json_token_type(jo, tok) != JSON_TYPE_NUMBER) {
+        jo->err = JSON_ERR_TYPE;
+        return -1;
+    }
+
+    char *end = NULL;
+    double tmp = strtod(jo->raw + tok->start, &end);
+    if (end != jo->raw + tok->end) {
+        jo->err = JSON_ERR_TYPE;
+        return -1;
+    }
+
+    *value = tmp;
+    return 0;
+}
+
+int json_get_bool(struct json_object *jo, const char *path, int *value)
+{
+    assert(value != NULL);
+
+    struct json_token *tok = json_lookup(jo, path);
+    if (tok == NULL)
+        return -1;
+    if (json_token_type(jo, tok) != JSON_TYPE_BOOL) {
+        jo->err = JSON_ERR_TYPE;
+        return -1;
+    }
+
+    *value = jo->raw[tok->start] == 't';
+    return 0;
+}
+
+int json_get_array_size(struct json_object *jo, const char *path, size_t *size)
+{
+    assert(size != NULL);
+
+    struct json_token *tok = json_lookup(jo, path);
+    if (tok == NULL)
+        return -1;
+    if (tok->type != JSON_T_ARRAY) {
+        jo->err = JSON_ERR_TYPE;
+        return -1;
+    }
+
+    *size = tok->size;
+    return 0;
+}
+
+int json_get_raw(struct json_object *jo, const char *path,
+                 const char **value, size_t *len)
+{
+    assert(value != NULL && len != NULL);
+
+    struct json_token *tok = json_lookup(jo, path);
+    if (tok == NULL)
+        return -1;
+
+    if (tok->type == JSON_T_STRING) {
+        *value = jo->raw + tok->start - 1;
+        *len = tok->end - tok->start + 2;
+    } else {
+        *value = jo->raw + tok->start;
+        *len = tok->end - tok->start;
+    }
+    return 0;
+}
+
+/*
+ * json_writer
+ */
+
+struct json_writer_buf {
+    struct json_writer_buf *next;
+    char data[JSON_WRITER_BUF_SIZE];
+};
+
+static __thread struct json_writer_buf *json_writer_pool;
+static __thread int json_writer_pool_cnt;
+
+int json_writer_init(struct json_writer *jw, char *buf, size_t size)
+{
+    assert(jw != NULL);
+
+    memset(jw, 0, sizeof(*jw));
+
+    if (buf == NULL) {
+        struct json_writer_buf *wb = json_writer_pool;
+        if (wb != NULL) {
+            json_writer_pool = wb->next;
+            json_writer_pool_cnt--;
+        } else {
+            wb = mem_alloc(sizeof(*wb));
+            if (wb == NULL) {
+                jw->err = JSON_ERR_RANGE;
                 return -1;
             }
         }
-        if (j == strlen(str)) {
-            jo->errno = JSON_ERR_BRACE;
-            return -1;
+        buf = wb->data;
+        size = sizeof(wb->data);
+        jw->pooled = 1;
+    }
+
+    if (size == 0) {
+        jw->err = JSON_ERR_RANGE;
+        return -1;
+    }
+
+    jw->buf = buf;
+    jw->size = size;
+    jw->buf[0] = 0;
+    return 0;
+}
+
+void json_writer_fini(struct json_writer *jw)
+{
+    if (jw->pooled && jw->buf) {
+        struct json_writer_buf *wb = (struct json_writer_buf *)
+            (jw->buf - offsetof(struct json_writer_buf, data));
+        if (json_writer_pool_cnt < JSON_WRITER_POOL_MAX) {
+            wb->next = json_writer_pool;
+            json_writer_pool = wb;
+            json_writer_pool_cnt++;
+        } else {
+            mem_free(wb);
         }
-        assert(value_end != NULL);
-        char tmp[32] = {0};
-        memcpy(tmp, str + i, value_end - str - i);
-        *value = atoi(tmp);
-        return 0;
     }
+    jw->buf = NULL;
+    jw->size = 0;
+    jw->len = 0;
+    jw->pooled = 0;
+}
 
-    jo->errno = JSON_ERR_TYPE;
+const char *json_writer_data(struct json_writer *jw)
+{
+    return jw->buf;
+}
+
+size_t json_writer_len(struct json_writer *jw)
+{
+    return jw->len;
+}
+
+static int json_writer_put(struct json_writer *jw, const char *data, size_t len)
+{
+    // keep one byte for the terminating null
+    if (jw->size - jw->len <= len) {
+        jw->err = JSON_ERR_RANGE;
+        return -1;
+    }
+    memcpy(jw->buf + jw->len, data, len);
+    jw->len += len;
+    jw->buf[jw->len] = 0;
+    return 0;
+}
+
+static int json_writer_fail(struct json_writer *jw)
+{
+    jw->err = JSON_ERR_SYNTAX;
     return -1;
 }
 
-int json_get_int(struct json_object *jo, const char *path, int *value)
+static int json_writer_comma(struct json_writer *jw)
+{
+    if (jw->depth > 0 && (jw->need_comma & (1ULL << jw->depth)))
+        return json_writer_put(jw, ",", 1);
+    return 0;
+}
+
+/*
+ * Emit the separator owed before a value, values directly inside an object
+ * must follow a key.
+ */
+static int json_writer_sep(struct json_writer *jw)
+{
+    if (jw->err)
+        return -1;
+
+    if (jw->after_key) {
+        jw->after_key = 0;
+        return 0;
+    }
+
+    if (jw->depth > 0 && !(jw->in_array & (1ULL << jw->depth)))
+        return json_writer_fail(jw);
+    return json_writer_comma(jw);
+}
+
+static void json_writer_done(struct json_writer *jw)
+{
+    jw->need_comma |= 1ULL << jw->depth;
+}
+
+static int json_write_open(struct json_writer *jw, char c)
+{
+    if (json_writer_sep(jw) != 0)
+        return -1;
+    if (jw->depth + 1 >= JSON_DEPTH_MAX)
+        return json_writer_fail(jw);
+    if (json_writer_put(jw, &c, 1) != 0)
+        return -1;
+    jw->depth++;
+    jw->need_comma &= ~(1ULL << jw->depth);
+    if (c == '[')
+        jw->in_array |= 1ULL << jw->depth;
+    else
+        jw->in_array &= ~(1ULL << jw->depth);
+    return 0;
+}
+
+static int json_write_close(struct json_writer *jw, char c)
+{
+    if (jw->err)
+        return -1;
+    if (jw->depth == 0 || jw->after_key ||
+        !(jw->in_array & (1ULL << jw->depth)) != (c == '}'))
+        return json_writer_fail(jw);
+    if (json_writer_put(jw, &c, 1) != 0)
+        return -1;
+    jw->depth--;
+    json_writer_done(jw);
+    return 0;
+}
+
+int json_write_object_begin(struct json_writer *jw)
+{
+    return json_write_open(jw, '{');
+}
+
+int json_write_object_end(struct json_writer *jw)
+{
+    return json_write_close(jw, '}');
+}
+
+int json_write_array_begin(struct json_writer *jw)
+{
+    return json_write_open(jw, '[');
+}
+
+int json_write_array_end(struct json_writer *jw)
+{
+    return json_write_close(jw, ']');
+}
+
+static int json_write_escaped(struct json_writer *jw, const char *str, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    size_t begin = 0;
+
+    if (json_writer_put(jw, "\"", 1) != 0)
+        return -1;
+
+    // copy runs of plain bytes at once, escape the rest one by one
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = str[i];
+        if (c >= 0x20 && c != '"' && c != '\\')
+            continue;
+
+        if (json_writer_put(jw, str + begin, i - begin) != 0)
+            return -1;
+        begin = i + 1;
+
+        char esc[6] = { '\\', 0 };
+        size_t n = 2;
+        switch (c) {
+        case '"': esc[1] = '"'; break;
+        case '\\': esc[1] = '\\'; break;
+        case '\b': esc[1] = 'b'; break;
+        case '\f': esc[1] = 'f'; break;
+        case '\n': esc[1] = 'n'; break;
+        case '\r': esc[1] = 'r'; break;
+        case '\t': esc[1] = 't'; break;
+        default:
+            esc[1] = 'u';
+            esc[2] = '0';
+            esc[3] = '0';
+            esc[4] = hex[c >> 4];
+            esc[5] = hex[c & 0xf];
+            n = 6;
+        }
+        if (json_writer_put(jw, esc, n) != 0)
+            return -1;
+    }
+
+    if (json_writer_put(jw, str + begin, len - begin) != 0)
+        return -1;
+    return json_writer_put(jw, "\"", 1);
+}
+
+int json_write_key(struct json_writer *jw, const char *key)
+{
+    if (jw->err)
+        return -1;
+    if (jw->depth == 0 || jw->after_key || (jw->in_array & (1ULL << jw->depth)))
+        return json_writer_fail(jw);
+    if (json_writer_comma(jw) != 0)
+        return -1;
+    if (json_write_escaped(jw, key, strlen(key)) != 0 ||
+        json_writer_put(jw, ":", 1) != 0)
+        return -1;
+    jw->after_key = 1;
+    return 0;
+}
+
+int json_write_string_len(struct json_writer *jw, const char *value, size_t len)
+{
+    if (json_writer_sep(jw) != 0 || json_write_escaped(jw, value, len) != 0)
+        return -1;
+    json_writer_done(jw);
+    return 0;
+}
+
+int json_write_string(struct json_writer *jw, const char *value)
+{
+    return json_write_string_len(jw, value, strlen(value));
+}
+
+int json_write_raw(struct json_writer *jw, const char *raw, size_t len)
+{
+    if (json_writer_sep(jw) != 0 || json_writer_put(jw, raw, len) != 0)
+        return -1;
+    json_writer_done(jw);
+    return 0;
+}
+
+int json_write_int64(struct json_writer *jw, int64_t value)
+{
+    char tmp[24];
+    char *p = tmp + sizeof(tmp);
+    uint64_t u = value < 0 ? -(uint64_t)value : (uint64_t)value;
+
+    do {
+        *--p = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    if (value < 0)
+        *--p = '-';
+
+    return json_write_raw(jw, p, tmp + sizeof(tmp) - p);
+}
+
+int json_write_double(struct json_writer *jw, double value)
+{
+    char tmp[32];
+
+    // json has no representation of inf and nan
+    if (value != value || value - value != 0)
+        return json_write_null(jw);
+
+    int n = snprintf(tmp, sizeof(tmp), "%.17g", value);
+    return json_write_raw(jw, tmp, n);
+}
+
+int json_write_bool(struct json_writer *jw, int value)
+{
+    return value ? json_write_raw(jw, "true", 4) : json_write_raw(jw, "false", 5);
+}
+
+int json_write_null(struct json_writer *jw)
 {
-    int rc = json_walk(jo, jo->raw, path);
-    if (rc != 0) return rc;
-    return __json_get_int(jo, value);
+    return json_write_raw(jw, "null", 4);
 }
@@ -2,25 +2,115 @@
 #define __JSON_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#define JSON_DEPTH_MAX 64
+
 enum json_errno {
     JSON_ERR_OK = 0,
     JSON_ERR_BRACE,
     JSON_ERR_KEY,
     JSON_ERR_TYPE,
+    JSON_ERR_SYNTAX,
+    JSON_ERR_RANGE,
+};
+
+enum json_type {
+    JSON_TYPE_NONE = 0,
+    JSON_TYPE_OBJECT,
+    JSON_TYPE_ARRAY,
+    JSON_TYPE_STRING,
+    JSON_TYPE_NUMBER,
+    JSON_TYPE_BOOL,
+    JSON_TYPE_NULL,
 };
 
 struct json_object;
 
+/**
+ * json_object_new
+ * - tokenize str once into a flat index, all json_get_* look up the index
+ * - keys may be unquoted and strings single-quoted, e.g. {len: 12, name: 'yon'}
+ * - path is like "/test/name", array elements are addressed as "/equip/1"
+ * - NULL if out of memory
+ */
 struct json_object *json_object_new(const char *str);
 void json_object_delete(struct json_object *jo);
 
+enum json_type json_get_type(struct json_object *jo, const char *path);
+
 int json_get_string(struct json_object *jo, const char *path, char *value, size_t size);
 int json_get_int(struct json_object *jo, const char *path, int *value);
+int json_get_int64(struct json_object *jo, const char *path, int64_t *value);
+int json_get_double(struct json_object *jo, const char *path, double *value);
+int json_get_bool(struct json_object *jo, const char *path, int *value);
+int json_get_array_size(struct json_object *jo, const char *path, size_t *size);
+
+/**
+ * json_get_raw
+ * - point value at the unparsed text of any element, e.g. a nested object
+ */
+int json_get_raw(struct json_object *jo, const char *path,
+                 const char **value, size_t *len);
+
+/**
+ * json_writer
+ * - streaming writer appending into one buffer, no allocation per value
+ * - with buf NULL, a JSON_WRITER_BUF_SIZE buffer is taken from a per-thread
+ *   pool and given back by json_writer_fini
+ * - the output is always null terminated, on overflow or misuse the writer
+ *   fails sticky and every later json_write_* returns -1
+ * - json_writer_data/len feed srrp_new directly, write "j:" with
+ *   json_write_raw before the first value for a srrp json payload
+ */
+
+#ifdef APIX_STATIC_ALLOC
+#include "mem.h"
+#define JSON_WRITER_BUF_SIZE (APIX_MAX_FRAME - 16) /* a block with its link */
+#else
+#define JSON_WRITER_BUF_SIZE 4096
+#endif
+#define JSON_WRITER_POOL_MAX 4
+
+struct json_writer {
+    char *buf;
+    size_t size;
+    size_t len;
+    int depth;
+    uint64_t need_comma; // one bit per depth
+    uint64_t in_array; // one bit per depth
+    int after_key;
+    int pooled;
+    int err;
+};
+
+int json_writer_init(struct json_writer *jw, char *buf, size_t size);
+void json_writer_fini(struct json_writer *jw);
+
+const char *json_writer_data(struct json_writer *jw);
+size_t json_writer_len(struct json_writer *jw);
+
+int json_write_object_begin(struct json_writer *jw);
+int json_write_object_end(struct json_writer *jw);
+int json_write_array_begin(struct json_writer *jw);
+int json_write_array_end(struct json_writer *jw);
+int json_write_key(struct json_writer *jw, const char *key);
+int json_write_string(struct json_writer *jw, const char *value);
+int json_write_string_len(struct json_writer *jw, const char *value, size_t len);
+int json_write_int64(struct json_writer *jw, int64_t value);
+int json_write_double(struct json_writer *jw, double value);
+int json_write_bool(struct json_writer *jw, int value);
+int json_write_null(struct json_writer *jw);
+
+/**
+ * json_write_raw
+ * - append pre-encoded text as a value, or a prefix before the first value
+ */
+int json_write_raw(struct json_writer *jw, const char *raw, size_t len);
 
 #ifdef __cplusplus
 }
@@ -171,6 +171,10 @@ impl Apix {
         }
     }
 
+    pub fn enable_posix_uring(&self) -> i32 {
+        unsafe { apix_sys::apix_enable_posix_uring(self.ctx) }
+    }
+
     pub fn disable_posix(&self) {
         unsafe {
             apix_sys::apix_disable_posix(self.ctx);
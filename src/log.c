@@ -1,10 +1,19 @@
 #include "log.h"
+#include "mem.h"
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/types.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#include <unistd.h>
+#endif
 
 #if defined(__unix__) || defined(__APPLE__)
 #define CL_RESET "\033[0;0m"
@@ -41,46 +50,54 @@ int log_set_level(int level)
     return previous;
 }
 
-static int __log_message(int level, const char *format, va_list ap)
+int log_level_enabled(int level)
 {
-    char prefix[40];
+    return level >= limit || level == LOG_LV_NONE;
+}
 
+static const char *__log_prefix(int level)
+{
     switch (level) {
     case LOG_LV_NONE: // None
-        strcpy(prefix, "");
-        break;
+        return "";
     case LOG_LV_TRACE: // Bright Cyan, important stuff!
-        strcpy(prefix, CL_CYAN"T"CL_RESET);
-        break;
+        return CL_CYAN"T"CL_RESET;
     case LOG_LV_DEBUG: // Bright Cyan, important stuff!
-        strcpy(prefix, CL_CYAN"D"CL_RESET);
-        break;
+        return CL_CYAN"D"CL_RESET;
     case LOG_LV_INFO: // Bright White (Variable information)
-        strcpy(prefix, CL_WHITE"I"CL_RESET);
-        break;
+        return CL_WHITE"I"CL_RESET;
     case LOG_LV_NOTICE: // Bright White (Less than a warning)
-        strcpy(prefix, CL_WHITE"N"CL_RESET);
-        break;
+        return CL_WHITE"N"CL_RESET;
     case LOG_LV_WARN: // Bright Yellow
-        strcpy(prefix, CL_YELLOW"W"CL_RESET);
-        break;
+        return CL_YELLOW"W"CL_RESET;
     case LOG_LV_ERROR: // Bright Red (Regular errors)
-        strcpy(prefix, CL_RED"E"CL_RESET);
-        break;
+        return CL_RED"E"CL_RESET;
     case LOG_LV_FATAL: // Bright Red (Fatal errors, abort(); if possible)
-        strcpy(prefix, CL_RED"F"CL_RESET);
-        break;
+        return CL_RED"F"CL_RESET;
     default:
+        return NULL;
+    }
+}
+
+static void __log_timestamp(const struct timeval *tv, char *buf, size_t size)
+{
+    size_t len = strftime(buf, size, "%Y-%m-%d %H:%M:%S",
+                          localtime(&tv->tv_sec));
+    snprintf(buf + len, size - len, ".%04d", (int)tv->tv_usec / 100);
+}
+
+static int __log_message(int level, const char *format, va_list ap)
+{
+    const char *prefix = __log_prefix(level);
+    if (prefix == NULL) {
         printf("__log_message: Invalid level passed.\n");
         return 1;
     }
 
     struct timeval tmnow;
-    char buf[32] = {0}, usec_buf[16] = {0};
+    char buf[32] = {0};
     gettimeofday(&tmnow, NULL);
-    strftime(buf, 30, "%Y-%m-%d %H:%M:%S", localtime(&tmnow.tv_sec));
-    sprintf(usec_buf, ".%04d", (int)tmnow.tv_usec / 100);
-    strcat(buf, usec_buf);
+    __log_timestamp(&tmnow, buf, sizeof(buf));
 
     printf("[%s] %s - ", buf, prefix);
     vprintf(format, ap);
@@ -90,6 +107,563 @@ static int __log_message(int level, const char *format, va_list ap)
     return 0;
 }
 
+/**
+ * async backend
+ * - a bounded multi-producer ring, each slot carries a sequence number which
+ *   tells the producers and the single consumer who owns it
+ * - producers keep the format pointer and pack the raw arguments, strings are
+ *   copied, all formatting is done by the background thread
+ * - the background thread sleeps on a condition and is only signaled by the
+ *   producers when it is asleep
+ */
+
+#if defined(__unix__) || defined(__APPLE__)
+
+struct log_record {
+    size_t seq;
+    int level;
+    int truncated;
+    struct timeval ts;
+    const char *format;
+    size_t len;
+    char args[LOG_RECORD_MSG_MAX];
+};
+
+struct log_async {
+    struct log_record *records;
+    size_t mask;
+    size_t enqueue_pos;
+    size_t dequeue_pos;
+    size_t dropped;
+    int running;
+    int sleeping;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t tid;
+};
+
+static struct log_async *async;
+
+enum {
+    LOG_LEN_NONE = 0,
+    LOG_LEN_HH,
+    LOG_LEN_H,
+    LOG_LEN_L,
+    LOG_LEN_LL,
+    LOG_LEN_Z,
+    LOG_LEN_J,
+    LOG_LEN_T,
+    LOG_LEN_BIG_L,
+};
+
+/* A conversion spec, from the '%' to the conversion character. */
+struct log_spec {
+    const char *start;
+    const char *len_pos;
+    char conv;
+    int len;
+    int width_star;
+    int prec_star;
+};
+
+/* Parse the spec at p which points to the '%', return the char after it. */
+static const char *__log_spec(const char *p, struct log_spec *spec)
+{
+    memset(spec, 0, sizeof(*spec));
+    spec->start = p++;
+
+    while (*p && strchr("-+ #0'", *p))
+        p++;
+    if (*p == '*') {
+        spec->width_star = 1;
+        p++;
+    } else {
+        while (*p >= '0' && *p <= '9')
+            p++;
+    }
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            spec->prec_star = 1;
+            p++;
+        } else {
+            while (*p >= '0' && *p <= '9')
+                p++;
+        }
+    }
+
+    spec->len_pos = p;
+    switch (*p) {
+    case 'h':
+        spec->len = p[1] == 'h' ? LOG_LEN_HH : LOG_LEN_H;
+        p += p[1] == 'h' ? 2 : 1;
+        break;
+    case 'l':
+        spec->len = p[1] == 'l' ? LOG_LEN_LL : LOG_LEN_L;
+        p += p[1] == 'l' ? 2 : 1;
+        break;
+    case 'q': spec->len = LOG_LEN_LL; p++; break;
+    case 'z': spec->len = LOG_LEN_Z; p++; break;
+    case 'j': spec->len = LOG_LEN_J; p++; break;
+    case 't': spec->len = LOG_LEN_T; p++; break;
+    case 'L': spec->len = LOG_LEN_BIG_L; p++; break;
+    }
+
+    spec->conv = *p;
+    return *p ? p + 1 : p;
+}
+
+static int __log_put(struct log_record *rec, const void *val, size_t len)
+{
+    if (rec->len + len > sizeof(rec->args))
+        return -1;
+    memcpy(rec->args + rec->len, val, len);
+    rec->len += len;
+    return 0;
+}
+
+static int __log_get(const struct log_record *rec, size_t *pos,
+                     void *val, size_t len)
+{
+    if (*pos + len > rec->len)
+        return -1;
+    memcpy(val, rec->args + *pos, len);
+    *pos += len;
+    return 0;
+}
+
+static long long __log_signed_arg(int len, va_list *ap)
+{
+    switch (len) {
+    case LOG_LEN_HH: return (signed char)va_arg(*ap, int);
+    case LOG_LEN_H: return (short)va_arg(*ap, int);
+    case LOG_LEN_L: return va_arg(*ap, long);
+    case LOG_LEN_LL: return va_arg(*ap, long long);
+    case LOG_LEN_Z: return va_arg(*ap, ssize_t);
+    case LOG_LEN_J: return va_arg(*ap, intmax_t);
+    case LOG_LEN_T: return va_arg(*ap, ptrdiff_t);
+    default: return va_arg(*ap, int);
+    }
+}
+
+static unsigned long long __log_unsigned_arg(int len, va_list *ap)
+{
+    switch (len) {
+    case LOG_LEN_HH: return (unsigned char)va_arg(*ap, unsigned int);
+    case LOG_LEN_H: return (unsigned short)va_arg(*ap, unsigned int);
+    case LOG_LEN_L: return va_arg(*ap, unsigned long);
+    case LOG_LEN_LL: return va_arg(*ap, unsigned long long);
+    case LOG_LEN_Z: return va_arg(*ap, size_t);
+    case LOG_LEN_J: return va_arg(*ap, uintmax_t);
+    case LOG_LEN_T: return va_arg(*ap, ptrdiff_t);
+    default: return va_arg(*ap, unsigned int);
+    }
+}
+
+/**
+ * __log_pack
+ * - integers are widened to long long as their length modifier says, so the
+ *   consumer prints them all with "ll"
+ * - a string is copied with its terminator, the record is marked truncated
+ *   and packing stops when the args have no room left
+ */
+static void __log_pack(struct log_record *rec, const char *format, va_list ap)
+{
+    struct log_spec spec;
+    va_list aq;
+
+    va_copy(aq, ap);
+    rec->len = 0;
+    rec->truncated = 0;
+
+    for (const char *p = format; *p;) {
+        if (*p != '%' || p[1] == '%') {
+            p += *p == '%' ? 2 : 1;
+            continue;
+        }
+        p = __log_spec(p, &spec);
+
+        int rc = 0;
+        if (spec.width_star) {
+            int width = va_arg(aq, int);
+            rc |= __log_put(rec, &width, sizeof(width));
+        }
+        if (spec.prec_star) {
+            int prec = va_arg(aq, int);
+            rc |= __log_put(rec, &prec, sizeof(prec));
+        }
+
+        switch (spec.conv) {
+        case 'd':
+        case 'i': {
+            long long val = __log_signed_arg(spec.len, &aq);
+            rc |= __log_put(rec, &val, sizeof(val));
+            break;
+        }
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X': {
+            unsigned long long val = __log_unsigned_arg(spec.len, &aq);
+            rc |= __log_put(rec, &val, sizeof(val));
+            break;
+        }
+        case 'c': {
+            int val = va_arg(aq, int);
+            rc |= __log_put(rec, &val, sizeof(val));
+            break;
+        }
+        case 'e': case 'E': case 'f': case 'F':
+        case 'g': case 'G': case 'a': case 'A':
+            if (spec.len == LOG_LEN_BIG_L) {
+                long double val = va_arg(aq, long double);
+                rc |= __log_put(rec, &val, sizeof(val));
+            } else {
+                double val = va_arg(aq, double);
+                rc |= __log_put(rec, &val, sizeof(val));
+            }
+            break;
+        case 'p': {
+            void *val = va_arg(aq, void *);
+            rc |= __log_put(rec, &val, sizeof(val));
+            break;
+        }
+        case 's': {
+            const char *val = va_arg(aq, const char *);
+            if (val == NULL)
+                val = "(null)";
+            size_t len = strlen(val) + 1;
+            size_t room = sizeof(rec->args) - rec->len;
+            if (len > room) {
+                if (room) {
+                    memcpy(rec->args + rec->len, val, room - 1);
+                    rec->args[sizeof(rec->args) - 1] = 0;
+                    rec->len = sizeof(rec->args);
+                }
+                rc = -1;
+            } else {
+                rc |= __log_put(rec, val, len);
+            }
+            break;
+        }
+        case 'n':
+            (void)va_arg(aq, void *);
+            break;
+        default:
+            rc = -1;
+            break;
+        }
+
+        if (rc) {
+            rec->truncated = 1;
+            break;
+        }
+    }
+
+    va_end(aq);
+}
+
+/* Rebuild spec with the stars resolved and the length modifier replaced. */
+static void __log_spec_fmt(const struct log_spec *spec, int width, int prec,
+                           const char *len, char *buf, size_t size)
+{
+    size_t idx = 0;
+
+    for (const char *p = spec->start; p < spec->len_pos && idx < size; p++) {
+        if (*p == '*' && p[-1] == '.') {
+            if (prec >= 0)
+                idx += snprintf(buf + idx, size - idx, "%d", prec);
+            else
+                idx--; /* a negative precision is taken as omitted */
+        } else if (*p == '*') {
+            idx += snprintf(buf + idx, size - idx, "%d", width);
+        } else {
+            buf[idx++] = *p;
+        }
+    }
+    if (idx < size)
+        snprintf(buf + idx, size - idx, "%s%c", len, spec->conv);
+    else
+        buf[size - 1] = 0;
+}
+
+static void __log_unpack(const struct log_record *rec)
+{
+    struct log_spec spec;
+    char fmt[64];
+    size_t pos = 0;
+    const char *p = rec->format;
+
+    while (*p) {
+        const char *lit = p;
+        while (*p && (*p != '%' || p[1] == '%'))
+            p += *p == '%' ? 2 : 1;
+        for (const char *q = lit; q < p; q++) {
+            putchar(*q);
+            if (*q == '%') q++;
+        }
+        if (*p == 0)
+            break;
+
+        p = __log_spec(p, &spec);
+
+        int width = 0, prec = -1, rc = 0;
+        if (spec.width_star)
+            rc |= __log_get(rec, &pos, &width, sizeof(width));
+        if (spec.prec_star)
+            rc |= __log_get(rec, &pos, &prec, sizeof(prec));
+
+        switch (spec.conv) {
+        case 'd':
+        case 'i': {
+            long long val;
+            rc |= __log_get(rec, &pos, &val, sizeof(val));
+            __log_spec_fmt(&spec, width, prec, "ll", fmt, sizeof(fmt));
+            if (!rc) printf(fmt, val);
+            break;
+        }
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X': {
+            unsigned long long val;
+            rc |= __log_get(rec, &pos, &val, sizeof(val));
+            __log_spec_fmt(&spec, width, prec, "ll", fmt, sizeof(fmt));
+            if (!rc) printf(fmt, val);
+            break;
+        }
+        case 'c': {
+            int val;
+            rc |= __log_get(rec, &pos, &val, sizeof(val));
+            __log_spec_fmt(&spec, width, prec, "", fmt, sizeof(fmt));
+            if (!rc) printf(fmt, val);
+            break;
+        }
+        case 'e': case 'E': case 'f': case 'F':
+        case 'g': case 'G': case 'a': case 'A':
+            if (spec.len == LOG_LEN_BIG_L) {
+                long double val;
+                rc |= __log_get(rec, &pos, &val, sizeof(val));
+                __log_spec_fmt(&spec, width, prec, "L", fmt, sizeof(fmt));
+                if (!rc) printf(fmt, val);
+            } else {
+                double val;
+                rc |= __log_get(rec, &pos, &val, sizeof(val));
+                __log_spec_fmt(&spec, width, prec, "", fmt, sizeof(fmt));
+                if (!rc) printf(fmt, val);
+            }
+            break;
+        case 'p': {
+            void *val;
+            rc |= __log_get(rec, &pos, &val, sizeof(val));
+            __log_spec_fmt(&spec, width, prec, "", fmt, sizeof(fmt));
+            if (!rc) printf(fmt, val);
+            break;
+        }
+        case 's': {
+            const char *val = rec->args + pos;
+            size_t len = strnlen(val, rec->len - pos);
+            if (pos + len < rec->len) {
+                pos += len + 1;
+                __log_spec_fmt(&spec, width, prec, "", fmt, sizeof(fmt));
+                printf(fmt, val);
+            } else {
+                rc = -1;
+                fwrite(val, 1, len, stdout);
+            }
+            break;
+        }
+        case 'n':
+            break;
+        default:
+            rc = -1;
+            break;
+        }
+
+        if (rc) {
+            if (rec->truncated)
+                fputs("...", stdout);
+            break;
+        }
+    }
+}
+
+static int __log_async_push(struct log_async *la, int level,
+                            const char *format, va_list ap)
+{
+    struct log_record *rec;
+    size_t pos = __atomic_load_n(&la->enqueue_pos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        rec = &la->records[pos & la->mask];
+        size_t seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(
+                    &la->enqueue_pos, &pos, pos + 1, 1,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (dif < 0) {
+            __atomic_add_fetch(&la->dropped, 1, __ATOMIC_RELAXED);
+            return -1;
+        } else {
+            pos = __atomic_load_n(&la->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    rec->level = level;
+    rec->format = format;
+    gettimeofday(&rec->ts, NULL);
+    __log_pack(rec, format, ap);
+    __atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+
+    // pairs with the store of sleeping in __log_async_thread
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&la->sleeping, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&la->lock);
+        pthread_cond_signal(&la->wake);
+        pthread_mutex_unlock(&la->lock);
+    }
+    return 0;
+}
+
+static int __log_async_pending(struct log_async *la)
+{
+    struct log_record *rec = &la->records[la->dequeue_pos & la->mask];
+    return __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) == la->dequeue_pos + 1
+        || __atomic_load_n(&la->dropped, __ATOMIC_RELAXED);
+}
+
+static int __log_async_drain(struct log_async *la)
+{
+    int cnt = 0;
+    char buf[32];
+
+    for (;;) {
+        struct log_record *rec = &la->records[la->dequeue_pos & la->mask];
+        size_t seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+        if (seq != la->dequeue_pos + 1)
+            break;
+
+        memset(buf, 0, sizeof(buf));
+        __log_timestamp(&rec->ts, buf, sizeof(buf));
+        printf("[%s] %s - ", buf, __log_prefix(rec->level));
+        __log_unpack(rec);
+        printf("\n");
+
+        __atomic_store_n(&rec->seq, la->dequeue_pos + la->mask + 1,
+                         __ATOMIC_RELEASE);
+        la->dequeue_pos++;
+        cnt++;
+    }
+
+    size_t dropped = __atomic_exchange_n(&la->dropped, 0, __ATOMIC_RELAXED);
+    if (dropped) {
+        struct timeval tmnow;
+        gettimeofday(&tmnow, NULL);
+        memset(buf, 0, sizeof(buf));
+        __log_timestamp(&tmnow, buf, sizeof(buf));
+        printf("[%s] %s - [log_async] ring full, %zu messages dropped\n",
+               buf, __log_prefix(LOG_LV_WARN), dropped);
+    }
+
+    if (cnt || dropped)
+        fflush(stdout);
+    return cnt;
+}
+
+static void *__log_async_thread(void *arg)
+{
+    struct log_async *la = arg;
+
+    for (;;) {
+        __log_async_drain(la);
+
+        pthread_mutex_lock(&la->lock);
+        __atomic_store_n(&la->sleeping, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&la->running, __ATOMIC_ACQUIRE) &&
+               !__log_async_pending(la))
+            pthread_cond_wait(&la->wake, &la->lock);
+        __atomic_store_n(&la->sleeping, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&la->lock);
+
+        if (!__atomic_load_n(&la->running, __ATOMIC_ACQUIRE))
+            break;
+    }
+
+    __log_async_drain(la);
+    return NULL;
+}
+
+int log_enable_async(unsigned int nr_records)
+{
+    if (async)
+        return -1;
+
+    size_t size = 1;
+    while (size < nr_records)
+        size <<= 1;
+    if (size < 2)
+        size = 2;
+
+    struct log_async *la = mem_calloc(1, sizeof(*la));
+    if (la == NULL)
+        return -1;
+    la->records = mem_calloc(size, sizeof(struct log_record));
+    if (la->records == NULL) {
+        mem_free(la);
+        return -1;
+    }
+    for (size_t i = 0; i < size; i++)
+        la->records[i].seq = i;
+    la->mask = size - 1;
+    la->running = 1;
+    pthread_mutex_init(&la->lock, NULL);
+    pthread_cond_init(&la->wake, NULL);
+
+    if (pthread_create(&la->tid, NULL, __log_async_thread, la) != 0) {
+        pthread_cond_destroy(&la->wake);
+        pthread_mutex_destroy(&la->lock);
+        mem_free(la->records);
+        mem_free(la);
+        return -1;
+    }
+
+    __atomic_store_n(&async, la, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void log_disable_async(void)
+{
+    struct log_async *la = __atomic_exchange_n(&async, NULL, __ATOMIC_ACQ_REL);
+    if (la == NULL)
+        return;
+
+    pthread_mutex_lock(&la->lock);
+    __atomic_store_n(&la->running, 0, __ATOMIC_RELEASE);
+    pthread_cond_signal(&la->wake);
+    pthread_mutex_unlock(&la->lock);
+    pthread_join(la->tid, NULL);
+    pthread_cond_destroy(&la->wake);
+    pthread_mutex_destroy(&la->lock);
+    mem_free(la->records);
+    mem_free(la);
+}
+
+#else
+
+int log_enable_async(unsigned int nr_records)
+{
+    (void)nr_records;
+    return -1;
+}
+
+void log_disable_async(void)
+{
+}
+
+#endif
+
 int log_message(int level, const char *format, ...)
 {
     int rc;
@@ -101,8 +675,38 @@ int log_message(int level, const char *format, ...)
         return 0;
 
     va_start(ap, format);
+#if defined(__unix__) || defined(__APPLE__)
+    struct log_async *la = __atomic_load_n(&async, __ATOMIC_ACQUIRE);
+    if (la && __log_prefix(level))
+        rc = __log_async_push(la, level, format, ap);
+    else
+#endif
     rc = __log_message(level, format, ap);
     va_end(ap);
 
     return rc;
 }
+
+int log_ratelimit(struct log_ratelimit *rl)
+{
+    struct timeval tmnow;
+    gettimeofday(&tmnow, NULL);
+
+    if (rl->sec != tmnow.tv_sec) {
+        unsigned int suppressed = rl->suppressed;
+        rl->sec = tmnow.tv_sec;
+        rl->cnt = 0;
+        rl->suppressed = 0;
+        if (suppressed)
+            log_message(LOG_LV_WARN, "[log_ratelimit] %u messages suppressed",
+                        suppressed);
+    }
+
+    if (rl->cnt >= LOG_RATELIMIT_BURST) {
+        rl->suppressed++;
+        return 0;
+    }
+
+    rl->cnt++;
+    return 1;
+}
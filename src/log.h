@@ -16,21 +16,75 @@ enum {
     LOG_LV_FATAL,
 };
 
+/*
+ * Call sites below LOG_LV_MIN are removed at compile time, arguments included,
+ * e.g. -DLOG_LV_MIN=LOG_LV_INFO for release builds.
+ */
+#ifndef LOG_LV_MIN
+#define LOG_LV_MIN LOG_LV_TRACE
+#endif
+
+#define LOG_ASYNC_DEFAULT_RECORDS 1024
+#define LOG_RECORD_MSG_MAX 480 /* argument bytes of an async record */
+#define LOG_RATELIMIT_BURST 10 /* per second and call site */
+
 /* Set log level and return former log level. */
 int log_set_level(int level);
 
+/* Return non-zero if messages of the level pass the runtime log level. */
+int log_level_enabled(int level);
+
 /* Log message to stdout */
 int log_message(int level, const char *format, ...);
 
+/*
+ * Switch to the async backend, messages are put into a lock-free ring of
+ * nr_records slots and formatted & written by a background thread. A message
+ * never blocks the caller, it is dropped and counted when the ring is full.
+ * - the format is kept by pointer and must outlive the call, a string literal
+ * - the arguments are copied, strings included, up to LOG_RECORD_MSG_MAX,
+ *   the rest of a longer message is cut to "..."
+ */
+int log_enable_async(unsigned int nr_records);
+
+/*
+ * Flush pending messages, stop the background thread and log synchronously.
+ * - other threads must not log while it is running
+ */
+void log_disable_async(void);
+
+struct log_ratelimit {
+    long sec;
+    unsigned int cnt;
+    unsigned int suppressed;
+};
+
+/* Return non-zero if the call site may log within LOG_RATELIMIT_BURST. */
+int log_ratelimit(struct log_ratelimit *rl);
+
+#define LOG_LEVEL_ON(level) \
+    ((level) >= LOG_LV_MIN && log_level_enabled(level))
+
+#define __LOG(level, format, ...) \
+    (LOG_LEVEL_ON(level) ? log_message(level, format, ##__VA_ARGS__) : 0)
+
 /* Marcos wrapping log_level for convenient usage of log_message */
 #define LOG_NONE(format, ...) log_message(LOG_LV_NONE, format, ##__VA_ARGS__)
-#define LOG_TRACE(format, ...) log_message(LOG_LV_TRACE, format, ##__VA_ARGS__)
-#define LOG_DEBUG(format, ...) log_message(LOG_LV_DEBUG, format, ##__VA_ARGS__)
-#define LOG_INFO(format, ...) log_message(LOG_LV_INFO, format, ##__VA_ARGS__)
-#define LOG_NOTICE(format, ...) log_message(LOG_LV_NOTICE, format, ##__VA_ARGS__)
-#define LOG_WARN(format, ...) log_message(LOG_LV_WARN, format, ##__VA_ARGS__)
-#define LOG_ERROR(format, ...) log_message(LOG_LV_ERROR, format, ##__VA_ARGS__)
-#define LOG_FATAL(format, ...) log_message(LOG_LV_FATAL, format, ##__VA_ARGS__)
+#define LOG_TRACE(format, ...) __LOG(LOG_LV_TRACE, format, ##__VA_ARGS__)
+#define LOG_DEBUG(format, ...) __LOG(LOG_LV_DEBUG, format, ##__VA_ARGS__)
+#define LOG_INFO(format, ...) __LOG(LOG_LV_INFO, format, ##__VA_ARGS__)
+#define LOG_NOTICE(format, ...) __LOG(LOG_LV_NOTICE, format, ##__VA_ARGS__)
+#define LOG_WARN(format, ...) __LOG(LOG_LV_WARN, format, ##__VA_ARGS__)
+#define LOG_ERROR(format, ...) __LOG(LOG_LV_ERROR, format, ##__VA_ARGS__)
+#define LOG_FATAL(format, ...) __LOG(LOG_LV_FATAL, format, ##__VA_ARGS__)
+
+/* Same as LOG_*, but each call site logs at most LOG_RATELIMIT_BURST/s */
+#define LOG_RATELIMITED(level, format, ...)                             \
+    do {                                                                \
+        static struct log_ratelimit __rl;                               \
+        if (LOG_LEVEL_ON(level) && log_ratelimit(&__rl))                \
+            log_message(level, format, ##__VA_ARGS__);                  \
+    } while (0)
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,243 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mem.h"
+
+#ifdef APIX_STATIC_ALLOC
+
+#define MEM_ALIGN(size) (((size) + 15) & ~(size_t)15)
+
+struct mem_block {
+    struct mem_block *next;
+};
+
+#define MEM_CLASS_BYTES(size, count) + MEM_ALIGN(size) * (count)
+#define MEM_CLASS(size, count) { "bytes", MEM_ALIGN(size), count, NULL },
+
+static u8 arena[0 APIX_MEM_CLASSES(MEM_CLASS_BYTES)] __attribute__((aligned(16)));
+static struct mem_pool classes[] = { APIX_MEM_CLASSES(MEM_CLASS) };
+#define NR_CLASSES (sizeof(classes) / sizeof(classes[0]))
+
+static struct {
+    char lock;
+    int ready; /* classes carved out of arena */
+    struct mem_pool *pools;
+} mem;
+
+static void register_pool(struct mem_pool *pool)
+{
+    APIX_MEM_LOCK(&mem.lock);
+    if (!pool->registered) {
+        pool->next = mem.pools;
+        mem.pools = pool;
+        __atomic_store_n(&pool->registered, 1, __ATOMIC_RELEASE);
+    }
+    APIX_MEM_UNLOCK(&mem.lock);
+}
+
+static void init_classes(void)
+{
+    APIX_MEM_LOCK(&mem.lock);
+    if (!mem.ready) {
+        u8 *blocks = arena;
+        for (u32 i = 0; i < NR_CLASSES; i++) {
+            assert(i == 0 || classes[i].size >= classes[i - 1].size);
+            classes[i].blocks = blocks;
+            blocks += (size_t)classes[i].size * classes[i].count;
+        }
+        for (u32 i = NR_CLASSES; i > 0; i--) {
+            classes[i - 1].next = mem.pools;
+            classes[i - 1].registered = 1;
+            mem.pools = &classes[i - 1];
+        }
+        __atomic_store_n(&mem.ready, 1, __ATOMIC_RELEASE);
+    }
+    APIX_MEM_UNLOCK(&mem.lock);
+}
+
+/* Take a block without zeroing it or counting a failure. */
+static void *pool_take(struct mem_pool *pool)
+{
+    void *ptr = NULL;
+
+    APIX_MEM_LOCK(&pool->lock);
+    if (pool->free_list) {
+        ptr = pool->free_list;
+        pool->free_list = ((struct mem_block *)ptr)->next;
+    } else if (pool->top < pool->count) {
+        ptr = pool->blocks + (size_t)pool->size * pool->top++;
+    }
+    if (ptr && ++pool->used > pool->peak)
+        pool->peak = pool->used;
+    APIX_MEM_UNLOCK(&pool->lock);
+    return ptr;
+}
+
+static void pool_fail(struct mem_pool *pool)
+{
+    APIX_MEM_LOCK(&pool->lock);
+    pool->fails++;
+    APIX_MEM_UNLOCK(&pool->lock);
+}
+
+static int pool_owns(struct mem_pool *pool, const void *ptr)
+{
+    const u8 *p = ptr;
+    return p >= pool->blocks &&
+        p < pool->blocks + (size_t)pool->size * pool->count;
+}
+
+void *mem_pool_alloc(struct mem_pool *pool)
+{
+    if (!__atomic_load_n(&pool->registered, __ATOMIC_ACQUIRE))
+        register_pool(pool);
+
+    void *ptr = pool_take(pool);
+    if (ptr == NULL) {
+        pool_fail(pool);
+        return NULL;
+    }
+    memset(ptr, 0, pool->size);
+    return ptr;
+}
+
+void mem_pool_free(struct mem_pool *pool, void *ptr)
+{
+    if (ptr == NULL)
+        return;
+    assert(pool_owns(pool, ptr));
+
+    APIX_MEM_LOCK(&pool->lock);
+    ((struct mem_block *)ptr)->next = pool->free_list;
+    pool->free_list = ptr;
+    pool->used--;
+    APIX_MEM_UNLOCK(&pool->lock);
+}
+
+static struct mem_pool *class_of(const void *ptr)
+{
+    for (u32 i = 0; i < NR_CLASSES; i++) {
+        if (pool_owns(&classes[i], ptr))
+            return &classes[i];
+    }
+    return NULL;
+}
+
+static int class_fit(size_t size)
+{
+    for (u32 i = 0; i < NR_CLASSES; i++) {
+        if (classes[i].size >= size)
+            return i;
+    }
+    return -1;
+}
+
+void *mem_alloc(size_t size)
+{
+    if (!__atomic_load_n(&mem.ready, __ATOMIC_ACQUIRE))
+        init_classes();
+
+    int fit = class_fit(size ? size : 1);
+    if (fit == -1)
+        return NULL;
+
+    // a larger class when the one that fits is exhausted
+    for (u32 i = fit; i < NR_CLASSES; i++) {
+        void *ptr = pool_take(&classes[i]);
+        if (ptr)
+            return ptr;
+    }
+    pool_fail(&classes[fit]);
+    return NULL;
+}
+
+void *mem_calloc(size_t nmemb, size_t size)
+{
+    if (size && nmemb > (size_t)-1 / size)
+        return NULL;
+    void *ptr = mem_alloc(nmemb * size);
+    if (ptr)
+        memset(ptr, 0, nmemb * size);
+    return ptr;
+}
+
+void *mem_realloc(void *ptr, size_t size)
+{
+    if (ptr == NULL)
+        return mem_alloc(size);
+
+    struct mem_pool *pool = class_of(ptr);
+    assert(pool);
+
+    // move down to the class that fits, if the block is larger than needed
+    int fit = class_fit(size ? size : 1);
+    if (fit != -1 && &classes[fit] == pool)
+        return ptr;
+    if (fit != -1 && size <= pool->size) {
+        void *newptr = pool_take(&classes[fit]);
+        if (newptr == NULL)
+            return ptr;
+        memcpy(newptr, ptr, size);
+        mem_free(ptr);
+        return newptr;
+    }
+
+    void *newptr = mem_alloc(size);
+    if (newptr == NULL)
+        return NULL;
+    memcpy(newptr, ptr, size < pool->size ? size : pool->size);
+    mem_free(ptr);
+    return newptr;
+}
+
+void mem_free(void *ptr)
+{
+    if (ptr == NULL)
+        return;
+    struct mem_pool *pool = class_of(ptr);
+    assert(pool);
+    mem_pool_free(pool, ptr);
+}
+
+char *mem_strdup(const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *dup = mem_alloc(len);
+    if (dup)
+        memcpy(dup, s, len);
+    return dup;
+}
+
+int mem_stat(struct mem_stat *stats, int max)
+{
+    if (!__atomic_load_n(&mem.ready, __ATOMIC_ACQUIRE))
+        init_classes();
+
+    int nr = 0;
+    APIX_MEM_LOCK(&mem.lock);
+    for (struct mem_pool *pos = mem.pools; pos && nr < max; pos = pos->next) {
+        APIX_MEM_LOCK(&pos->lock);
+        stats[nr++] = (struct mem_stat){
+            .name = pos->name,
+            .size = pos->size,
+            .count = pos->count,
+            .used = pos->used,
+            .peak = pos->peak,
+            .fails = pos->fails,
+        };
+        APIX_MEM_UNLOCK(&pos->lock);
+    }
+    APIX_MEM_UNLOCK(&mem.lock);
+    return nr;
+}
+
+#else
+
+int mem_stat(struct mem_stat *stats, int max)
+{
+    (void)stats;
+    (void)max;
+    return 0;
+}
+
+#endif
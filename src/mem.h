@@ -0,0 +1,172 @@
+#ifndef __MEM_H
+#define __MEM_H
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * mem
+ * - every allocation of libapix but the io_uring backend goes through here:
+ *   straight to libc by default, from pools in static storage with
+ *   -DAPIX_STATIC_ALLOC, then the heap is never touched and never fragments
+ * - typed pools hold a fixed number of one struct: ctx, streams, messages
+ *   & packets, byte pools serve the rest by size class, a request takes the
+ *   smallest class with a free block
+ * - an exhausted pool fails the allocation, nothing grows behind it, see
+ *   mem_stat for sizing
+ */
+
+#ifdef APIX_STATIC_ALLOC
+
+#ifndef APIX_MAX_CTX
+#define APIX_MAX_CTX 1
+#endif
+#ifndef APIX_MAX_STREAMS
+#define APIX_MAX_STREAMS 16 /* listen, accepted & client streams */
+#endif
+#ifndef APIX_MAX_MESSAGES
+#define APIX_MAX_MESSAGES 32 /* received, not yet finished */
+#endif
+#ifndef APIX_MAX_PACKETS
+/* messages, reassembly & cut-through of each stream, and a few in hand */
+#define APIX_MAX_PACKETS (APIX_MAX_MESSAGES + 2 * APIX_MAX_STREAMS + 8)
+#endif
+#ifndef APIX_MAX_FRAME
+#define APIX_MAX_FRAME 2048 /* any packet, parsed, built or reassembled */
+#endif
+#if APIX_MAX_FRAME < 1024
+#error "APIX_MAX_FRAME below 1024 leaves no room for a payload"
+#endif
+
+/*
+ * Byte pools as X(block size, blocks), sizes ascending, override for the
+ * target with -DAPIX_MEM_CLASSES=..., the largest class bounds rx & tx
+ * buffers of a stream, two frames.
+ */
+#ifndef APIX_MEM_CLASSES
+#define APIX_MEM_CLASSES(X) \
+    X(32, 16 * APIX_MAX_STREAMS + 64) \
+    X(64, 8 * APIX_MAX_STREAMS + 64) \
+    X(128, 4 * APIX_MAX_STREAMS + 16) \
+    X(256, 2 * APIX_MAX_STREAMS + APIX_MAX_PACKETS) \
+    X(512, APIX_MAX_STREAMS + 8) \
+    X(APIX_MAX_FRAME, APIX_MAX_STREAMS + APIX_MAX_PACKETS / 2) \
+    X(2 * APIX_MAX_FRAME, APIX_MAX_STREAMS / 2 + 1)
+#endif
+
+/* Taken around every pool operation, MCU ports may mask irqs instead. */
+#ifndef APIX_MEM_LOCK
+#define APIX_MEM_LOCK(lock) \
+    while (__atomic_test_and_set(lock, __ATOMIC_ACQUIRE))
+#define APIX_MEM_UNLOCK(lock) __atomic_clear(lock, __ATOMIC_RELEASE)
+#endif
+
+#endif
+
+struct mem_pool {
+    const char *name;
+    u32 size; /* of a block */
+    u32 count;
+    u8 *blocks; /* NULL without APIX_STATIC_ALLOC */
+
+    char lock;
+    u32 top; /* blocks below it were handed out once */
+    void *free_list;
+    u32 used;
+    u32 peak;
+    u32 fails;
+    struct mem_pool *next; /* for mem_stat, linked on first use */
+    int registered;
+};
+
+/*
+ * Define a static pool of count blocks of type, count is ignored without
+ * APIX_STATIC_ALLOC, each block is calloc'ed then.
+ */
+#ifdef APIX_STATIC_ALLOC
+#define MEM_POOL(name, type, count) \
+    static union { type obj; void *next; } name##_blocks[count]; \
+    static struct mem_pool name = { \
+        #name, sizeof(name##_blocks[0]), count, (u8 *)name##_blocks }
+#else
+#define MEM_POOL(name, type, count) \
+    static struct mem_pool name = { #name, sizeof(type), 0, NULL }
+#endif
+
+#ifdef APIX_STATIC_ALLOC
+
+/* Zeroed block of pool, or NULL if it is exhausted. */
+void *mem_pool_alloc(struct mem_pool *pool);
+void mem_pool_free(struct mem_pool *pool, void *ptr);
+
+void *mem_alloc(size_t size);
+void *mem_calloc(size_t nmemb, size_t size);
+void *mem_realloc(void *ptr, size_t size);
+void mem_free(void *ptr);
+char *mem_strdup(const char *s);
+
+#else
+
+static inline void *mem_pool_alloc(struct mem_pool *pool)
+{
+    return calloc(1, pool->size);
+}
+
+static inline void mem_pool_free(struct mem_pool *pool, void *ptr)
+{
+    (void)pool;
+    free(ptr);
+}
+
+static inline void *mem_alloc(size_t size)
+{
+    return malloc(size);
+}
+
+static inline void *mem_calloc(size_t nmemb, size_t size)
+{
+    return calloc(nmemb, size);
+}
+
+static inline void *mem_realloc(void *ptr, size_t size)
+{
+    return realloc(ptr, size);
+}
+
+static inline void mem_free(void *ptr)
+{
+    free(ptr);
+}
+
+static inline char *mem_strdup(const char *s)
+{
+    return strdup(s);
+}
+
+#endif
+
+struct mem_stat {
+    const char *name;
+    u32 size;
+    u32 count;
+    u32 used;
+    u32 peak;
+    u32 fails;
+};
+
+/*
+ * Fill stats of the byte pools & the typed pools used so far, up to max.
+ * - return the number filled, 0 without APIX_STATIC_ALLOC
+ */
+int mem_stat(struct mem_stat *stats, int max);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
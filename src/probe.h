@@ -0,0 +1,86 @@
+#ifndef __PROBE_H
+#define __PROBE_H
+
+/**
+ * Static tracepoints (USDT)
+ * - each probe is a single nop plus an ELF note in .note.stapsdt, so it is
+ *   free until perf/bpftrace attach to it, e.g.
+ *     bpftrace -e 'usdt:./libapix.so:apix:route { printf("%s\n", str(arg1)); }'
+ * - the note layout follows systemtap's sys/sdt.h, no header from it is needed
+ * - every argument is passed as a signed long, pointers included
+ * - defined to nothing unless APIX_USDT is set on an ELF target
+ */
+
+#if defined APIX_USDT && defined __ELF__ && \
+    (defined __x86_64__ || defined __i386__ || defined __aarch64__ || defined __arm__)
+
+#ifdef __LP64__
+#define __PROBE_ASM_ADDR ".8byte"
+#else
+#define __PROBE_ASM_ADDR ".4byte"
+#endif
+
+#define __PROBE_ARG(n, x) \
+    [__probe_s##n] "n" ((int)sizeof(long)), [__probe_a##n] "nor" ((long)(x))
+#define __PROBE_FMT(n) "%n[__probe_s" #n "]@%[__probe_a" #n "]"
+
+#define __PROBE_ASM(provider, name, args, ...)                          \
+    __asm__ __volatile__ (                                              \
+        "990: nop\n"                                                    \
+        ".pushsection .note.stapsdt,\"?\",\"note\"\n"                   \
+        ".balign 4\n"                                                   \
+        ".4byte 992f-991f, 994f-993f, 3\n"                              \
+        "991: .asciz \"stapsdt\"\n"                                     \
+        "992: .balign 4\n"                                              \
+        "993: " __PROBE_ASM_ADDR " 990b\n"                              \
+        __PROBE_ASM_ADDR " _.stapsdt.base\n"                            \
+        __PROBE_ASM_ADDR " 0\n"                                         \
+        ".asciz \"" #provider "\"\n"                                    \
+        ".asciz \"" #name "\"\n"                                        \
+        ".asciz \"" args "\"\n"                                         \
+        "994: .balign 4\n"                                              \
+        ".popsection\n"                                                 \
+        ".ifndef _.stapsdt.base\n"                                      \
+        ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+        ".weak _.stapsdt.base\n"                                        \
+        ".hidden _.stapsdt.base\n"                                      \
+        "_.stapsdt.base: .space 1\n"                                    \
+        ".size _.stapsdt.base, 1\n"                                     \
+        ".popsection\n"                                                 \
+        ".endif\n"                                                      \
+        :: __VA_ARGS__)
+
+#define PROBE1(provider, name, a1)                                      \
+    __PROBE_ASM(provider, name, __PROBE_FMT(1),                         \
+                __PROBE_ARG(1, a1))
+#define PROBE2(provider, name, a1, a2)                                  \
+    __PROBE_ASM(provider, name, __PROBE_FMT(1) " " __PROBE_FMT(2),      \
+                __PROBE_ARG(1, a1), __PROBE_ARG(2, a2))
+#define PROBE3(provider, name, a1, a2, a3)                              \
+    __PROBE_ASM(provider, name,                                         \
+                __PROBE_FMT(1) " " __PROBE_FMT(2) " " __PROBE_FMT(3),   \
+                __PROBE_ARG(1, a1), __PROBE_ARG(2, a2), __PROBE_ARG(3, a3))
+#define PROBE4(provider, name, a1, a2, a3, a4)                          \
+    __PROBE_ASM(provider, name,                                         \
+                __PROBE_FMT(1) " " __PROBE_FMT(2) " "                   \
+                __PROBE_FMT(3) " " __PROBE_FMT(4),                      \
+                __PROBE_ARG(1, a1), __PROBE_ARG(2, a2),                 \
+                __PROBE_ARG(3, a3), __PROBE_ARG(4, a4))
+#define PROBE5(provider, name, a1, a2, a3, a4, a5)                      \
+    __PROBE_ASM(provider, name,                                         \
+                __PROBE_FMT(1) " " __PROBE_FMT(2) " " __PROBE_FMT(3) " " \
+                __PROBE_FMT(4) " " __PROBE_FMT(5),                      \
+                __PROBE_ARG(1, a1), __PROBE_ARG(2, a2), __PROBE_ARG(3, a3), \
+                __PROBE_ARG(4, a4), __PROBE_ARG(5, a5))
+
+#else
+
+#define PROBE1(provider, name, a1) do {} while (0)
+#define PROBE2(provider, name, a1, a2) do {} while (0)
+#define PROBE3(provider, name, a1, a2, a3) do {} while (0)
+#define PROBE4(provider, name, a1, a2, a3, a4) do {} while (0)
+#define PROBE5(provider, name, a1, a2, a3, a4, a5) do {} while (0)
+
+#endif
+
+#endif
@@ -1,4 +1,5 @@
 #include "ringbuf.h"
+#include "mem.h"
 #include <assert.h>
 #include <stdint.h>
 #include <string.h>
@@ -16,12 +17,12 @@ ringbuf_t *ringbuf_new(size_t size)
     if (size == 0)
         size = RINGBUF_DEFAULT_SIZE;
 
-    ringbuf_t *self = (ringbuf_t*)calloc(sizeof(ringbuf_t), 1);
+    ringbuf_t *self = (ringbuf_t*)mem_calloc(sizeof(ringbuf_t), 1);
     if (!self) return NULL;
 
-    self->rawbuf = (char*)calloc(size, 1);
+    self->rawbuf = (char*)mem_calloc(size, 1);
     if (!self->rawbuf) {
-        free(self);
+        mem_free(self);
         return NULL;
     }
 
@@ -35,8 +36,8 @@ ringbuf_t *ringbuf_new(size_t size)
 void ringbuf_delete(ringbuf_t *self)
 {
     if (self) {
-        free(self->rawbuf);
-        free(self);
+        mem_free(self->rawbuf);
+        mem_free(self);
     }
 }
 
@@ -6,11 +6,24 @@
 #include <stdio.h>
 
 #include "srrp.h"
+#include "atom.h"
 #include "crc16.h"
-#include "str.h"
+#include "crc32c.h"
+#include "mem.h"
 #include "vec.h"
 
-#define CRC_SIZE 5 /* <crc16>\0 */
+/*
+ * The check ends every packet as \0<check>\0, its hex digits tell the
+ * integrity mode, so packets of any mode parse without prior agreement.
+ */
+static const u8 check_digits[] = {
+    [SRRP_INTEGRITY_NONE] = 0,
+    [SRRP_INTEGRITY_CRC16] = 4,
+    [SRRP_INTEGRITY_CRC32C] = 8,
+};
+
+#define PACKET_LEN_OFFSET 6 /* of the 4 hex digits in =101j#[packet_len]# */
+#define PACKET_FRAMING_MAX 48 /* all but ids, anchor & payload, check included */
 
 struct srrp_packet {
     char leader;
@@ -21,16 +34,99 @@ struct srrp_packet {
     u16 packet_len;
     u32 payload_len;
 
-    str_t *srcid;
-    str_t *dstid;
+    atom_t *srcid;
+    atom_t *dstid;
+    u32 seqno;
 
-    str_t *anchor;
+    atom_t *anchor;
     const u8 *payload;
 
-    u16 crc16;
+    u8 integrity;
+    u32 crc;
     vec_t *raw;
 };
 
+MEM_POOL(packet_pool, struct srrp_packet, APIX_MAX_PACKETS);
+
+/* Return non-zero if pac may not be held, over APIX_MAX_FRAME. */
+static int srrp_over_frame(u32 packet_len)
+{
+#ifdef APIX_STATIC_ALLOC
+    return packet_len > APIX_MAX_FRAME;
+#else
+    (void)packet_len;
+    return 0;
+#endif
+}
+
+static struct srrp_packet *__srrp_new(
+    char leader, u8 fin, atom_t *srcid, atom_t *dstid, u32 seqno,
+    atom_t *anchor, const u8 *payload, u32 payload_len, u8 integrity);
+
+static u32 srrp_check_update(u8 integrity, u32 crc, const u8 *buf, u32 len)
+{
+    switch (integrity) {
+    case SRRP_INTEGRITY_CRC16:
+        return crc16_crc(crc, buf, len);
+    case SRRP_INTEGRITY_CRC32C:
+        return crc32c_crc(crc, buf, len);
+    default:
+        return 0;
+    }
+}
+
+static u32 srrp_check(u8 integrity, const u8 *buf, u32 len)
+{
+    return srrp_check_update(integrity, 0, buf, len);
+}
+
+/*
+ * Append the check of integrity to v, which holds the packet up to its stop
+ * flag, and fill in packet_len.
+ */
+static u32 srrp_pack_check(vec_t *v, u8 integrity)
+{
+    char tmp[16] = {0};
+    u8 digits = check_digits[integrity];
+
+    u32 packet_len = vsize(v) + digits + 1;
+    assert(packet_len < SRRP_PACKET_MAX);
+    snprintf(tmp, sizeof(tmp), "%.4x", packet_len);
+    assert(strlen(tmp) == 4);
+    memcpy((char *)vraw(v) + PACKET_LEN_OFFSET, tmp, 4);
+
+    u32 crc = srrp_check(integrity, vraw(v), vsize(v));
+    if (digits) {
+        snprintf(tmp, sizeof(tmp), "%.*x", digits, crc);
+        assert(strlen(tmp) == digits);
+        vpack(v, tmp, digits);
+    }
+    vpack(v, "\0", 1);
+    return crc;
+}
+
+/*
+ * Return the integrity mode told by the check of buf, -1 if malformed.
+ */
+static int srrp_parse_integrity(const u8 *buf, u32 packet_len)
+{
+    if (packet_len < 2 || buf[packet_len - 1] != 0)
+        return -1;
+
+    u32 digits = 0;
+    while (digits < 8 && digits + 2 < packet_len &&
+           isxdigit(buf[packet_len - 2 - digits]))
+        digits++;
+    if (buf[packet_len - 2 - digits] != 0)
+        return -1;
+
+    for (u32 i = 0; i < sizeof(check_digits); i++) {
+        if (check_digits[i] == digits)
+            return i;
+    }
+    return -1;
+}
+
 char srrp_get_leader(const struct srrp_packet *pac)
 {
     return pac->leader;
@@ -63,17 +159,37 @@ u32 srrp_get_payload_len(const struct srrp_packet *pac)
 
 const char *srrp_get_srcid(const struct srrp_packet *pac)
 {
-    return sget(pac->srcid);
+    return atom_str(pac->srcid);
 }
 
 const char *srrp_get_dstid(const struct srrp_packet *pac)
 {
-    return sget(pac->dstid);
+    return atom_str(pac->dstid);
 }
 
 const char *srrp_get_anchor(const struct srrp_packet *pac)
 {
-    return sget(pac->anchor);
+    return atom_str(pac->anchor);
+}
+
+struct atom *srrp_get_srcid_atom(const struct srrp_packet *pac)
+{
+    return pac->srcid;
+}
+
+struct atom *srrp_get_dstid_atom(const struct srrp_packet *pac)
+{
+    return pac->dstid;
+}
+
+struct atom *srrp_get_anchor_atom(const struct srrp_packet *pac)
+{
+    return pac->anchor;
+}
+
+u32 srrp_get_seqno(const struct srrp_packet *pac)
+{
+    return pac->seqno;
 }
 
 const u8 *srrp_get_payload(const struct srrp_packet *pac)
@@ -83,7 +199,12 @@ const u8 *srrp_get_payload(const struct srrp_packet *pac)
 
 u16 srrp_get_crc16(const struct srrp_packet *pac)
 {
-    return pac->crc16;
+    return pac->integrity == SRRP_INTEGRITY_CRC16 ? pac->crc : 0;
+}
+
+u8 srrp_get_integrity(const struct srrp_packet *pac)
+{
+    return pac->integrity;
 }
 
 const u8 *srrp_get_raw(const struct srrp_packet *pac)
@@ -91,6 +212,24 @@ const u8 *srrp_get_raw(const struct srrp_packet *pac)
     return vraw(pac->raw);
 }
 
+void srrp_get_header(const struct srrp_packet *pac, struct srrp_header *hdr)
+{
+    hdr->srcid = atom_str(pac->srcid);
+    hdr->dstid = atom_str(pac->dstid);
+    hdr->anchor = atom_str(pac->anchor);
+    hdr->payload = pac->payload;
+    hdr->raw = vraw(pac->raw);
+    hdr->payload_len = pac->payload_len;
+    hdr->seqno = pac->seqno;
+    hdr->crc = pac->crc;
+    hdr->ver = pac->ver;
+    hdr->packet_len = pac->packet_len;
+    hdr->leader = pac->leader;
+    hdr->fin = pac->fin;
+    hdr->payload_type = pac->payload_type;
+    hdr->integrity = pac->integrity;
+}
+
 void srrp_set_fin(struct srrp_packet *pac, u8 fin)
 {
     assert(fin == SRRP_FIN_0 || fin == SRRP_FIN_1);
@@ -101,9 +240,42 @@ void srrp_set_fin(struct srrp_packet *pac, u8 fin)
     pac->fin = fin;
     *((char *)vraw(pac->raw) + 1) = fin + '0';
 
-    u16 crc = crc16(vraw(pac->raw), vsize(pac->raw) - CRC_SIZE);
-    snprintf((char *)vraw(pac->raw) + vsize(pac->raw) - CRC_SIZE,
-             CRC_SIZE, "%.4x", crc);
+    u8 digits = check_digits[pac->integrity];
+    u32 len = vsize(pac->raw) - digits - 1;
+    pac->crc = srrp_check(pac->integrity, vraw(pac->raw), len);
+    if (digits) {
+        snprintf((char *)vraw(pac->raw) + len, digits + 1, "%.*x",
+                 digits, pac->crc);
+    }
+}
+
+int srrp_set_integrity(struct srrp_packet *pac, u8 integrity)
+{
+    assert(integrity < sizeof(check_digits));
+
+    if (pac->integrity == integrity)
+        return 0;
+
+    // only packets with a 4 digits packet_len can be rebuilt in place
+    const char *raw = vraw(pac->raw);
+    if (raw[PACKET_LEN_OFFSET - 1] != '#' || raw[PACKET_LEN_OFFSET + 4] != '#')
+        return -1;
+
+    u32 len = vsize(pac->raw) - check_digits[pac->integrity] - 1;
+    if (srrp_over_frame(len + check_digits[integrity] + 1))
+        return -1;
+    vec_t *v = vec_new(1, len + check_digits[integrity] + 1);
+    if (v == NULL)
+        return -1;
+    vpack(v, raw, len);
+    pac->crc = srrp_pack_check(v, integrity);
+
+    pac->payload = (u8 *)vraw(v) + (pac->payload - (u8 *)vraw(pac->raw));
+    vec_free(pac->raw);
+    pac->raw = v;
+    pac->packet_len = vsize(v);
+    pac->integrity = integrity;
+    return 0;
 }
 
 void srrp_set_payload_type(struct srrp_packet *pac, u8 payload_type)
@@ -111,28 +283,31 @@ void srrp_set_payload_type(struct srrp_packet *pac, u8 payload_type)
     pac->payload_type = payload_type;
 }
 
+static void srrp_free_fields(struct srrp_packet *pac)
+{
+    atom_put(pac->srcid);
+    atom_put(pac->dstid);
+    atom_put(pac->anchor);
+    vec_free(pac->raw);
+}
+
 void srrp_free(struct srrp_packet *pac)
 {
 #ifdef DEBUG_SRRP
     printf("srrp_free: %p\n", pac);
 #endif
 
-    str_free(pac->srcid);
-    str_free(pac->dstid);
-    str_free(pac->anchor);
-    vec_free(pac->raw);
-
-    free(pac);
+    srrp_free_fields(pac);
+    mem_pool_free(&packet_pool, pac);
 }
 
 struct srrp_packet *srrp_move(struct srrp_packet *fst, struct srrp_packet *snd)
 {
     // should not call srrp_free as it will free snd ...
-    str_free(snd->anchor);
-    vec_free(snd->raw);
+    srrp_free_fields(snd);
     *snd = *fst;
     memset(fst, 0, sizeof(*fst));
-    free(fst);
+    mem_pool_free(&packet_pool, fst);
     return snd;
 }
 
@@ -145,23 +320,27 @@ struct srrp_packet *srrp_cat(
         return NULL;
     if (fst->ver != snd->ver)
         return NULL;
-    if (strcmp(sget(fst->srcid), sget(snd->srcid)) != 0)
+    if (fst->srcid != snd->srcid)
+        return NULL;
+    if (fst->dstid != snd->dstid)
         return NULL;
-    if (strcmp(sget(fst->dstid), sget(snd->dstid)) != 0)
+    if (fst->seqno != snd->seqno)
         return NULL;
-    if (strcmp(sget(fst->anchor), sget(snd->anchor)) != 0)
+    if (fst->anchor != snd->anchor)
         return NULL;
     //assert(snd->payload_len != 0);
 
     vec_t *v = vec_new(1, fst->payload_len + snd->payload_len);
+    if (v == NULL)
+        return NULL;
     vpack(v, fst->payload, fst->payload_len);
     vpack(v, snd->payload, snd->payload_len);
 
-    struct srrp_packet *retpac = srrp_new(
+    struct srrp_packet *retpac = __srrp_new(
         fst->leader, snd->fin,
-        sget(fst->srcid), sget(fst->dstid),
-        sget(fst->anchor),
-        vraw(v), vsize(v));
+        atom_get(fst->srcid), atom_get(fst->dstid), fst->seqno,
+        atom_get(fst->anchor),
+        vraw(v), vsize(v), fst->integrity);
 
     vec_free(v);
     return retpac;
@@ -200,6 +379,7 @@ struct srrp_packet *srrp_parse(const u8 *buf, u32 len)
     char srcid[SRRP_ID_MAX] = {0};
     char dstid[SRRP_ID_MAX] = {0};
     char anchor[SRRP_ANCHOR_MAX] = {0};
+    u32 seqno = 0;
 
     leader = buf[0];
 
@@ -213,6 +393,15 @@ struct srrp_packet *srrp_parse(const u8 *buf, u32 len)
             return NULL;
         if (strlen(srcid) == 0 || strlen(dstid) == 0)
             return NULL;
+        char *sharp = strchr(dstid, '#');
+        if (sharp) {
+            char *end = NULL;
+            *sharp = 0;
+            seqno = strtoul(sharp + 1, &end, 16);
+            if (end == sharp + 1 || *end != 0 || strlen(dstid) == 0 ||
+                leader == SRRP_CTRL_LEADER)
+                return NULL;
+        }
     } else if (leader == SRRP_SUBSCRIBE_LEADER ||
                leader == SRRP_UNSUBSCRIBE_LEADER ||
                leader == SRRP_PUBLISH_LEADER) {
@@ -224,22 +413,32 @@ struct srrp_packet *srrp_parse(const u8 *buf, u32 len)
         return NULL;
     }
 
-    if (packet_len > len)
+    if (packet_len > len || srrp_over_frame(packet_len))
         return NULL;
 
-    u16 crc = 0;
-
-    if (sscanf((char *)buf + packet_len - CRC_SIZE, "%4hx", &crc) != 1)
+    int integrity = srrp_parse_integrity(buf, packet_len);
+    if (integrity < 0)
         return NULL;
 
-    if (crc != crc16(buf, packet_len - CRC_SIZE))
-        return NULL;
+    u32 crc = 0;
+    u8 digits = check_digits[integrity];
+    if (digits) {
+        char tmp[16] = {0};
+        memcpy(tmp, buf + packet_len - digits - 1, digits);
+        crc = strtoul(tmp, NULL, 16);
+        if (crc != srrp_check(integrity, buf, packet_len - digits - 1))
+            return NULL;
+    }
 
-    struct srrp_packet *pac = calloc(1, sizeof(*pac));
-    assert(pac);
+    struct srrp_packet *pac = mem_pool_alloc(&packet_pool);
+    if (pac == NULL)
+        return NULL;
 
     pac->raw = vec_new(1, packet_len);
-    assert(pac->raw);
+    if (pac->raw == NULL) {
+        mem_pool_free(&packet_pool, pac);
+        return NULL;
+    }
     vpack(pac->raw, buf, packet_len);
 
     pac->leader = leader;
@@ -249,11 +448,17 @@ struct srrp_packet *srrp_parse(const u8 *buf, u32 len)
     pac->packet_len = packet_len;
     pac->payload_len = payload_len;
 
-    pac->srcid = str_new(srcid);
-    pac->dstid = str_new(dstid);
+    // ids and anchors seen before are shared without allocation
+    pac->srcid = atom_new(srcid);
+    pac->dstid = atom_new(dstid);
+    pac->seqno = seqno;
 
-    pac->anchor = str_new(anchor);
-    assert(pac->anchor);
+    pac->anchor = atom_new(anchor);
+    if ((srcid[0] && !pac->srcid) || (dstid[0] && !pac->dstid) ||
+        (anchor[0] && !pac->anchor)) {
+        srrp_free(pac);
+        return NULL;
+    }
     if (pac->payload_len == 0) {
         pac->payload = vraw(pac->raw) + strlen(vraw(pac->raw));
     } else {
@@ -261,22 +466,23 @@ struct srrp_packet *srrp_parse(const u8 *buf, u32 len)
         if (pac->payload) pac->payload += 1;
     }
 
-    pac->crc16 = crc;
+    pac->integrity = integrity;
+    pac->crc = crc;
 #ifdef DEBUG_SRRP
     printf("srrp_new : %p\n", pac);
 #endif
     return pac;
 }
 
-static vec_t *__srrp_new_raw(
-    char leader, u8 fin, const char *srcid, const char *dstid,
-    const char *anchor, const u8 *payload, u32 payload_len)
+/*
+ * Pack the packet up to its payload into v, packet_len left as ____.
+ */
+static void __srrp_pack_head(
+    vec_t *v, char leader, u8 fin, const char *srcid, const char *dstid,
+    u32 seqno, const char *anchor, u32 payload_len)
 {
     char tmp[32] = {0};
 
-    vec_t *v = vec_new(1, 0);
-    assert(v);
-
     // leader
     vpush(v, &leader);
 
@@ -318,6 +524,11 @@ static vec_t *__srrp_new_raw(
         } else {
             assert(dstid);
             vpack(v, dstid, strlen(dstid));
+            // seqno
+            if (seqno) {
+                snprintf(tmp, sizeof(tmp), "#%x", seqno);
+                vpack(v, tmp, strlen(tmp));
+            }
         }
     }
 
@@ -325,50 +536,65 @@ static vec_t *__srrp_new_raw(
     vpack(v, ":", 1);
     vpack(v, anchor, strlen(anchor));
 
-    // payload
-    if (payload_len) {
+    if (payload_len)
         vpack(v, "?", 1);
+}
+
+static vec_t *__srrp_new_raw(
+    char leader, u8 fin, const char *srcid, const char *dstid, u32 seqno,
+    const char *anchor, const u8 *payload, u32 payload_len,
+    u8 integrity, u32 *crc)
+{
+    // sized up front, so the packet is built without growing
+    size_t cap = PACKET_FRAMING_MAX + strlen(srcid) + strlen(dstid) +
+        strlen(anchor) + payload_len;
+    vec_t *v = vec_new(1, cap);
+    if (v == NULL)
+        return NULL;
+
+    __srrp_pack_head(v, leader, fin, srcid, dstid, seqno, anchor, payload_len);
+
+    // payload
+    if (payload_len)
         vpack(v, payload, payload_len);
-    }
 
     // stop flag
     vpack(v, "\0", 1);
 
-    // packet_len
-#ifndef VINSERT
-    u16 packet_len = vsize(v) + CRC_SIZE;
-    assert(packet_len < SRRP_PACKET_MAX);
-    snprintf(tmp, sizeof(tmp), "%.4x", packet_len);
-    assert(strlen(tmp) == 4);
-    memcpy((char *)vraw(v) + 6, tmp, 4);
-#else
-    u16 packet_len = vsize(v) + CRC_SIZE + 4;
-    assert(packet_len < SRRP_PACKET_MAX);
-    snprintf(tmp, sizeof(tmp), "%.4x", packet_len);
-    assert(strlen(tmp) == 4);
-    vinsert(v, 6, tmp, 4);
+    // packet_len & check
+#ifdef VINSERT
+    vinsert(v, PACKET_LEN_OFFSET, "0000", 4);
 #endif
-
-    // crc16
-    u16 crc = crc16(vraw(v), vsize(v));
-    snprintf(tmp, sizeof(tmp), "%.4x", crc);
-    assert(strlen(tmp) == 4);
-    vpack(v, tmp, strlen(tmp));
-    vpack(v, "\0", 1);
+    *crc = srrp_pack_check(v, integrity);
 
     vshrink(v);
     return v;
 }
 
-struct srrp_packet *srrp_new(
-    char leader, u8 fin, const char *srcid, const char *dstid,
-    const char *anchor, const u8 *payload, u32 payload_len)
+/*
+ * Take the refs of srcid, dstid & anchor.
+ */
+static struct srrp_packet *__srrp_new(
+    char leader, u8 fin, atom_t *srcid, atom_t *dstid, u32 seqno,
+    atom_t *anchor, const u8 *payload, u32 payload_len, u8 integrity)
 {
-    vec_t *v = __srrp_new_raw(
-        leader, fin, srcid, dstid, anchor, payload, payload_len);
+    if (leader != SRRP_REQUEST_LEADER && leader != SRRP_RESPONSE_LEADER)
+        seqno = 0;
 
-    struct srrp_packet *pac = calloc(1, sizeof(*pac));
-    assert(pac);
+    u32 crc = 0;
+    vec_t *v = __srrp_new_raw(
+        leader, fin, atom_str(srcid), atom_str(dstid), seqno,
+        atom_str(anchor), payload, payload_len, integrity, &crc);
+    struct srrp_packet *pac = NULL;
+    if (v && !srrp_over_frame(vsize(v)))
+        pac = mem_pool_alloc(&packet_pool);
+    if (pac == NULL) {
+        vec_free(v);
+        atom_put(srcid);
+        atom_put(dstid);
+        atom_put(anchor);
+        return NULL;
+    }
     pac->raw = v;
 
     pac->leader = leader;
@@ -378,19 +604,11 @@ struct srrp_packet *srrp_new(
     pac->packet_len = vsize(v);
     pac->payload_len = payload_len;
 
-    if (srcid) {
-        pac->srcid = str_new(srcid);
-    } else {
-        pac->srcid = str_new("");
-    }
-    if (dstid) {
-        pac->dstid = str_new(dstid);
-    } else {
-        pac->dstid = str_new("");
-    }
+    pac->srcid = srcid;
+    pac->dstid = dstid;
+    pac->seqno = seqno;
 
-    pac->anchor = str_new(anchor);
-    assert(pac->anchor);
+    pac->anchor = anchor;
     if (pac->payload_len == 0) {
         pac->payload = vraw(pac->raw) + strlen(vraw(pac->raw));
     } else {
@@ -398,10 +616,102 @@ struct srrp_packet *srrp_new(
         if (pac->payload) pac->payload += 1;
     }
 
-    sscanf(vraw(v) + vsize(v) - CRC_SIZE, "%4hx", &pac->crc16);
+    pac->integrity = integrity;
+    pac->crc = crc;
 
 #ifdef DEBUG_SRRP
     printf("srrp_new : %p\n", pac);
 #endif
     return pac;
 }
+
+struct srrp_packet *srrp_new(
+    char leader, u8 fin, const char *srcid, const char *dstid,
+    const char *anchor, const u8 *payload, u32 payload_len)
+{
+    if (leader == SRRP_CTRL_LEADER ||
+        leader == SRRP_REQUEST_LEADER ||
+        leader == SRRP_RESPONSE_LEADER) {
+        assert(srcid);
+        assert(leader == SRRP_CTRL_LEADER || dstid);
+    }
+    assert(anchor);
+
+    atom_t *src = srcid ? atom_new(srcid) : NULL;
+    atom_t *dst = dstid ? atom_new(dstid) : NULL;
+    atom_t *anc = atom_new(anchor);
+    if ((srcid && *srcid && !src) || (dstid && *dstid && !dst) ||
+        (*anchor && !anc)) {
+        atom_put(src);
+        atom_put(dst);
+        atom_put(anc);
+        return NULL;
+    }
+    return __srrp_new(leader, fin, src, dst, 0, anc, payload, payload_len,
+                      SRRP_INTEGRITY_CRC16);
+}
+
+void srrp_set_seqno(struct srrp_packet *pac, u32 seqno)
+{
+    if (pac->leader != SRRP_REQUEST_LEADER && pac->leader != SRRP_RESPONSE_LEADER)
+        return;
+    if (pac->seqno == seqno)
+        return;
+
+    struct srrp_packet *tmp = __srrp_new(
+        pac->leader, pac->fin, atom_get(pac->srcid), atom_get(pac->dstid), seqno,
+        atom_get(pac->anchor), pac->payload, pac->payload_len, pac->integrity);
+    if (tmp == NULL)
+        return;
+    tmp->payload_type = pac->payload_type;
+    srrp_free_fields(pac);
+    *pac = *tmp;
+    mem_pool_free(&packet_pool, tmp);
+}
+
+struct srrp_packet *srrp_new_slice(
+    const struct srrp_packet *pac, u8 fin, u32 offset, u32 len, u8 integrity)
+{
+    assert(offset + len <= pac->payload_len);
+    struct srrp_packet *slice = __srrp_new(
+        pac->leader, fin, atom_get(pac->srcid), atom_get(pac->dstid), pac->seqno,
+        atom_get(pac->anchor), pac->payload + offset, len, integrity);
+    if (slice)
+        slice->payload_type = pac->payload_type;
+    return slice;
+}
+
+int srrp_frame_slice(
+    const struct srrp_packet *pac, u8 fin, const u8 *payload, u32 len,
+    u8 integrity, struct vec *head, struct vec *tail)
+{
+    char tmp[16] = {0};
+    u8 digits = check_digits[integrity];
+
+    if (vsize(head)) vdrop(head, vsize(head));
+    if (vsize(tail)) vdrop(tail, vsize(tail));
+
+    u8 leader = pac->leader;
+    u32 seqno = (leader == SRRP_REQUEST_LEADER || leader == SRRP_RESPONSE_LEADER) ?
+        pac->seqno : 0;
+    __srrp_pack_head(head, leader, fin, atom_str(pac->srcid), atom_str(pac->dstid),
+                     seqno, atom_str(pac->anchor), len);
+
+    u32 packet_len = vsize(head) + len + 1 + digits + 1;
+    if (packet_len >= SRRP_PACKET_MAX)
+        return -1;
+    snprintf(tmp, sizeof(tmp), "%.4x", packet_len);
+    memcpy((char *)vraw(head) + PACKET_LEN_OFFSET, tmp, 4);
+
+    u32 crc = srrp_check_update(integrity, 0, vraw(head), vsize(head));
+    crc = srrp_check_update(integrity, crc, payload, len);
+    crc = srrp_check_update(integrity, crc, (const u8 *)"", 1);
+
+    vpack(tail, "\0", 1);
+    if (digits) {
+        snprintf(tmp, sizeof(tmp), "%.*x", digits, crc);
+        vpack(tail, tmp, digits);
+    }
+    vpack(tail, "\0", 1);
+    return 0;
+}
@@ -19,6 +19,10 @@ extern "C" {
  * Response: <[fin][ver2][payload_type]#[packet_len]#[payload_len]#[srcid]#[dstid]:[/anchor]?[payload]\0<crc16>\0
  *   <101j#[packet_len]#[payload_len]#8A8F#F1:/echo?{"err":0,"msg":"ok","v":"good news"}\0<crc16>\0
  *
+ * Request & Response may carry a hex seqno after dstid, it is omitted when zero:
+ *   >101j#[packet_len]#[payload_len]#F1#8A8F#1f:/echo?{"msg":"ok"}\0<crc16>\0
+ *   <101j#[packet_len]#[payload_len]#8A8F#F1#1f:/echo?{"err":0}\0<crc16>\0
+ *
  * Subscribe: +[fin][ver2][payload_type]#[packet_len]#[payload_len]:[/anchor]?[payload]\0<crc16>\0
  *   +101j#[packet_len]#0:/motor/speed\0<crc16>\0
  *
@@ -52,10 +56,16 @@ extern "C" {
 #define SRRP_ID_MAX 256
 #define SRRP_ANCHOR_MAX 1024
 
+#define SRRP_INTEGRITY_NONE 0 /* trusted transports, e.g. unix socket */
+#define SRRP_INTEGRITY_CRC16 1
+#define SRRP_INTEGRITY_CRC32C 2 /* long frames over noisy links */
+
 #define SRRP_CTRL_SYNC "/sync"
 #define SRRP_CTRL_NODEID_DUP "/sync/nodeid/dup"
 
 struct srrp_packet;
+struct atom;
+struct vec;
 
 char srrp_get_leader(const struct srrp_packet *pac);
 u8 srrp_get_fin(const struct srrp_packet *pac);
@@ -66,13 +76,64 @@ u32 srrp_get_payload_len(const struct srrp_packet *pac);
 const char *srrp_get_srcid(const struct srrp_packet *pac);
 const char *srrp_get_dstid(const struct srrp_packet *pac);
 const char *srrp_get_anchor(const struct srrp_packet *pac);
+u32 srrp_get_seqno(const struct srrp_packet *pac);
 const u8 *srrp_get_payload(const struct srrp_packet *pac);
 u16 srrp_get_crc16(const struct srrp_packet *pac);
+u8 srrp_get_integrity(const struct srrp_packet *pac);
 const u8 *srrp_get_raw(const struct srrp_packet *pac);
 
+/**
+ * srrp_header
+ * - the fields of a packet in one struct, see srrp_get_header, for callers
+ *   paying for each call, e.g. across an ffi
+ * - srcid, dstid & anchor are "" if none, the pointers live as long as pac
+ */
+struct srrp_header {
+    const char *srcid;
+    const char *dstid;
+    const char *anchor;
+    const u8 *payload;
+    const u8 *raw;
+    u32 payload_len;
+    u32 seqno;
+    u32 crc;
+    u16 ver;
+    u16 packet_len;
+    char leader;
+    u8 fin;
+    u8 payload_type;
+    u8 integrity;
+};
+
+void srrp_get_header(const struct srrp_packet *pac, struct srrp_header *hdr);
+
+/**
+ * srrp_get_*_atom
+ * - interned ids & anchor, equal content => equal pointer, "" => NULL
+ */
+struct atom *srrp_get_srcid_atom(const struct srrp_packet *pac);
+struct atom *srrp_get_dstid_atom(const struct srrp_packet *pac);
+struct atom *srrp_get_anchor_atom(const struct srrp_packet *pac);
+
 void srrp_set_fin(struct srrp_packet *pac, u8 fin);
 void srrp_set_payload_type(struct srrp_packet *pac, u8 payload_type);
 
+/**
+ * srrp_set_integrity
+ * - integrity: SRRP_INTEGRITY_*, the raw packet is rebuilt with the check
+ *   of it, packets are built with crc16 by default
+ * - return -1 if the raw packet can't be rebuilt
+ */
+int srrp_set_integrity(struct srrp_packet *pac, u8 integrity);
+
+/**
+ * srrp_set_seqno
+ * - only request & response carry a seqno, the raw packet is rebuilt
+ * - a responder should echo the seqno of the request in its response
+ * - pac is left as it is if it can't be rebuilt, out of memory
+ */
+void srrp_set_seqno(struct srrp_packet *pac, u32 seqno);
+
 /**
  * srrp_free
  * - free packet created by srrp_parse & srrp_new_*
@@ -91,7 +152,8 @@ struct srrp_packet *srrp_move(struct srrp_packet *fst, struct srrp_packet *snd);
  * - concatenate slice packets.
  * - the return value is a new alloc packet.
  * - the fin of fst must 0, otherwise assert will fail.
- * - the leader, srcid, dstid, anchor, must same, otherwise assert will fail.
+ * - the leader, srcid, dstid, seqno, anchor, must same, otherwise assert will fail.
+ * - NULL if out of memory, or over APIX_MAX_FRAME with APIX_STATIC_ALLOC
  */
 struct srrp_packet *srrp_cat(
     const struct srrp_packet *fst, const struct srrp_packet *snd);
@@ -105,18 +167,42 @@ u32 srrp_next_packet_offset(const u8 *buf, u32 len);
 
 /**
  * srrp_parse
- * - read one packet from buffer
+ * - read one packet from buffer, with the check of any integrity mode
+ * - NULL if there is no complete packet, or no memory to hold it
  */
 struct srrp_packet *srrp_parse(const u8 *buf, u32 len);
 
 /**
  * srrp_new
  * - create new srrp packet
+ * - NULL if out of memory, with APIX_STATIC_ALLOC also if the packet would
+ *   be over APIX_MAX_FRAME, the same goes for srrp_new_slice
  */
 struct srrp_packet *srrp_new(
     char leader, u8 fin, const char *srcid, const char *dstid,
     const char *anchor, const u8 *payload, u32 payload_len);
 
+/**
+ * srrp_new_slice
+ * - create a packet of payload [offset, offset + len) of pac, with the
+ *   header of pac and the check of integrity
+ */
+struct srrp_packet *srrp_new_slice(
+    const struct srrp_packet *pac, u8 fin, u32 offset, u32 len, u8 integrity);
+
+/**
+ * srrp_frame_slice
+ * - frame len bytes of payload as a slice of pac, like srrp_new_slice but
+ *   without copying the payload: head gets the packet up to the payload,
+ *   tail the stop flag & the check, head, payload & tail in a row are one
+ *   packet, so the payload can go out from elsewhere, e.g. by sendfile
+ * - head & tail are reset first
+ * - return -1 if the packet would reach SRRP_PACKET_MAX
+ */
+int srrp_frame_slice(
+    const struct srrp_packet *pac, u8 fin, const u8 *payload, u32 len,
+    u8 integrity, struct vec *head, struct vec *tail);
+
 /**
  * srrp_new_ctrl
  * - create new ctrl packet
@@ -4,6 +4,7 @@
 #ifdef DEBUG_STR
 #include <stdio.h>
 #endif
+#include "mem.h"
 #include "str.h"
 
 struct str {
@@ -18,13 +19,13 @@ str_t *str_new(const char *s)
 
 str_t *str_new_len(const void *buf, size_t len)
 {
-    str_t *self = (str_t*)calloc(1, sizeof(str_t));
+    str_t *self = (str_t*)mem_calloc(1, sizeof(str_t));
     if (!self) return NULL;
 
     self->size = len + 1;
-    self->rawbuf = (char*)calloc(1, self->size);
+    self->rawbuf = (char*)mem_calloc(1, self->size);
     if (!self->rawbuf) {
-        free(self);
+        mem_free(self);
         return NULL;
     }
 
@@ -42,8 +43,8 @@ void str_free(str_t *self)
     printf("str_del: %p\n", self);
 #endif
     if (self) {
-        free(self->rawbuf);
-        free(self);
+        mem_free(self->rawbuf);
+        mem_free(self);
     }
 }
 
@@ -1,79 +1,301 @@
 #include "svcx.h"
+#include "mem.h"
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "list.h"
 
 #define SERVICE_HEADER_LEN 256
 
-struct service {
-    char header[SERVICE_HEADER_LEN];
+/**
+ * svcx_node
+ * - compressed radix tree, each edge holds the label that is common to all
+ *   headers below it, so a lookup compares every header byte once
+ * - children are sorted by the first byte of their label, which is unique
+ *   among siblings, and found by binary search
+ */
+struct svcx_node {
+    char *label;
+    size_t len;
+    int has_service;
     void *private_data;
-    struct list_head ln;
+    struct svcx_node **children;
+    unsigned int nr_children;
+    unsigned int cap_children;
 };
 
 struct svcx {
-    struct list_head services;
+    struct svcx_node root;
 };
 
+static struct svcx_node *svcx_node_new(const char *label, size_t len)
+{
+    struct svcx_node *node = mem_calloc(1, sizeof(*node));
+    if (node == NULL)
+        return NULL;
+    node->label = mem_alloc(len + 1);
+    if (node->label == NULL) {
+        mem_free(node);
+        return NULL;
+    }
+    memcpy(node->label, label, len);
+    node->label[len] = 0;
+    node->len = len;
+    return node;
+}
+
+static void svcx_node_free(struct svcx_node *node)
+{
+    for (unsigned int i = 0; i < node->nr_children; i++)
+        svcx_node_free(node->children[i]);
+    mem_free(node->children);
+    mem_free(node->label);
+    mem_free(node);
+}
+
+/* Return the index of the child starting with c, or where it would go. */
+static unsigned int svcx_child_index(struct svcx_node *node, unsigned char c)
+{
+    unsigned int lo = 0, hi = node->nr_children;
+    while (lo < hi) {
+        unsigned int mid = (lo + hi) / 2;
+        if ((unsigned char)node->children[mid]->label[0] < c)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static struct svcx_node *svcx_child(struct svcx_node *node, unsigned char c)
+{
+    unsigned int idx = svcx_child_index(node, c);
+    if (idx < node->nr_children && (unsigned char)node->children[idx]->label[0] == c)
+        return node->children[idx];
+    return NULL;
+}
+
+/* Make room for one more child, return -1 and leave node as is if out of memory. */
+static int svcx_child_reserve(struct svcx_node *node)
+{
+    if (node->nr_children < node->cap_children)
+        return 0;
+
+    unsigned int cap = node->cap_children ? node->cap_children * 2 : 2;
+    struct svcx_node **children = mem_realloc(
+        node->children, cap * sizeof(*node->children));
+    if (children == NULL)
+        return -1;
+    node->children = children;
+    node->cap_children = cap;
+    return 0;
+}
+
+/* Insert child into node, which has room for it, see svcx_child_reserve. */
+static void svcx_child_insert(struct svcx_node *node, struct svcx_node *child)
+{
+    assert(node->nr_children < node->cap_children);
+    unsigned int idx = svcx_child_index(node, child->label[0]);
+    memmove(node->children + idx + 1, node->children + idx,
+            (node->nr_children - idx) * sizeof(*node->children));
+    node->children[idx] = child;
+    node->nr_children++;
+}
+
+static void svcx_child_replace(struct svcx_node *node, struct svcx_node *child)
+{
+    unsigned int idx = svcx_child_index(node, child->label[0]);
+    assert(idx < node->nr_children);
+    node->children[idx] = child;
+}
+
+static void svcx_child_remove(struct svcx_node *node, struct svcx_node *child)
+{
+    unsigned int idx = svcx_child_index(node, child->label[0]);
+    assert(idx < node->nr_children && node->children[idx] == child);
+    memmove(node->children + idx, node->children + idx + 1,
+            (node->nr_children - idx - 1) * sizeof(*node->children));
+    node->nr_children--;
+}
+
+static size_t svcx_common_prefix(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+    size_t i = 0;
+    while (i < a_len && i < b_len && a[i] == b[i])
+        i++;
+    return i;
+}
+
 struct svcx *svcx_new()
 {
-    struct svcx *svcx = calloc(1, sizeof(*svcx));
-    assert(svcx);
-    INIT_LIST_HEAD(&svcx->services);
-    return svcx;
+    return mem_calloc(1, sizeof(struct svcx));
 }
 
 void svcx_drop(struct svcx *svcx)
 {
-    struct service *pos, *n;
-    list_for_each_entry_safe(pos, n, &svcx->services, ln) {
-        list_del(&pos->ln);
-        free(pos);
-    }
-    free(svcx);
+    for (unsigned int i = 0; i < svcx->root.nr_children; i++)
+        svcx_node_free(svcx->root.children[i]);
+    mem_free(svcx->root.children);
+    mem_free(svcx);
 }
 
 int svcx_add_service(struct svcx *svcx, const char *header, void *private_data)
 {
-    struct service *serv = calloc(1, sizeof(*serv));
-    assert(serv);
-    snprintf(serv->header, sizeof(serv->header), "%s", header);
-    serv->private_data = private_data;
-    INIT_LIST_HEAD(&serv->ln);
-    list_add(&serv->ln, &svcx->services);
+    struct svcx_node *node = &svcx->root;
+    size_t len = strnlen(header, SERVICE_HEADER_LEN - 1);
+
+    // out of memory leaves the tree valid, at most with an edge split
+    while (len) {
+        struct svcx_node *child = svcx_child(node, header[0]);
+        if (child == NULL) {
+            if (svcx_child_reserve(node) != 0)
+                return -1;
+            child = svcx_node_new(header, len);
+            if (child == NULL)
+                return -1;
+            svcx_child_insert(node, child);
+            node = child;
+            break;
+        }
+
+        size_t common = svcx_common_prefix(child->label, child->len, header, len);
+        if (common < child->len) {
+            // split the edge at the first differing byte
+            struct svcx_node *mid = svcx_node_new(child->label, common);
+            if (mid == NULL)
+                return -1;
+            if (svcx_child_reserve(mid) != 0) {
+                svcx_node_free(mid);
+                return -1;
+            }
+            memmove(child->label, child->label + common, child->len - common + 1);
+            child->len -= common;
+            svcx_child_insert(mid, child);
+            svcx_child_replace(node, mid);
+            child = mid;
+        }
+
+        node = child;
+        header += common;
+        len -= common;
+    }
+
+    node->has_service = 1;
+    node->private_data = private_data;
     return 0;
 }
 
-int svcx_del_service(struct svcx *svcx, const char *header)
+/*
+ * Remove the service of header below node, then drop nodes left without a
+ * service or children and merge nodes left with a single child.
+ */
+static int svcx_node_del(struct svcx_node *node, const char *header, size_t len)
 {
-    struct service *pos;
-    list_for_each_entry(pos, &svcx->services, ln) {
-        if (strncmp(pos->header, header, strlen(pos->header)) == 0) {
-            list_del(&pos->ln);
-            free(pos);
+    if (len == 0) {
+        if (!node->has_service)
+            return -1;
+        node->has_service = 0;
+        node->private_data = NULL;
+        return 0;
+    }
+
+    struct svcx_node *child = svcx_child(node, header[0]);
+    if (child == NULL || child->len > len || memcmp(child->label, header, child->len) != 0)
+        return -1;
+
+    if (svcx_node_del(child, header + child->len, len - child->len) != 0)
+        return -1;
+
+    if (child->has_service)
+        return 0;
+
+    if (child->nr_children == 0) {
+        svcx_child_remove(node, child);
+        svcx_node_free(child);
+    } else if (child->nr_children == 1) {
+        struct svcx_node *grandchild = child->children[0];
+        // out of memory, the two stay apart, uncompressed but valid
+        char *label = mem_alloc(child->len + grandchild->len + 1);
+        if (label == NULL)
             return 0;
-        }
+        memcpy(label, child->label, child->len);
+        memcpy(label + child->len, grandchild->label, grandchild->len + 1);
+        mem_free(grandchild->label);
+        grandchild->label = label;
+        grandchild->len += child->len;
+        svcx_child_replace(node, grandchild);
+        child->nr_children = 0;
+        svcx_node_free(child);
     }
-    return -1;
+
+    return 0;
 }
 
-void *svcx_get_service_private(struct svcx *svcx, const char *header)
+int svcx_del_service(struct svcx *svcx, const char *header)
 {
-    struct service *pos;
-    list_for_each_entry(pos, &svcx->services, ln) {
-        if (strncmp(pos->header, header, strlen(pos->header)) == 0) {
-            return pos->private_data;
-        }
+    return svcx_node_del(&svcx->root, header, strnlen(header, SERVICE_HEADER_LEN - 1));
+}
+
+static struct svcx_node *
+svcx_lookup(struct svcx *svcx, const char *header, int exact)
+{
+    struct svcx_node *node = &svcx->root;
+    struct svcx_node *best = NULL;
+    size_t len = strnlen(header, SERVICE_HEADER_LEN - 1);
+
+    if (node->has_service)
+        best = node;
+
+    while (len) {
+        struct svcx_node *child = svcx_child(node, header[0]);
+        if (child == NULL || child->len > len ||
+            memcmp(child->label, header, child->len) != 0)
+            break;
+
+        node = child;
+        header += child->len;
+        len -= child->len;
+        if (node->has_service)
+            best = node;
     }
-    return NULL;
+
+    if (exact)
+        return len == 0 && node->has_service ? node : NULL;
+    return best;
+}
+
+void *svcx_get_service_private(struct svcx *svcx, const char *header)
+{
+    struct svcx_node *node = svcx_lookup(svcx, header, 0);
+    return node ? node->private_data : NULL;
+}
+
+void *svcx_get_service_private_exact(struct svcx *svcx, const char *header)
+{
+    struct svcx_node *node = svcx_lookup(svcx, header, 1);
+    return node ? node->private_data : NULL;
+}
+
+static void svcx_node_foreach(struct svcx_node *node, char *header, size_t len,
+                              svcx_foreach_func_t func)
+{
+    memcpy(header + len, node->label, node->len + 1);
+    len += node->len;
+
+    if (node->has_service)
+        func(header, node->private_data);
+
+    for (unsigned int i = 0; i < node->nr_children; i++)
+        svcx_node_foreach(node->children[i], header, len, func);
 }
 
 void svcx_foreach(struct svcx *svcx, svcx_foreach_func_t func)
 {
-    struct service *pos;
-    list_for_each_entry(pos, &svcx->services, ln) {
-        func(pos->header, pos->private_data);
-    }
+    char header[SERVICE_HEADER_LEN] = {0};
+
+    if (svcx->root.has_service)
+        func(header, svcx->root.private_data);
+
+    for (unsigned int i = 0; i < svcx->root.nr_children; i++)
+        svcx_node_foreach(svcx->root.children[i], header, 0, func);
 }
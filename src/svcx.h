@@ -5,11 +5,35 @@ struct svcx;
 
 typedef void (*svcx_foreach_func_t)(const char *header, void *private_data);
 
+/* Return NULL if out of memory. */
 struct svcx *svcx_new();
 void svcx_drop(struct svcx *svcx);
+
+/**
+ * svcx_add_service
+ * - header is usually "dstid:anchor", adding it again replaces private_data
+ * - return -1 if out of memory, the services added before are kept
+ */
 int svcx_add_service(struct svcx *svcx, const char *header, void *private_data);
+
+/**
+ * svcx_del_service
+ * - remove the service added with exactly this header
+ */
 int svcx_del_service(struct svcx *svcx, const char *header);
+
+/**
+ * svcx_get_service_private
+ * - return the service with the longest header that is a prefix of header
+ */
 void *svcx_get_service_private(struct svcx *svcx, const char *header);
+void *svcx_get_service_private_exact(struct svcx *svcx, const char *header);
+
+/**
+ * svcx_foreach
+ * - visit services in lexicographic order of header
+ * - the tree must not be modified by func
+ */
 void svcx_foreach(struct svcx *svcx, svcx_foreach_func_t func);
 
 #endif
@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include "mem.h"
 #include "vec.h"
 
 struct vec {
@@ -19,15 +20,15 @@ vec_t *vec_new(size_t type_size, size_t cap)
 
 vec_t *vec_new_alloc(size_t type_size, size_t cap, enum vec_alloc_type alloc)
 {
-    vec_t *self = (vec_t*)calloc(1, sizeof(vec_t));
+    vec_t *self = (vec_t*)mem_calloc(1, sizeof(vec_t));
     if (!self) return NULL;
 
     if (cap == 0)
-        self->rawbuf = (char*)calloc(type_size, VEC_DEFAULT_CAP);
+        self->rawbuf = (char*)mem_calloc(type_size, VEC_DEFAULT_CAP);
     else
-        self->rawbuf = (char*)calloc(type_size, cap);
+        self->rawbuf = (char*)mem_calloc(type_size, cap);
     if (!self->rawbuf) {
-        free(self);
+        mem_free(self);
         return NULL;
     }
 
@@ -43,14 +44,14 @@ vec_t *vec_new_alloc(size_t type_size, size_t cap, enum vec_alloc_type alloc)
 void vec_free(vec_t *self)
 {
     if (self) {
-        free(self->rawbuf);
-        free(self);
+        mem_free(self->rawbuf);
+        mem_free(self);
     }
 }
 
 static int vec_realloc(vec_t *self, size_t new_cap)
 {
-    void *newbuf = realloc(self->rawbuf, new_cap * self->type_size);
+    void *newbuf = mem_realloc(self->rawbuf, new_cap * self->type_size);
     if (newbuf) {
         self->rawbuf = newbuf;
         self->cap = new_cap;
@@ -69,7 +70,9 @@ static int vec_check_cap(vec_t *self, size_t cnt)
         }
         if (self->offset + self->size + cnt > self->cap) {
             size_t new_cap = (self->cap + cnt) << 1;
-            return vec_realloc(self, new_cap);
+            // no room to double in a bounded pool, take what is needed
+            if (vec_realloc(self, new_cap) != 0)
+                return vec_realloc(self, self->size + cnt);
         }
     }
     return 0;
@@ -81,6 +84,11 @@ void *vat(vec_t *self, size_t idx)
     return self->rawbuf + (self->offset + idx) * self->type_size;
 }
 
+int vreserve(vec_t *self, size_t cnt)
+{
+    return vec_check_cap(self, cnt);
+}
+
 void vpush(vec_t *self, const void *value)
 {
     assert(vec_check_cap(self, 1) == 0);
@@ -138,7 +146,7 @@ void vshrink(vec_t *self)
     memmove(self->rawbuf, self->rawbuf + self->offset, self->size * self->type_size);
     self->offset = 0;
 
-    void *newbuf = realloc(self->rawbuf, self->size * self->type_size);
+    void *newbuf = mem_realloc(self->rawbuf, self->size * self->type_size);
     if (newbuf) {
         self->rawbuf = newbuf;
         self->cap = self->size;
@@ -27,6 +27,12 @@ void vec_free(vec_t *self);
 
 void *vat(vec_t *self, size_t idx);
 
+/**
+ * vreserve: make room for cnt more values, so that the next vpack of up to
+ * cnt can't fail, return -1 if the buffer can't grow
+ */
+int vreserve(vec_t *self, size_t cnt);
+
 void vpush(vec_t *self, const void *value);
 void vpop(vec_t *self, /* out */ void *value);
 
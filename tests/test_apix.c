@@ -1,3 +1,4 @@
+#define _GNU_SOURCE /* memmem */
 #include <sched.h>
 #include <stdarg.h>
 #include <stddef.h>
@@ -7,7 +8,15 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pty.h>
+#include <termios.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 #include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -16,6 +25,7 @@
 #include "srrp.h"
 #include "crc16.h"
 #include "log.h"
+#include "mem.h"
 
 #define UNIX_ADDR "test_apisink_unix"
 #define TCP_ADDR "127.0.0.1:1224"
@@ -420,11 +430,1479 @@ static void test_api_subscribe_publish(void **status)
     apix_drop(ctx);
 }
 
+/**
+ * test_api_call
+ */
+
+#define CALL_UNIX_ADDR "test_apisink_unix_call"
+
+enum {
+    CALL_NONE = 0,
+    CALL_RESP,
+    CALL_TIMEOUT,
+    CALL_NOT_FOUND,
+};
+
+static int call_responser_finished = 0;
+
+static void *call_responser_thread(void *args)
+{
+    struct apix *ctx = apix_new();
+    apix_enable_posix(ctx);
+    apix_set_wait_timeout(ctx, 10 * 1000);
+    struct stream *stream = apix_open_unix_client(ctx, CALL_UNIX_ADDR);
+    assert_true(stream);
+    apix_upgrade_to_srrp(stream, "8888");
+
+    while (!call_responser_finished) {
+        struct stream *stream = apix_wait_stream(ctx);
+        if (stream == NULL || apix_wait_event(stream) != AEC_SRRP_PACKET)
+            continue;
+
+        struct srrp_packet *pac = apix_wait_srrp_packet(stream);
+        if (pac == NULL || srrp_get_leader(pac) != SRRP_REQUEST_LEADER ||
+            strcmp(srrp_get_anchor(pac), "/mute") == 0)
+            continue;
+
+        struct srrp_packet *resp = srrp_new_response(
+            srrp_get_dstid(pac), srrp_get_srcid(pac), srrp_get_anchor(pac),
+            (char *)srrp_get_payload(pac));
+        // "/legacy" does not echo the seqno
+        if (strcmp(srrp_get_anchor(pac), "/legacy") != 0)
+            srrp_set_seqno(resp, srrp_get_seqno(pac));
+        apix_srrp_send(stream, resp);
+        srrp_free(resp);
+    }
+
+    apix_close(stream);
+    apix_drop(ctx);
+    return NULL;
+}
+
+static int call_results[5];
+static int call_cnt = 0;
+
+static void on_call(struct stream *stream, struct srrp_packet *resp, void *arg)
+{
+    int *result = arg;
+    call_cnt++;
+
+    if (resp == NULL) {
+        *result = CALL_TIMEOUT;
+    } else if (strstr((char *)srrp_get_payload(resp), "404")) {
+        *result = CALL_NOT_FOUND;
+    } else {
+        assert_true(srrp_get_leader(resp) == SRRP_RESPONSE_LEADER);
+        assert_int_equal((int)(result - call_results) + '0',
+                         srrp_get_payload(resp)[2]);
+        *result = CALL_RESP;
+    }
+}
+
+static int call_requester_finished = 0;
+
+static void *call_requester_thread(void *args)
+{
+    struct apix *ctx = apix_new();
+    apix_enable_posix(ctx);
+    apix_set_wait_timeout(ctx, 10 * 1000);
+    struct stream *stream = apix_open_unix_client(ctx, CALL_UNIX_ADDR);
+    assert_true(stream);
+    apix_upgrade_to_srrp(stream, "3333");
+
+    sleep(1);
+
+    // pipeline requests to the same anchor and a non-echoing responder
+    struct srrp_packet *pac;
+    pac = srrp_new_request("3333", "8888", "/hello", "t:0");
+    assert_true(apix_srrp_call(stream, pac, on_call, &call_results[0], 3000) == 0);
+    assert_true(srrp_get_seqno(pac) != 0);
+    srrp_free(pac);
+    pac = srrp_new_request("3333", "8888", "/hello", "t:1");
+    assert_true(apix_srrp_call(stream, pac, on_call, &call_results[1], 3000) == 0);
+    srrp_free(pac);
+    pac = srrp_new_request("3333", "8888", "/legacy", "t:2");
+    assert_true(apix_srrp_call(stream, pac, on_call, &call_results[2], 3000) == 0);
+    srrp_free(pac);
+    pac = srrp_new_request("3333", "8888", "/mute", "t:3");
+    assert_true(apix_srrp_call(stream, pac, on_call, &call_results[3], 500) == 0);
+    srrp_free(pac);
+    pac = srrp_new_request("3333", "4444", "/hello", "t:4");
+    assert_true(apix_srrp_call(stream, pac, on_call, &call_results[4], 3000) == 0);
+    srrp_free(pac);
+
+    while (call_cnt != 5) {
+        struct stream *stream = apix_wait_stream(ctx);
+        if (stream) apix_wait_event(stream);
+    }
+
+    apix_close(stream);
+    apix_drop(ctx);
+    call_requester_finished = 1;
+    return NULL;
+}
+
+static void test_api_call(void **status)
+{
+    struct apix *ctx = apix_new();
+    apix_enable_posix(ctx);
+    apix_set_wait_timeout(ctx, 10 * 1000);
+    struct stream *server = apix_open_unix_server(ctx, CALL_UNIX_ADDR);
+    assert_true(server);
+    apix_upgrade_to_srrp(server, "1");
+
+    pthread_t responser_pid;
+    pthread_create(&responser_pid, NULL, call_responser_thread, NULL);
+    pthread_t requester_pid;
+    pthread_create(&requester_pid, NULL, call_requester_thread, NULL);
+
+    while (!call_requester_finished) {
+        struct stream *stream = apix_wait_stream(ctx);
+        if (stream == NULL) continue;
+
+        switch (apix_wait_event(stream)) {
+        case AEC_ACCEPT:
+            apix_accept(stream);
+            break;
+        case AEC_SRRP_PACKET: {
+            struct srrp_packet *pac = apix_wait_srrp_packet(stream);
+            if (pac) apix_srrp_forward(stream, pac);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    call_responser_finished = 1;
+    pthread_join(requester_pid, NULL);
+    pthread_join(responser_pid, NULL);
+
+    assert_int_equal(call_results[0], CALL_RESP);
+    assert_int_equal(call_results[1], CALL_RESP);
+    assert_int_equal(call_results[2], CALL_RESP);
+    assert_int_equal(call_results[3], CALL_TIMEOUT);
+    assert_int_equal(call_results[4], CALL_NOT_FOUND);
+
+    apix_close(server);
+    apix_drop(ctx);
+}
+
+/*
+ * Call funcs closing streams whose calls are pending: a times out & closes
+ * b, b's calls finish with it & the first closes c. b & c are closed by the
+ * peer and their close events taken, so apix_close frees them at once.
+ */
+#define CALL_UNIX_ADDR2 "test_apisink_unix_call2"
+
+static int close_call_cnt = 0;
+
+static void on_close_call(struct stream *stream, struct srrp_packet *resp, void *arg)
+{
+    assert_null(resp);
+    close_call_cnt++;
+    if (arg)
+        apix_close(arg);
+}
+
+static void test_api_call_close(void **status)
+{
+    struct apix *ctx = apix_new();
+    apix_enable_posix(ctx);
+    apix_set_wait_timeout(ctx, 10 * 1000);
+    struct stream *server = apix_open_unix_server(ctx, CALL_UNIX_ADDR);
+    struct stream *server2 = apix_open_unix_server(ctx, CALL_UNIX_ADDR2);
+    assert_true(server && server2);
+    struct stream *a = apix_open_unix_client(ctx, CALL_UNIX_ADDR);
+    struct stream *b = apix_open_unix_client(ctx, CALL_UNIX_ADDR2);
+    struct stream *c = apix_open_unix_client(ctx, CALL_UNIX_ADDR2);
+    assert_true(a && b && c);
+
+    struct srrp_packet *pac = srrp_new_request("3333", "8888", "/mute", "t:a");
+    assert_true(apix_srrp_call(a, pac, on_close_call, b, 300) == 0);
+    assert_true(apix_srrp_call(b, pac, on_close_call, c, 0) == 0);
+    assert_true(apix_srrp_call(c, pac, on_close_call, NULL, 0) == 0);
+    assert_true(apix_srrp_call(b, pac, on_close_call, NULL, 0) == 0);
+    srrp_free(pac);
+
+    struct apix_stream_event evs[16];
+    struct stream *peers[2];
+    int nr_peers = 0, closed = 0;
+    for (int i = 0; i < 100 && closed != 2; i++) {
+        int nr = apix_dispatch_events(ctx, evs, 16);
+        for (int j = 0; j < nr; j++) {
+            if (evs[j].code == AEC_ACCEPT && evs[j].stream == server2)
+                peers[nr_peers++] = apix_accept(server2);
+            else if (evs[j].code == AEC_ACCEPT)
+                apix_accept(evs[j].stream);
+            else if (evs[j].code == AEC_CLOSE &&
+                     (evs[j].stream == b || evs[j].stream == c))
+                closed++;
+        }
+        // both peers at once, the close events of b & c come in one pass
+        if (nr_peers == 2) {
+            apix_close(peers[0]);
+            apix_close(peers[1]);
+            nr_peers = 0;
+            usleep(50 * 1000);
+        }
+        if (nr == 0) usleep(10 * 1000);
+    }
+    assert_int_equal(closed, 2);
+    assert_int_equal(close_call_cnt, 0);
+
+    usleep(400 * 1000);
+    apix_dispatch_events(ctx, evs, 16);
+    assert_int_equal(close_call_cnt, 4);
+
+    apix_close(a);
+    apix_close(server2);
+    apix_close(server);
+    apix_drop(ctx);
+}
+
+/*
+ * Idle waits are cut short by the nearest call deadline, with or without
+ * busy polling, instead of sleeping the whole wait timeout.
+ */
+static void on_idle_call(struct stream *stream, struct srrp_packet *resp, void *arg)
+{
+    gettimeofday(arg, NULL);
+}
+
+static void test_api_idle_deadline(void **status)
+{
+    for (int busy = 0; busy < 2; busy++) {
+        struct apix *ctx = apix_new();
+        apix_enable_posix(ctx);
+        apix_set_wait_timeout(ctx, 2000 * 1000);
+        if (busy)
+            apix_set_busy_poll(ctx, 100);
+        struct stream *server = apix_open_unix_server(ctx, CALL_UNIX_ADDR);
+        struct stream *cli = apix_open_unix_client(ctx, CALL_UNIX_ADDR);
+        assert_true(server && cli);
+
+        struct timeval start, done = {0}, elapsed;
+        gettimeofday(&start, NULL);
+        struct srrp_packet *pac = srrp_new_request("3333", "8888", "/mute", "t:idle");
+        assert_true(apix_srrp_call(cli, pac, on_idle_call, &done, 100) == 0);
+        srrp_free(pac);
+
+        while (done.tv_sec == 0) {
+            struct stream *stream = apix_wait_stream(ctx);
+            if (stream && apix_wait_event(stream) == AEC_ACCEPT)
+                apix_accept(stream);
+        }
+        timersub(&done, &start, &elapsed);
+        assert_true(elapsed.tv_sec == 0 && elapsed.tv_usec < 500 * 1000);
+
+        apix_close(cli);
+        apix_close(server);
+        apix_drop(ctx);
+    }
+}
+
+/**
+ * test_api_poll_fd
+ */
+
+#define POLL_UNIX_ADDR "test_apisink_unix_poll"
+
+static int wait_poll_fd(int fd, int timeout_ms)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    return poll(&pfd, 1, timeout_ms);
+}
+
+static void dispatch_all(struct apix *ctx)
+{
+    struct stream *stream;
+    while ((stream = apix_dispatch(ctx)) != NULL)
+        apix_wait_event(stream);
+}
+
+static void test_api_poll_fd(void **status)
+{
+    struct apix *ctx = apix_new();
+    apix_enable_posix(ctx);
+    struct stream *server = apix_open_unix_server(ctx, POLL_UNIX_ADDR);
+    assert_true(server);
+
+    int fd = apix_get_poll_fd(ctx);
+    assert_true(fd != -1);
+    assert_true(apix_get_poll_fd(ctx) == fd);
+
+    // the open event is pending
+    assert_true(wait_poll_fd(fd, 0) == 1);
+    dispatch_all(ctx);
+    assert_true(wait_poll_fd(fd, 0) == 0);
+
+    // the timer wakes an idle ctx
+    assert_true(wait_poll_fd(fd, 1500) == 1);
+    assert_true(apix_dispatch(ctx) == NULL);
+
+    int cli = socket(PF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = { .sun_family = PF_UNIX };
+    strcpy(addr.sun_path, POLL_UNIX_ADDR);
+    assert_true(connect(cli, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+
+    assert_true(wait_poll_fd(fd, 1000) == 1);
+    assert_true(apix_dispatch(ctx) == server);
+    assert_true(apix_wait_event(server) == AEC_ACCEPT);
+    struct stream *peer = apix_accept(server);
+    assert_true(peer);
+    dispatch_all(ctx);
+
+    assert_true(send(cli, "hello", 5, 0) == 5);
+    assert_true(wait_poll_fd(fd, 1000) == 1);
+    assert_true(apix_dispatch(ctx) == peer);
+    assert_true(apix_wait_event(peer) == AEC_POLLIN);
+    char buf[8] = {0};
+    assert_true(apix_read_from_buffer(peer, (u8 *)buf, sizeof(buf)) == 5);
+    assert_string_equal(buf, "hello");
+
+    // events of all streams by one call, the fd stays readable past max
+    apix_upgrade_to_srrp(peer, "1");
+    struct srrp_packet *sync = srrp_new_ctrl("3333", SRRP_CTRL_SYNC, "");
+    assert_true(send(cli, srrp_get_raw(sync), srrp_get_packet_len(sync), 0) ==
+                srrp_get_packet_len(sync));
+    srrp_free(sync);
+    for (int i = 0; i < 3; i++) {
+        struct srrp_packet *req = srrp_new_request("3333", "1", "/batch", "t:x");
+        assert_true(send(cli, srrp_get_raw(req), srrp_get_packet_len(req), 0) ==
+                    srrp_get_packet_len(req));
+        srrp_free(req);
+    }
+    struct apix_stream_event evs[2];
+    int nr_pacs = 0, rounds = 0;
+    assert_true(wait_poll_fd(fd, 1000) == 1);
+    while (nr_pacs < 3 && rounds++ < 10) {
+        int nr = apix_dispatch_events(ctx, evs, 2);
+        for (int i = 0; i < nr; i++) {
+            assert_true(evs[i].stream == peer);
+            if (evs[i].code != AEC_SRRP_PACKET)
+                continue;
+            assert_true(evs[i].pac != NULL);
+            assert_string_equal(evs[i].hdr.anchor, "/batch");
+            nr_pacs++;
+        }
+        if (nr == 2)
+            assert_true(wait_poll_fd(fd, 0) == 1);
+    }
+    assert_int_equal(nr_pacs, 3);
+    assert_int_equal(apix_dispatch_events(ctx, evs, 2), 0);
+
+    close(cli);
+    assert_true(wait_poll_fd(fd, 1000) == 1);
+    assert_true(apix_dispatch(ctx) == peer);
+    assert_true(apix_wait_event(peer) == AEC_CLOSE);
+    dispatch_all(ctx);
+
+    apix_close(server);
+    apix_drop(ctx);
+}
+
+/**
+ * test_api_post
+ */
+
+#define POST_UNIX_ADDR "test_apisink_unix_post"
+#define POST_THREADS 4
+#define POST_PER_THREAD 100
+
+static int post_done = 0;
+static int post_failed = 0;
+
+static void on_post(struct stream *stream, int rc, void *arg)
+{
+    if (rc < 0)
+        post_failed++;
+    else
+        post_done++;
+}
+
+static void on_post_run(struct apix *ctx, void *arg)
+{
+    struct stream **opened = arg;
+    *opened = apix_open_unix_client(ctx, POST_UNIX_ADDR);
+}
+
+struct post_args {
+    struct apix *ctx;
+    struct stream *stream;
+};
+
+static void *post_thread(void *args)
+{
+    struct post_args *pa = args;
+    for (int i = 0; i < POST_PER_THREAD; i++)
+        assert_true(apix_post_send(pa->ctx, pa->stream, (u8 *)"x", 1, on_post, NULL) == 0);
+    return NULL;
+}
+
+static void test_api_post(void **status)
+{
+    struct apix *ctx = apix_new();
+    apix_enable_posix(ctx);
+    apix_set_wait_timeout(ctx, 1000 * 1000);
+    struct stream *server = apix_open_unix_server(ctx, POST_UNIX_ADDR);
+    assert_true(server);
+
+    int cli = socket(PF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = { .sun_family = PF_UNIX };
+    strcpy(addr.sun_path, POST_UNIX_ADDR);
+    assert_true(connect(cli, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+
+    struct stream *peer = NULL;
+    while (peer == NULL) {
+        struct stream *stream = apix_wait_stream(ctx);
+        if (stream && apix_wait_event(stream) == AEC_ACCEPT)
+            peer = apix_accept(stream);
+    }
+
+    pthread_t pids[POST_THREADS];
+    struct post_args pa = { ctx, peer };
+    for (int i = 0; i < POST_THREADS; i++)
+        pthread_create(&pids[i], NULL, post_thread, &pa);
+
+    while (post_done != POST_THREADS * POST_PER_THREAD) {
+        struct stream *stream = apix_wait_stream(ctx);
+        if (stream) apix_wait_event(stream);
+    }
+    for (int i = 0; i < POST_THREADS; i++)
+        pthread_join(pids[i], NULL);
+
+    char buf[POST_THREADS * POST_PER_THREAD];
+    int nr = 0;
+    while (nr != sizeof(buf)) {
+        int rc = recv(cli, buf + nr, sizeof(buf) - nr, 0);
+        assert_true(rc > 0);
+        nr += rc;
+    }
+    for (int i = 0; i < nr; i++)
+        assert_true(buf[i] == 'x');
+
+    // sends after close fail
+    assert_true(apix_post_close(ctx, peer, on_post, NULL) == 0);
+    assert_true(apix_post_send(ctx, peer, (u8 *)"x", 1, on_post, NULL) == 0);
+    while (post_done + post_failed != POST_THREADS * POST_PER_THREAD + 2) {
+        struct stream *stream = apix_wait_stream(ctx);
+        if (stream) apix_wait_event(stream);
+    }
+    assert_int_equal(post_done, POST_THREADS * POST_PER_THREAD + 1);
+    assert_int_equal(post_failed, 1);
+
+    // any other call by apix_post
+    struct stream *opened = NULL;
+    assert_true(apix_post(ctx, on_post_run, &opened) == 0);
+    while (opened == NULL) {
+        struct stream *stream = apix_wait_stream(ctx);
+        if (stream) apix_wait_event(stream);
+    }
+    apix_close(opened);
+
+    close(cli);
+    apix_close(server);
+    apix_drop(ctx);
+}
+
+/**
+ * test_api_workers
+ */
+
+#define WORK_UNIX_ADDR "test_apisink_unix_work"
+#define WORK_SLOW_CALLS 8
+#define WORK_SLOW_LIMIT 2
+
+static int work_running = 0;
+static int work_running_max = 0;
+
+static struct srrp_packet *on_slow(const struct srrp_packet *req, void *arg)
+{
+    int running = __atomic_add_fetch(&work_running, 1, __ATOMIC_SEQ_CST);
+    int max = __atomic_load_n(&work_running_max, __ATOMIC_SEQ_CST);
+    while (running > max &&
+           !__atomic_compare_exchange_n(&work_running_max, &max, running, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+    usleep(100 * 1000);
+    __atomic_sub_fetch(&work_running, 1, __ATOMIC_SEQ_CST);
+
+    return srrp_new_response(
+        srrp_get_dstid(req), srrp_get_srcid(req), srrp_get_anchor(req),
+        (const char *)srrp_get_payload(req));
+}
+
+static int work_responser_finished = 0;
+
+static void *work_responser_thread(void *args)
+{
+    struct apix *ctx = apix_new();
+    apix_enable_posix(ctx);
+    apix_set_wait_timeout(ctx, 10 * 1000);
+    assert_true(apix_enable_workers(ctx, 4, 2) == 0);
+    assert_true(apix_srrp_handle(ctx, "8888:/slow", on_slow, NULL, WORK_SLOW_LIMIT) == 0);
+    struct stream *stream = apix_open_unix_client(ctx, WORK_UNIX_ADDR);
+    assert_true(stream);
+    apix_upgrade_to_srrp(stream, "8888");
+
+    // requests without handler are still returned inline
+    while (!work_responser_finished) {
+        struct stream *stream = apix_wait_stream(ctx);
+        if (stream == NULL || apix_wait_event(stream) != AEC_SRRP_PACKET)
+            continue;
+
+        struct srrp_packet *pac = apix_wait_srrp_packet(stream);
+        if (pac == NULL || srrp_get_leader(pac) != SRRP_REQUEST_LEADER)
+            continue;
+        assert_string_equal(srrp_get_anchor(pac), "/inline");
+
+        struct srrp_packet *resp = srrp_new_response(
+            srrp_get_dstid(pac), srrp_get_srcid(pac), srrp_get_anchor(pac),
+            (char *)srrp_get_payload(pac));
+        srrp_set_seqno(resp, srrp_get_seqno(pac));
+        apix_srrp_send(stream, resp);
+        srrp_free(resp);
+    }
+
+    apix_close(stream);
+    apix_drop(ctx);
+    return NULL;
+}
+
+static int work_resp_cnt = 0;
+
+static void on_work_call(struct stream *stream, struct srrp_packet *resp, void *arg)
+{
+    assert_true(resp);
+    assert_string_equal((char *)srrp_get_payload(resp), arg);
+    work_resp_cnt++;
+}
+
+static int work_requester_finished = 0;
+
+static void *work_requester_thread(void *args)
+{
+    struct apix *ctx = apix_new();
+    apix_enable_posix(ctx);
+    apix_set_wait_timeout(ctx, 10 * 1000);
+    struct stream *stream = apix_open_unix_client(ctx, WORK_UNIX_ADDR);
+    assert_true(stream);
+    apix_upgrade_to_srrp(stream, "3333");
+
+    sleep(1);
+
+    struct srrp_packet *pac;
+    for (int i = 0; i < WORK_SLOW_CALLS; i++) {
+        pac = srrp_new_request("3333", "8888", "/slow", "t:slow");
+        assert_true(apix_srrp_call(stream, pac, on_work_call, "t:slow", 5000) == 0);
+        srrp_free(pac);
+    }
+    pac = srrp_new_request("3333", "8888", "/inline", "t:inline");
+    assert_true(apix_srrp_call(stream, pac, on_work_call, "t:inline", 5000) == 0);
+    srrp_free(pac);
+
+    while (work_resp_cnt != WORK_SLOW_CALLS + 1) {
+        struct stream *stream = apix_wait_stream(ctx);
+        if (stream) apix_wait_event(stream);
+    }
+
+    apix_close(stream);
+    apix_drop(ctx);
+    work_requester_finished = 1;
+    return NULL;
+}
+
+static void test_api_workers(void **status)
+{
+    struct apix *ctx = apix_new();
+    apix_enable_posix(ctx);
+    apix_set_wait_timeout(ctx, 10 * 1000);
+    struct stream *server = apix_open_unix_server(ctx, WORK_UNIX_ADDR);
+    assert_true(server);
+    apix_upgrade_to_srrp(server, "1");
+
+    pthread_t responser_pid;
+    pthread_create(&responser_pid, NULL, work_responser_thread, NULL);
+    pthread_t requester_pid;
+    pthread_create(&requester_pid, NULL, work_requester_thread, NULL);
+
+    while (!work_requester_finished) {
+        struct stream *stream = apix_wait_stream(ctx);
+        if (stream == NULL) continue;
+
+        switch (apix_wait_event(stream)) {
+        case AEC_ACCEPT:
+            apix_accept(stream);
+            break;
+        case AEC_SRRP_PACKET: {
+            struct srrp_packet *pac = apix_wait_srrp_packet(stream);
+            if (pac) apix_srrp_forward(stream, pac);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    work_responser_finished = 1;
+    pthread_join(requester_pid, NULL);
+    pthread_join(responser_pid, NULL);
+
+    assert_int_equal(work_resp_cnt, WORK_SLOW_CALLS + 1);
+    assert_int_equal(work_running_max, WORK_SLOW_LIMIT);
+
+    apix_close(server);
+    apix_drop(ctx);
+}
+
+/*
+ * A work outliving its stream: the response must not go to the stream
+ * accepted next, which likely takes the freed address.
+ */
+
+#define REUSE_UNIX_ADDR "test_apisink_unix_reuse"
+
+static int reuse_hold = 1;
+static int reuse_state = 0; /* 1 => handler entered, 2 => returned */
+
+static struct srrp_packet *on_hold(const struct srrp_packet *req, void *arg)
+{
+    __atomic_store_n(&reuse_state, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&reuse_hold, __ATOMIC_SEQ_CST))
+        usleep(1000);
+    struct srrp_packet *resp = srrp_new_response(
+        srrp_get_dstid(req), srrp_get_srcid(req), srrp_get_anchor(req), "t:held");
+    __atomic_store_n(&reuse_state, 2, __ATOMIC_SEQ_CST);
+    return resp;
+}
+
+static struct stream *reuse_accept(struct apix *ctx, struct stream *server)
+{
+    for (int i = 0; i < 100; i++) {
+        struct stream *stream = apix_wait_stream(ctx);
+        if (stream == server && apix_wait_event(stream) == AEC_ACCEPT)
+            return apix_accept(stream);
+    }
+    return NULL;
+}
+
+static void test_api_work_stream_reuse(void **status)
+{
+    struct apix *ctx = apix_new();
+    apix_enable_posix(ctx);
+    apix_set_wait_timeout(ctx, 10 * 1000);
+    assert_true(apix_enable_workers(ctx, 1, 2) == 0);
+    assert_true(apix_srrp_handle(ctx, "8888:/hold", on_hold, NULL, 0) == 0);
+    struct stream *server = apix_open_unix_server(ctx, REUSE_UNIX_ADDR);
+    assert_true(server);
+    apix_upgrade_to_srrp(server, "8888");
+
+    struct sockaddr_un addr = { .sun_family = PF_UNIX };
+    strcpy(addr.sun_path, REUSE_UNIX_ADDR);
+    int cli = socket(PF_UNIX, SOCK_STREAM, 0);
+    assert_true(connect(cli, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    struct stream *first = reuse_accept(ctx, server);
+    assert_true(first);
+
+    struct srrp_packet *pac = srrp_new_ctrl("3333", SRRP_CTRL_SYNC, "");
+    assert_true(send(cli, srrp_get_raw(pac), srrp_get_packet_len(pac), 0) ==
+                srrp_get_packet_len(pac));
+    srrp_free(pac);
+    pac = srrp_new_request("3333", "8888", "/hold", "t:x");
+    assert_true(send(cli, srrp_get_raw(pac), srrp_get_packet_len(pac), 0) ==
+                srrp_get_packet_len(pac));
+    srrp_free(pac);
+    for (int i = 0; i < 100 && __atomic_load_n(&reuse_state, __ATOMIC_SEQ_CST) == 0; i++) {
+        struct stream *stream = apix_wait_stream(ctx);
+        if (stream) apix_wait_event(stream);
+    }
+    assert_int_equal(reuse_state, 1);
+
+    // the first client goes away while its request is being handled
+    close(cli);
+    for (int i = 0; i < 10; i++) {
+        struct stream *stream = apix_wait_stream(ctx);
+        if (stream) apix_wait_event(stream);
+    }
+
+    cli = socket(PF_UNIX, SOCK_STREAM, 0);
+    assert_true(connect(cli, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    assert_true(reuse_accept(ctx, server));
+
+    __atomic_store_n(&reuse_hold, 0, __ATOMIC_SEQ_CST);
+    for (int i = 0; i < 20 || reuse_state != 2; i++) {
+        struct stream *stream = apix_wait_stream(ctx);
+        if (stream) apix_wait_event(stream);
+    }
+
+    // the /sync of the second stream only, packets end with a nul
+    char buf[1024];
+    int nr = recv(cli, buf, sizeof(buf), MSG_DONTWAIT);
+    assert_true(nr > 0);
+    assert_null(memmem(buf, nr, "/hold", 5));
+
+    close(cli);
+    apix_close(server);
+    apix_drop(ctx);
+}
+
+/**
+ * test_api_uring
+ */
+
+#define URING_UNIX_ADDR "test_apisink_unix_uring"
+#define URING_CLIENTS 3
+#ifdef APIX_STATIC_ALLOC
+#define URING_BULK APIX_MAX_FRAME /* queues are bounded by the byte pools */
+#else
+#define URING_BULK (256 * 1024)
+#endif
+
+static void uring_wait(struct apix *ctx, int *accepted, struct stream **peers,
+                       int *closed)
+{
+    struct stream *stream = apix_wait_stream(ctx);
+    if (stream == NULL)
+        return;
+
+    switch (apix_wait_event(stream)) {
+    case AEC_ACCEPT: {
+        struct stream *peer = apix_accept(stream);
+        if (peer) peers[(*accepted)++] = peer;
+        break;
+    }
+    case AEC_POLLIN: {
+        // echo
+        u8 buf[256];
+        int nr = apix_read_from_buffer(stream, buf, sizeof(buf));
+        if (nr > 0) apix_send(stream, buf, nr);
+        break;
+    }
+    case AEC_CLOSE:
+        (*closed)++;
+        break;
+    default:
+        break;
+    }
+}
+
+static void test_api_uring(void **status)
+{
+    struct apix *ctx = apix_new();
+    // runs on select if the kernel lacks io_uring
+    assert_true(apix_enable_posix_uring(ctx) >= 0);
+    apix_set_wait_timeout(ctx, 10 * 1000);
+    struct stream *server = apix_open_unix_server(ctx, URING_UNIX_ADDR);
+    assert_true(server);
+
+    int clis[URING_CLIENTS];
+    struct sockaddr_un addr = { .sun_family = PF_UNIX };
+    strcpy(addr.sun_path, URING_UNIX_ADDR);
+    for (int i = 0; i < URING_CLIENTS; i++) {
+        clis[i] = socket(PF_UNIX, SOCK_STREAM, 0);
+        assert_true(connect(clis[i], (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    }
+
+    struct stream *peers[URING_CLIENTS] = {0};
+    int accepted = 0, closed = 0;
+    while (accepted != URING_CLIENTS)
+        uring_wait(ctx, &accepted, peers, &closed);
+
+    // echo on every connection
+    for (int i = 0; i < URING_CLIENTS; i++) {
+        char msg[16];
+        snprintf(msg, sizeof(msg), "ping%d", i);
+        assert_true(send(clis[i], msg, strlen(msg), 0) == (int)strlen(msg));
+    }
+    for (int i = 0; i < URING_CLIENTS; i++) {
+        char expect[16], buf[16] = {0};
+        snprintf(expect, sizeof(expect), "ping%d", i);
+        int nr = 0;
+        while (nr != (int)strlen(expect)) {
+            uring_wait(ctx, &accepted, peers, &closed);
+            int rc = recv(clis[i], buf + nr, sizeof(buf) - nr, MSG_DONTWAIT);
+            if (rc > 0) nr += rc;
+        }
+        assert_string_equal(buf, expect);
+    }
+
+    // bulk send larger than the socket buffer is queued, not blocked
+    u8 *bulk = malloc(URING_BULK);
+    for (int i = 0; i < URING_BULK; i++)
+        bulk[i] = i % 251;
+    assert_int_equal(apix_send(peers[0], bulk, URING_BULK), URING_BULK);
+    memset(bulk, 0, URING_BULK);
+    int nr = 0;
+    while (nr != URING_BULK) {
+        uring_wait(ctx, &accepted, peers, &closed);
+        int rc = recv(clis[0], bulk + nr, URING_BULK - nr, MSG_DONTWAIT);
+        if (rc > 0) nr += rc;
+    }
+    for (int i = 0; i < URING_BULK; i++)
+        assert_true(bulk[i] == i % 251);
+    free(bulk);
+
+    for (int i = 0; i < URING_CLIENTS; i++)
+        close(clis[i]);
+    while (closed != URING_CLIENTS)
+        uring_wait(ctx, &accepted, peers, &closed);
+
+    // closed & dropped with the cancel of its recv & a send in flight, all
+    // reaped before the ring is freed, the peer sees the close
+    int cli = socket(PF_UNIX, SOCK_STREAM, 0);
+    assert_true(connect(cli, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    struct stream *peer[1] = {0};
+    accepted = 0;
+    while (accepted != 1)
+        uring_wait(ctx, &accepted, peer, &closed);
+    bulk = calloc(1, URING_BULK);
+    assert_int_equal(apix_send(peer[0], bulk, URING_BULK), URING_BULK);
+    apix_wait_stream(ctx);
+    apix_close(peer[0]);
+    apix_close(server);
+    apix_drop(ctx);
+
+    struct timeval tv = { 2, 0 };
+    setsockopt(cli, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    int rc;
+    while ((rc = recv(cli, bulk, URING_BULK, 0)) > 0);
+    assert_int_equal(rc, 0);
+    free(bulk);
+    close(cli);
+}
+
+/**
+ * test_api_cut_through
+ */
+
+#define CUT_UNIX_ADDR "test_apisink_unix_cut"
+#define CUT_BULK (60 * 1024)
+
+static struct stream *cut_stream; /* of the last cut_wait */
+
+static struct srrp_packet *cut_wait(struct apix *ctx, struct stream **accepted)
+{
+    struct stream *stream = apix_wait_stream(ctx);
+    if (stream == NULL)
+        return NULL;
+    cut_stream = stream;
+
+    switch (apix_wait_event(stream)) {
+    case AEC_ACCEPT: {
+        struct stream *peer = apix_accept(stream);
+        if (accepted) *accepted = peer;
+        break;
+    }
+    case AEC_SRRP_PACKET:
+        return apix_wait_srrp_packet(stream);
+    default:
+        break;
+    }
+    return NULL;
+}
+
+static void test_api_cut_through(void **status)
+{
+    struct apix *broker = apix_new();
+    apix_enable_posix(broker);
+    apix_set_wait_timeout(broker, 0);
+    apix_set_cut_through(broker, 1);
+    struct stream *server = apix_open_unix_server(broker, CUT_UNIX_ADDR);
+    assert_true(server);
+    apix_upgrade_to_srrp(server, "1");
+
+    struct apix *ctxs[2];
+    struct stream *clis[2];
+    const char *nodeids[2] = { "3333", "8888" };
+    for (int i = 0; i < 2; i++) {
+        ctxs[i] = apix_new();
+        apix_enable_posix(ctxs[i]);
+        apix_set_wait_timeout(ctxs[i], 0);
+        clis[i] = apix_open_unix_client(ctxs[i], CUT_UNIX_ADDR);
+        assert_true(clis[i]);
+        apix_upgrade_to_srrp(clis[i], nodeids[i]);
+    }
+    // 3333 asks for crc32c, 8888 keeps none of unix streams
+    apix_set_integrity(clis[0], SRRP_INTEGRITY_CRC32C);
+
+    // let the broker learn both nodeids from /sync
+    int accepted = 0;
+    for (int i = 0; i < 2000 && accepted != 2; i++) {
+        struct stream *peer = NULL;
+        assert_null(cut_wait(broker, &peer));
+        if (peer) accepted++;
+        cut_wait(ctxs[0], NULL);
+        cut_wait(ctxs[1], NULL);
+        usleep(100);
+    }
+    assert_int_equal(accepted, 2);
+    for (int i = 0; i < 100; i++) {
+        cut_wait(broker, NULL);
+        cut_wait(ctxs[0], NULL);
+        cut_wait(ctxs[1], NULL);
+        usleep(100);
+    }
+
+    char *payload = malloc(CUT_BULK + 1);
+    payload[0] = 't';
+    payload[1] = ':';
+    for (int i = 2; i < CUT_BULK; i++)
+        payload[i] = 'a' + i % 26;
+    payload[CUT_BULK] = 0;
+    struct srrp_packet *req = srrp_new_request("3333", "8888", "/bulk", payload);
+    assert_int_equal(apix_srrp_send(clis[0], req), 0);
+    srrp_free(req);
+
+    // the sliced request passes the broker without surfacing
+    int broker_pacs = 0, resp_cnt = 0;
+    for (int i = 0; i < 100000 && resp_cnt == 0; i++) {
+        struct srrp_packet *pac = cut_wait(broker, NULL);
+        if (pac) {
+            broker_pacs++;
+            assert_true(srrp_get_leader(pac) == SRRP_RESPONSE_LEADER);
+            apix_srrp_forward(cut_stream, pac);
+        }
+
+        pac = cut_wait(ctxs[1], NULL);
+        if (pac) {
+            assert_true(srrp_get_leader(pac) == SRRP_REQUEST_LEADER);
+            assert_true(srrp_get_integrity(pac) == SRRP_INTEGRITY_NONE);
+            assert_int_equal(srrp_get_payload_len(pac), CUT_BULK);
+            assert_memory_equal(srrp_get_payload(pac), payload, CUT_BULK);
+            struct srrp_packet *resp = srrp_new_response(
+                srrp_get_dstid(pac), srrp_get_srcid(pac), srrp_get_anchor(pac),
+                "j:{\"err\":0}");
+            apix_srrp_send(clis[1], resp);
+            srrp_free(resp);
+        }
+
+        pac = cut_wait(ctxs[0], NULL);
+        if (pac && srrp_get_leader(pac) == SRRP_RESPONSE_LEADER) {
+            assert_true(srrp_get_integrity(pac) == SRRP_INTEGRITY_CRC32C);
+            resp_cnt++;
+        }
+    }
+    assert_int_equal(resp_cnt, 1);
+    assert_int_equal(broker_pacs, 1);
+    free(payload);
+
+    // a cut given up on a slice of another message is closed at dst
+    struct srrp_packet *cut = srrp_new_request("3333", "8888", "/cut", "t:abcdef");
+    struct srrp_packet *next = srrp_new_request("3333", "8888", "/next", "t:xyz");
+    struct srrp_packet *slices[3] = {
+        srrp_new_slice(cut, SRRP_FIN_0, 0, 4, SRRP_INTEGRITY_NONE),
+        srrp_new_slice(next, SRRP_FIN_0, 0, 2, SRRP_INTEGRITY_NONE),
+        srrp_new_slice(next, SRRP_FIN_1, 2, 3, SRRP_INTEGRITY_NONE),
+    };
+    for (int i = 0; i < 3; i++) {
+        assert_int_equal(apix_send_to_buffer(
+            clis[0], srrp_get_raw(slices[i]), srrp_get_packet_len(slices[i])), 0);
+        srrp_free(slices[i]);
+    }
+    srrp_free(cut);
+    srrp_free(next);
+
+    int got = 0;
+    for (int i = 0; i < 10000 && got != 2; i++) {
+        assert_null(cut_wait(broker, NULL));
+        cut_wait(ctxs[0], NULL);
+        struct srrp_packet *pac = cut_wait(ctxs[1], NULL);
+        if (pac == NULL)
+            continue;
+        if (got++ == 0) {
+            assert_string_equal(srrp_get_anchor(pac), "/cut");
+            assert_int_equal(srrp_get_payload_len(pac), 4);
+            assert_memory_equal(srrp_get_payload(pac), "t:ab", 4);
+        } else {
+            assert_string_equal(srrp_get_anchor(pac), "/next");
+            assert_int_equal(srrp_get_payload_len(pac), 5);
+            assert_memory_equal(srrp_get_payload(pac), "t:xyz", 5);
+        }
+    }
+    assert_int_equal(got, 2);
+
+    // a peer that never synced is not routed, but answered "nodeid not sync"
+    int raw = socket(PF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = { .sun_family = PF_UNIX };
+    strcpy(addr.sun_path, CUT_UNIX_ADDR);
+    assert_true(connect(raw, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    accepted = 0;
+    for (int i = 0; i < 1000 && accepted == 0; i++) {
+        struct stream *peer = NULL;
+        cut_wait(broker, &peer);
+        if (peer) accepted++;
+    }
+    assert_int_equal(accepted, 1);
+
+    struct srrp_packet *unsynced =
+        srrp_new_request("5555", "8888", "/unsynced", "t:abcdef");
+    for (int i = 0; i < 2; i++) {
+        struct srrp_packet *slice = srrp_new_slice(
+            unsynced, i ? SRRP_FIN_1 : SRRP_FIN_0, i * 4, 4, SRRP_INTEGRITY_CRC16);
+        assert_true(send(raw, srrp_get_raw(slice), srrp_get_packet_len(slice), 0)
+                    == srrp_get_packet_len(slice));
+        srrp_free(slice);
+    }
+    srrp_free(unsynced);
+
+    char buf[512];
+    int nr = 0;
+    for (int i = 0; i < 10000 && nr <= 0; i++) {
+        assert_null(cut_wait(broker, NULL));
+        cut_wait(ctxs[0], NULL);
+        assert_null(cut_wait(ctxs[1], NULL));
+        nr = recv(raw, buf, sizeof(buf), MSG_DONTWAIT);
+    }
+    assert_true(nr > 0);
+    assert_non_null(memmem(buf, nr, "nodeid not sync", 15));
+    for (int i = 0; i < 100; i++)
+        assert_null(cut_wait(ctxs[1], NULL));
+    close(raw);
+
+    for (int i = 0; i < 2; i++) {
+        apix_close(clis[i]);
+        apix_drop(ctxs[i]);
+    }
+    apix_close(server);
+    apix_drop(broker);
+}
+
+/**
+ * test_api_com
+ */
+
+#define COM_GAP_USEC (100 * 1000)
+
+#if defined __linux__ && defined TCGETS2 && \
+    (defined __x86_64__ || defined __i386__ || defined __arm__ || \
+     defined __aarch64__ || defined __riscv)
+#define COM_TERMIOS2
+struct termios2 {
+    tcflag_t c_iflag;
+    tcflag_t c_oflag;
+    tcflag_t c_cflag;
+    tcflag_t c_lflag;
+    cc_t c_line;
+    cc_t c_cc[19];
+    speed_t c_ispeed;
+    speed_t c_ospeed;
+};
+#ifndef BOTHER
+#define BOTHER 0010000
+#endif
+#endif
+
+static void *com_writer(void *arg)
+{
+    int master = *(int *)arg;
+    assert_int_equal(write(master, "hello ", 6), 6);
+    // well inside the gap, so both halves reach one pollin
+    usleep(2000);
+    assert_int_equal(write(master, "world", 5), 5);
+    return NULL;
+}
+
+static void test_api_com(void **status)
+{
+    int master, slave;
+    char name[64];
+    assert_int_equal(openpty(&master, &slave, name, NULL, NULL), 0);
+
+    struct apix *ctx = apix_new();
+    apix_enable_posix(ctx);
+    apix_set_wait_timeout(ctx, 10 * 1000);
+    struct stream *com = apix_open_com(ctx, name);
+    assert_true(com);
+
+    struct ioctl_com_param bad = { 115200, 9, 'N', 1 };
+    assert_int_equal(apix_ioctl(com, 0, (unsigned long)&bad), -1);
+
+    struct termios tio;
+    struct ioctl_com_param sp = { 115200, 8, 'N', 1 };
+    assert_int_equal(apix_ioctl(com, 0, (unsigned long)&sp), 0);
+    assert_int_equal(tcgetattr(slave, &tio), 0);
+    assert_true(cfgetospeed(&tio) == B115200);
+
+    // no Bxxx constant, set by termios2 on linux
+    sp = (struct ioctl_com_param){ 2500000, 8, 'N', 1, COM_ARG_FLOW_RTSCTS,
+                                   COM_GAP_USEC, 1 };
+    assert_int_equal(apix_ioctl(com, 0, (unsigned long)&sp), 0);
+    assert_int_equal(tcgetattr(slave, &tio), 0);
+    assert_true(tio.c_cflag & CRTSCTS);
+#ifdef COM_TERMIOS2
+    struct termios2 tio2;
+    assert_int_equal(ioctl(slave, TCGETS2, &tio2), 0);
+    assert_true((tio2.c_cflag & CBAUD) == BOTHER);
+    assert_int_equal(tio2.c_ospeed, 2500000);
+#endif
+    close(slave);
+
+    pthread_t writer;
+    pthread_create(&writer, NULL, com_writer, &master);
+    char buf[32] = {0};
+    struct timeval start, now;
+    gettimeofday(&start, NULL);
+    for (int i = 0; i < 1000 && buf[0] == 0; i++) {
+        struct stream *stream = apix_wait_stream(ctx);
+        if (stream == com && apix_wait_event(stream) == AEC_POLLIN)
+            apix_read_from_buffer(com, (u8 *)buf, sizeof(buf) - 1);
+    }
+    gettimeofday(&now, NULL);
+    pthread_join(writer, NULL);
+    assert_string_equal(buf, "hello world");
+    // held until the line stayed idle for the gap
+    timersub(&now, &start, &now);
+    assert_true(now.tv_sec == 0 && now.tv_usec >= COM_GAP_USEC);
+
+    assert_int_equal(apix_send(com, (const u8 *)"pong", 4), 4);
+    memset(buf, 0, sizeof(buf));
+    int nr = 0;
+    while (nr != 4) {
+        int rc = read(master, buf + nr, sizeof(buf) - nr);
+        if (rc > 0) nr += rc;
+    }
+    assert_string_equal(buf, "pong");
+
+    apix_close(com);
+    apix_drop(ctx);
+    close(master);
+}
+
+/**
+ * test_api_pipe
+ */
+
+#define PIPE_UNIX_ADDR "test_apisink_unix_pipe"
+#define PIPE_FIFO_UP "test_apisink_fifo_up"
+#define PIPE_FIFO_DOWN "test_apisink_fifo_down"
+#define PIPE_BULK (64 * 1024)
+
+static int pipe_pollin; /* AEC_POLLIN seen by pipe_wait */
+
+static void pipe_wait(struct apix *ctx, struct stream **accepted)
+{
+    struct stream *stream = apix_wait_stream(ctx);
+    if (stream == NULL)
+        return;
+
+    switch (apix_wait_event(stream)) {
+    case AEC_ACCEPT:
+        *accepted = apix_accept(stream);
+        break;
+    case AEC_POLLIN:
+        pipe_pollin++;
+        break;
+    default:
+        break;
+    }
+}
+
+#define PIPE_SLOW_BULK (1024 * 1024)
+#define PIPE_IDLE_USEC (200 * 1000)
+
+struct pipe_writer {
+    int fd;
+    const u8 *buf;
+    int len;
+};
+
+static void *pipe_writer_thread(void *arg)
+{
+    struct pipe_writer *pw = arg;
+    for (int nr = 0; nr < pw->len;) {
+        int rc = send(pw->fd, pw->buf + nr, pw->len - nr, 0);
+        assert_true(rc > 0);
+        nr += rc;
+    }
+    return NULL;
+}
+
+static void pipe_read_all(struct apix *ctx, int fd, u8 *buf, int len)
+{
+    int nr = 0;
+    while (nr != len) {
+        pipe_wait(ctx, NULL);
+        int rc = recv(fd, buf + nr, len - nr, MSG_DONTWAIT);
+        if (rc == -1 && errno == ENOTSOCK)
+            rc = read(fd, buf + nr, len - nr);
+        if (rc > 0) nr += rc;
+    }
+}
+
+static void test_api_pipe(void **status)
+{
+    struct apix *ctx = apix_new();
+    apix_enable_posix(ctx);
+    apix_set_wait_timeout(ctx, 10 * 1000);
+
+    // inherited fds: rx from down, tx to up
+    int down[2], up[2];
+    assert_int_equal(pipe(down), 0);
+    assert_int_equal(pipe(up), 0);
+    fcntl(up[0], F_SETFL, O_NONBLOCK);
+    char addr[32];
+    snprintf(addr, sizeof(addr), "%d:%d", down[0], up[1]);
+    struct stream *child = apix_open_pipe(ctx, addr);
+    assert_true(child);
+
+    assert_int_equal(write(down[1], "ping", 4), 4);
+    char buf[16] = {0};
+    while (pipe_pollin == 0)
+        pipe_wait(ctx, NULL);
+    assert_int_equal(apix_read_from_buffer(child, (u8 *)buf, sizeof(buf)), 4);
+    assert_string_equal(buf, "ping");
+    assert_int_equal(apix_send_to_buffer(child, (const u8 *)"pong", 4), 0);
+    memset(buf, 0, sizeof(buf));
+    pipe_read_all(ctx, up[0], (u8 *)buf, 4);
+    assert_string_equal(buf, "pong");
+
+    // fifos, both ends in one ctx
+    unlink(PIPE_FIFO_UP);
+    unlink(PIPE_FIFO_DOWN);
+    struct stream *f1 = apix_open_pipe(ctx, PIPE_FIFO_UP ":" PIPE_FIFO_DOWN);
+    struct stream *f2 = apix_open_pipe(ctx, PIPE_FIFO_DOWN ":" PIPE_FIFO_UP);
+    assert_true(f1 && f2);
+    assert_true(apix_open_pipe(ctx, "nocolon") == NULL);
+    assert_int_equal(apix_send(f2, (const u8 *)"fifo", 4), 4);
+    pipe_pollin = 0;
+    while (pipe_pollin == 0)
+        pipe_wait(ctx, NULL);
+    memset(buf, 0, sizeof(buf));
+    assert_int_equal(apix_read_from_buffer(f1, (u8 *)buf, sizeof(buf)), 4);
+    assert_string_equal(buf, "fifo");
+
+    // relay socket to socket, through a pipe of the relay
+    struct stream *server = apix_open_unix_server(ctx, PIPE_UNIX_ADDR);
+    assert_true(server);
+    int clis[2];
+    struct stream *peers[2] = {0};
+    struct sockaddr_un sa = { .sun_family = PF_UNIX };
+    strcpy(sa.sun_path, PIPE_UNIX_ADDR);
+    for (int i = 0; i < 2; i++) {
+        clis[i] = socket(PF_UNIX, SOCK_STREAM, 0);
+        assert_true(connect(clis[i], (struct sockaddr *)&sa, sizeof(sa)) == 0);
+        while (peers[i] == NULL)
+            pipe_wait(ctx, &peers[i]);
+    }
+    assert_int_equal(apix_relay(peers[0], peers[1]), 0);
+    assert_int_equal(apix_relay(peers[0], peers[0]), -1);
+    assert_int_equal(apix_relay(server, peers[1]), -1);
+
+    u8 *bulk = malloc(PIPE_BULK), *out = malloc(PIPE_BULK);
+    for (int i = 0; i < PIPE_BULK; i++)
+        bulk[i] = i % 251;
+    pipe_pollin = 0;
+    assert_int_equal(send(clis[0], bulk, PIPE_BULK, 0), PIPE_BULK);
+    pipe_read_all(ctx, clis[1], out, PIPE_BULK);
+    assert_memory_equal(bulk, out, PIPE_BULK);
+    assert_int_equal(pipe_pollin, 0);
+
+    // a dst not read for a while holds up neither the ctx nor any byte
+    u8 *slow = malloc(PIPE_SLOW_BULK), *slow_out = malloc(PIPE_SLOW_BULK);
+    for (int i = 0; i < PIPE_SLOW_BULK; i++)
+        slow[i] = i % 253;
+    struct pipe_writer pw = { clis[0], slow, PIPE_SLOW_BULK };
+    pthread_t writer;
+    pthread_create(&writer, NULL, pipe_writer_thread, &pw);
+    for (int i = 0; i < 100; i++)
+        pipe_wait(ctx, NULL);
+
+    // nor does it spin the busy poll on src it can't read
+    apix_set_busy_poll(ctx, 100);
+    struct timeval start, now, elapsed;
+    struct rusage ru_start, ru;
+    gettimeofday(&start, NULL);
+    getrusage(RUSAGE_THREAD, &ru_start);
+    do {
+        pipe_wait(ctx, NULL);
+        gettimeofday(&now, NULL);
+        timersub(&now, &start, &elapsed);
+    } while (elapsed.tv_sec == 0 && elapsed.tv_usec < PIPE_IDLE_USEC);
+    getrusage(RUSAGE_THREAD, &ru);
+    u64 cpu = (ru.ru_utime.tv_sec - ru_start.ru_utime.tv_sec) * 1000000ULL +
+        ru.ru_utime.tv_usec - ru_start.ru_utime.tv_usec +
+        (ru.ru_stime.tv_sec - ru_start.ru_stime.tv_sec) * 1000000ULL +
+        ru.ru_stime.tv_usec - ru_start.ru_stime.tv_usec;
+    assert_true(cpu < PIPE_IDLE_USEC / 2);
+    apix_set_busy_poll(ctx, 0);
+
+    pipe_read_all(ctx, clis[1], slow_out, PIPE_SLOW_BULK);
+    pthread_join(writer, NULL);
+    assert_memory_equal(slow, slow_out, PIPE_SLOW_BULK);
+    free(slow);
+    free(slow_out);
+
+    // relay pipe to socket, spliced directly
+    assert_int_equal(apix_relay(child, peers[0]), 0);
+    assert_int_equal(write(down[1], bulk, 4096), 4096);
+    pipe_read_all(ctx, clis[0], out, 4096);
+    assert_memory_equal(bulk, out, 4096);
+    assert_int_equal(pipe_pollin, 0);
+
+    // stopped, back to rxbuf
+    assert_int_equal(apix_relay(peers[0], NULL), 0);
+    assert_int_equal(send(clis[0], "back", 4, 0), 4);
+    while (pipe_pollin == 0)
+        pipe_wait(ctx, NULL);
+    memset(buf, 0, sizeof(buf));
+    assert_int_equal(apix_read_from_buffer(peers[0], (u8 *)buf, sizeof(buf)), 4);
+    assert_string_equal(buf, "back");
+
+    free(bulk);
+    free(out);
+    close(clis[0]);
+    close(clis[1]);
+    close(down[1]);
+    close(up[0]);
+    apix_close(server);
+    apix_drop(ctx);
+    unlink(PIPE_FIFO_UP);
+    unlink(PIPE_FIFO_DOWN);
+}
+
+/**
+ * test_api_file
+ */
+
+#define FILE_UNIX_ADDR "test_apisink_unix_file"
+#define FILE_SRC "test_apisink_file_src"
+#define FILE_DST "test_apisink_file_dst"
+#define FILE_SIZE (300 * 1024)
+#define FILE_OFFSET 1000 /* not page aligned */
+
+static void test_api_file(void **status)
+{
+    struct apix *ctx = apix_new();
+    apix_enable_posix(ctx);
+    apix_set_wait_timeout(ctx, 0);
+    struct stream *server = apix_open_unix_server(ctx, FILE_UNIX_ADDR);
+    assert_true(server);
+    apix_upgrade_to_srrp(server, "1");
+
+    struct apix *cli_ctx = apix_new();
+    apix_enable_posix(cli_ctx);
+    apix_set_wait_timeout(cli_ctx, 0);
+    struct stream *cli = apix_open_unix_client(cli_ctx, FILE_UNIX_ADDR);
+    assert_true(cli);
+    apix_upgrade_to_srrp(cli, "3333");
+
+    struct stream *peer = NULL;
+    for (int i = 0; i < 2000 && peer == NULL; i++) {
+        cut_wait(ctx, &peer);
+        cut_wait(cli_ctx, NULL);
+        usleep(100);
+    }
+    assert_true(peer);
+    apix_set_integrity(peer, SRRP_INTEGRITY_CRC32C);
+    for (int i = 0; i < 100; i++) {
+        cut_wait(ctx, NULL);
+        cut_wait(cli_ctx, NULL);
+        usleep(100);
+    }
+
+    u8 *data = malloc(FILE_SIZE);
+    for (int i = 0; i < FILE_SIZE; i++)
+        data[i] = i % 251;
+    int src = open(FILE_SRC, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    int dst = open(FILE_DST, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    assert_true(src != -1 && dst != -1);
+    assert_int_equal(write(src, data, FILE_SIZE), FILE_SIZE);
+
+    assert_int_equal(apix_srrp_recv_file(server, "/file", dst), -1);
+    assert_int_equal(apix_srrp_recv_file(peer, "/file", dst), 0);
+
+    // the send returns at once, the slices go out as cli_ctx polls, and a
+    // send made meanwhile follows the file
+    struct srrp_packet *hdr = srrp_new_request("3333", "1", "/file", "");
+    assert_int_equal(apix_srrp_send_file(cli, hdr, src, FILE_OFFSET,
+                                         FILE_SIZE - FILE_OFFSET), 0);
+    assert_int_equal(apix_srrp_send_file(cli, hdr, src, 0, 100), -1);
+    struct srrp_packet *after = srrp_new_request("3333", "1", "/after", "t:x");
+    assert_int_equal(apix_srrp_send(cli, after), 0);
+    srrp_free(after);
+
+    struct srrp_packet *done = NULL;
+    for (int i = 0; i < 100000 && done == NULL; i++) {
+        cut_wait(cli_ctx, NULL);
+        done = cut_wait(ctx, NULL);
+    }
+    assert_non_null(done);
+    assert_true(srrp_get_leader(done) == SRRP_REQUEST_LEADER);
+    assert_string_equal(srrp_get_anchor(done), "/file");
+    assert_int_equal(srrp_get_payload_len(done), 0);
+    after = NULL;
+    for (int i = 0; i < 100000 && after == NULL; i++) {
+        cut_wait(cli_ctx, NULL);
+        after = cut_wait(ctx, NULL);
+    }
+    assert_non_null(after);
+    assert_string_equal(srrp_get_anchor(after), "/after");
+
+    u8 *out = malloc(FILE_SIZE);
+    assert_int_equal(pread(dst, out, FILE_SIZE, 0), FILE_SIZE - FILE_OFFSET);
+    assert_memory_equal(out, data + FILE_OFFSET, FILE_SIZE - FILE_OFFSET);
+
+    // disarmed after one message, the next is reassembled as usual
+    assert_int_equal(apix_srrp_send_file(cli, hdr, src, 0, 100), 0);
+    struct srrp_packet *pac = NULL;
+    for (int i = 0; i < 100000 && pac == NULL; i++) {
+        cut_wait(cli_ctx, NULL);
+        pac = cut_wait(ctx, NULL);
+    }
+    assert_non_null(pac);
+    assert_int_equal(srrp_get_payload_len(pac), 100);
+    assert_memory_equal(srrp_get_payload(pac), data, 100);
+
+    // several waiting packets by one call, sent by one flush of cli
+    for (int i = 0; i < 3; i++) {
+        struct srrp_packet *req = srrp_new_request("3333", "1", "/batch", "t:x");
+        assert_int_equal(apix_srrp_send(cli, req), 0);
+        srrp_free(req);
+    }
+    struct srrp_packet *pacs[4];
+    struct srrp_header hdrs[4];
+    int nr = 0;
+    for (int i = 0; i < 100000 && nr == 0; i++) {
+        cut_wait(cli_ctx, NULL);
+        apix_wait_stream(ctx);
+        nr = apix_wait_srrp_packets(peer, pacs, hdrs, 4);
+    }
+    assert_int_equal(nr, 3);
+    for (int i = 0; i < 3; i++) {
+        assert_string_equal(hdrs[i].anchor, "/batch");
+        assert_true(hdrs[i].raw == srrp_get_raw(pacs[i]));
+    }
+
+    srrp_free(hdr);
+    free(data);
+    free(out);
+    close(src);
+    close(dst);
+    unlink(FILE_SRC);
+    unlink(FILE_DST);
+    apix_close(cli);
+    apix_drop(cli_ctx);
+    apix_close(server);
+    apix_drop(ctx);
+}
+
 int main(void)
 {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(test_api_request_response),
         cmocka_unit_test(test_api_subscribe_publish),
+        cmocka_unit_test(test_api_call),
+        cmocka_unit_test(test_api_call_close),
+        cmocka_unit_test(test_api_idle_deadline),
+        cmocka_unit_test(test_api_poll_fd),
+        cmocka_unit_test(test_api_post),
+        cmocka_unit_test(test_api_workers),
+        cmocka_unit_test(test_api_work_stream_reuse),
+        cmocka_unit_test(test_api_uring),
+        cmocka_unit_test(test_api_cut_through),
+        cmocka_unit_test(test_api_com),
+        cmocka_unit_test(test_api_pipe),
+        cmocka_unit_test(test_api_file),
     };
     return cmocka_run_group_tests(tests, NULL, NULL);
 }
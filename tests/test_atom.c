@@ -0,0 +1,72 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <string.h>
+#include "atom.h"
+#include "srrp.h"
+
+static void test_atom(void **status)
+{
+    atom_t *a = atom_new("8A8F");
+    atom_t *b = atom_new_len("8A8F:/echo", 4);
+    assert_true(a == b);
+    assert_true(strcmp(atom_str(a), "8A8F") == 0);
+    assert_true(atom_len(a) == 4);
+
+    atom_t *c = atom_new("F1");
+    assert_true(c != a);
+
+    assert_true(atom_new("") == NULL);
+    assert_true(strcmp(atom_str(NULL), "") == 0);
+    assert_true(atom_len(NULL) == 0);
+    atom_put(NULL);
+
+    assert_true(atom_get(a) == a);
+    atom_put(a);
+    atom_put(a);
+    atom_put(b);
+    atom_put(c);
+
+    // unused atoms are purged as the table grows, live ones are kept
+    atom_t *live = atom_new("/live");
+    for (int i = 0; i < 10000; i++) {
+        char tmp[32];
+        snprintf(tmp, sizeof(tmp), "/tmp/%d", i);
+        atom_put(atom_new(tmp));
+    }
+    assert_true(atom_new("/live") == live);
+    assert_true(strcmp(atom_str(live), "/live") == 0);
+    atom_put(live);
+    atom_put(live);
+}
+
+static void test_srrp_atom(void **status)
+{
+    struct srrp_packet *req = srrp_new_request("F1", "8A8F", "/echo", "{}");
+    struct srrp_packet *pac = srrp_parse(srrp_get_raw(req), srrp_get_packet_len(req));
+    assert_true(pac);
+    assert_true(srrp_get_srcid_atom(pac) == srrp_get_srcid_atom(req));
+    assert_true(srrp_get_dstid_atom(pac) == srrp_get_dstid_atom(req));
+    assert_true(srrp_get_anchor_atom(pac) == srrp_get_anchor_atom(req));
+    assert_true(srrp_get_srcid_atom(pac) != srrp_get_dstid_atom(pac));
+
+    struct srrp_packet *pub = srrp_new_publish("/echo", "{}");
+    assert_true(srrp_get_anchor_atom(pub) == srrp_get_anchor_atom(req));
+    assert_true(srrp_get_srcid_atom(pub) == NULL);
+    assert_true(strcmp(srrp_get_srcid(pub), "") == 0);
+
+    srrp_free(req);
+    srrp_free(pac);
+    srrp_free(pub);
+}
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_atom),
+        cmocka_unit_test(test_srrp_atom),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,241 @@
+#define _GNU_SOURCE /* RTLD_NEXT */
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include "apix-posix.h"
+#include "apix.h"
+#include "isotp.h"
+
+/*
+ * PF_CAN is out of reach here, so a can stream gets one end of a seqpacket
+ * socketpair instead, canfd frames written on bus_fd come in as from the bus,
+ * and bind & the CAN_RAW options are taken as done.
+ * - the stream end is nonblocking with the least send buffer, so a burst of
+ *   frames fills it and fails the write as a full can tx queue does
+ */
+
+static int bus_fd = -1;
+
+int socket(int domain, int type, int protocol)
+{
+    static int (*real)(int, int, int);
+    if (real == NULL)
+        real = dlsym(RTLD_NEXT, "socket");
+    if (domain != PF_CAN)
+        return real(domain, type, protocol);
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) != 0)
+        return -1;
+    fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+    int sndbuf = 1; /* the least the kernel takes, a few frames */
+    setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    bus_fd = sv[1];
+    return sv[0];
+}
+
+int bind(int fd, const struct sockaddr *addr, socklen_t len)
+{
+    static int (*real)(int, const struct sockaddr *, socklen_t);
+    if (real == NULL)
+        real = dlsym(RTLD_NEXT, "bind");
+    if (addr->sa_family == AF_CAN)
+        return 0;
+    return real(fd, addr, len);
+}
+
+int setsockopt(int fd, int level, int name, const void *val, socklen_t len)
+{
+    static int (*real)(int, int, int, const void *, socklen_t);
+    if (real == NULL)
+        real = dlsym(RTLD_NEXT, "setsockopt");
+    if (level == SOL_CAN_RAW)
+        return 0;
+    return real(fd, level, name, val, len);
+}
+
+#define CAN_TX_ID 0x123
+#define CAN_RX_ID 0x321
+#if ISOTP_MSG_MAX < 2000
+#define CAN_MSG_LEN ISOTP_MSG_MAX
+#else
+#define CAN_MSG_LEN 2000
+#endif
+#define CAN_MSG_BACK (CAN_MSG_LEN * 3 / 4)
+
+static u64 now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void fill(u8 *buf, u32 len)
+{
+    for (u32 i = 0; i < len; i++)
+        buf[i] = i % 251;
+}
+
+/* Put the frames bus has due on bus_fd, return the frames written. */
+static int bus_out(struct isotp *bus)
+{
+    struct canfd_frame frame = { .can_id = CAN_RX_ID };
+    int len, nr = 0;
+
+    while ((len = isotp_poll_frame(bus, now_usec(), frame.data)) > 0) {
+        frame.len = len;
+        if (send(bus_fd, &frame, CANFD_MTU, MSG_DONTWAIT) != CANFD_MTU) {
+            assert_true(errno == EAGAIN);
+            isotp_unpoll_frame(bus);
+            break;
+        }
+        nr++;
+    }
+    return nr;
+}
+
+/* Feed bus the frames on bus_fd, return 1 once a message completed. */
+static int bus_in(struct isotp *bus)
+{
+    struct canfd_frame frame;
+    int done = 0;
+
+    while (recv(bus_fd, &frame, sizeof(frame), MSG_DONTWAIT) == CANFD_MTU) {
+        assert_int_equal(frame.can_id, CAN_TX_ID);
+        int rc = isotp_recv_frame(bus, now_usec(), frame.data, frame.len);
+        assert_true(rc >= 0);
+        if (rc == 1) done = 1;
+    }
+    return done;
+}
+
+static void test_can_isotp(void **status)
+{
+    struct apix *ctx = apix_new();
+    apix_enable_posix(ctx);
+    apix_set_wait_timeout(ctx, 0);
+    struct stream *can = apix_open_can(ctx, "vcan0");
+    assert_true(can);
+    assert_true(bus_fd != -1);
+
+    struct ioctl_can_isotp_param ip = { CAN_TX_ID, CAN_RX_ID, 1, 0, 0 };
+    assert_int_equal(apix_ioctl(can, CAN_ARG_ISOTP, (unsigned long)&ip), 0);
+    struct isotp *bus = isotp_new(ISOTP_FRAME_CANFD);
+
+    // out: 33 consecutive frames for 2000 bytes, far over the socket queue,
+    // the ones it has no room for must go out on later passes
+    u8 buf[CAN_MSG_LEN];
+    fill(buf, sizeof(buf));
+    assert_int_equal(apix_send(can, buf, sizeof(buf)), sizeof(buf));
+    struct canfd_frame ff;
+    assert_int_equal(read(bus_fd, &ff, sizeof(ff)), CANFD_MTU);
+    assert_int_equal(ff.can_id, CAN_TX_ID);
+    assert_int_equal(ff.len, ISOTP_FRAME_CANFD);
+    assert_int_equal(isotp_recv_frame(bus, now_usec(), ff.data, ff.len), 0);
+    assert_int_equal(bus_out(bus), 1);
+    for (int i = 0; i < 10; i++)
+        apix_wait_stream(ctx);
+
+    int done = 0;
+    for (int i = 0; i < 1000 && !done; i++) {
+        done = bus_in(bus);
+        apix_wait_stream(ctx);
+    }
+    assert_true(done);
+    u32 len = 0;
+    const u8 *msg = isotp_rx_msg(bus, &len);
+    assert_int_equal(len, sizeof(buf));
+    assert_memory_equal(msg, buf, sizeof(buf));
+
+    // in: the flow control of the stream comes back through can_pump
+    fill(buf, sizeof(buf));
+    buf[0] = 'x';
+    assert_int_equal(isotp_send(bus, buf, CAN_MSG_BACK), 0);
+    u8 got[CAN_MSG_BACK];
+    int nr = 0;
+    for (int i = 0; i < 1000 && nr == 0; i++) {
+        bus_out(bus);
+        bus_in(bus);
+        struct stream *stream = apix_wait_stream(ctx);
+        if (stream == can && apix_wait_event(stream) == AEC_POLLIN)
+            nr = apix_read_from_buffer(can, got, sizeof(got));
+    }
+    assert_int_equal(nr, CAN_MSG_BACK);
+    assert_memory_equal(got, buf, CAN_MSG_BACK);
+
+    isotp_free(bus);
+    apix_close(can);
+    apix_drop(ctx);
+    close(bus_fd);
+}
+
+#define CAN_WAIT_USEC (200 * 1000)
+#define CAN_ST_MIN 2 /* ms */
+
+/*
+ * Consecutive frames held back by STmin go out when it passed, apix_wait_*
+ * don't sleep out their wait timeout in between.
+ */
+static void test_can_st_min(void **status)
+{
+    struct apix *ctx = apix_new();
+    apix_enable_posix(ctx);
+    apix_set_wait_timeout(ctx, CAN_WAIT_USEC);
+    struct stream *can = apix_open_can(ctx, "vcan0");
+    assert_true(can);
+
+    struct ioctl_can_isotp_param ip = { CAN_TX_ID, CAN_RX_ID, 1, 0, 0 };
+    assert_int_equal(apix_ioctl(can, CAN_ARG_ISOTP, (unsigned long)&ip), 0);
+    struct isotp *bus = isotp_new(ISOTP_FRAME_CANFD);
+    isotp_set_flow(bus, 0, CAN_ST_MIN);
+
+    u8 buf[CAN_MSG_LEN];
+    fill(buf, sizeof(buf));
+    assert_int_equal(apix_send(can, buf, sizeof(buf)), sizeof(buf));
+    u64 start = now_usec();
+
+    int done = 0;
+    for (int i = 0; i < 10000 && !done; i++) {
+        done = bus_in(bus);
+        bus_out(bus);
+        struct stream *stream = apix_wait_stream(ctx);
+        if (stream) apix_wait_event(stream);
+    }
+    assert_true(done);
+    u32 len = 0;
+    const u8 *msg = isotp_rx_msg(bus, &len);
+    assert_int_equal(len, sizeof(buf));
+    assert_memory_equal(msg, buf, sizeof(buf));
+
+    // STmin is kept, and the CFs don't wait out the wait timeout
+    u32 rest = sizeof(buf) - (ISOTP_FRAME_CANFD - 2); /* past the FF */
+    u32 nr_cf = (rest + ISOTP_FRAME_CANFD - 2) / (ISOTP_FRAME_CANFD - 1);
+    u64 elapsed = now_usec() - start;
+    assert_true(elapsed >= (nr_cf - 1) * CAN_ST_MIN * 1000);
+    assert_true(elapsed < nr_cf * CAN_ST_MIN * 1000 + 5 * CAN_WAIT_USEC);
+
+    isotp_free(bus);
+    apix_close(can);
+    apix_drop(ctx);
+    close(bus_fd);
+}
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_can_isotp),
+        cmocka_unit_test(test_can_st_min),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,299 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdlib.h>
+#include <string.h>
+#include "isotp.h"
+#include "srrp.h"
+
+/*
+ * Move frames between the two ends until a is done sending and neither has
+ * a frame due, the clock advancing by step usec on each round, return the
+ * frames sent by a.
+ */
+static int shuttle(struct isotp *a, struct isotp *b, u64 *now, u64 step,
+                   int *msg_at_b)
+{
+    u8 frame[ISOTP_FRAME_CANFD];
+    int nr_frames = 0, idle = 0;
+
+    while (isotp_tx_busy(a) || idle < 3) {
+        int moved = 0, len;
+        while ((len = isotp_poll_frame(a, *now, frame)) > 0) {
+            int rc = isotp_recv_frame(b, *now, frame, len);
+            assert_true(rc >= 0);
+            if (rc == 1) *msg_at_b = 1;
+            nr_frames++;
+            moved = 1;
+        }
+        while ((len = isotp_poll_frame(b, *now, frame)) > 0) {
+            assert_true(isotp_recv_frame(a, *now, frame, len) >= 0);
+            moved = 1;
+        }
+        idle = moved ? 0 : idle + 1;
+        *now += step;
+    }
+    return nr_frames;
+}
+
+static void fill(u8 *buf, u32 len)
+{
+    for (u32 i = 0; i < len; i++)
+        buf[i] = i % 251;
+}
+
+static void test_isotp_single(void **status)
+{
+    struct isotp *a = isotp_new(ISOTP_FRAME_CAN);
+    struct isotp *b = isotp_new(ISOTP_FRAME_CAN);
+    assert_null(isotp_new(16));
+
+    u8 frame[ISOTP_FRAME_CANFD];
+    assert_int_equal(isotp_send(a, (const u8 *)"hello", 5), 0);
+    assert_int_equal(isotp_send(a, (const u8 *)"again", 5), -1);
+    assert_int_equal(isotp_poll_frame(a, 0, frame), 8);
+    assert_int_equal(frame[0], 0x05);
+    assert_int_equal(frame[7], ISOTP_PAD);
+    assert_false(isotp_tx_busy(a));
+    assert_int_equal(isotp_poll_frame(a, 0, frame), 0);
+
+    u32 len = 0;
+    assert_int_equal(isotp_recv_frame(b, 0, frame, 8), 1);
+    const u8 *msg = isotp_rx_msg(b, &len);
+    assert_int_equal(len, 5);
+    assert_memory_equal(msg, "hello", 5);
+
+    isotp_free(a);
+    isotp_free(b);
+}
+
+static void test_isotp_flow_control(void **status)
+{
+    struct isotp *a = isotp_new(ISOTP_FRAME_CAN);
+    struct isotp *b = isotp_new(ISOTP_FRAME_CAN);
+    isotp_set_flow(b, 4, 0xf5); /* 4 frames a block, 500us apart */
+
+    u8 buf[1000], frame[ISOTP_FRAME_CANFD];
+    u64 now = 1;
+    fill(buf, sizeof(buf));
+    assert_true(isotp_next_deadline(a) == ISOTP_NEVER);
+    assert_int_equal(isotp_send(a, buf, sizeof(buf)), 0);
+    assert_true(isotp_next_deadline(a) == 0);
+
+    // first frame, then nothing until flow control
+    assert_int_equal(isotp_poll_frame(a, now, frame), 8);
+    assert_int_equal(frame[0], 0x13);
+    assert_int_equal(frame[1], 0xe8);
+    assert_int_equal(isotp_poll_frame(a, now, frame), 0);
+    assert_true(isotp_next_deadline(a) == now + ISOTP_TIMEOUT + 1);
+    assert_int_equal(isotp_recv_frame(b, now, frame, 8), 0);
+    assert_true(isotp_next_deadline(b) == 0);
+
+    assert_int_equal(isotp_poll_frame(b, now, frame), 8);
+    assert_int_equal(frame[0], 0x30);
+    assert_int_equal(frame[1], 4);
+    assert_int_equal(frame[2], 0xf5);
+    assert_true(isotp_next_deadline(b) == now + ISOTP_TIMEOUT + 1);
+    assert_int_equal(isotp_recv_frame(a, now, frame, 8), 0);
+
+    // STmin between consecutive frames
+    assert_int_equal(isotp_poll_frame(a, now, frame), 8);
+    assert_int_equal(frame[0], 0x21);
+    assert_true(isotp_next_deadline(a) == now + 500);
+    assert_int_equal(isotp_recv_frame(b, now, frame, 8), 0);
+    assert_int_equal(isotp_poll_frame(a, now + 499, frame), 0);
+    assert_int_equal(isotp_poll_frame(a, now + 500, frame), 8);
+    assert_int_equal(frame[0], 0x22);
+    assert_int_equal(isotp_recv_frame(b, now, frame, 8), 0);
+    now += 500;
+
+    int done = 0;
+    // 6 bytes in FF, 7 in each CF: 142 CFs, 2 sent above
+    assert_int_equal(shuttle(a, b, &now, 100, &done), 140);
+    assert_true(done);
+    u32 len = 0;
+    const u8 *msg = isotp_rx_msg(b, &len);
+    assert_int_equal(len, sizeof(buf));
+    assert_memory_equal(msg, buf, sizeof(buf));
+    assert_true(isotp_next_deadline(a) == ISOTP_NEVER);
+    assert_true(isotp_next_deadline(b) == ISOTP_NEVER);
+
+    isotp_free(a);
+    isotp_free(b);
+}
+
+#if ISOTP_MSG_MAX > 4095
+#define CANFD_LEN 5000 /* past 4095, the first frame takes the escape */
+#else
+#define CANFD_LEN ISOTP_MSG_MAX
+#endif
+
+static void test_isotp_canfd(void **status)
+{
+    struct isotp *a = isotp_new(ISOTP_FRAME_CANFD);
+    struct isotp *b = isotp_new(ISOTP_FRAME_CANFD);
+
+    // single frame escape, padded to the next dlc
+    u8 buf[CANFD_LEN], frame[ISOTP_FRAME_CANFD];
+    fill(buf, sizeof(buf));
+    assert_int_equal(isotp_send(a, buf, 40), 0);
+    assert_int_equal(isotp_poll_frame(a, 0, frame), 48);
+    assert_int_equal(frame[0], 0x00);
+    assert_int_equal(frame[1], 40);
+    assert_int_equal(isotp_recv_frame(b, 0, frame, 48), 1);
+
+    // first frame escape past 4095
+    u64 now = 1;
+    int done = 0;
+    assert_int_equal(isotp_send(a, buf, sizeof(buf)), 0);
+    assert_int_equal(isotp_poll_frame(a, now, frame), 64);
+#if CANFD_LEN > 4095
+    assert_int_equal(frame[0], 0x10);
+    assert_int_equal(frame[1], 0x00);
+    u32 ff_len = 58;
+#else
+    assert_int_equal(frame[0], 0x10 | (CANFD_LEN >> 8));
+    assert_int_equal(frame[1], CANFD_LEN & 0xff);
+    u32 ff_len = 62;
+#endif
+    assert_int_equal(isotp_recv_frame(b, now, frame, 64), 0);
+    // ff_len bytes in FF, 63 in each CF: 79 CFs for 5000
+    assert_int_equal(shuttle(a, b, &now, 10, &done),
+                     (sizeof(buf) - ff_len + 62) / 63);
+    assert_true(done);
+    u32 len = 0;
+    const u8 *msg = isotp_rx_msg(b, &len);
+    assert_int_equal(len, sizeof(buf));
+    assert_memory_equal(msg, buf, sizeof(buf));
+
+    isotp_free(a);
+    isotp_free(b);
+}
+
+static void test_isotp_errors(void **status)
+{
+    struct isotp *a = isotp_new(ISOTP_FRAME_CAN);
+    struct isotp *b = isotp_new(ISOTP_FRAME_CAN);
+    u8 buf[100], frame[ISOTP_FRAME_CANFD];
+    fill(buf, sizeof(buf));
+
+    assert_int_equal(isotp_send(a, buf, 0), -1);
+    assert_int_equal(isotp_send(a, buf, ISOTP_MSG_MAX + 1), -1);
+
+    // no flow control
+    assert_int_equal(isotp_send(a, buf, sizeof(buf)), 0);
+    assert_int_equal(isotp_poll_frame(a, 1, frame), 8);
+    assert_int_equal(isotp_poll_frame(a, 1 + ISOTP_TIMEOUT, frame), 0);
+    assert_int_equal(isotp_poll_frame(a, 2 + ISOTP_TIMEOUT, frame), -1);
+    assert_false(isotp_tx_busy(a));
+
+    // wrong sequence number
+    assert_int_equal(isotp_send(a, buf, sizeof(buf)), 0);
+    assert_int_equal(isotp_poll_frame(a, 1, frame), 8);
+    assert_int_equal(isotp_recv_frame(b, 1, frame, 8), 0);
+    assert_int_equal(isotp_poll_frame(b, 1, frame), 8);
+    assert_int_equal(isotp_recv_frame(a, 1, frame, 8), 0);
+    assert_int_equal(isotp_poll_frame(a, 1, frame), 8);
+    frame[0] = 0x22;
+    assert_int_equal(isotp_recv_frame(b, 1, frame, 8), -1);
+    // the rest is ignored
+    while (isotp_poll_frame(a, 1, frame) > 0)
+        assert_int_equal(isotp_recv_frame(b, 1, frame, 8), 0);
+
+    // overflow
+    u8 ff[8] = { 0x10, 0x00, 0x7f, 0xff, 0xff, 0xff, 0, 0 };
+    assert_int_equal(isotp_recv_frame(b, 1, ff, 8), -1);
+    assert_int_equal(isotp_poll_frame(b, 1, frame), 8);
+    assert_int_equal(frame[0], 0x32);
+    assert_int_equal(isotp_send(a, buf, sizeof(buf)), 0);
+    assert_int_equal(isotp_poll_frame(a, 1, frame), 8);
+    frame[0] = 0x32;
+    assert_int_equal(isotp_recv_frame(a, 1, frame, 8), 0);
+    assert_int_equal(isotp_poll_frame(a, 1, frame), -1);
+
+    isotp_free(a);
+    isotp_free(b);
+}
+
+static void test_isotp_unpoll(void **status)
+{
+    struct isotp *a = isotp_new(ISOTP_FRAME_CAN);
+    struct isotp *b = isotp_new(ISOTP_FRAME_CAN);
+    u8 buf[100], frame[ISOTP_FRAME_CANFD], again[ISOTP_FRAME_CANFD];
+    fill(buf, sizeof(buf));
+
+    // a first frame put back goes out again
+    assert_int_equal(isotp_send(a, buf, sizeof(buf)), 0);
+    assert_int_equal(isotp_poll_frame(a, 1, frame), 8);
+    isotp_unpoll_frame(a);
+    assert_int_equal(isotp_poll_frame(a, 1, again), 8);
+    assert_memory_equal(again, frame, 8);
+    assert_int_equal(isotp_recv_frame(b, 1, frame, 8), 0);
+
+    // so does the flow control
+    assert_int_equal(isotp_poll_frame(b, 1, frame), 8);
+    isotp_unpoll_frame(b);
+    assert_int_equal(isotp_poll_frame(b, 1, again), 8);
+    assert_memory_equal(again, frame, 8);
+    assert_int_equal(isotp_recv_frame(a, 1, frame, 8), 0);
+
+    // and a consecutive frame, with its sequence number
+    assert_int_equal(isotp_poll_frame(a, 1, frame), 8);
+    assert_int_equal(frame[0], 0x21);
+    isotp_unpoll_frame(a);
+    assert_int_equal(isotp_poll_frame(a, 1, again), 8);
+    assert_memory_equal(again, frame, 8);
+    assert_int_equal(isotp_recv_frame(b, 1, frame, 8), 0);
+
+    u64 now = 1;
+    int done = 0;
+    // 6 bytes in FF, 7 in each CF: 14 CFs, 1 sent above
+    assert_int_equal(shuttle(a, b, &now, 1, &done), 13);
+    assert_true(done);
+    u32 len = 0;
+    const u8 *msg = isotp_rx_msg(b, &len);
+    assert_int_equal(len, sizeof(buf));
+    assert_memory_equal(msg, buf, sizeof(buf));
+
+    isotp_free(a);
+    isotp_free(b);
+}
+
+static void test_isotp_srrp(void **status)
+{
+    struct isotp *a = isotp_new(ISOTP_FRAME_CAN);
+    struct isotp *b = isotp_new(ISOTP_FRAME_CAN);
+
+    struct srrp_packet *pac = srrp_new_request("8888", "8889", "/echo", "t:hello over can");
+    u64 now = 1;
+    int done = 0;
+    assert_int_equal(isotp_send(a, srrp_get_raw(pac), srrp_get_packet_len(pac)), 0);
+    shuttle(a, b, &now, 1, &done);
+    assert_true(done);
+
+    u32 len = 0;
+    const u8 *msg = isotp_rx_msg(b, &len);
+    struct srrp_packet *rxpac = srrp_parse(msg, len);
+    assert_non_null(rxpac);
+    assert_string_equal(srrp_get_anchor(rxpac), "/echo");
+    assert_string_equal((const char *)srrp_get_payload(rxpac), "t:hello over can");
+
+    srrp_free(rxpac);
+    srrp_free(pac);
+    isotp_free(a);
+    isotp_free(b);
+}
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_isotp_single),
+        cmocka_unit_test(test_isotp_flow_control),
+        cmocka_unit_test(test_isotp_canfd),
+        cmocka_unit_test(test_isotp_errors),
+        cmocka_unit_test(test_isotp_unpoll),
+        cmocka_unit_test(test_isotp_srrp),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -23,10 +23,144 @@ static void test_json(void **status)
     json_object_delete(jo);
 }
 
+static void test_json_types(void **status)
+{
+    struct json_object *jo = json_object_new(
+        "{\"id\": -9007199254740993, \"ratio\": 0.25, \"ok\": true, \"nil\": null,"
+        " \"msg\": \"a\\\"b\\u00e9\", \"equip\": ['hat', 'shoes', {size: 42}],"
+        " \"nest\": {\"a\": {\"b\": [1, 2]}}}");
+
+    int64_t value_i64 = 0;
+    assert_true(json_get_int64(jo, "/id", &value_i64) == 0);
+    assert_true(value_i64 == -9007199254740993LL);
+
+    int value_int = 0;
+    assert_true(json_get_int(jo, "/id", &value_int) == -1);
+    assert_true(json_get_int(jo, "/equip/2/size", &value_int) == 0);
+    assert_true(value_int == 42);
+    assert_true(json_get_int(jo, "/nest/a/b/1", &value_int) == 0);
+    assert_true(value_int == 2);
+
+    double value_double = 0;
+    assert_true(json_get_double(jo, "/ratio", &value_double) == 0);
+    assert_true(value_double == 0.25);
+
+    int value_bool = 0;
+    assert_true(json_get_bool(jo, "/ok", &value_bool) == 0);
+    assert_true(value_bool == 1);
+    assert_true(json_get_type(jo, "/nil") == JSON_TYPE_NULL);
+    assert_true(json_get_type(jo, "/nest/a") == JSON_TYPE_OBJECT);
+    assert_true(json_get_type(jo, "/nope") == JSON_TYPE_NONE);
+
+    char value_str[16];
+    assert_true(json_get_string(jo, "/msg", value_str, sizeof(value_str)) == 0);
+    assert_string_equal(value_str, "a\"b\xc3\xa9");
+    assert_true(json_get_string(jo, "/equip/1", value_str, sizeof(value_str)) == 0);
+    assert_string_equal(value_str, "shoes");
+    assert_true(json_get_string(jo, "/ok", value_str, sizeof(value_str)) == -1);
+
+    size_t size = 0;
+    assert_true(json_get_array_size(jo, "/equip", &size) == 0);
+    assert_true(size == 3);
+    assert_true(json_get_array_size(jo, "/equip/3", &size) == -1);
+    assert_true(json_get_type(jo, "/equip/4294967297") == JSON_TYPE_NONE);
+    assert_true(json_get_type(jo, "/equip/4294967295") == JSON_TYPE_NONE);
+    assert_true(json_get_type(jo, "/equip/00000000000000000001") == JSON_TYPE_STRING);
+
+    const char *raw = NULL;
+    assert_true(json_get_raw(jo, "/nest/a", &raw, &size) == 0);
+    assert_true(size == strlen("{\"b\": [1, 2]}"));
+    assert_true(memcmp(raw, "{\"b\": [1, 2]}", size) == 0);
+
+    json_object_delete(jo);
+
+    jo = json_object_new("{s: 'the quick brown fox jumps over the lazy dog\\'s back', n: 7}");
+    char value_long[64];
+    assert_true(json_get_string(jo, "/s", value_long, sizeof(value_long)) == 0);
+    assert_string_equal(value_long, "the quick brown fox jumps over the lazy dog's back");
+    assert_true(json_get_int(jo, "/n", &value_int) == 0);
+    assert_true(value_int == 7);
+    json_object_delete(jo);
+
+    // runs of whitespace and primitives over the 16 bytes of a scan
+    jo = json_object_new("{\"count\"  :\t\r\n                   123456789012345678,"
+                         "                 \"list\":[true,false,null     ,\f\v-1.5e-3]"
+                         "                                                  }");
+    int64_t count = 0;
+    assert_true(json_get_int64(jo, "/count", &count) == 0);
+    assert_true(count == 123456789012345678LL);
+    assert_true(json_get_array_size(jo, "/list", &size) == 0);
+    assert_true(size == 4);
+    assert_true(json_get_type(jo, "/list/2") == JSON_TYPE_NULL);
+    assert_true(json_get_double(jo, "/list/3", &value_double) == 0);
+    assert_true(value_double == -1.5e-3);
+    json_object_delete(jo);
+
+    jo = json_object_new("{a: 1, b: {c: 2}");
+    assert_true(json_get_int(jo, "/a", &value_int) == -1);
+    json_object_delete(jo);
+}
+
+static void test_json_writer(void **status)
+{
+    char buf[256];
+    struct json_writer jw;
+
+    assert_true(json_writer_init(&jw, buf, sizeof(buf)) == 0);
+    assert_true(json_write_raw(&jw, "j:", 2) == 0);
+    json_write_object_begin(&jw);
+    json_write_key(&jw, "err");
+    json_write_int64(&jw, -12);
+    json_write_key(&jw, "msg");
+    json_write_string(&jw, "a\"b\n\x01");
+    json_write_key(&jw, "list");
+    json_write_array_begin(&jw);
+    json_write_bool(&jw, 1);
+    json_write_null(&jw);
+    json_write_double(&jw, 0.5);
+    json_write_object_begin(&jw);
+    json_write_object_end(&jw);
+    json_write_array_end(&jw);
+    assert_true(json_write_object_end(&jw) == 0);
+    assert_string_equal(json_writer_data(&jw),
+                        "j:{\"err\":-12,\"msg\":\"a\\\"b\\n\\u0001\","
+                        "\"list\":[true,null,0.5,{}]}");
+    assert_true(json_writer_len(&jw) == strlen(buf));
+
+    struct json_object *jo = json_object_new(json_writer_data(&jw) + 2);
+    char value_str[16];
+    assert_true(json_get_string(jo, "/msg", value_str, sizeof(value_str)) == 0);
+    assert_string_equal(value_str, "a\"b\n\x01");
+    size_t size = 0;
+    assert_true(json_get_array_size(jo, "/list", &size) == 0);
+    assert_true(size == 4);
+    json_object_delete(jo);
+    json_writer_fini(&jw);
+
+    // misuse and overflow fail sticky
+    json_writer_init(&jw, buf, sizeof(buf));
+    json_write_array_begin(&jw);
+    assert_true(json_write_key(&jw, "x") == -1);
+    assert_true(json_write_array_end(&jw) == -1);
+
+    json_writer_init(&jw, buf, 8);
+    assert_true(json_write_string(&jw, "1234567") == -1);
+    assert_true(json_write_null(&jw) == -1);
+    assert_true(strlen(buf) < 8);
+
+    // pooled buffer
+    assert_true(json_writer_init(&jw, NULL, 0) == 0);
+    assert_true(json_write_int64(&jw, INT64_MIN) == 0);
+    assert_string_equal(json_writer_data(&jw), "-9223372036854775808");
+    json_writer_fini(&jw);
+}
+
 int main(void)
 {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(test_json),
+        cmocka_unit_test(test_json_types),
+        cmocka_unit_test(test_json_writer),
     };
     return cmocka_run_group_tests(tests, NULL, NULL);
 }
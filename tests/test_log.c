@@ -2,8 +2,20 @@
 #include <stddef.h>
 #include <setjmp.h>
 #include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "log.h"
 
+static int evaluated;
+
+static int side_effect(void)
+{
+    evaluated++;
+    return 0;
+}
+
 static void test_log_level(void **status)
 {
     assert_true(log_set_level(LOG_LV_WARN) == LOG_LV_INFO);
@@ -11,10 +23,161 @@ static void test_log_level(void **status)
     assert_true(log_set_level(LOG_LV_NONE) == LOG_LV_FATAL);
 }
 
+static void test_log_lazy_args(void **status)
+{
+    int previous = log_set_level(LOG_LV_WARN);
+
+    evaluated = 0;
+    LOG_TRACE("trace %d", side_effect());
+    LOG_DEBUG("debug %d", side_effect());
+    assert_true(evaluated == 0);
+    LOG_WARN("warn %d", side_effect());
+    assert_true(evaluated == 1);
+
+    log_set_level(previous);
+}
+
+static void test_log_ratelimit(void **status)
+{
+    struct log_ratelimit rl = {0};
+    int passed = 0;
+
+    for (int i = 0; i < LOG_RATELIMIT_BURST * 3; i++)
+        passed += log_ratelimit(&rl);
+    assert_true(passed <= LOG_RATELIMIT_BURST * 2);
+    assert_true(passed >= LOG_RATELIMIT_BURST);
+}
+
+/* Point stdout to a temporary file, until capture_end hands its content. */
+static int capture_fd = -1, stdout_fd = -1;
+
+static void capture_begin(void)
+{
+    char path[] = "/tmp/test-log-XXXXXX";
+    fflush(stdout);
+    capture_fd = mkstemp(path);
+    assert_true(capture_fd != -1);
+    unlink(path);
+    stdout_fd = dup(STDOUT_FILENO);
+    dup2(capture_fd, STDOUT_FILENO);
+}
+
+static char *capture_end(void)
+{
+    fflush(stdout);
+    dup2(stdout_fd, STDOUT_FILENO);
+    close(stdout_fd);
+
+    off_t len = lseek(capture_fd, 0, SEEK_END);
+    char *buf = malloc(len + 1);
+    assert_int_equal(pread(capture_fd, buf, len, 0), len);
+    buf[len] = 0;
+    close(capture_fd);
+    return buf;
+}
+
+/* Check the "async message #n" lines are in order, return their count. */
+static int count_async_messages(const char *out, int *dropped)
+{
+    int cnt = 0, last = -1;
+
+    *dropped = 0;
+    for (const char *line = out; *line;) {
+        const char *p;
+        int nr;
+        if ((p = strstr(line, "async message #")) && p < strchr(line, '\n')) {
+            assert_int_equal(sscanf(p, "async message #%d", &nr), 1);
+            assert_true(nr > last);
+            last = nr;
+            cnt++;
+        } else if ((p = strstr(line, "ring full, ")) &&
+                   p < strchr(line, '\n')) {
+            assert_int_equal(sscanf(p, "ring full, %d", &nr), 1);
+            *dropped += nr;
+        }
+        line = strchr(line, '\n') + 1;
+    }
+    return cnt;
+}
+
+static void test_log_async(void **status)
+{
+    int previous = log_set_level(LOG_LV_INFO);
+    int dropped;
+    char *out;
+
+    // a burst over a small ring: the records arrive in order, the ones the
+    // ring had no room for are counted as dropped
+    capture_begin();
+    assert_true(log_enable_async(4) == 0);
+    assert_true(log_enable_async(4) == -1);
+    int fails = 0;
+    for (int i = 0; i < 100; i++) {
+        if (LOG_INFO("async message #%d", i) != 0)
+            fails++;
+    }
+    log_disable_async();
+    out = capture_end();
+    assert_int_equal(count_async_messages(out, &dropped), 100 - fails);
+    assert_int_equal(dropped, fails);
+    free(out);
+
+    // retried until taken, the consumer is woken for each of them
+    capture_begin();
+    assert_true(log_enable_async(4) == 0);
+    fails = 0;
+    for (int i = 0; i < 100; i++) {
+        while (LOG_INFO("async message #%d", i) != 0) {
+            fails++;
+            usleep(100);
+        }
+    }
+    log_disable_async();
+    out = capture_end();
+    assert_int_equal(count_async_messages(out, &dropped), 100);
+    assert_int_equal(dropped, fails);
+    free(out);
+
+    // the consumer formats as printf does, with the arguments of the time of
+    // the call
+    char str[16] = "before";
+    char want[256];
+    snprintf(want, sizeof(want),
+             "fmt %s|%5d|%-4u|%hhd|%lld|%zu|%x|%c|%.2f|%*d|%.*s|%p|%%|%5.1Le",
+             str, 42, 7u, 300, -5LL, (size_t)9, 255, 'z', 3.14159, 4, 1,
+             3, "abcdef", (void *)0x10, (long double)2.5);
+    char big[LOG_RECORD_MSG_MAX * 2];
+    memset(big, 'b', sizeof(big) - 1);
+    big[sizeof(big) - 1] = 0;
+
+    capture_begin();
+    assert_true(log_enable_async(4) == 0);
+    LOG_INFO("fmt %s|%5d|%-4u|%hhd|%lld|%zu|%x|%c|%.2f|%*d|%.*s|%p|%%|%5.1Le",
+             str, 42, 7u, 300, -5LL, (size_t)9, 255, 'z', 3.14159, 4, 1,
+             3, "abcdef", (void *)0x10, (long double)2.5);
+    strcpy(str, "after");
+    LOG_INFO("big %s %d", big, 1);
+    log_disable_async();
+    out = capture_end();
+    assert_non_null(strstr(out, want));
+    assert_null(strstr(out, "after"));
+    char *p = strstr(out, "big bbb");
+    assert_non_null(p);
+    assert_true(strchr(p, '\n') - p < LOG_RECORD_MSG_MAX + 8);
+    assert_true(strncmp(strchr(p, '\n') - 3, "...", 3) == 0);
+    free(out);
+
+    assert_true(LOG_INFO("sync message") == 0);
+    log_set_level(previous);
+}
+
 int main(void)
 {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(test_log_level),
+        cmocka_unit_test(test_log_lazy_args),
+        cmocka_unit_test(test_log_ratelimit),
+        cmocka_unit_test(test_log_async),
     };
     return cmocka_run_group_tests(tests, NULL, NULL);
 }
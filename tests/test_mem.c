@@ -0,0 +1,211 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "apix-private.h"
+#include "apix-posix.h"
+#include "mem.h"
+#include "srrp.h"
+#include "svcx.h"
+#include "vec.h"
+
+MEM_POOL(test_pool, u64, 4);
+
+static void test_mem_pool(void **status)
+{
+    u64 *objs[4];
+    for (int i = 0; i < 4; i++) {
+        objs[i] = mem_pool_alloc(&test_pool);
+        assert_non_null(objs[i]);
+        assert_int_equal(*objs[i], 0);
+        *objs[i] = i + 1;
+    }
+
+#ifdef APIX_STATIC_ALLOC
+    // exhausted, nothing grows behind it
+    assert_null(mem_pool_alloc(&test_pool));
+    mem_pool_free(&test_pool, objs[2]);
+    objs[2] = mem_pool_alloc(&test_pool);
+    assert_non_null(objs[2]);
+    assert_int_equal(*objs[2], 0);
+
+    struct mem_stat stats[32];
+    int nr = mem_stat(stats, 32), found = 0;
+    for (int i = 0; i < nr; i++) {
+        if (strcmp(stats[i].name, "test_pool") == 0) {
+            assert_int_equal(stats[i].count, 4);
+            assert_int_equal(stats[i].used, 4);
+            assert_int_equal(stats[i].peak, 4);
+            assert_int_equal(stats[i].fails, 1);
+            found = 1;
+        }
+    }
+    assert_true(found);
+#else
+    struct mem_stat stats[1];
+    assert_int_equal(mem_stat(stats, 1), 0);
+#endif
+
+    for (int i = 0; i < 4; i++)
+        mem_pool_free(&test_pool, objs[i]);
+}
+
+static void test_mem_bytes(void **status)
+{
+    char *s = mem_strdup("hello");
+    assert_string_equal(s, "hello");
+    s = mem_realloc(s, 1000);
+    assert_non_null(s);
+    assert_string_equal(s, "hello");
+    s = mem_realloc(s, 8);
+    assert_string_equal(s, "hello");
+    mem_free(s);
+
+    u8 *buf = mem_calloc(100, 1);
+    for (int i = 0; i < 100; i++)
+        assert_int_equal(buf[i], 0);
+    mem_free(buf);
+
+    vec_t *v = vec_new(1, 0);
+    assert_int_equal(vreserve(v, 300), 0);
+    assert_true(vcap(v) >= 300);
+    assert_int_equal(vsize(v), 0);
+    vec_free(v);
+
+#ifdef APIX_STATIC_ALLOC
+    // larger than the largest class
+    assert_null(mem_alloc(4 * APIX_MAX_FRAME + 1));
+#endif
+}
+
+static void test_mem_packets(void **status)
+{
+#ifdef APIX_STATIC_ALLOC
+    static struct srrp_packet *pacs[APIX_MAX_PACKETS + 1];
+    int nr = 0;
+
+    // deterministic failure once the packet pool is drained
+    while (nr < APIX_MAX_PACKETS + 1) {
+        pacs[nr] = srrp_new_request("8888", "8889", "/mem", "t:hello");
+        if (pacs[nr] == NULL)
+            break;
+        nr++;
+    }
+    assert_int_equal(nr, APIX_MAX_PACKETS);
+    assert_null(srrp_new_request("8888", "8889", "/mem", "t:hello"));
+
+    srrp_free(pacs[0]);
+    pacs[0] = srrp_new_request("8888", "8889", "/mem", "t:again");
+    assert_non_null(pacs[0]);
+    assert_string_equal((const char *)srrp_get_payload(pacs[0]), "t:again");
+
+    for (int i = 0; i < nr; i++)
+        srrp_free(pacs[i]);
+
+#if APIX_MAX_FRAME < SRRP_PACKET_MAX
+    // a packet past the frame is refused, not built on the heap
+    static char big[APIX_MAX_FRAME + 1];
+    memset(big, 'x', sizeof(big) - 1);
+    big[0] = 't';
+    big[1] = ':';
+    assert_null(srrp_new_request("8888", "8889", "/mem", big));
+#endif
+#endif
+
+    struct srrp_packet *pac = srrp_new_request("8888", "8889", "/mem", "t:hello");
+    assert_non_null(pac);
+    srrp_free(pac);
+}
+
+#define TXBUF_UNIX_ADDR "test_mem_unix_txbuf"
+
+static void test_mem_txbuf(void **status)
+{
+#ifdef APIX_STATIC_ALLOC
+    struct apix *ctx = apix_new();
+    apix_enable_posix(ctx);
+    struct stream *server = apix_open_unix_server(ctx, TXBUF_UNIX_ADDR);
+    struct stream *cli = apix_open_unix_client(ctx, TXBUF_UNIX_ADDR);
+    assert_true(server && cli);
+
+    // txbuf takes the first slice but not the second, the first goes back
+    static u8 filler[STREAM_BUF_MAX - (PAYLOAD_LIMIT + 256)];
+    assert_int_equal(apix_send_to_buffer(cli, filler, sizeof(filler)), 0);
+    static char payload[PAYLOAD_LIMIT + 300];
+    memset(payload, 'x', sizeof(payload) - 1);
+    payload[0] = 't';
+    payload[1] = ':';
+    struct srrp_packet *pac = srrp_new_request("8888", "8889", "/mem", payload);
+    assert_non_null(pac);
+    assert_int_equal(apix_srrp_send(cli, pac), -1);
+    assert_int_equal(stream_tx_size(cli), sizeof(filler));
+    srrp_free(pac);
+
+    apix_close(cli);
+    apix_close(server);
+    apix_drop(ctx);
+    unlink(TXBUF_UNIX_ADDR);
+#endif
+}
+
+#ifdef APIX_STATIC_ALLOC
+static struct srrp_packet *on_exhausted(const struct srrp_packet *req, void *arg)
+{
+    return NULL;
+}
+
+/* Add services until the byte pools run dry, return how many were added. */
+static int svcx_fill(struct svcx *svcx)
+{
+    char header[32];
+    int nr = 0;
+    for (;; nr++) {
+        snprintf(header, sizeof(header), "%d:/fill/%d", nr, nr);
+        if (svcx_add_service(svcx, header, (void *)(long)(nr + 1)) != 0)
+            break;
+    }
+    for (int i = 0; i < nr; i++) {
+        snprintf(header, sizeof(header), "%d:/fill/%d", i, i);
+        assert_true(svcx_get_service_private_exact(svcx, header) == (void *)(long)(i + 1));
+    }
+    return nr;
+}
+#endif
+
+static void test_mem_exhausted(void **status)
+{
+#ifdef APIX_STATIC_ALLOC
+    struct apix *ctx = apix_new();
+    assert_non_null(ctx);
+
+    // queues past the largest class fail the workers, not the process
+    assert_int_equal(apix_enable_workers(ctx, 2, 4 * APIX_MAX_FRAME), -1);
+    assert_int_equal(apix_enable_workers(ctx, 2, 2), 0);
+
+    // a full svcx keeps what it has, a handler finds no room either
+    struct svcx *svcx = svcx_new();
+    assert_non_null(svcx);
+    assert_true(svcx_fill(svcx) > 0);
+    assert_int_equal(apix_srrp_handle(ctx, "1:/exhausted", on_exhausted, NULL, 0), -1);
+    svcx_drop(svcx);
+    assert_int_equal(apix_srrp_handle(ctx, "1:/exhausted", on_exhausted, NULL, 0), 0);
+
+    apix_drop(ctx);
+#endif
+}
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_mem_pool),
+        cmocka_unit_test(test_mem_bytes),
+        cmocka_unit_test(test_mem_packets),
+        cmocka_unit_test(test_mem_txbuf),
+        cmocka_unit_test(test_mem_exhausted),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
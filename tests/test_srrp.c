@@ -7,9 +7,19 @@
 #include <string.h>
 #include "srrp.h"
 #include "crc16.h"
+#include "crc32c.h"
+#include "vec.h"
+#include "mem.h"
 
 #define UNIX_ADDR "test_apisink_unix"
 
+#ifdef APIX_STATIC_ALLOC
+#define BULK_LEN (APIX_MAX_FRAME - 128) /* the packet fits a frame of the pools */
+#else
+#define BULK_LEN 4096
+#endif
+#define SLICE_LEN (BULK_LEN / 4)
+
 static void test_srrp_base(void **status)
 {
     struct srrp_packet *pac0 = NULL;
@@ -88,6 +98,158 @@ static void test_srrp_request_reponse(void **status)
     srrp_free(rxpac);
 }
 
+static void test_srrp_header(void **status)
+{
+    struct srrp_header hdr;
+    struct srrp_packet *pac = srrp_new_request(
+        "3333", "8888", "/hello/x", "j:{name:'yon',age:'18',equip:['hat','shoes']}");
+    assert_true(pac);
+    srrp_get_header(pac, &hdr);
+    assert_true(hdr.leader == SRRP_REQUEST_LEADER);
+    assert_true(hdr.fin == SRRP_FIN_1);
+    assert_string_equal(hdr.srcid, "3333");
+    assert_string_equal(hdr.dstid, "8888");
+    assert_string_equal(hdr.anchor, "/hello/x");
+    assert_true(hdr.payload == srrp_get_payload(pac));
+    assert_true(hdr.payload_len == srrp_get_payload_len(pac));
+    assert_true(hdr.raw == srrp_get_raw(pac));
+    assert_true(hdr.packet_len == srrp_get_packet_len(pac));
+    assert_true(hdr.crc == srrp_get_crc16(pac));
+    srrp_free(pac);
+
+    pac = srrp_new_publish("/hello/x", "j:{}");
+    assert_true(pac);
+    srrp_get_header(pac, &hdr);
+    assert_string_equal(hdr.srcid, "");
+    assert_true(hdr.seqno == 0);
+    srrp_free(pac);
+}
+
+static void test_srrp_seqno(void **status)
+{
+    struct srrp_packet *txpac = srrp_new_request("3333", "8888", "/hello/x", "j:{}");
+    assert_true(srrp_get_seqno(txpac) == 0);
+    srrp_set_seqno(txpac, 0x1f);
+    assert_true(srrp_get_seqno(txpac) == 0x1f);
+    assert_true(strstr((char *)srrp_get_raw(txpac), "#3333#8888#1f:/hello/x?j:{}"));
+    assert_true(strcmp((char *)srrp_get_payload(txpac), "j:{}") == 0);
+
+    struct srrp_packet *rxpac = srrp_parse(
+        srrp_get_raw(txpac), srrp_get_packet_len(txpac));
+    assert_true(rxpac);
+    assert_true(srrp_get_seqno(rxpac) == 0x1f);
+    assert_string_equal(srrp_get_dstid(rxpac), "8888");
+    assert_string_equal(srrp_get_anchor(rxpac), "/hello/x");
+
+    // slices only concatenate with the same seqno
+    srrp_set_fin(txpac, SRRP_FIN_0);
+    struct srrp_packet *cat = srrp_cat(txpac, rxpac);
+    assert_true(cat);
+    assert_true(srrp_get_seqno(cat) == 0x1f);
+    srrp_free(cat);
+    srrp_set_seqno(rxpac, 0x20);
+    assert_true(srrp_cat(txpac, rxpac) == NULL);
+
+    srrp_free(txpac);
+    srrp_free(rxpac);
+
+    // publish never carries a seqno
+    txpac = srrp_new_publish("/motor/speed", "j:{}");
+    srrp_set_seqno(txpac, 3);
+    assert_true(srrp_get_seqno(txpac) == 0);
+    srrp_free(txpac);
+}
+
+static void test_srrp_integrity(void **status)
+{
+    assert_true(crc32c((const u8 *)"123456789", 9) == 0xe3069283);
+    assert_true(crc32c_crc(crc32c((const u8 *)"1234", 4), (const u8 *)"56789", 5) ==
+                0xe3069283);
+
+    struct srrp_packet *txpac = srrp_new_request("3333", "8888", "/hello/x", "j:{}");
+    assert_true(srrp_get_integrity(txpac) == SRRP_INTEGRITY_CRC16);
+    u16 packet_len = srrp_get_packet_len(txpac);
+
+    u8 modes[] = { SRRP_INTEGRITY_NONE, SRRP_INTEGRITY_CRC32C, SRRP_INTEGRITY_CRC16 };
+    int lens[] = { packet_len - 4, packet_len + 4, packet_len };
+    for (u32 i = 0; i < sizeof(modes); i++) {
+        assert_true(srrp_set_integrity(txpac, modes[i]) == 0);
+        assert_true(srrp_get_integrity(txpac) == modes[i]);
+        assert_true(srrp_get_packet_len(txpac) == lens[i]);
+        assert_true(strcmp((char *)srrp_get_payload(txpac), "j:{}") == 0);
+
+        struct srrp_packet *rxpac = srrp_parse(
+            srrp_get_raw(txpac), srrp_get_packet_len(txpac));
+        assert_true(rxpac);
+        assert_true(srrp_get_integrity(rxpac) == modes[i]);
+        assert_string_equal(srrp_get_anchor(rxpac), "/hello/x");
+        assert_true(strcmp((char *)srrp_get_payload(rxpac), "j:{}") == 0);
+        srrp_free(rxpac);
+
+        // the check still matches after fin is changed
+        srrp_set_fin(txpac, SRRP_FIN_0);
+        rxpac = srrp_parse(srrp_get_raw(txpac), srrp_get_packet_len(txpac));
+        assert_true(rxpac);
+        assert_true(srrp_get_fin(rxpac) == SRRP_FIN_0);
+        srrp_free(rxpac);
+        srrp_set_fin(txpac, SRRP_FIN_1);
+
+        // a flipped byte is caught
+        if (modes[i] != SRRP_INTEGRITY_NONE) {
+            u8 *raw = malloc(srrp_get_packet_len(txpac));
+            memcpy(raw, srrp_get_raw(txpac), srrp_get_packet_len(txpac));
+            raw[srrp_get_packet_len(txpac) - 12] ^= 1;
+            assert_null(srrp_parse(raw, srrp_get_packet_len(txpac)));
+            free(raw);
+        }
+    }
+    srrp_free(txpac);
+
+    // slices take the check asked for
+    char payload[BULK_LEN];
+    memset(payload, 'x', sizeof(payload) - 1);
+    payload[sizeof(payload) - 1] = 0;
+    txpac = srrp_new_request("3333", "8888", "/bulk", payload);
+    srrp_set_seqno(txpac, 7);
+    struct srrp_packet *slice = srrp_new_slice(txpac, SRRP_FIN_0, 100, SLICE_LEN,
+                                               SRRP_INTEGRITY_CRC32C);
+    assert_true(srrp_get_integrity(slice) == SRRP_INTEGRITY_CRC32C);
+    assert_true(srrp_get_seqno(slice) == 7);
+    assert_true(srrp_get_payload_len(slice) == SLICE_LEN);
+    struct srrp_packet *rxpac = srrp_parse(srrp_get_raw(slice), srrp_get_packet_len(slice));
+    assert_true(rxpac);
+    assert_true(srrp_get_fin(rxpac) == SRRP_FIN_0);
+    srrp_free(rxpac);
+
+    // a framed slice is the same packet with the payload left out
+    vec_t *head = vec_new(1, 0), *tail = vec_new(1, 0);
+    const u8 *part = srrp_get_payload(txpac) + 100;
+    assert_int_equal(srrp_frame_slice(txpac, SRRP_FIN_0, part, SLICE_LEN,
+                                      SRRP_INTEGRITY_CRC32C, head, tail), 0);
+    assert_int_equal(vsize(head) + SLICE_LEN + vsize(tail), srrp_get_packet_len(slice));
+    assert_memory_equal(vraw(head), srrp_get_raw(slice), vsize(head));
+    assert_memory_equal(vraw(tail), srrp_get_raw(slice) + vsize(head) + SLICE_LEN,
+                        vsize(tail));
+    assert_int_equal(srrp_frame_slice(txpac, SRRP_FIN_1, part, 0,
+                                      SRRP_INTEGRITY_CRC16, head, tail), 0);
+    u8 *raw = malloc(vsize(head) + vsize(tail));
+    memcpy(raw, vraw(head), vsize(head));
+    memcpy(raw + vsize(head), vraw(tail), vsize(tail));
+    rxpac = srrp_parse(raw, vsize(head) + vsize(tail));
+    assert_true(rxpac);
+    assert_true(srrp_get_payload_len(rxpac) == 0);
+    assert_true(srrp_get_seqno(rxpac) == 7);
+    srrp_free(rxpac);
+    free(raw);
+    assert_int_equal(srrp_frame_slice(txpac, SRRP_FIN_0, NULL, SRRP_PACKET_MAX,
+                                      SRRP_INTEGRITY_CRC16, head, tail), -1);
+    vec_free(head);
+    vec_free(tail);
+
+    srrp_free(slice);
+    srrp_free(txpac);
+}
+
 static void test_srrp_subscribe_publish(void **status)
 {
     struct srrp_packet *sub = NULL;
@@ -155,6 +317,9 @@ int main(void)
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(test_srrp_base),
         cmocka_unit_test(test_srrp_request_reponse),
+        cmocka_unit_test(test_srrp_header),
+        cmocka_unit_test(test_srrp_seqno),
+        cmocka_unit_test(test_srrp_integrity),
         cmocka_unit_test(test_srrp_subscribe_publish),
     };
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -37,10 +37,59 @@ static void test_svc(void **status)
     svcx_drop(svcx);
 }
 
+static char foreach_buf[256];
+
+static void on_foreach(const char *header, void *private_data)
+{
+    strcat(foreach_buf, header);
+    strcat(foreach_buf, ";");
+}
+
+static void test_svc_prefix(void **status)
+{
+    struct svcx *svcx = svcx_new();
+    svcx_add_service(svcx, "8888:/echo", (void *)1);
+    svcx_add_service(svcx, "8888:/e", (void *)2);
+    svcx_add_service(svcx, "8888:/echo/deep", (void *)3);
+    svcx_add_service(svcx, "8888:/ex", (void *)4);
+    svcx_add_service(svcx, "7777:/echo", (void *)5);
+
+    assert_true(svcx_get_service_private(svcx, "8888:/echo") == (void *)1);
+    assert_true(svcx_get_service_private(svcx, "8888:/echo/de") == (void *)1);
+    assert_true(svcx_get_service_private(svcx, "8888:/echo/deeper") == (void *)3);
+    assert_true(svcx_get_service_private(svcx, "8888:/exit") == (void *)4);
+    assert_true(svcx_get_service_private(svcx, "8888:/eat") == (void *)2);
+    assert_true(svcx_get_service_private(svcx, "8888:/") == NULL);
+    assert_true(svcx_get_service_private(svcx, "9999:/echo") == NULL);
+    assert_true(svcx_get_service_private_exact(svcx, "8888:/echo/de") == NULL);
+    assert_true(svcx_get_service_private_exact(svcx, "7777:/echo") == (void *)5);
+
+    svcx_foreach(svcx, on_foreach);
+    assert_string_equal(foreach_buf,
+                        "7777:/echo;8888:/e;8888:/echo;8888:/echo/deep;8888:/ex;");
+
+    assert_true(svcx_del_service(svcx, "8888:/ech") == -1);
+    assert_true(svcx_del_service(svcx, "8888:/echo") == 0);
+    assert_true(svcx_del_service(svcx, "8888:/echo") == -1);
+    assert_true(svcx_get_service_private(svcx, "8888:/echo/x") == (void *)2);
+    assert_true(svcx_get_service_private(svcx, "8888:/echo/deep") == (void *)3);
+    assert_true(svcx_del_service(svcx, "8888:/e") == 0);
+    assert_true(svcx_get_service_private(svcx, "8888:/exit") == (void *)4);
+
+    svcx_add_service(svcx, "8888:/ex", (void *)6);
+    assert_true(svcx_get_service_private(svcx, "8888:/ex") == (void *)6);
+
+    foreach_buf[0] = 0;
+    svcx_foreach(svcx, on_foreach);
+    assert_string_equal(foreach_buf, "7777:/echo;8888:/echo/deep;8888:/ex;");
+    svcx_drop(svcx);
+}
+
 int main(void)
 {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(test_svc),
+        cmocka_unit_test(test_svc_prefix),
     };
     return cmocka_run_group_tests(tests, NULL, NULL);
 }